@@ -0,0 +1,60 @@
+#pragma once
+#include <windows.h>
+#include <CopyMetrics.h>
+#include <LogUtils.h>
+
+#define AUTOTUNE_INTERVAL_MS 2000           // Length of one measurement
+#define AUTOTUNE_MIN_GAIN_PCT 5             // A step is kept only if it raises throughput by at least this much
+#define AUTOTUNE_MAX_BLOCKS_PER_IO 16       // Largest I/O, in blocks
+#define AUTOTUNE_BUFFER_BUDGET_MB 512       // Buffer memory all IOContexts together may use
+#define AUTOTUNE_DEFAULT_QUEUE_DEPTH 8      // Contexts per worker when --queuedepth is not given
+
+// Where the tuner is in its search
+enum class AutoTunePhase {
+    QUEUE_DEPTH = 0,    // Doubling the number of active IOContexts
+    IO_SIZE,            // Doubling the blocks covered by one read/write
+    STEADY              // Holding the best configuration found
+};
+
+// Hill climbs from a probe configuration (one active context per worker, one block per I/O).
+// Each step doubles one parameter and keeps it only if the next measured interval is faster, so the
+// search moves through queue depth first, then I/O size, and holds once neither improves.
+class AutoTuner {
+private:
+    AutoTunePhase m_phase;
+    int m_contexts;             // Active IOContexts
+    int m_blocksPerIo;
+    int m_minContexts;
+    int m_maxContexts;
+    int m_maxBlocksPerIo;
+    int m_bestContexts;
+    int m_bestBlocksPerIo;
+    double m_bestThroughput;    // Bytes per second of the best configuration
+    double m_bestLatencyUs;
+    bool m_settling;            // The interval after a change is not measured
+
+    // Interval state
+    LONGLONG m_intervalStart;   // GetTickCount64 at the start of the interval
+    LONGLONG m_intervalBytes;
+    ULONGLONG m_intervalOps;
+    double m_intervalLatencySumUs;
+
+    bool TryGrow();             // Doubles the parameter of the current phase, moving to the next phase when it is at its limit
+
+public:
+    AutoTuner() : m_phase(AutoTunePhase::STEADY), m_contexts(1), m_blocksPerIo(1), m_minContexts(1), m_maxContexts(1), m_maxBlocksPerIo(1),
+        m_bestContexts(1), m_bestBlocksPerIo(1), m_bestThroughput(0), m_bestLatencyUs(0), m_settling(true),
+        m_intervalStart(0), m_intervalBytes(0), m_intervalOps(0), m_intervalLatencySumUs(0) {}
+
+    // Getters
+    AutoTunePhase getPhase() const;
+    int getContexts() const;
+    int getBlocksPerIo() const;
+
+    // Resets the search to the probe configuration
+    void Start(int minContexts, int maxContexts, int maxBlocksPerIo);
+
+    // Called by the monitor loop with the bytes done so far, reads the latencies from metrics once per interval.
+    // Returns true when getContexts()/getBlocksPerIo() changed and must be applied.
+    bool Sample(LONGLONG bytesDone, const CopyMetrics& metrics);
+};
@@ -1,28 +1,153 @@
 #pragma once
 #include <DiskUtils.h>
 #include <IOUtils.h>
+#include <BlockSchedule.h>
+#include <BlockDigestIndex.h>
+#include <CopyJournal.h>
+#include <CompressedImage.h>
+#include <CompressionPool.h>
+#include <CopyMetrics.h>
+#include <AutoTuner.h>
+#include <BufferArena.h>
+#include <RangeScheduler.h>
+#include <ReorderBuffer.h>
+#include <FanOutTargets.h>
+#include <NumaPlacement.h>
+#include <HashManifest.h>
+#include <HashPool.h>
+#include <IoThrottle.h>
+#include <NetworkTarget.h>
+#include <FileImage.h>
+#include <FaultHandler.h>
+#include <ChunkStore.h>
+#include <BlockPipeline.h>
+#include <CompletionPool.h>
 #include <LogUtils.h>
 #include <vector>
 #include <string>
 #include <memory>
 #include <thread>
 #include <atomic>
+#include <functional>
 
 #define DEFAULT_BLOCK_SIZE_MB 1
+#define MAX_BLOCK_SIZE_MB 1024  // Largest block; keeps block and buffer sizes, and their multiples, within a DWORD
 #define DEFAULT_MAX_OUTSTANDING_IO 4
+#define DEFAULT_QUEUE_DEPTH 2   // IOContexts (buffers) owned by each worker thread
+#define MAX_QUEUE_DEPTH 64
+#define IOCP_DEQUEUE_BATCH 64   // Completion entries dequeued per GetQueuedCompletionStatusEx call
+#define DEFAULT_MEMORY_BUDGET_PERCENT 25    // Share of physical memory I/O buffers may use unless --membudget is given
+#define FALLBACK_MEMORY_BUDGET_MB 4096      // Budget when physical memory cannot be queried
+#define MONITOR_INTERVAL_MS 100             // Longest wait of the monitoring thread between progress samples
+
+// Snapshot handed to the progress callback while copying
+struct CopyProgress {
+    LONGLONG bytesRead;
+    LONGLONG bytesWritten;  // Written, skipped as unchanged or handled as zero
+    LONGLONG bytesTotal;    // Bytes the schedule covers
+    int pendingIOs;
+};
+
+using CopyProgressCallback = std::function<void(const CopyProgress&)>;
 
 class BlockCopier {
 private:
     HANDLE m_hSrc;                      
     HANDLE m_hDest;                     
+    HANDLE m_hIocp;                     // Completion port both handles are bound to (IOCP engine only), nullptr with a shared pool
+    CompletionPool* m_completionPool;   // Pool of a JobScheduler whose port and threads serve this copy instead, nullptr for none
+    CompletionRoute* m_routes;          // This copy's completion keys on m_completionPool, nullptr until Initialize attaches it
+    std::atomic<int> m_share;           // Contexts the copy may keep active on m_completionPool, 0 for all of them
+    std::vector<std::wstring> m_mirrorPaths; // Fan-out: destinations written besides the first one
+    FanOutTargets m_fanOutTargets;      // Fan-out: every destination, the first one being m_hDest
+    bool m_networkMode;                 // The destination is a receiver reached over tcp://, m_hDest stays invalid
+    int m_networkConnections;           // Connections to the receiver
+    std::string m_networkSecret;        // Answers the receiver's challenge, empty if the receiver only checks addresses
+    NetworkTarget m_networkTarget;
+    bool m_fileImageMode;               // The destination is a regular file the copy creates and allocates in full
+    std::wstring m_baseImagePath;       // File image: previous image unchanged blocks are cloned from, empty for none
+    FileImage m_fileImage;
+    FaultHandler m_faultHandler;        // Reissues failed reads and writes instead of ending the copy
+    ChunkStore* m_chunkStore;           // Store new chunks are written to, owned by the caller, nullptr unless the destination is a chunk store
+    std::wstring m_chunkManifestPath;   // Chunk store: the destination path, where the backup's manifest is saved
+    ChunkManifest m_chunkManifest;
+    bool m_chunkRunActive;              // The copy's run of m_chunkStore has begun and not ended
+    IOEngineType m_engineType;
+    bool m_usedBlocksOnly;              // Copy only blocks holding in-use clusters of the source volume
+    BlockSchedule m_schedule;           // Source ranges to copy
+    bool m_sharedCursor;                // Claim blocks from one global index instead of per worker ranges
+    RangeScheduler m_ranges;            // Per worker ranges of m_schedule with work stealing
+    bool m_orderedWrites;               // Write blocks strictly in offset order through m_reorderBuffer
+    ReorderBuffer m_reorderBuffer;
+    std::wstring m_digestIndexPath;     // Incremental mode: per-block digests of the previous run, empty for a full copy
+    BlockDigestIndex m_digestIndex;
+    ZeroBlockPolicy m_zeroBlockPolicy;
+    std::wstring m_journalPath;         // Journal of completed blocks, empty when the copy is not resumable
+    bool m_resume;                      // Continue from the blocks m_journalPath already records
+    CopyJournal m_journal;
+    ImageCompression m_imageCompression; // Write a compressed image file instead of a raw copy
+    int m_compressionThreads;           // Compression pool size, 0 for one thread per logical processor
+    CompressedImage m_image;
+    CompressionPool m_compressionPool;
+    bool m_hashBlocks;                  // Hash every block for the manifest and the verify pass
+    std::wstring m_hashManifestPath;    // Block hash manifest saved at the end of the run, empty for none
+    bool m_verify;                      // Read the destination back after copying and compare its hashes
+    bool m_verifyPass;                  // The destination is being read back
+    int m_hashThreads;                  // Hash pool size, 0 for one thread per logical processor
+    HashManifest m_hashManifest;
+    HashPool m_hashPool;
+    CopyMetrics m_metrics;
+    std::wstring m_metricsPath;         // JSON dump of m_metrics at the end of the run, empty for none
+    bool m_autoTune;                    // Tune active contexts and I/O size while copying
+    AutoTuner m_autoTuner;
+    int m_maxBlocksPerIo;               // Blocks one IOContext buffer holds, 1 unless auto tuning
+    LONGLONG m_memoryBudget;            // Bytes all I/O buffers together may use, 0 for the default share of physical memory
+    int m_numaNode;                     // Requested node, NUMA_NODE_AUTO to follow the source or destination device
+    NumaPlacement m_numaPlacement;      // Affinity of each worker thread, node of the buffer arena
+    IoThrottle m_throttle;              // Read bandwidth and IOPS limits
+    bool m_throttleEnabled;             // Reads pass m_throttle, decided by Initialize
+    PRIORITY_HINT m_ioPriority;         // I/O priority hint of the source and destination handles
     LONGLONG m_srcFileSize;           
+    LONGLONG m_bytesToCopy;             // Bytes covered by m_schedule
     LONGLONG m_destCapacity;            
     DWORD m_destSectorSize;  // Physical sector size
+    DWORD m_srcSectorSize;   // Physical sector size of the source, reads are unbuffered as well
+    DWORD m_bufferAlignment; // Buffers must start on a multiple of this: the sector sizes and the adapters' alignment
     int m_numOfThreads;                 
+    int m_queueDepth;                   // Number of IOContexts in each worker's ring
     DWORD m_blockSize;              
 
-    std::vector<std::unique_ptr<IOContext>> m_cntxts; // IOContexts, one for each worker thread
+    BufferArena m_bufferArena;          // Buffers of every IOContext, declared first so it outlives them
+    BufferArena* m_sharedArena;         // Arena owned by a JobScheduler that contexts take their buffers from instead, nullptr for none
+    std::vector<std::unique_ptr<IOContext>> m_cntxts; // IOContexts, m_queueDepth consecutive entries for each worker thread
     std::vector<std::thread> m_workerThreads;        
+    HANDLE m_hFinished;                 // Manual reset event the workers set once the copy is done or failed, StartCopy waits on it
+    HANDLE m_hDrained;                  // Manual reset event the workers set once no I/O is pending, CancelInFlightIo waits on it
+    std::atomic<bool> m_cancelled;      // Cancel was called, StartCopy stops and fails
+    CopyProgressCallback m_progressCallback; // Called by the thread running StartCopy, empty for none
+
+    // Lowers m_queueDepth, and m_numOfThreads if needed, until the buffers fit m_memoryBudget
+    bool FitMemoryBudget(LONGLONG bytesPerContext);
+
+    // Reads every copied block back from the destination through the pool threads and checks it against the manifest
+    bool VerifyDestination();
+
+    // After an error or a cancel: cancels the reads and writes still in flight and waits until no I/O is pending,
+    // while the worker threads go on servicing completions, so no context is completed into once they are gone
+    void CancelInFlightIo();
+
+    // IOCP engine: issues the next read with a context whose read/write cycle has ended. A block handed to another
+    // stage may finish its cycle on another thread first, so only one thread may claim the context.
+    void ReuseContext(IOContext* context, const HANDLE& hSrc);
+
+    // Issues the first reads of a worker's ring, parking the contexts above the active limit
+    void SeedReads(int workerIndex, const HANDLE& hSrc);
+
+    // IOCP engine: completes one dequeued entry, key being the copy's own completion key of it
+    void DispatchCompletion(const OVERLAPPED_ENTRY& entry, ULONG_PTR key, const HANDLE& hSrc, const HANDLE& hDest);
+
+    // Waits until the threads servicing completions have ended every I/O of the copy
+    void WaitUntilDrained();
 
 public:
     IOUtils ioUtilsObj;     // for handling I/O operations
@@ -31,24 +156,105 @@ public:
     // For progress reporting
     std::atomic<LONGLONG> m_bytesReadTotal;
     std::atomic<LONGLONG> m_bytesWrittenTotal;
+    std::atomic<LONGLONG> m_bytesSkippedTotal; // Bytes read but not written because the destination already holds them
+    std::atomic<LONGLONG> m_bytesZeroTotal;    // Bytes of all-zero blocks skipped or unmapped instead of written
 
 
     BlockCopier() :
-        m_hSrc(INVALID_HANDLE_VALUE), m_hDest(INVALID_HANDLE_VALUE),
-        m_srcFileSize(0), m_destCapacity(0), m_destSectorSize(0),
-        m_numOfThreads(DEFAULT_MAX_OUTSTANDING_IO), m_blockSize(DEFAULT_BLOCK_SIZE_MB * 1024 * 1024),
-        m_bytesReadTotal(0), m_bytesWrittenTotal(0) { 
+        m_hSrc(INVALID_HANDLE_VALUE), m_hDest(INVALID_HANDLE_VALUE), m_hIocp(nullptr), m_completionPool(nullptr), m_routes(nullptr), m_share(0), m_networkMode(false), m_networkConnections(DEFAULT_NETWORK_CONNECTIONS), m_fileImageMode(false), m_chunkStore(nullptr), m_chunkRunActive(false), m_engineType(IOEngineType::APC), m_usedBlocksOnly(false), m_sharedCursor(false), m_orderedWrites(false), m_zeroBlockPolicy(ZeroBlockPolicy::WRITE), m_resume(false),
+        m_imageCompression(ImageCompression::NONE), m_compressionThreads(0), m_hashBlocks(false), m_verify(false), m_verifyPass(false), m_hashThreads(0), m_autoTune(false), m_maxBlocksPerIo(1), m_memoryBudget(0), m_numaNode(NUMA_NODE_AUTO), m_throttleEnabled(false), m_ioPriority(IoPriorityHintNormal), m_sharedArena(nullptr),
+        m_srcFileSize(0), m_bytesToCopy(0), m_destCapacity(0), m_destSectorSize(0), m_srcSectorSize(0), m_bufferAlignment(0),
+        m_numOfThreads(DEFAULT_MAX_OUTSTANDING_IO), m_queueDepth(DEFAULT_QUEUE_DEPTH), m_blockSize(DEFAULT_BLOCK_SIZE_MB * 1024 * 1024), m_hFinished(nullptr), m_hDrained(nullptr), m_cancelled(false),
+        m_bytesReadTotal(0), m_bytesWrittenTotal(0), m_bytesSkippedTotal(0), m_bytesZeroTotal(0) { 
+        ioUtilsObj.setBlockHandler(BlockStages::Select(BlockPipelineConfig())); // Plain copy until Initialize picks the copy's pipeline
+        ioUtilsObj.setBufferRelease(BlockStages::SelectRelease(BlockPipelineConfig()));
+        // Created up front so Cancel may be called from another thread at any time, Initialize fails without it
+        m_hFinished = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        ioUtilsObj.setFinishedEvent(m_hFinished);
+        m_hDrained = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        ioUtilsObj.setDrainedEvent(m_hDrained);
     }
 
 
     //Getters
     HANDLE getDestHandle();
     DWORD getDestSectorSize();
+    DWORD getSrcSectorSize();
+    IOEngineType getEngineType();
+    BlockDigestIndex* getDigestIndex(); // nullptr unless incremental mode is enabled
+    ZeroBlockPolicy getZeroBlockPolicy();
+    CopyJournal* getJournal(); // nullptr unless a journal is configured
+    CompressedImage* getImage(); // nullptr unless a compressed image is written
+    CompressionPool* getCompressionPool(); // nullptr unless a compressed image is written
+    ReorderBuffer* getReorderBuffer(); // nullptr unless writes are ordered
+    FanOutTargets* getFanOutTargets(); // nullptr unless there is more than one destination
+    CopyMetrics& getMetrics();  // Latencies, per worker counters and throughput timeline, may be pulled while copying
+    HashManifest* getHashManifest(); // nullptr unless blocks are hashed
+    HashPool* getHashPool(); // nullptr unless blocks are hashed on the pool (not for a compressed image)
+    bool getVerifyPass();       // True while the destination is read back
+    HANDLE getCompletionPort(); // nullptr for the APC engine, the pool's port with a shared pool
+    ULONG_PTR getCompletionKey(ULONG_PTR key); // Key to bind or post with on getCompletionPort for the copy's own key
+    NetworkTarget* getNetworkTarget(); // nullptr unless the destination is a tcp:// receiver
+    FileImage* getFileImage();  // nullptr unless the destination is a raw image file
+    FaultHandler* getFaultHandler(); // nullptr when retries are off, and during the verify pass
+    ChunkStore* getChunkStore();    // nullptr unless the destination is a chunk store
+    ChunkManifest* getChunkManifest(); // nullptr unless the destination is a chunk store
+    bool getCancelled();
+
+    //Setters (must be called before Initialize)
+    void setEngineType(IOEngineType engineType);
+    void setUsedBlocksOnly(bool usedBlocksOnly);
+    void setDigestIndexPath(LPCWSTR indexPath);
+    void setZeroBlockPolicy(ZeroBlockPolicy policy);
+    void setJournalPath(LPCWSTR journalPath, bool resume);
+    void setImageCompression(ImageCompression compression, int nCompressionThreads);
+    void setMetricsPath(LPCWSTR metricsPath);
+    // Hashes every block (uses iocp), saving the hashes to manifestPath (may be nullptr) and, with verify, checking the destination against them
+    void setBlockHashing(LPCWSTR manifestPath, bool verify, int nHashThreads);
+    void setAutoTune(bool autoTune);    // Uses the IOCP engine, queueDepth passed to Initialize becomes the upper bound
+    void setMemoryBudget(LONGLONG budgetMB); // Caps buffer memory by lowering queue depth, then threads; 0 for the default
+    void setOrderedWrites(bool orderedWrites); // Uses iocp and the shared cursor, the contexts become the read-ahead window
+    void setSharedCursor(bool sharedCursor); // All workers claim from one global block index (the pre-range scheduler)
+    void setSharedArena(BufferArena* arena); // Slices must hold a block and outlive the copier, the budget must fit its free slices
+    void setNumaNode(int numaNode);     // Node for workers and buffers, NUMA_NODE_AUTO (default) or NUMA_NODE_NONE
+    void setIoPriority(PRIORITY_HINT priority); // Hint on every handle, low priority I/O yields to other I/O on the devices
+    // Read limits in MB/s and IOPS, 0 for unlimited (uses iocp). May also be called while copying if a limit was set before Initialize.
+    void setThrottle(LONGLONG megabytesPerSecond, LONGLONG iops);
+    void setNetworkConnections(int nConnections); // Parallel connections to a tcp:// destination
+    void setNetworkSecret(const std::string& secret); // Shared secret the receiver authenticates the connections with
+    // Creates the destination as a regular file allocated to the source size. With incremental mode, a new image clones
+    // its unchanged blocks from baseImagePath (may be nullptr, ReFS only) while an existing image is updated in place.
+    void setFileImage(bool fileImage, LPCWSTR baseImagePath);
+    // Failed reads and writes are reissued up to retries times (0 to fail at once), waiting retryDelayMs and doubling it
+    // each time. Unreadable source sectors are then copied as zeros and listed in badSectorPath (may be nullptr),
+    // until more than errorBudget of them fail the copy.
+    void setFaultHandling(int retries, DWORD retryDelayMs, LONGLONG errorBudget, LPCWSTR badSectorPath);
+    // Deduplicates the copy into store, which must be open and outlive the copier and may be shared by several.
+    // Only chunks the store does not hold yet are written, the destination path receives the backup's chunk manifest.
+    void setChunkStore(ChunkStore* store);
+    // Called from the thread running StartCopy at least every MONITOR_INTERVAL_MS while copying, and once at the end
+    void setProgressCallback(CopyProgressCallback callback);
+    // Runs the copy on pool's port and threads (uses iocp, no auto tuning), which must be started and outlive the copier
+    void setCompletionPool(CompletionPool* pool);
+    // Contexts the copy may keep active on its completion pool, 0 for all. May also be called while copying.
+    void setShare(int contexts);
+
+    // Memory budget used when none is set: DEFAULT_MEMORY_BUDGET_PERCENT of physical memory
+    static LONGLONG GetDefaultMemoryBudget();
 
     // Initialization and main copy logic
-    bool Initialize(LPCWSTR srcPath, LPCWSTR destPath, int nThreads = DEFAULT_MAX_OUTSTANDING_IO, int blockSizeMB = DEFAULT_BLOCK_SIZE_MB);
+    bool Initialize(LPCWSTR srcPath, LPCWSTR destPath, int nThreads = DEFAULT_MAX_OUTSTANDING_IO, int blockSizeMB = DEFAULT_BLOCK_SIZE_MB, int queueDepth = DEFAULT_QUEUE_DEPTH);
+    // Fan-out: the source is read once and every block is written to each of destPaths (raw copies only, uses iocp)
+    bool Initialize(LPCWSTR srcPath, const std::vector<std::wstring>& destPaths, int nThreads = DEFAULT_MAX_OUTSTANDING_IO, int blockSizeMB = DEFAULT_BLOCK_SIZE_MB, int queueDepth = DEFAULT_QUEUE_DEPTH);
     bool StartCopy();
 
+    // Stops the copy from any thread: no new reads are issued, StartCopy cancels the I/Os in flight and returns
+    // false once they ended. A copy not started yet fails at once.
+    void Cancel();
+
+    // Called by the threads of the completion pool for every completion keyed to this copy
+    void OnPoolCompletion(const OVERLAPPED_ENTRY& entry, ULONG_PTR key);
+
     ~BlockCopier() {
         // Ensure all worker threads are joined before destruction
         for (auto& t : m_workerThreads) {
@@ -57,7 +263,19 @@ public:
             }
         }
 
-        // Close handles
+        // Completions still queued for this copy are dropped from now on
+        if (m_completionPool != nullptr) {
+            m_completionPool->Detach(m_routes);
+            m_routes = nullptr;
+        }
+
+        // A run that did not commit must not leave its entries counting in the store
+        if (m_chunkRunActive) {
+            m_chunkStore->AbortRun(m_chunkManifest);
+            m_chunkRunActive = false;
+        }
+
+        // Close handles. Only here: a failed Initialize leaves them open, so no handle value is closed twice.
         if (m_hSrc != INVALID_HANDLE_VALUE) {
             CloseHandle(m_hSrc);
             m_hSrc = INVALID_HANDLE_VALUE;
@@ -66,7 +284,20 @@ public:
             CloseHandle(m_hDest);
             m_hDest = INVALID_HANDLE_VALUE;
         }
+        if (m_hIocp != nullptr) {
+            CloseHandle(m_hIocp);
+            m_hIocp = nullptr;
+        }
+        if (m_hFinished != nullptr) {
+            CloseHandle(m_hFinished);
+            m_hFinished = nullptr;
+        }
+        if (m_hDrained != nullptr) {
+            CloseHandle(m_hDrained);
+            m_hDrained = nullptr;
+        }
     }
 
-    void WorkerThreadLoop(IOContext* context, const HANDLE& hSrc, const HANDLE& hDest, const DWORD& blockSize, const LONGLONG& totalFileSize);
+    void WorkerThreadLoop(int workerIndex, const HANDLE& hSrc, const HANDLE& hDest);
+    void IocpWorkerThreadLoop(int workerIndex, const HANDLE& hSrc, const HANDLE& hDest);
 };
\ No newline at end of file
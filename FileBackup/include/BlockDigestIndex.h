@@ -0,0 +1,55 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <string>
+#include <LogUtils.h>
+
+#define DIGEST_INDEX_MAGIC 0x49444246   // "FBDI"
+#define DIGEST_INDEX_VERSION 1
+
+// On-disk header of a digest index file, followed by one ULONGLONG digest per block
+struct DigestIndexHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD blockSize;
+    DWORD reserved;
+    LONGLONG sourceSize;
+    LONGLONG blockCount;
+    ULONGLONG destinationId;   // Hash of the destination path the digests were written to
+};
+
+// Per-block digests of the previous run, plus the digests of the current run.
+// Blocks are addressed by their absolute number (source offset / block size). A digest of 0 means unknown.
+// Each block is touched by a single I/O at a time, so the arrays need no locking.
+class BlockDigestIndex {
+private:
+    std::wstring m_path;
+    DigestIndexHeader m_header;
+    std::vector<ULONGLONG> m_previous;    // Digests loaded from m_path
+    std::vector<ULONGLONG> m_current;     // Digests to save at the end of this run
+
+public:
+    BlockDigestIndex() : m_header() {}
+
+    // Getters
+    LONGLONG getBlockCount() const;
+    DWORD getBlockSize() const;
+    LONGLONG getKnownBlocks() const;
+
+    // Loads the previous index from path. A missing or mismatching index starts empty so every block is copied.
+    // previousDestPath names the destination the previous run wrote when this run writes elsewhere (a new image
+    // cloned from the previous one); the saved index then describes destPath.
+    bool Load(LPCWSTR path, DWORD blockSize, LONGLONG sourceSize, LPCWSTR destPath, LPCWSTR previousDestPath = nullptr);
+
+    // Records the digest of a block read in this run, returns true if it matches the previous run
+    bool Update(LONGLONG blockNumber, ULONGLONG digest);
+
+    // Removes the index file before the destination is modified. Blocks written by a run that never
+    // finishes would otherwise still be described by the old digests.
+    bool Invalidate();
+
+    // Writes the current digests to a temporary file and replaces the index with it
+    bool Save();
+
+    ~BlockDigestIndex() {}
+};
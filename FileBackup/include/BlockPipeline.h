@@ -0,0 +1,100 @@
+#pragma once
+#include <windows.h>
+#include <IOUtils.h>
+
+// What a stage leaves for the rest of the pipeline
+enum class StageResult {
+    NEXT = 0,   // The block goes on to the next stage
+    DONE        // The stage finished the block (skipped, queued or written), later stages do not see it
+};
+
+// Where a block that is not skipped ends up
+enum class BlockSink {
+    WRITE = 0,  // Written straight from the read completion
+    COMPRESS,   // Handed to the compression pool of a compressed image
+    REORDER,    // Handed to the reorder buffer of ordered writes
+    CHUNK_STORE // Deduplicated into a chunk store, only chunks it does not hold yet are written
+};
+
+// Features of a copy that add stages to its read completion, fixed once Initialize has run
+struct BlockPipelineConfig {
+    bool hashBlocks = false;    // Blocks are hashed alongside their writes by the hash pool
+    bool digestIndex = false;   // Incremental mode: unchanged blocks are skipped
+    bool cloneUnchanged = false; // Incremental into a new file image: unchanged blocks are cloned from the previous image
+    ZeroBlockPolicy zeroBlocks = ZeroBlockPolicy::WRITE;
+    BlockSink sink = BlockSink::WRITE;
+};
+
+// One step of the read completion. bytesRead is what the read returned, cntxt->bytesTransferred is padded by PadToSector.
+using BlockStage = StageResult(*)(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+
+// Runs Stages in order until one returns DONE. The stages are template arguments, so every call is direct and
+// the whole chain is compiled into one function per combination, with no feature test left for a stage that is off.
+template <BlockStage... Stages>
+struct BlockPipeline;
+
+template <>
+struct BlockPipeline<> {
+    static void Run(IOUtils&, IOContext*, DWORD) {}
+};
+
+template <BlockStage First, BlockStage... Rest>
+struct BlockPipeline<First, Rest...> {
+    static void Run(IOUtils& io, IOContext* cntxt, DWORD bytesRead) {
+        if (First(io, cntxt, bytesRead) == StageResult::NEXT) {
+            BlockPipeline<Rest...>::Run(io, cntxt, bytesRead);
+        }
+    }
+};
+
+// Stages of the read completion and the pre-instantiated pipelines built from them. Every combination of
+// BlockPipelineConfig is instantiated here, Select picks one at runtime and IOUtils calls it through one pointer.
+class BlockStages {
+private:
+    static StageResult CountRead(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    static StageResult Hash(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    template <bool CloneUnchanged, bool Ordered>
+    static StageResult SkipUnchanged(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    static StageResult PadToSector(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    template <bool Ordered>
+    static StageResult SkipZero(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    template <bool Ordered>
+    static StageResult UnmapZero(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    static StageResult Compress(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    static StageResult Reorder(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    static StageResult Write(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    static StageResult StoreChunks(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+    static StageResult Verify(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+
+    // Ordered writes: a block that leaves without a write passes its turn in the reorder buffer
+    template <bool Ordered>
+    static void PassTurn(IOContext* cntxt);
+    // Ends a block that needs no write
+    template <bool Ordered>
+    static void FinishSkipped(IOUtils& io, IOContext* cntxt);
+
+    // Buffer releases: with hashing the write and the hash stage both hold the buffer, the last one to finish frees it
+    static void ReleaseOwned(IOContext* cntxt);
+    static void ReleaseShared(IOContext* cntxt);
+
+    // Each appends the stages of one feature to Stages and hands on to the next selector. Ordered is the
+    // reorder buffer sink, which the stages that skip blocks need to know about.
+    template <bool Ordered>
+    static BlockHandler SelectHash(const BlockPipelineConfig& config);
+    template <bool Ordered, BlockStage... Stages>
+    static BlockHandler SelectDigest(const BlockPipelineConfig& config);
+    template <bool Ordered, BlockStage... Stages>
+    static BlockHandler SelectZero(const BlockPipelineConfig& config);
+    template <bool Ordered, BlockStage... Stages>
+    static BlockHandler SelectSink(const BlockPipelineConfig& config);
+
+public:
+    // Pipeline of a copy's read completions
+    static BlockHandler Select(const BlockPipelineConfig& config);
+
+    // How the copy's write completions free a buffer, chosen with its pipeline
+    static BufferRelease SelectRelease(const BlockPipelineConfig& config);
+
+    // Pipeline of the verify pass: blocks read back from the destination are only hashed and compared
+    static BlockHandler SelectVerify();
+};
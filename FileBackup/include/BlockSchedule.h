@@ -0,0 +1,38 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <DiskUtils.h>
+
+// Maps a linear block index onto the source ranges that have to be copied.
+// Each extent is split into blocks of m_blockSize, only the last block of an extent may be shorter.
+class BlockSchedule {
+private:
+    std::vector<DiskExtent> m_extents;     // Ranges to copy, in ascending offset order
+    std::vector<LONGLONG> m_firstBlock;    // Linear index of the first block of each extent
+    DWORD m_blockSize;
+    LONGLONG m_totalBlocks;
+    LONGLONG m_totalBytes;
+
+public:
+    BlockSchedule() : m_blockSize(0), m_totalBlocks(0), m_totalBytes(0) {}
+
+    // Getters
+    DWORD getBlockSize() const;
+    LONGLONG getTotalBlocks() const;
+    LONGLONG getTotalBytes() const;
+    const std::vector<DiskExtent>& getExtents() const;
+
+    // Replaces the schedule with the given extents
+    bool Build(const std::vector<DiskExtent>& extents, DWORD blockSize);
+
+    // Translates a linear block index into its source offset and length, false once past the last block
+    bool GetBlock(LONGLONG blockIndex, LONGLONG& offset, DWORD& length) const;
+
+    // Same for count consecutive blocks starting at blockIndex, which must lie in one extent
+    bool GetBlocks(LONGLONG blockIndex, LONGLONG count, LONGLONG& offset, DWORD& length) const;
+
+    // Number of blocks from blockIndex to the end of its extent, at most maxBlocks, 0 once past the last block
+    LONGLONG GetRunLength(LONGLONG blockIndex, LONGLONG maxBlocks) const;
+
+    ~BlockSchedule() {}
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <vector>
+#include <LogUtils.h>
+
+#define ARENA_NO_SLICE 0xFFFFFFFFu // End of the free list
+
+// One allocation holding every I/O buffer of a copy. It is backed by large pages when SeLockMemoryPrivilege
+// can be enabled, and otherwise locked into the working set, so unbuffered transfers find the pages resident.
+// It is split into page aligned slices of one size, handed out and returned through a lock-free free list.
+class BufferArena {
+private:
+    char* m_base;
+    SIZE_T m_totalSize;         // Bytes allocated, a multiple of the large page size when m_largePages
+    SIZE_T m_sliceSize;         // Requested buffer size rounded up to the page size
+    DWORD m_sliceCount;
+    bool m_largePages;
+    bool m_locked;              // VirtualLock succeeded (large pages are never paged out either)
+    SIZE_T m_workingSetGrowth;  // Added to the working set limits for VirtualLock, given back in Destroy
+
+    // Treiber stack of free slice indices. The head packs a version counter (high 32 bits) with the index
+    // (low 32 bits) so a pop cannot be fooled by the same slice being released and acquired in between.
+    std::atomic<ULONGLONG> m_freeHead;
+    std::vector<std::atomic<DWORD>> m_nextFree;
+    std::atomic<DWORD> m_freeSlices;
+
+    static bool EnableLockMemoryPrivilege();
+
+public:
+    BufferArena() : m_base(nullptr), m_totalSize(0), m_sliceSize(0), m_sliceCount(0), m_largePages(false), m_locked(false),
+        m_workingSetGrowth(0), m_freeHead(ARENA_NO_SLICE), m_freeSlices(0) {}
+
+    // Getters
+    SIZE_T getSliceSize() const;
+    DWORD getSliceCount() const;
+    DWORD getFreeSlices() const;
+    SIZE_T getTotalSize() const;
+    bool isLargePages() const;
+    bool isLocked() const;
+
+    // Allocates sliceCount slices of at least sliceSize bytes, replacing any previous arena (all slices must be back).
+    // numaNode >= 0 takes the memory from that node, -1 leaves the choice to the system
+    bool Create(SIZE_T sliceSize, DWORD sliceCount, int numaNode = -1);
+    void Destroy();
+
+    // nullptr when every slice is in use; safe to call from any thread
+    char* Acquire();
+    void Release(char* slice);
+
+    BufferArena(const BufferArena&) = delete;
+    BufferArena& operator=(const BufferArena&) = delete;
+
+    ~BufferArena() {
+        Destroy();
+    }
+};
@@ -0,0 +1,17 @@
+#pragma once
+#include <windows.h>
+
+// Scans on block buffers, vectorized with the widest instruction set the CPU supports
+class BufferUtils
+{
+public:
+    BufferUtils() {}
+
+    // True if all len bytes are zero. Uses AVX2 when available, SSE2 otherwise, and stops at the first non-zero chunk.
+    static bool IsAllZero(const void* data, size_t len);
+
+    // Name of the implementation picked for this CPU, for logging
+    static const wchar_t* GetZeroScanImplName();
+
+    ~BufferUtils() {}
+};
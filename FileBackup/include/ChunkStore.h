@@ -0,0 +1,221 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <DiskUtils.h>
+#include <LogUtils.h>
+
+#define CHUNK_STORE_MAGIC 0x53434246        // "FBCS"
+#define CHUNK_STORE_VERSION 2              // 2: keyed SHA-256 fingerprints
+#define CHUNK_STORE_HEADER_SIZE 8192        // Header and committed run bitmap, the index slots follow
+#define CHUNK_STORE_MAX_RUNS 32768          // Run numbers between two index rebuilds, a rebuild renumbers the committed runs
+#define CHUNK_FINGERPRINT_KEY_SIZE 32
+#define DEFAULT_CHUNK_SIZE_KB 64
+#define MIN_CHUNK_SIZE_KB 4
+#define MAX_CHUNK_SIZE_KB 4096
+#define CHUNK_INDEX_MIN_SLOTS (1 << 20)
+#define CHUNK_INDEX_MAX_LOAD_PERCENT 70     // The index grows before the runs starting could fill it past this
+#define CHUNK_PROBE_BATCH 32                // Chunks fingerprinted and prefetched before any of them is probed
+#define CHUNK_MAX_PER_CALL 1024             // Chunks one read may hold, StoreChunks keeps its bookkeeping on the stack
+#define CHUNK_MANIFEST_MAGIC 0x4D434246     // "FBCM"
+#define CHUNK_MANIFEST_VERSION 1
+#define CHUNK_REF_STORED 0x1                // The chunk is in the store at ChunkRef::offset
+#define CHUNK_REF_ZERO 0x2                  // The chunk is all zero and not stored, neither flag means it was not copied
+
+// First bytes of the index file. Lives in the mapped view, fields a run changes are only updated under the store's lock
+// except dataEnd, which every copy advances with an interlocked add.
+struct ChunkStoreHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD chunkSize;
+    DWORD sectorSize;           // Of the volume holding the store, chunks are stored at multiples of it
+    ULONGLONG storeId;          // Manifests name the store they reference
+    ULONGLONG slotCount;        // Power of two
+    ULONGLONG occupiedSlots;    // Entries of every ended run, committed or not
+    volatile LONGLONG dataEnd;  // Bytes of the chunk data file handed out so far
+    DWORD nextRun;
+    DWORD activeRuns;           // Runs begun and not ended, not 0 when opening means a run was interrupted
+    DWORD needsRebuild;         // Entries of failed runs take up slots
+    DWORD reserved;
+    BYTE fingerprintKey[CHUNK_FINGERPRINT_KEY_SIZE]; // Random HMAC key of the fingerprints, drawn when the store is created
+    ULONGLONG committedRuns[CHUNK_STORE_MAX_RUNS / 64];
+};
+
+// One slot of the fingerprint index: open addressing with linear probing, two slots per cache line. A slot is
+// claimed with a compare exchange of keyHigh and published by setting run, so lookups never take a lock.
+struct ChunkIndexEntry {
+    volatile LONGLONG keyHigh;  // High half of the fingerprint with its top bit set, 0 for a free slot
+    ULONGLONG keyLow;
+    LONGLONG offset;            // In the chunk data file, set once the claiming copy reserved space for the chunk
+    DWORD length;               // Source bytes, only the last chunk of a source is short
+    volatile LONG run;          // Run that stored the chunk, 0 while the claiming thread fills the entry in
+};
+
+struct ChunkKey {
+    ULONGLONG high;
+    ULONGLONG low;
+};
+
+// Where chunk i of a backed up source is. While the run is active offset holds the index slot of a stored chunk,
+// CommitRun turns it into the data file offset.
+struct ChunkRef {
+    LONGLONG offset;
+    DWORD length;
+    DWORD flags;
+};
+
+struct ChunkManifestHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD chunkSize;
+    DWORD reserved;
+    ULONGLONG storeId;
+    LONGLONG sourceSize;
+    LONGLONG chunkCount;        // ChunkRef entries following the header
+    LONGLONG storedChunks;      // Chunks this backup added to the store
+    LONGLONG dedupChunks;       // Chunks found in the store already
+    LONGLONG zeroChunks;
+    ULONGLONG storedBytes;
+};
+
+// One backup in a chunk store: a reference per source chunk, written next to nothing else
+class ChunkManifest {
+private:
+    ChunkManifestHeader m_header;
+    std::vector<ChunkRef> m_refs;
+    DWORD m_run;                        // Writer: run of the store this backup is
+    std::atomic<LONGLONG> m_storedChunks;
+    std::atomic<LONGLONG> m_dedupChunks;
+    std::atomic<LONGLONG> m_zeroChunks;
+    std::atomic<ULONGLONG> m_storedBytes;
+
+public:
+    ChunkManifest() : m_header(), m_run(0), m_storedChunks(0), m_dedupChunks(0), m_zeroChunks(0), m_storedBytes(0) {}
+
+    // Getters
+    DWORD getRun() const;
+    DWORD getChunkSize() const;
+    ULONGLONG getStoreId() const;
+    LONGLONG getSourceSize() const;
+    LONGLONG getChunkCount() const;
+    LONGLONG getStoredChunks() const;
+    LONGLONG getDedupChunks() const;
+    LONGLONG getZeroChunks() const;
+    ULONGLONG getStoredBytes() const;
+    const ChunkRef& getRef(LONGLONG chunkNumber) const;
+
+    // Writer: an empty manifest of run for a source of sourceSize bytes, called by ChunkStore::BeginRun
+    void Create(DWORD run, ULONGLONG storeId, DWORD chunkSize, LONGLONG sourceSize);
+
+    // Writer: references of the chunks from firstChunk on, filled in by ChunkStore::StoreChunks
+    ChunkRef* getRefs(LONGLONG firstChunk);
+    void CountChunks(LONGLONG stored, LONGLONG deduped, LONGLONG zero, ULONGLONG storedBytes);
+
+    // Writer: saves the manifest once its run has been committed
+    bool Save(LPCWSTR path);
+
+    // Reader: loads a saved manifest
+    bool Load(LPCWSTR path);
+};
+
+// What StoreChunks left for the copy to write
+struct ChunkWrite {
+    LONGLONG storeOffset = 0;   // Where the new chunks go in the data file
+    DWORD bytesToWrite = 0;     // New chunks moved to the front of the buffer, each padded to the sector size, 0 for none
+    DWORD newBytes = 0;         // Source bytes of the new chunks, the rest of the block needs no write
+};
+
+// Content-addressed store of fixed size chunks in a directory, shared by every backup written to it. Chunks are
+// fingerprinted (HMAC-SHA256 with the store's random key, truncated to 128 bits) as blocks complete, looked up in a memory-mapped index and only new
+// ones are appended to the data file, so nearly identical volumes share almost all of their chunks. Each copy is one
+// run: the entries it adds count for other runs only once it has committed, which flushes the chunks first, so an
+// interrupted or failed run never leaves the index pointing at data that is not there. The index needs no lock to
+// look up or add chunks; it only grows while no run is active. One process at a time opens a store.
+class ChunkStore {
+private:
+    struct MappedFile {
+        HANDLE hFile = INVALID_HANDLE_VALUE;
+        HANDLE hMapping = nullptr;
+        BYTE* view = nullptr;
+        ULONGLONG size = 0;
+    };
+
+    std::wstring m_dir;
+    MappedFile m_index;
+    ChunkStoreHeader* m_header;
+    ChunkIndexEntry* m_slots;
+    ULONGLONG m_slotMask;
+    HANDLE m_hData;                     // Chunk data file, for allocating, flushing and truncating it; copies write through their own handles
+    std::mutex m_runLock;               // Guards run bookkeeping, the header fields besides dataEnd and growing the index
+    std::condition_variable m_runEnded;
+    int m_activeRuns;
+    LONGLONG m_reservedSlots;           // Slots the active runs may still claim, one per source chunk
+    LONGLONG m_reservedBytes;           // Data file space the active runs may still append
+    DiskUtils m_diskUtils;
+
+    std::wstring getIndexPath() const;
+    std::wstring getDataPath() const;
+
+    static bool MapFile(LPCWSTR path, DWORD disposition, ULONGLONG size, MappedFile& file);
+    static void UnmapFile(MappedFile& file);
+    bool AttachIndex();                 // Points m_header and m_slots at the mapped index and checks it
+
+    // Rewrites the index with slotCount slots, keeping the committed entries only, which all become run 1 so run
+    // numbers start over. m_runLock held, no run active.
+    bool Rebuild(ULONGLONG slotCount);
+    // Sizes the data file for the chunks the active runs may still append, or back to the chunks stored once none is left
+    bool ResizeData();
+
+    bool Fingerprint(const char* data, DWORD length, ChunkKey& key) const;
+    bool IsCommitted(DWORD run) const;
+
+    // Finds the entry of key that run may reference, or claims a free slot for it (claimed set)
+    bool FindOrClaim(DWORD run, const ChunkKey& key, DWORD length, ULONGLONG& slot, bool& claimed);
+
+    // Ends a run and makes the header durable, m_runLock held
+    bool EndRun(const ChunkManifest& manifest);
+
+public:
+    ChunkStore() : m_header(nullptr), m_slots(nullptr), m_slotMask(0), m_hData(INVALID_HANDLE_VALUE), m_activeRuns(0), m_reservedSlots(0), m_reservedBytes(0) {}
+
+    // Getters
+    bool isOpen() const;
+    DWORD getChunkSize() const;
+    DWORD getSectorSize() const;
+    ULONGLONG getStoreId() const;
+    LONGLONG getDataEnd() const;
+
+    // Opens the store in dir, creating it with chunkSize byte chunks (0 for the default) if dir holds none yet.
+    // An index left behind by an interrupted run is cleaned of that run's entries.
+    bool Open(LPCWSTR dir, DWORD chunkSize);
+
+    // Unbuffered overlapped handle on the chunk data file, for a copy to write (or a restore to read) through
+    HANDLE OpenDataHandle();
+
+    // Starts a run for a source of sourceSize bytes and prepares its manifest. Grows the index first if the run
+    // could fill it, or rebuilds it if run numbers are used up, waiting for the active runs to end if there are any.
+    bool BeginRun(LONGLONG sourceSize, ChunkManifest& manifest);
+
+    // Fingerprints the chunks of length bytes of data (chunk firstChunk onward) and looks them up in batches,
+    // recording their references in the manifest. New chunks get index slots and one run of store space, and are
+    // moved to the front of data (which must hold them padded to the sector size) to be written there in one piece.
+    bool StoreChunks(ChunkManifest& manifest, LONGLONG firstChunk, char* data, DWORD length, ChunkWrite& write);
+
+    // Makes the run's chunks durable, then its index entries, resolves the manifest's references and commits the run.
+    // The run has ended either way, a false return ends it as aborted.
+    bool CommitRun(ChunkManifest& manifest);
+    // Ends a failed run, its entries never count as stored
+    void AbortRun(ChunkManifest& manifest);
+
+    void Close();
+
+    ~ChunkStore() {
+        Close();
+    }
+
+    ChunkStore(const ChunkStore&) = delete;
+    ChunkStore& operator=(const ChunkStore&) = delete;
+};
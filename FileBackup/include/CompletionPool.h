@@ -0,0 +1,69 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <FanOutTargets.h>
+#include <LogUtils.h>
+
+#define MAX_POOL_THREADS 256
+// Keys a copier binds handles and posts packets with: 0 for the source and destination, 1..FANOUT_MAX_DESTINATIONS
+// for fan-out destinations, then HASH_COMPLETION_KEY, NETWORK_COMPLETION_KEY and FAULT_COMPLETION_KEY (~0, ~1, ~2)
+#define POOL_ROUTES_PER_COPIER (FANOUT_MAX_DESTINATIONS + 4)
+
+class BlockCopier;
+struct CompletionMember;
+
+// What the pool's completion key points at: the copier a packet belongs to and the key the copier itself knows it by
+struct CompletionRoute {
+    CompletionMember* member;
+    ULONG_PTR key;
+};
+
+// A copier attached to the pool. Kept until the pool goes away, so a packet that is still queued for a detached
+// copier finds copier == nullptr instead of freed memory.
+struct CompletionMember {
+    SRWLOCK lock;                       // Held shared while a completion is dispatched, exclusive by Detach
+    BlockCopier* copier;
+    CompletionRoute routes[POOL_ROUTES_PER_COPIER];
+};
+
+// One completion port and one set of I/O threads for the copies of a JobScheduler. Every copier binds its handles
+// with its own route keys, and the threads hand each completion to the copier its key names. How much of the pool
+// a copy gets is up to the scheduler, which limits the contexts each copy keeps active.
+class CompletionPool {
+private:
+    HANDLE m_hIocp;
+    std::vector<std::thread> m_threads;
+    std::mutex m_lock;                  // Guards m_members
+    std::vector<std::unique_ptr<CompletionMember>> m_members;
+
+    void ThreadLoop();
+
+public:
+    CompletionPool() : m_hIocp(nullptr) {}
+
+    // Getters
+    HANDLE getCompletionPort() const;
+    int getThreadCount() const;
+
+    // Creates the port and starts nThreads threads servicing it
+    bool Start(int nThreads);
+
+    // Registers copier, its completion keys are the addresses of the returned POOL_ROUTES_PER_COPIER routes
+    CompletionRoute* Attach(BlockCopier* copier);
+
+    // Waits for completions being dispatched to the copier to return, later ones for it are dropped
+    void Detach(CompletionRoute* routes);
+
+    // Posts one shutdown packet per thread and joins them, every copier must have been detached
+    void Stop();
+
+    ~CompletionPool() {
+        Stop();
+    }
+
+    CompletionPool(const CompletionPool&) = delete;
+    CompletionPool& operator=(const CompletionPool&) = delete;
+};
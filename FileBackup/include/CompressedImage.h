@@ -0,0 +1,99 @@
+#pragma once
+#include <windows.h>
+#include <compressapi.h>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <LogUtils.h>
+
+#define COMPRESSED_IMAGE_MAGIC 0x49434246   // "FBCI"
+#define COMPRESSED_IMAGE_VERSION 1
+#define COMPRESSED_IMAGE_HEADER_SIZE 4096   // Chunk data starts after this (or after one sector if larger)
+#define IMAGE_CHUNK_COMPRESSED 0x1          // Chunk holds compressed data, otherwise the raw block
+
+// Output mode of the copy
+enum class ImageCompression {
+    NONE = 0,   // Raw block copy to a disk or partition
+    FAST,       // Compressed image file, XPRESS
+    RATIO       // Compressed image file, LZMS
+};
+
+// First bytes of an image file. Only written once the image is complete, so a torn image has no valid header.
+struct CompressedImageHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD algorithm;        // COMPRESS_ALGORITHM_* used for compressed chunks
+    DWORD blockSize;
+    LONGLONG sourceSize;
+    LONGLONG blockCount;
+    ULONGLONG indexOffset;  // Chunk index, blockCount CompressedImageChunk entries
+    ULONGLONG storedBytes;  // Bytes of chunk data, padding included
+    DWORD sectorSize;       // Alignment of chunks and of the index
+    DWORD reserved;
+};
+
+// Where block number i of the source is stored. storedLength 0 means the block is all zero or was not copied.
+struct CompressedImageChunk {
+    ULONGLONG offset;
+    DWORD storedLength;
+    DWORD flags;
+};
+
+// Chunked, seekable compressed image of a source. Each source block is one chunk, appended in completion order
+// at a sector aligned offset, and the index at the end maps block numbers to chunks for random reads.
+class CompressedImage {
+private:
+    CompressedImageHeader m_header;
+    std::vector<CompressedImageChunk> m_chunks;
+    std::atomic<ULONGLONG> m_nextOffset;    // Writer: end of the chunk data reserved so far
+    HANDLE m_hReadFile;                     // Reader: image opened by Open
+    DECOMPRESSOR_HANDLE m_decompressor;     // Reader: used by ReadBlock
+    std::vector<char> m_readBuf;
+
+    ULONGLONG getDataStart() const;  // Offset of the first chunk
+    bool WriteSync(HANDLE hFile, const void* data, DWORD length, ULONGLONG offset);
+
+public:
+    CompressedImage() : m_header(), m_nextOffset(0), m_hReadFile(INVALID_HANDLE_VALUE), m_decompressor(nullptr) {}
+
+    static DWORD GetAlgorithm(ImageCompression compression);
+    static const wchar_t* GetAlgorithmName(DWORD algorithm);
+
+    // Getters
+    DWORD getAlgorithm() const;
+    DWORD getBlockSize() const;
+    LONGLONG getBlockCount() const;
+    LONGLONG getSourceSize() const;
+    ULONGLONG getStoredBytes() const;
+    DWORD getSectorSize() const;    // Chunks and the index start on multiples of it
+    const CompressedImageChunk& getChunk(LONGLONG blockNumber) const; // Reader: index entry of a block of the opened image
+
+    // Writer: prepares an empty index for a source of sourceSize bytes
+    bool Create(DWORD algorithm, DWORD blockSize, LONGLONG sourceSize, DWORD sectorSize);
+
+    // Writer: compresses length bytes of data into out (same capacity as data). Returns the bytes to store
+    // and sets compressed, or returns length with compressed false when the block does not shrink.
+    DWORD CompressChunk(COMPRESSOR_HANDLE compressor, const char* data, DWORD length, char* out, bool& compressed);
+
+    // Writer: reserves sector aligned space for one chunk and records it in the index, returns its file offset
+    ULONGLONG ReserveChunk(LONGLONG blockNumber, DWORD storedLength, DWORD flags);
+
+    // Writer: writes the index and then the header, once every chunk write has completed
+    bool Finalize(HANDLE hFile);
+
+    // Reader: opens an image and loads its index
+    bool Open(LPCWSTR path);
+
+    // Reader: reads block blockNumber into out (at least getBlockSize() bytes), length receives its source length.
+    // Not thread safe, a reader shares one decompressor.
+    bool ReadBlock(LONGLONG blockNumber, char* out, DWORD& length);
+
+    void Close();
+
+    ~CompressedImage() {
+        Close();
+    }
+
+    CompressedImage(const CompressedImage&) = delete;
+    CompressedImage& operator=(const CompressedImage&) = delete;
+};
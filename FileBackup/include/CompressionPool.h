@@ -0,0 +1,54 @@
+#pragma once
+#include <windows.h>
+#include <compressapi.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <IOUtils.h>
+#include <LogUtils.h>
+
+#define MAX_COMPRESSION_THREADS 64
+
+// Worker pool that runs the CPU bound compression stage between a read completion and its write,
+// so I/O completion threads hand blocks off instead of compressing them.
+// Each thread owns a compressor, as compressor handles cannot be shared between threads.
+class CompressionPool {
+public:
+    using Handler = std::function<void(IOContext*, COMPRESSOR_HANDLE)>;
+
+private:
+    std::vector<std::thread> m_threads;
+    std::vector<COMPRESSOR_HANDLE> m_compressors;
+    std::deque<IOContext*> m_queue;     // Blocks waiting to be compressed, bounded by the number of IOContexts
+    std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    bool m_stopping;
+    Handler m_handler;
+
+    void ThreadLoop(int threadIndex);
+
+public:
+    CompressionPool() : m_stopping(false) {}
+
+    // Getters
+    int getThreadCount() const;
+
+    // Starts nThreads threads (all logical processors when 0) that pass queued blocks to handler
+    bool Start(int nThreads, DWORD algorithm, Handler handler);
+
+    // Queues a block for compression
+    void Submit(IOContext* cntxt);
+
+    // Lets the threads finish the queued blocks, then joins them
+    void Stop();
+
+    ~CompressionPool() {
+        Stop();
+    }
+
+    CompressionPool(const CompressionPool&) = delete;
+    CompressionPool& operator=(const CompressionPool&) = delete;
+};
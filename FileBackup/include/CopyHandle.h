@@ -0,0 +1,72 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <BlockCopier.h>
+#include <LogUtils.h>
+
+// What StartCopyAsync copies and how, the service embedding the copier fills it in instead of a command line
+struct AsyncCopyRequest {
+    std::wstring srcPath;
+    std::vector<std::wstring> destPaths;        // More than one fans out, see BlockCopier::Initialize
+    int threads = DEFAULT_MAX_OUTSTANDING_IO;
+    int blockSizeMB = DEFAULT_BLOCK_SIZE_MB;
+    int queueDepth = DEFAULT_QUEUE_DEPTH;
+    std::function<void(BlockCopier&)> configure; // Applies the copy options before Initialize, may be empty
+    CopyProgressCallback onProgress;            // Called from the copy's thread while copying, may be empty
+    std::function<void(bool)> onComplete;       // Called from the copy's thread with the outcome before the handle is signalled, may be empty
+};
+
+// A copy running on its own thread of the calling process. The copier is configured, initialized and run there,
+// so starting costs a thread and the caller never blocks on console input or on the copy. Completion is signalled
+// through an event the caller can wait on with other handles, or through Wait.
+class CopyHandle {
+private:
+    BlockCopier m_copier;
+    std::thread m_thread;
+    HANDLE m_hDone;                     // Manual reset event set once the copy has ended
+    std::atomic<bool> m_done;
+    std::atomic<bool> m_succeeded;
+
+    CopyHandle() : m_hDone(nullptr), m_done(false), m_succeeded(false) {}
+
+    void Run(AsyncCopyRequest request);
+
+public:
+    // Starts the copy described by request and returns at once, nullptr if the copy could not be started.
+    // A copy that fails to initialize still returns a handle, which ends unsuccessfully.
+    static std::unique_ptr<CopyHandle> StartCopyAsync(const AsyncCopyRequest& request);
+
+    // Getters
+    HANDLE getDoneEvent() const;    // Stays valid as long as the handle
+    bool isDone() const;
+    bool getSucceeded() const;      // Outcome once isDone
+    CopyMetrics& getMetrics();      // Pulled while copying, like BlockCopier::getMetrics
+
+    // Asks the copy to stop, it ends unsuccessfully once the I/Os in flight completed
+    void Cancel();
+
+    // Waits up to timeoutMs for the copy to end, true if it did
+    bool Wait(DWORD timeoutMs = INFINITE);
+
+    ~CopyHandle() {
+        // A copy still running is cancelled and waited for, the copier must not outlive its thread
+        if (m_thread.joinable()) {
+            if (!isDone()) {
+                Cancel();
+            }
+            m_thread.join();
+        }
+        if (m_hDone != nullptr) {
+            CloseHandle(m_hDone);
+            m_hDone = nullptr;
+        }
+    }
+
+    CopyHandle(const CopyHandle&) = delete;
+    CopyHandle& operator=(const CopyHandle&) = delete;
+};
@@ -0,0 +1,73 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <DiskUtils.h>
+#include <LogUtils.h>
+
+#define COPY_JOURNAL_MAGIC 0x4A434246       // "FBCJ"
+#define COPY_JOURNAL_VERSION 1
+#define COPY_JOURNAL_HEADER_SIZE 4096       // Keeps the bitmap page aligned in the mapped view
+#define JOURNAL_CHECKPOINT_INTERVAL_MS 2000 // How often StartCopy persists completed blocks
+
+// Header at the start of the journal file, the completion bitmap follows at COPY_JOURNAL_HEADER_SIZE
+struct CopyJournalHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD blockSize;
+    DWORD reserved;
+    LONGLONG sourceSize;
+    LONGLONG blockCount;
+    ULONGLONG destinationId;   // Hash of the destination path
+};
+
+// Crash-safe record of the blocks a copy has finished, so an interrupted copy can resume.
+// Completions are collected in memory. Checkpoint() flushes the destination first and only then
+// persists the bits collected before that flush, so a bit on disk always means the block is durable.
+// Bits only ever go from 0 to 1, so a torn page write still leaves a valid journal.
+class CopyJournal {
+private:
+    std::wstring m_path;
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+    BYTE* m_view;
+    ULONGLONG* m_durableBits;                     // Bitmap inside the mapped view
+    std::vector<std::atomic<ULONGLONG>> m_completedBits; // Blocks completed in memory, not necessarily durable
+    std::vector<ULONGLONG> m_snapshot;            // Copy of m_completedBits taken by Checkpoint
+    CopyJournalHeader m_header;
+    LONGLONG m_resumedBlocks;                     // Blocks found complete when the journal was opened
+
+public:
+    CopyJournal() : m_hFile(INVALID_HANDLE_VALUE), m_hMapping(nullptr), m_view(nullptr), m_durableBits(nullptr), m_header(), m_resumedBlocks(0) {}
+
+    // Getters
+    bool isOpen() const;
+    DWORD getBlockSize() const;
+    LONGLONG getResumedBlocks() const;
+    LONGLONG getCompletedBlocks() const;
+
+    // Opens or creates the journal. With resume, a matching journal's completed blocks are kept, otherwise it starts empty.
+    bool Open(LPCWSTR path, DWORD blockSize, LONGLONG sourceSize, LPCWSTR destPath, bool resume);
+
+    bool IsBlockComplete(LONGLONG blockNumber) const;
+    void MarkBlockComplete(LONGLONG blockNumber);
+
+    // Drops blocks that are already complete from block aligned extents
+    void RemoveCompleted(std::vector<DiskExtent>& extents) const;
+
+    // Flushes hDest, then persists every block completed before the flush
+    bool Checkpoint(HANDLE hDest);
+
+    // Closes the journal and deletes it, once the copy has completed
+    bool Remove();
+
+    void Close();
+
+    ~CopyJournal() {
+        Close();
+    }
+
+    CopyJournal(const CopyJournal&) = delete;
+    CopyJournal& operator=(const CopyJournal&) = delete;
+};
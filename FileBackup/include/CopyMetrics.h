@@ -0,0 +1,149 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <LogUtils.h>
+
+#define METRICS_CACHE_LINE 64
+#define METRICS_SUB_BUCKET_BITS 4           // 16 linear sub buckets per power of two, about 6% resolution
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_MAX_VALUE_BITS 40           // Latencies are recorded in microseconds, larger values are clamped
+#define METRICS_HISTOGRAM_BUCKETS ((METRICS_MAX_VALUE_BITS - METRICS_SUB_BUCKET_BITS + 2) * METRICS_SUB_BUCKETS)
+#define METRICS_TIMELINE_INTERVAL_MS 1000   // One throughput sample per second
+
+// HDR style log-linear latency histogram, safe to record into from any thread
+class LatencyHistogram {
+private:
+    std::atomic<ULONGLONG> m_counts[METRICS_HISTOGRAM_BUCKETS];
+    std::atomic<ULONGLONG> m_maxValue;
+
+public:
+    LatencyHistogram();
+
+    static size_t BucketIndex(ULONGLONG value);
+    static ULONGLONG BucketMidpoint(size_t index);
+
+    void Record(ULONGLONG value);
+    void Reset();
+
+    // Adds this histogram's counts to counts (METRICS_HISTOGRAM_BUCKETS entries)
+    void AddTo(std::vector<ULONGLONG>& counts, ULONGLONG& maxValue) const;
+};
+
+// Latency distribution of one kind of operation, in microseconds
+struct LatencySummary {
+    ULONGLONG count;
+    double mean;
+    ULONGLONG p50;
+    ULONGLONG p90;
+    ULONGLONG p99;
+    ULONGLONG p999;
+    ULONGLONG max;
+};
+
+// Counters of one worker's IOContexts, on their own cache lines so workers do not share them
+struct alignas(METRICS_CACHE_LINE) WorkerMetrics {
+    std::atomic<LONGLONG> readsIssued;
+    std::atomic<LONGLONG> readsCompleted;
+    std::atomic<LONGLONG> writesIssued;
+    std::atomic<LONGLONG> writesCompleted;
+    std::atomic<LONGLONG> bytesRead;
+    std::atomic<LONGLONG> bytesWritten;
+    alignas(METRICS_CACHE_LINE) LatencyHistogram readLatency;
+    LatencyHistogram writeLatency;
+
+    WorkerMetrics() : readsIssued(0), readsCompleted(0), writesIssued(0), writesCompleted(0), bytesRead(0), bytesWritten(0) {}
+
+    // Keep the cache line alignment for arrays of workers
+    static void* operator new[](size_t size);
+    static void operator delete[](void* p);
+};
+
+// One second of the copy
+struct ThroughputSample {
+    double seconds;         // End of the interval, since the copy started
+    LONGLONG bytesRead;     // Read during the interval
+    LONGLONG bytesWritten;  // Written during the interval
+    double readsInFlight;   // Average outstanding reads over the interval
+    double writesInFlight;  // Average outstanding writes over the interval
+};
+
+struct WorkerSummary {
+    LONGLONG reads;
+    LONGLONG writes;
+    LONGLONG bytesRead;
+    LONGLONG bytesWritten;
+};
+
+// Point in time view returned by CopyMetrics::GetSummary
+struct CopyMetricsSummary {
+    double elapsedSeconds;
+    LONGLONG bytesRead;
+    LONGLONG bytesWritten;
+    LatencySummary readLatency;
+    LatencySummary writeLatency;
+    double avgReadsInFlight;
+    double avgWritesInFlight;
+    int totalContexts;
+    const wchar_t* likelyBottleneck;    // "source", "destination", "cpu" or "balanced"
+    std::vector<WorkerSummary> workers;
+};
+
+// Per operation timings and counters of a copy. Completion paths record into it lock free, the monitor loop
+// samples queue depths and throughput, and anyone may pull a summary or the timeline while the copy runs.
+class CopyMetrics {
+private:
+    std::unique_ptr<WorkerMetrics[]> m_workers;
+    int m_numOfWorkers;
+    int m_totalContexts;
+    LONGLONG m_frequency;                   // QueryPerformanceCounter ticks per second
+    LONGLONG m_startTicks;
+    std::atomic<LONGLONG> m_endTicks;       // 0 while the copy runs
+
+    // Sampling state, monitor thread only
+    LONGLONG m_lastSampleTicks;
+    LONGLONG m_lastBytesRead;
+    LONGLONG m_lastBytesWritten;
+    double m_intervalReadsInFlight;
+    double m_intervalWritesInFlight;
+    int m_intervalSamples;
+
+    mutable std::mutex m_lock;              // Guards the fields below
+    std::vector<ThroughputSample> m_timeline;
+    double m_totalReadsInFlight;
+    double m_totalWritesInFlight;
+    LONGLONG m_totalSamples;
+
+    LatencySummary Summarize(bool reads) const;
+    void GetInFlight(LONGLONG& reads, LONGLONG& writes) const;
+
+public:
+    CopyMetrics() : m_numOfWorkers(0), m_totalContexts(0), m_frequency(1), m_startTicks(0), m_endTicks(0),
+        m_lastSampleTicks(0), m_lastBytesRead(0), m_lastBytesWritten(0), m_intervalReadsInFlight(0), m_intervalWritesInFlight(0), m_intervalSamples(0),
+        m_totalReadsInFlight(0), m_totalWritesInFlight(0), m_totalSamples(0) {}
+
+    static LONGLONG Now(); // QueryPerformanceCounter ticks
+
+    // Clears everything and starts the clock
+    bool Start(int numOfWorkers, int totalContexts);
+    void Stop();
+
+    // Recording, called from the I/O paths with the IOContext's worker index and issue time
+    void OnReadIssued(int workerIndex);
+    void OnReadCompleted(int workerIndex, DWORD bytes, LONGLONG issueTicks);
+    void OnWriteIssued(int workerIndex);
+    void OnWriteCompleted(int workerIndex, DWORD bytes, LONGLONG issueTicks);
+
+    // Called by the monitor loop on every tick, closes a timeline interval every METRICS_TIMELINE_INTERVAL_MS
+    void Sample();
+
+    // Pull API
+    CopyMetricsSummary GetSummary() const;
+    std::vector<ThroughputSample> GetTimeline() const;
+
+    // Writes the summary, per worker counters and the timeline as JSON
+    bool WriteJson(LPCWSTR path) const;
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+// ETW keywords of the FileBackup.BlockCopier provider, a session enables the ones it wants
+#define COPYTRACE_KEYWORD_IO 0x1        // Block claims, reads and writes
+#define COPYTRACE_KEYWORD_STALL 0x2     // Parked contexts, copies that stop making progress, stalled destinations
+
+#define COPYTRACE_STALL_THRESHOLD_MS 1000   // A copy completing no write for this long reports a stall
+
+TRACELOGGING_DECLARE_PROVIDER(g_copyTraceProvider);
+
+// TraceLogging provider for the I/O path, to be read next to the kernel's DiskIo and scheduler events in WPA, e.g.
+//   wpr -start GeneralProfile -start DiskIO  and  tracelog -start fb -guid #0e269d8e-c4e8-4b2f-9f46-c312152133dc -level 5
+// Each event is one inline TraceLoggingWrite, which tests the provider's enable state before evaluating any
+// argument, so with no session listening an event costs one load and a branch. The thread id and timestamp are
+// part of every ETW event header, and ContextId ties the events of one IOContext together.
+class CopyTrace
+{
+private:
+    static LONGLONG s_ticksPerSecond;
+
+    static LONGLONG MicrosecondsSince(LONGLONG issueTicks) {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return (now.QuadPart - issueTicks) * 1000000 / s_ticksPerSecond;
+    }
+
+public:
+    // Once per process, before the first copy and after the last one
+    static void Register();
+    static void Unregister();
+
+    static void BlockClaimed(int contextId, int workerIndex, LONGLONG blockIndex, LONGLONG blockCount) {
+        TraceLoggingWrite(g_copyTraceProvider, "BlockClaim",
+            TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE), TraceLoggingKeyword(COPYTRACE_KEYWORD_IO),
+            TraceLoggingInt32(contextId, "ContextId"), TraceLoggingInt32(workerIndex, "Worker"),
+            TraceLoggingInt64(blockIndex, "Block"), TraceLoggingInt64(blockCount, "Blocks"));
+    }
+
+    static void ReadIssued(int contextId, int workerIndex, LONGLONG offset, DWORD bytes) {
+        TraceLoggingWrite(g_copyTraceProvider, "ReadIssue",
+            TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE), TraceLoggingKeyword(COPYTRACE_KEYWORD_IO),
+            TraceLoggingInt32(contextId, "ContextId"), TraceLoggingInt32(workerIndex, "Worker"),
+            TraceLoggingInt64(offset, "Offset"), TraceLoggingUInt32(bytes, "Size"));
+    }
+
+    static void ReadCompleted(int contextId, int workerIndex, LONGLONG offset, DWORD bytes, LONGLONG issueTicks, DWORD errCode) {
+        TraceLoggingWrite(g_copyTraceProvider, "ReadComplete",
+            TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE), TraceLoggingKeyword(COPYTRACE_KEYWORD_IO),
+            TraceLoggingInt32(contextId, "ContextId"), TraceLoggingInt32(workerIndex, "Worker"),
+            TraceLoggingInt64(offset, "Offset"), TraceLoggingUInt32(bytes, "Size"),
+            TraceLoggingInt64(MicrosecondsSince(issueTicks), "LatencyUs"), TraceLoggingUInt32(errCode, "Status"));
+    }
+
+    // destIndex is the fan-out destination, 0 for a single destination
+    static void WriteIssued(int contextId, int workerIndex, int destIndex, LONGLONG offset, DWORD bytes) {
+        TraceLoggingWrite(g_copyTraceProvider, "WriteIssue",
+            TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE), TraceLoggingKeyword(COPYTRACE_KEYWORD_IO),
+            TraceLoggingInt32(contextId, "ContextId"), TraceLoggingInt32(workerIndex, "Worker"), TraceLoggingInt32(destIndex, "Destination"),
+            TraceLoggingInt64(offset, "Offset"), TraceLoggingUInt32(bytes, "Size"));
+    }
+
+    static void WriteCompleted(int contextId, int workerIndex, int destIndex, LONGLONG offset, DWORD bytes, LONGLONG issueTicks, DWORD errCode) {
+        TraceLoggingWrite(g_copyTraceProvider, "WriteComplete",
+            TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE), TraceLoggingKeyword(COPYTRACE_KEYWORD_IO),
+            TraceLoggingInt32(contextId, "ContextId"), TraceLoggingInt32(workerIndex, "Worker"), TraceLoggingInt32(destIndex, "Destination"),
+            TraceLoggingInt64(offset, "Offset"), TraceLoggingUInt32(bytes, "Size"),
+            TraceLoggingInt64(MicrosecondsSince(issueTicks), "LatencyUs"), TraceLoggingUInt32(errCode, "Status"));
+    }
+
+    // reason is a short constant, e.g. L"Throttled"; contextId and destIndex are -1 when the stall is not theirs
+    static void Stall(LPCWSTR reason, int contextId, int destIndex, ULONGLONG durationMs, int pendingIOs) {
+        TraceLoggingWrite(g_copyTraceProvider, "Stall",
+            TraceLoggingLevel(WINEVENT_LEVEL_WARNING), TraceLoggingKeyword(COPYTRACE_KEYWORD_STALL),
+            TraceLoggingWideString(reason, "Reason"), TraceLoggingInt32(contextId, "ContextId"), TraceLoggingInt32(destIndex, "Destination"),
+            TraceLoggingUInt64(durationMs, "DurationMs"), TraceLoggingInt32(pendingIOs, "PendingIOs"));
+    }
+};
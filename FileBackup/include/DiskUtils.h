@@ -2,15 +2,81 @@
 #include <windows.h>
 #include <iostream>
 #include <winioctl.h> // Required for DeviceIoControl related structures
+#include <vector>
 #include <LogUtils.h>
 
+#define VOLUME_BITMAP_QUERY_BYTES (1024 * 1024) // Bitmap bytes fetched per FSCTL_GET_VOLUME_BITMAP call (8M clusters)
+
+// A byte range [offset, offset + length) of a disk or volume
+struct DiskExtent {
+    LONGLONG offset;
+    LONGLONG length;
+};
+
+// How unbuffered I/O on a device has to be laid out to avoid read-modify-write and split requests
+struct DeviceAlignment {
+    DWORD logicalSectorSize = 0;    // Smallest unit unbuffered I/O may use
+    DWORD physicalSectorSize = 0;   // Unit the medium writes in, smaller writes are read-modify-write (4096 on 512e drives)
+    DWORD alignmentOffset = 0;      // Bytes the handle's offset 0 lies past a physical sector boundary, 0 when aligned
+    LONGLONG partitionOffset = 0;   // Start of the volume on its disk, 0 for a whole disk
+    DWORD maxTransferLength = 0;    // Largest request the adapter takes in one piece, 0 if unknown
+    DWORD bufferAlignment = 0;      // Alignment the adapter needs for buffers, 0 if unknown
+};
+
+// Input of IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES for a TRIM of a single range
+struct TrimRequest {
+    DEVICE_MANAGE_DATA_SET_ATTRIBUTES attributes;
+    DEVICE_DATA_SET_RANGE range;
+};
+
 class DiskUtils
 {
 public:
     DiskUtils() {}
 
-    DWORD GetVolumeSectorSize(HANDLE hFile, LPCWSTR path, bool isSrc);
+    // Sector size to align I/O on the handle to: the physical sector size, or the logical one if the partition is misaligned
+    // alignment, if given, receives everything GetDeviceAlignment found
+    DWORD GetVolumeSectorSize(HANDLE hFile, LPCWSTR path, bool isSrc, DeviceAlignment* alignment = nullptr);
     LONGLONG GetDiskOrDriveSize(HANDLE handle, LPCWSTR path, bool isSrc);
 
+    // Physical sector size of the volume holding a regular file, 0 if it cannot be queried
+    DWORD GetFileSectorSize(HANDLE hFile);
+
+    // Sector sizes (IOCTL_STORAGE_QUERY_PROPERTY StorageAccessAlignmentProperty), partition offset and adapter limits
+    // of the device behind a disk, volume or regular file handle
+    bool GetDeviceAlignment(HANDLE handle, DeviceAlignment& alignment);
+
+    // Builds block aligned ranges covering every in-use cluster of an NTFS volume, from its volume bitmap
+    bool GetUsedBlockExtents(HANDLE hVolume, LONGLONG volumeSize, DWORD blockSize, std::vector<DiskExtent>& extents);
+
+    // Whether the device behind the handle accepts TRIM/unmap requests
+    bool IsTrimEnabled(HANDLE handle);
+
+    // Whether a TRIM/unmap stands in for writing zeros: the device accepts it and reports that unmapped blocks
+    // read back as zeros. What a trimmed range reads is undefined otherwise.
+    bool IsTrimZeroing(HANDLE handle);
+
+    // Starts a TRIM/unmap of [offset, offset + length) on a handle opened with FILE_FLAG_OVERLAPPED. It completes
+    // like a read or write on the handle, request must stay valid until then. False if it could not be started.
+    bool IssueTrim(HANDLE handle, LONGLONG offset, LONGLONG length, TrimRequest& request, OVERLAPPED* overlapped);
+
+    // I/O priority of every request issued on the handle, the storage stack queues low priority I/O behind other I/O
+    bool SetIoPriorityHint(HANDLE handle, PRIORITY_HINT priority);
+
+    // Number of the disk behind the handle (a disk or a volume on it), as in \\.\PhysicalDriveN; false for other devices
+    bool GetDiskNumber(HANDLE handle, DWORD& diskNumber);
+
+    // NUMA node the disk behind the handle (a disk or a volume on it) is attached to, -1 if unknown
+    int GetDeviceNumaNode(HANDLE handle);
+
+    // DeviceIoControl for handles opened with FILE_FLAG_OVERLAPPED, waits for the request to finish
+    bool DeviceIoControlSync(HANDLE handle, DWORD ioControlCode, LPVOID inBuf, DWORD inBufSize, LPVOID outBuf, DWORD outBufSize, DWORD* bytesReturned);
+
+    // ReadFile at offset for handles opened with FILE_FLAG_OVERLAPPED, waits for the read. Several threads may
+    // read one handle this way at once, a synchronous handle would serialize them.
+    bool ReadSync(HANDLE handle, LONGLONG offset, LPVOID buf, DWORD length, DWORD* bytesRead);
+    // WriteFile counterpart of ReadSync
+    bool WriteSync(HANDLE handle, LONGLONG offset, LPCVOID buf, DWORD length, DWORD* bytesWritten);
+
     ~DiskUtils() {}
 };
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <LogUtils.h>
+
+#define FANOUT_MAX_DESTINATIONS 8
+#define FANOUT_STALL_TIMEOUT_MS 30000   // A destination with writes outstanding and none completing for this long is dropped
+
+// One destination of a fan-out copy
+struct FanOutTarget {
+    std::wstring path;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    bool ownsHandle = false;                        // Closed by FanOutTargets, the first destination belongs to BlockCopier
+    std::atomic<bool> dropped{ false };             // Failed or stalled, no further writes are issued to it
+    std::atomic<int> writesInFlight{ 0 };
+    std::atomic<ULONGLONG> lastProgressMs{ 0 };     // GetTickCount64 of the last completion, or of the issue that ended an idle period
+    std::atomic<LONGLONG> bytesWritten{ 0 };
+};
+
+// The destinations every block of a fan-out copy is written to. The source is read once and each buffer
+// is written to all live destinations concurrently. A destination that fails or stalls is dropped on its
+// own, its outstanding writes are cancelled and the other destinations carry on.
+class FanOutTargets {
+private:
+    std::vector<std::unique_ptr<FanOutTarget>> m_targets;
+    std::atomic<int> m_live;
+
+public:
+    FanOutTargets() : m_live(0) {}
+
+    // Getters
+    int getCount() const;
+    int getLiveCount() const;
+    FanOutTarget& getTarget(int index);
+
+    // Adds a destination opened with FILE_FLAG_OVERLAPPED, its index is its position in the list
+    void Add(LPCWSTR path, HANDLE handle, bool ownsHandle);
+
+    // Stops writing to a destination and cancels its outstanding writes, false if it was dropped before
+    bool Drop(int index, DWORD errCode);
+
+    // Drops destinations whose writes have not made progress for timeoutMs, returns how many were dropped
+    int DropStalled(ULONGLONG timeoutMs);
+
+    // Flushes every live destination, dropping those that fail; false once none is left
+    bool Flush();
+
+    // Logs what each destination received
+    void LogSummary() const;
+
+    // Closes the owned handles and forgets every destination
+    void Clear();
+
+    FanOutTargets(const FanOutTargets&) = delete;
+    FanOutTargets& operator=(const FanOutTargets&) = delete;
+
+    ~FanOutTargets() {
+        Clear();
+    }
+};
@@ -0,0 +1,124 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <IOUtils.h>
+#include <DiskUtils.h>
+#include <LogUtils.h>
+
+#define FAULT_DEFAULT_RETRIES 5           // Reissues of a failed range before it is given up on
+#define FAULT_DEFAULT_RETRY_DELAY_MS 200  // Delay before the first reissue, doubled for every further one
+#define FAULT_MAX_RETRY_DELAY_MS 30000
+#define FAULT_COMPLETION_KEY (~static_cast<ULONG_PTR>(0) - 2) // Completion key of a context the fault handler hands back to the I/O threads
+
+// Source sectors that could not be read, copied as zeros
+struct BadSectorRange {
+    LONGLONG offset;
+    LONGLONG length;
+    DWORD errCode;
+};
+
+// Takes over reads and writes that failed, so one bad range does not end the whole copy. The range is reissued
+// synchronously on a thread of its own with exponential backoff (a SAN path failover usually heals within that),
+// while every other context keeps streaming. A source read still failing with a media error is then bisected down
+// to sectors: readable halves are kept, unreadable sectors are zeroed and recorded, and only more bad sectors than
+// the error budget fail the copy. The outcome goes back through the engine the context belongs to, as a completion
+// carrying FAULT_COMPLETION_KEY (IOCP) or an APC queued to the worker that owns the context.
+class FaultHandler {
+private:
+    struct PendingFault {
+        IOContext* cntxt;
+        DWORD errCode;
+        int attempts;       // Reissues done so far
+        ULONGLONG dueMs;    // GetTickCount64 value of the next reissue
+    };
+
+    int m_retries;
+    DWORD m_retryDelayMs;
+    LONGLONG m_errorBudget;             // Bad sectors tolerated before the copy fails
+    std::wstring m_badSectorPath;       // List of bad sector ranges saved at the end of the run, empty for none
+
+    IOEngineType m_engineType;
+    HANDLE m_hIocp;
+    ULONG_PTR m_completionKey;          // Key redelivered contexts are posted with, FAULT_COMPLETION_KEY unless the port is shared
+    std::vector<HANDLE> m_workerThreads; // APC engine: thread of each worker, see RegisterWorkerThread
+    DWORD m_sectorSize;                 // Granularity of the bisection
+    LONGLONG m_srcSize;                 // Reads past it return nothing, however the range is split
+
+    std::thread m_thread;
+    std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    bool m_stopping;                    // Also while not started, Submit then declines every fault
+    std::vector<PendingFault> m_pending;
+
+    std::vector<BadSectorRange> m_badSectors; // Only touched by m_thread while it runs
+    LONGLONG m_badSectorCount;
+    std::atomic<LONGLONG> m_faults;
+    std::atomic<LONGLONG> m_reissues;
+    std::atomic<LONGLONG> m_recovered;
+    DiskUtils m_diskUtils;
+
+    void ThreadLoop();
+    ULONGLONG GetRetryDelay(int attempts) const;
+    void Reissue(PendingFault fault);
+
+    // Reads [offset, offset + length) into the context's buffer, halving ranges that fail with a media error down to
+    // sectors. Returns false on any other error or once the error budget is exceeded, errCode then holds the error.
+    bool ReadAroundBadSectors(IOContext* cntxt, LONGLONG offset, DWORD length, LONGLONG& dataEnd, DWORD& errCode);
+    void RecordBadSectors(LONGLONG offset, LONGLONG length, DWORD errCode);
+    bool SaveBadSectors() const;
+
+    // Hands the outcome of a fault back to the I/O threads
+    void Redeliver(IOContext* cntxt, DWORD errCode, DWORD bytesTransferred);
+    static void CALLBACK RedeliverApc(ULONG_PTR param);
+
+    static bool IsRetryable(DWORD errCode);
+    static bool IsMediaError(DWORD errCode);
+
+public:
+    FaultHandler() : m_retries(FAULT_DEFAULT_RETRIES), m_retryDelayMs(FAULT_DEFAULT_RETRY_DELAY_MS), m_errorBudget(0), m_engineType(IOEngineType::APC), m_hIocp(nullptr), m_completionKey(FAULT_COMPLETION_KEY),
+        m_sectorSize(0), m_srcSize(0), m_stopping(true), m_badSectorCount(0), m_faults(0), m_reissues(0), m_recovered(0) {}
+
+    // Getters
+    int getRetries() const;
+    LONGLONG getFaults() const;
+    LONGLONG getReissues() const;
+    LONGLONG getRecovered() const;
+    LONGLONG getBadSectors() const;     // Only once stopped
+
+    // Setters (must be called before Start)
+    void setRetries(int retries);       // 0 turns fault handling off, every failure ends the copy again
+    void setRetryDelay(DWORD retryDelayMs);
+    void setErrorBudget(LONGLONG sectors);
+    void setBadSectorPath(LPCWSTR path);
+
+    // Starts the retry thread. hIocp is the port of the IOCP engine and completionKey the key that stands for
+    // FAULT_COMPLETION_KEY on it, nThreads the number of APC workers.
+    bool Start(IOEngineType engineType, HANDLE hIocp, ULONG_PTR completionKey, int nThreads, DWORD sectorSize, LONGLONG srcSize);
+
+    // APC engine: called by each worker before it issues any I/O, so outcomes can be queued to it
+    bool RegisterWorkerThread(int workerIndex);
+
+    // Takes over the failed operation of cntxt, which stays counted as pending until it is redelivered.
+    // Returns false if errCode is not worth retrying, the caller then fails the operation as before.
+    bool Submit(IOContext* cntxt, DWORD errCode);
+
+    // Completes the operation of a redelivered context through IOUtils, on the thread that dequeued it
+    static void Deliver(IOContext* cntxt);
+
+    // Hands faults not handled yet back as failed (the copy has failed by then), joins the thread and saves the
+    // bad sector list. Must be called while the I/O threads still take redelivered contexts.
+    void Stop();
+    void LogSummary() const;
+
+    ~FaultHandler() {
+        Stop();
+    }
+
+    FaultHandler(const FaultHandler&) = delete;
+    FaultHandler& operator=(const FaultHandler&) = delete;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <windows.h>
+#include <winioctl.h>
+#include <atomic>
+#include <DiskUtils.h>
+#include <LogUtils.h>
+
+// Raw copy into a regular file on NTFS or ReFS instead of a device. The file is allocated to its full size
+// before the first write, so unbuffered writes never extend it, and with SE_MANAGE_VOLUME_NAME its valid data
+// length is moved to the end as well, so no write waits for the file system to zero the range before it.
+// A new image of an incremental run can share the unchanged blocks of the previous image through ReFS block
+// cloning instead of writing them.
+class FileImage {
+private:
+    HANDLE m_hFile;             // The image, owned by the copier
+    HANDLE m_hBase;             // Previous image unchanged blocks are cloned from, INVALID_HANDLE_VALUE for none
+    LONGLONG m_size;            // Allocated size: the source size rounded up to the sector size
+    DWORD m_clusterSize;        // Of the ReFS volume, clones cover whole clusters
+    bool m_inPlace;             // An existing image is updated, it already holds the blocks of the previous run
+    bool m_validDataSet;        // The valid data length was moved to m_size
+    std::atomic<LONGLONG> m_bytesCloned;
+    DiskUtils m_diskUtils;
+
+public:
+    FileImage() : m_hFile(INVALID_HANDLE_VALUE), m_hBase(INVALID_HANDLE_VALUE), m_size(0), m_clusterSize(0), m_inPlace(false),
+        m_validDataSet(false), m_bytesCloned(0) {}
+
+    // Getters
+    LONGLONG getSize() const;
+    bool isInPlace() const;
+    bool isValidDataSet() const;
+    bool hasBase() const;
+    LONGLONG getBytesCloned() const;
+
+    static bool EnableManageVolumePrivilege();
+
+    // Opens the previous image to clone from. Both images must be on the same ReFS volume. While hFile is still empty,
+    // its sparse and integrity stream settings are made to match the base, which block cloning requires.
+    // False if cloning is not possible, unchanged blocks are then written.
+    bool OpenBase(LPCWSTR basePath, HANDLE hFile, LONGLONG size);
+
+    // Allocates size bytes and moves the end of file there. With setValidData the valid data length follows when
+    // the privilege can be enabled: only for a new image every block of which is written or cloned, since a range
+    // that is never written would show whatever the volume held there before.
+    bool Prepare(HANDLE hFile, LONGLONG size, bool inPlace, bool setValidData);
+
+    // Shares [offset, offset + length) of the previous image with the image instead of writing it, false if the
+    // range must be written
+    bool CloneRange(LONGLONG offset, DWORD length);
+
+    void Close();
+
+    ~FileImage() {
+        Close();
+    }
+
+    FileImage(const FileImage&) = delete;
+    FileImage& operator=(const FileImage&) = delete;
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <JobScheduler.h>
+#include <MftEnumerator.h>
+#include <LogUtils.h>
+
+#define FILETREE_SMALL_FILE_BYTES (1024 * 1024)         // Contiguous files up to this size are read in batches
+#define FILETREE_ENGINE_FILE_BYTES (64 * 1024 * 1024)   // Files from this size on are copied by the block engine
+#define FILETREE_BATCH_BYTES (8 * 1024 * 1024)          // Volume span one batch read covers at most
+#define FILETREE_BATCH_GAP_BYTES (256 * 1024)           // Largest gap between two files that is read over rather than split at
+
+// How one entry of the tree is copied
+enum class TreeFileKind {
+    DIRECTORY = 0,
+    IN_RECORD,  // Empty or resident, written from the MFT record
+    BATCHED,    // Small and contiguous, read with its neighbours on the volume in one batch
+    COPIED,     // Anything the MFT alone cannot be trusted with, copied through the file system
+    ENGINE      // Large, copied by a BlockCopier job
+};
+
+struct TreeFile {
+    std::wstring relPath;       // Below the source and destination roots
+    TreeFileKind kind = TreeFileKind::COPIED;
+    MftFileData data;
+    LONGLONG volumeOffset = 0;  // BATCHED: where the file's clusters start on the volume
+};
+
+// One read of the volume covering several small files, in volume order
+struct FileBatch {
+    LONGLONG volumeOffset;
+    DWORD length;
+    size_t first;   // Range of the batch's files in m_batchOrder
+    size_t count;
+};
+
+// File-level backup of one directory of an NTFS snapshot. The tree is enumerated from the MFT (names with
+// FSCTL_ENUM_USN_DATA, sizes and extents from the file records read in large chunks) instead of a directory walk.
+// Small contiguous files are sorted by volume offset and read in coalesced, aligned batches straight from the
+// volume; resident files come out of their records; large files run as BlockCopier jobs of one JobScheduler
+// while worker threads handle the rest. The source must be a snapshot: the volume is read below the file system.
+class FileTreeCopier {
+private:
+    std::wstring m_srcRoot;     // Extended length forms of the two roots
+    std::wstring m_destRoot;
+    HANDLE m_hVolume;
+    MftEnumerator m_mft;
+    JobScheduler m_scheduler;
+    std::vector<TreeFile> m_files;
+    std::vector<size_t> m_batchOrder;   // BATCHED files by volume offset
+    std::vector<FileBatch> m_batches;
+    std::vector<size_t> m_singles;      // IN_RECORD and COPIED files, one work item each
+    std::vector<size_t> m_engineFiles;
+    std::atomic<size_t> m_nextItem;     // Workers claim m_batches first, then m_singles
+    std::atomic<LONGLONG> m_bytesCopied;
+    std::atomic<int> m_failures;
+    int m_skipped;                      // Reparse points, and everything below directory reparse points
+
+    // Prefixes \\?\ to a full path, so that deep trees are not limited to MAX_PATH
+    static std::wstring ToExtendedPath(const std::wstring& path);
+
+    // Opens the volume holding srcDir for MFT and cluster reads, and gets the file reference of srcDir itself
+    bool OpenVolume(LPCWSTR srcDir, ULONGLONG& srcDirRef);
+
+    // Enumerates the tree below srcDirRef, reads its records and decides how each file is copied
+    bool BuildTree(ULONGLONG srcDirRef);
+    void BuildBatches();
+    bool CreateDirectories();
+
+    void WorkerLoop(int workerIndex);
+    bool CopyBatch(const FileBatch& batch, BYTE* buf);
+    bool CopySingle(const TreeFile& file);
+    bool WriteFileData(const TreeFile& file, const BYTE* data, DWORD size);
+    static bool ApplyBasicInfo(HANDLE hFile, const FILE_BASIC_INFO& basicInfo);
+
+    // Engine copies leave the image size rounded up to a sector, cut them back and set their times
+    bool FinishEngineFiles();
+
+public:
+    FileTreeCopier() : m_hVolume(INVALID_HANDLE_VALUE), m_nextItem(0), m_bytesCopied(0), m_failures(0), m_skipped(0) {}
+
+    // Setters (must be called before Run), for the BlockCopier jobs of large files
+    void setMaxJobs(int maxJobs);
+    void setDeviceSlots(int deviceSlots);
+
+    // Copies every file and directory below srcDir to destDir with nThreads workers. Large files use
+    // blockSizeMB, queueDepth and the memory budget like --jobs does, configure applies the copy options to them.
+    bool Run(LPCWSTR srcDir, LPCWSTR destDir, int nThreads, int blockSizeMB, int queueDepth, LONGLONG memoryBudgetMB, JobScheduler::Configure configure);
+
+    ~FileTreeCopier();
+
+    FileTreeCopier(const FileTreeCopier&) = delete;
+    FileTreeCopier& operator=(const FileTreeCopier&) = delete;
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <LogUtils.h>
+
+#define HASH_MANIFEST_MAGIC 0x4D484246  // "FBHM"
+#define HASH_MANIFEST_VERSION 1
+#define HASH_MANIFEST_LOGGED_MISMATCHES 16 // Mismatching blocks logged individually by a verify pass
+
+// On-disk header of a hash manifest, followed by one ULONGLONG hash per block
+struct HashManifestHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD blockSize;
+    DWORD reserved;
+    LONGLONG sourceSize;
+    LONGLONG blockCount;
+    ULONGLONG imageDigest;     // Hash of the block hashes in block order
+};
+
+// xxHash64 of every block copied in this run, addressed by absolute block number (source offset / block size).
+// A hash of 0 means the block was not copied. Each block is touched by a single I/O at a time, so the array
+// needs no locking. The last block is hashed up to the end of the source, without its sector padding.
+class HashManifest {
+private:
+    std::wstring m_path;                    // Empty when the manifest is only kept for a verify pass
+    HashManifestHeader m_header;
+    std::vector<ULONGLONG> m_hashes;
+    std::atomic<LONGLONG> m_verifiedBlocks;
+    std::atomic<LONGLONG> m_mismatchedBlocks;
+
+public:
+    HashManifest() : m_header(), m_verifiedBlocks(0), m_mismatchedBlocks(0) {}
+
+    // Getters
+    DWORD getBlockSize() const;
+    ULONGLONG getImageDigest() const;   // Valid after Finish
+    LONGLONG getHashedBlocks() const;
+    LONGLONG getVerifiedBlocks() const;
+    LONGLONG getMismatchedBlocks() const;
+
+    // Starts an empty manifest, path may be nullptr when it is not saved
+    bool Create(LPCWSTR path, DWORD blockSize, LONGLONG sourceSize);
+
+    // Bytes of the block that are hashed, blockSize except for the last block of the source
+    DWORD GetBlockLength(LONGLONG blockNumber) const;
+
+    // Records the hash of a block copied in this run
+    void Record(LONGLONG blockNumber, ULONGLONG hash);
+
+    // Compares the hash of a block read back from the destination, false if it differs from the copied one.
+    // Blocks without a recorded hash are not checked.
+    bool Verify(LONGLONG blockNumber, ULONGLONG hash);
+    void ReportMismatch(LONGLONG blockNumber);  // A block that could not be read back in full
+
+    // Computes the image digest once every block is recorded, then saves the manifest if it has a path
+    bool Finish();
+
+    ~HashManifest() {}
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <IOUtils.h>
+#include <LogUtils.h>
+
+#define MAX_HASH_THREADS 64
+#define HASH_COMPLETION_KEY (~static_cast<ULONG_PTR>(0)) // Completion key of a context the hash stage hands back to the I/O threads
+
+// Worker pool that hashes blocks off the I/O completion threads. A block is hashed while its write is
+// in flight, so hashing adds no latency to the copy as long as the pool keeps up with the devices.
+class HashPool {
+public:
+    using Handler = std::function<void(IOContext*)>;
+
+private:
+    std::vector<std::thread> m_threads;
+    std::deque<IOContext*> m_queue;     // Blocks waiting to be hashed, bounded by the number of IOContexts
+    std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    bool m_stopping;
+    Handler m_handler;
+
+    void ThreadLoop();
+
+public:
+    HashPool() : m_stopping(false) {}
+
+    // Getters
+    int getThreadCount() const;
+
+    // Starts nThreads threads (all logical processors when 0) that pass queued blocks to handler
+    bool Start(int nThreads, Handler handler);
+
+    // Queues a block for hashing
+    void Submit(IOContext* cntxt);
+
+    // Lets the threads finish the queued blocks, then joins them
+    void Stop();
+
+    ~HashPool() {
+        Stop();
+    }
+
+    HashPool(const HashPool&) = delete;
+    HashPool& operator=(const HashPool&) = delete;
+};
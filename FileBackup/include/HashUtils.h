@@ -0,0 +1,14 @@
+#pragma once
+#include <windows.h>
+
+// Fast non-cryptographic hashing of block buffers
+class HashUtils
+{
+public:
+    HashUtils() {}
+
+    // xxHash64 of len bytes, runs at several GB/s per core
+    static ULONGLONG Hash64(const void* data, size_t len, ULONGLONG seed = 0);
+
+    ~HashUtils() {}
+};
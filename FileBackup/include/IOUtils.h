@@ -1,36 +1,130 @@
 #pragma once
 #include <windows.h>
+#include <compressapi.h>
 #include <iostream>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <LogUtils.h> 
+#include <BlockSchedule.h>
+#include <BufferArena.h>
+#include <RangeScheduler.h>
+#include <FanOutTargets.h>
+#include <HashManifest.h>
+#include <IoThrottle.h>
+#include <NetworkTarget.h>
+#include <DiskUtils.h>
 
 // Forward declaration of BlockCopier for IOContext
 class BlockCopier;
 
+// Selects how asynchronous I/O is issued and how its completions are delivered
+enum class IOEngineType {
+    APC = 0,    // ReadFileEx/WriteFileEx, completions run as APCs on the issuing thread inside SleepEx
+    IOCP        // ReadFile/WriteFile on handles bound to one I/O completion port, serviced by any pool thread
+};
+
+// What to do with blocks whose content is entirely zero
+enum class ZeroBlockPolicy {
+    WRITE = 0,  // Write them like any other block
+    SKIP,       // Do not write them, the destination is known to be zeroed already
+    UNMAP       // Trim the destination range instead of writing zeros
+};
+
+// Operation currently outstanding on an IOContext, used by the IOCP engine to route a dequeued completion
+enum class IOOperationType {
+    NONE = 0,
+    READ,
+    WRITE,
+    UNMAP       // TRIM of an all-zero block's destination range
+};
+
+struct IOContext;
+
+// One destination's write of a fanned out block. Fan-out destinations are bound to the completion port
+// with their index + 1 as the key, which tells the completion apart from an IOContext's own OVERLAPPED.
+struct FanOutWrite {
+    OVERLAPPED overlapped = {}; // Must stay the first member
+    IOContext* cntxt = nullptr;
+    LONGLONG issueTicks = 0;
+};
+
 // Structure to hold context for each asynchronous I/O operation
 struct IOContext {
-    OVERLAPPED overlapped = {}; // OVERLAPPED structure for async I/O
+    OVERLAPPED overlapped = {}; // OVERLAPPED structure for async I/O, must stay the first member
+    IOOperationType opType = IOOperationType::NONE; // Operation currently issued with this context
     char* buf = nullptr;        // Buffer for read/write operations
+    char* auxBuf = nullptr;     // Compressed image only: second buffer the compression stage writes into
     DWORD bufSize = 0;          // Size of the buffer
     std::atomic<bool> completed; // flag to signal completion of an operation
     LONGLONG readOffset = 0;    // Offset at which the current read operation started
+    LONGLONG blockIndex = 0;    // First schedule block of the current read
+    LONGLONG blockCount = 1;    // Consecutive schedule blocks covered by the current read
     DWORD bytesTransferred = 0; // Store the actual bytes transferred for this specific I/O operation 
     BlockCopier* curInst = nullptr; // Pointer to the BlockCopier instance for callbacks
+    int workerIndex = 0;        // Worker whose ring owns this context, selects its metrics slot
+    int index = 0;              // Position among the copier's contexts, selects its network connection and frame header
+    LONGLONG issueTicks = 0;    // QueryPerformanceCounter value when the current operation was issued
+    BufferArena* arena = nullptr; // Owner of buf/auxBuf, nullptr when they were allocated by the context itself
+    std::unique_ptr<FanOutWrite[]> fanOutWrites; // Fan-out only: one write per destination
+    std::atomic<int> writesLeft{ 0 }; // Fan-out only: writes of the current block (plus the issuer) not finished yet
+    DWORD hashLength = 0;       // Hashing only: bytes read into buf, bytesTransferred is padded for the write meanwhile
+    std::atomic<int> bufferHolds{ 0 }; // Hashing only: stages (write, hash) still using buf
+    HANDLE ioHandle = INVALID_HANDLE_VALUE; // Handle and length of the current read/write, for the fault handler to reissue it
+    DWORD ioLength = 0;
+    bool recovered = false;     // The current operation comes back from the fault handler, a failure is final
+    DWORD faultError = ERROR_SUCCESS; // Outcome the fault handler redelivers
+    DWORD faultBytes = 0;
+    TrimRequest trim = {};      // Unmap only: input of the outstanding TRIM
 
-    IOContext(DWORD bSize)
+    IOContext(DWORD bSize, bool withAuxBuf = false)
         : bufSize(bSize), completed(false), readOffset(0), bytesTransferred(0), curInst(nullptr) { // Initialize bytesTransferred
         // VirtualAlloc is crucial for FILE_FLAG_NO_BUFFERING as it guarantees page aligned memory.
         buf = (char*)VirtualAlloc(nullptr, bufSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (withAuxBuf && buf) {
+            auxBuf = (char*)VirtualAlloc(nullptr, bufSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+            if (!auxBuf) { // Report it through buf like any other allocation failure
+                VirtualFree(buf, 0, MEM_RELEASE);
+                buf = nullptr;
+            }
+        }
         if (!buf) {
             LOG_ERROR(L"IOContext: Failed to allocate buffer for IOContext.\n");
         }
     }
 
+    // Buffers are slices of a shared arena, which must outlive the context
+    IOContext(BufferArena& bufferArena, bool withAuxBuf = false)
+        : bufSize(static_cast<DWORD>(bufferArena.getSliceSize())), completed(false), readOffset(0), bytesTransferred(0), curInst(nullptr), arena(&bufferArena) {
+        buf = arena->Acquire();
+        if (withAuxBuf && buf) {
+            auxBuf = arena->Acquire();
+            if (!auxBuf) {
+                arena->Release(buf);
+                buf = nullptr;
+            }
+        }
+        if (!buf) {
+            LOG_ERROR(L"IOContext: No free buffer slice left in the arena for IOContext.\n");
+        }
+    }
+
     ~IOContext() {
+        if (arena) {
+            arena->Release(buf); // Ignores nullptr
+            arena->Release(auxBuf);
+            buf = nullptr;
+            auxBuf = nullptr;
+        }
         if (buf) {
             VirtualFree(buf, 0, MEM_RELEASE);
             buf = nullptr;
         }
+        if (auxBuf) {
+            VirtualFree(auxBuf, 0, MEM_RELEASE);
+            auxBuf = nullptr;
+        }
     }
 
     // Explicitly delete copy constructor and copy assignment operator
@@ -40,37 +134,134 @@ struct IOContext {
     IOContext& operator=(IOContext&&) = delete;
 };
 
+class IOUtils;
+
+// Everything a successful read completion does with its block, one pre-instantiated BlockPipeline (see BlockPipeline.h)
+using BlockHandler = void(*)(IOUtils& io, IOContext* cntxt, DWORD bytesRead);
+
+// Ends the write stage of a block's buffer, picked with the pipeline (see BlockStages::SelectRelease)
+using BufferRelease = void(*)(IOContext* cntxt);
+
 class IOUtils {
 private:
     std::atomic<int> m_pendingIOs;         // Counter for currently active I/O operations
-    std::atomic<LONGLONG> m_fileOffset;     // Tracked global file offset for reads
+    std::atomic<LONGLONG> m_nextBlock;      // Next linear block index of m_schedule to be claimed for reading, unless m_ranges is set
     std::atomic<bool> m_readComplete;       // Flag indicating all source data has been read
     std::atomic<bool> m_errOccurred;        // Flag indicating a critical error has occurred
+    IOEngineType m_engineType;              // How reads/writes are issued
+    const BlockSchedule* m_schedule;        // Source ranges to copy
+    RangeScheduler* m_ranges;               // Per worker ranges of m_schedule, nullptr to claim from m_nextBlock
+    IoThrottle* m_throttle;                 // Read rate limits, nullptr when reads are not throttled
+    std::atomic<int> m_blocksPerIo;         // Schedule blocks claimed by one read, tuned while copying
+    std::atomic<int> m_activeLimit;         // IOCP engine: IOContexts allowed in the read/write cycle, 0 for all of them
+    std::atomic<int> m_activeContexts;      // IOContexts currently in the cycle
+    std::mutex m_parkedLock;                // Guards m_parkedContexts
+    std::vector<IOContext*> m_parkedContexts; // Idle contexts above m_activeLimit
+    BlockHandler m_blockHandler;            // Stages a block read goes through, chosen for the copy's features
+    BufferRelease m_bufferRelease;          // How a finished write frees the buffer, chosen with m_blockHandler
+    DWORD m_readSectorSize;                 // Unit reads are rounded up to: the source's sector, or the destination's on a verify pass
+    HANDLE m_hFinished;                     // Manual reset event set once the copy is done or failed, nullptr for none
+    HANDLE m_hDrained;                      // Manual reset event set once no I/O is pending, nullptr for none
+
+    friend class BlockStages;
+
+    void MarkBlockComplete(IOContext* cntxt);
+
+    // Ordered writes: a block read that ends without a write (EOF, error) passes its turn, so later blocks are not held
+    void PassTurn(IOContext* cntxt);
+
+    // Ends the write stage of the block in cntxt through the release picked for the copy: the buffer is free
+    // unless the hash stage still uses it
+    void ReleaseBuffer(IOContext* cntxt);
+
+    // Records (or during the verify pass, checks) the hash of every block held by cntxt
+    void HashBlocks(IOContext* cntxt, HashManifest& manifest, bool verifyPass);
+
+    // Fan-out: writes the block in cntxt to every live destination, the buffer is free once all of them finished
+    void IssueFanOutWrites(IOContext* cntxt, FanOutTargets& targets);
+    void ReleaseFanOutWrite(IOContext* cntxt, FanOutTargets& targets);
 
 public:
-    IOUtils() : m_pendingIOs(0), m_fileOffset(0), m_readComplete(false), m_errOccurred(false) {}
+    IOUtils(); // Buffers are released as owned by the write alone until setBufferRelease picks the pipeline's release
 
     // Getters
     int getPendingIOs();
     bool getReadCompleteInfo();
     bool getErrorOccuredInfo();
-    LONGLONG getFileOffset();
+    LONGLONG getNextBlock();
+    IOEngineType getEngineType();
+    int getBlocksPerIo();
+    int getActiveLimit();
+    BlockHandler getBlockHandler();
+    BufferRelease getBufferRelease();
+    DWORD getReadSectorSize();
 
     // Setters
     void setReadCompleteInfo(bool ifCompleted);
     void setErrorOccuredInfo(bool ifOccured);
     void setPendingIOs(int value);
-    void setFileOffset(LONGLONG offset);
+    void setNextBlock(LONGLONG blockIndex);
+    void setEngineType(IOEngineType engineType);
+    void setSchedule(const BlockSchedule* schedule);
+    void setRanges(RangeScheduler* ranges); // Built over the schedule; reads then claim by IOContext::workerIndex
+    void setBlocksPerIo(int blocksPerIo);   // IOContext buffers must hold blocksPerIo blocks
+    void setActiveLimit(int activeLimit);   // Takes effect as contexts finish their cycle, see UnparkContexts
+    void setThrottle(IoThrottle* throttle); // IOCP engine: contexts park while it admits no reads, see UnparkContexts
+    void setBlockHandler(BlockHandler blockHandler); // Only while no read is in flight
+    void setBufferRelease(BufferRelease bufferRelease); // Only while no write is in flight
+    void setReadSectorSize(DWORD sectorSize); // Only while no read is in flight, 0 leaves reads unrounded
+    void setFinishedEvent(HANDLE hFinished); // Owned by the caller, who resets it before the workers start
+    void setDrainedEvent(HANDLE hDrained);   // Owned by the caller, who resets it before waiting for the count to drop
 
-    // Issues an asynchronous read operation using the given IOContext
-    bool IssueRead(const HANDLE& handle, IOContext* cntxt, const DWORD& blockSize, const LONGLONG& totalFileSize);
+    // Wakes whoever waits on the finished event once every read was issued and no I/O is pending, or an error
+    // occurred, and whoever waits on the drained event once no I/O is pending. Called by the threads that end
+    // I/Os, after they are done with the contexts involved.
+    void SignalIfFinished();
+
+    // IOCP engine: a context that finished its cycle (or is about to start its first one, after AddActiveContext)
+    // parks instead of reading again while more contexts than the limit are active, or while the throttle
+    // admits no reads. Returns true if it was parked.
+    void AddActiveContext();
+    bool ParkIfOverLimit(IOContext* cntxt);
+    // Puts parked contexts back into the cycle until the limit is reached or the throttle stops admitting reads
+    void UnparkContexts(const HANDLE& handle);
+    // Forgets parked contexts and the active count before the contexts are seeded again
+    void ClearParkedContexts();
+
+    // Claims the next scheduled block (or run of blocks) of the context's worker and issues an asynchronous read of it using the given IOContext
+    bool IssueRead(const HANDLE& handle, IOContext* cntxt);
 
     // Issues an asynchronous write operation using the given IOContext
     bool IssueWrite(const HANDLE& handle, IOContext* cntxt, DWORD bytesToWrite); 
 
+    // IOCP engine: unmaps the all-zero block in cntxt with an overlapped TRIM of its destination range. The read
+    // stays pending for the caller to end, false if the TRIM could not be started and the zeros need writing.
+    bool IssueUnmap(IOContext* cntxt);
+
+    // Writes the block read into cntxt (cntxt->bytesTransferred bytes at its read offset) and ends the read.
+    // Called from the read completion, or from the ReorderBuffer once the block's turn has come.
+    void IssueBlockWrite(IOContext* cntxt);
+
+    // Network target: sends the block in cntxt as one frame, the send completes through the RIO completion queue
+    bool IssueSend(NetworkTarget& target, IOContext* cntxt, DWORD bytesToSend);
+    void OnNetworkSendCompletion(IOContext* cntxt, DWORD errCode, DWORD numOfBytesTransfered);
+
+    // Fan-out: completion of one destination's write, dequeued with that destination's completion key
+    void OnFanOutWriteCompletion(int destIndex, DWORD errCode, DWORD numOfBytesTransfered, FanOutWrite* write);
+
     // Handlers for completion of asynchronous I/O operations (called by static callbacks)
     void OnReadCompletion(DWORD errCode, DWORD numOfBytesTransfered, LPOVERLAPPED lpOverlapped);
     void OnWriteCompletion(DWORD errCode, DWORD numOfBytesTransfered, LPOVERLAPPED lpOverlapped);
+    // A failed TRIM falls back to writing the zeros still held in the buffer
+    void OnUnmapCompletion(DWORD errCode, LPOVERLAPPED lpOverlapped);
+
+    // Compression stage of a compressed image (called by CompressionPool threads): compresses the block read
+    // into cntxt, appends it to the image and issues its write
+    void CompressAndWrite(IOContext* cntxt, COMPRESSOR_HANDLE compressor);
+
+    // Hash stage (called by HashPool threads): hashes the block read into cntxt, running alongside its write,
+    // and hands the context back to the I/O threads if the write finished first
+    void HashAndRelease(IOContext* cntxt);
 
     ~IOUtils() {} // Destructor
 };
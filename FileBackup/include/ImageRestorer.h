@@ -0,0 +1,159 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <BlockCopier.h>
+#include <LogUtils.h>
+
+#define RESTORE_HOT_HEAD_BYTES (1024 * 1024)            // Start of the source and of each partition: partition tables, boot code, boot sectors
+#define RESTORE_HOT_MFT_BYTES (64 * 1024 * 1024)        // Start of the $MFT of each NTFS volume found in the source
+#define RESTORE_HOT_ESP_MAX_BYTES (512 * 1024 * 1024)   // EFI system partitions up to this size are restored first as a whole
+#define RESTORE_MAX_PARTITIONS 128                      // GPT entries looked at
+#define RESTORE_ZERO_RUN_MAX_BYTES (1024LL * 1024 * 1024) // Zero ranges skipped or unmapped in one piece
+#define RESTORE_EXTENT_COMPRESSED 0x1                   // The stored bytes are a compressed block
+#define RESTORE_EXTENT_ZERO 0x2                         // Nothing is stored, the range is zero or was not copied
+
+// Backup a restore reads from
+enum class RestoreSourceType {
+    COMPRESSED_IMAGE = 0,   // Image file written with --compress
+    CHUNK_STORE             // Chunk manifest written with --chunkstore, resolved against its store
+};
+
+// One piece of the target and where its bytes are in the backup
+struct RestoreExtent {
+    LONGLONG targetOffset;
+    LONGLONG length;            // Source bytes, at most a block unless the extent is zero
+    ULONGLONG storedOffset;     // In the image file or the chunk data file
+    DWORD storedLength;         // Bytes stored there (compressed size, or length for raw data), reads round it up to the sector size; 0 for a zero extent
+    DWORD flags;
+    bool hot;                   // Overlaps a hot range, restored before every other extent
+};
+
+// What a RestoreContext is waiting for
+enum class RestoreOpType {
+    READ = 0,
+    WRITE,
+    UNMAP
+};
+
+struct RestoreContext {
+    OVERLAPPED overlapped;      // First member, a dequeued OVERLAPPED is the context itself
+    RestoreOpType opType;
+    char* buf;                  // Stored bytes of the extent
+    char* auxBuf;               // Compressed image: the decompressed block, written from there
+    size_t extentIndex;
+    LONGLONG zeroDone;          // Zero extent: bytes of it already handed to a write of zeros
+    TrimRequest trim;           // Unmap only: input of the outstanding TRIM
+};
+
+// Writes a compressed image or a chunk store backup back to a disk or partition. The backup's index is turned into
+// extents of at most a block; a pool of completion port threads, each owning a ring of contexts, read the stored
+// bytes with unbuffered overlapped reads, decompress them on the same thread and write them at their target offset.
+// Zero and uncopied ranges are written, skipped or unmapped as --zeroblocks says. Extents overlapping the hot ranges
+// (partition tables, boot code, EFI system partitions and the start of each NTFS $MFT, plus any given ranges) are
+// restored first, and an event is set once they are, so a VM can be started from the target early.
+class ImageRestorer {
+private:
+    RestoreSourceType m_sourceType;
+    CompressedImage m_image;
+    ChunkStore* m_chunkStore;           // Store a chunk manifest is resolved against, owned by the caller
+    ChunkManifest m_chunkManifest;
+    HANDLE m_hStored;                   // Image file or chunk data file the stored bytes are read from
+    HANDLE m_hTarget;
+    HANDLE m_hIocp;
+    HANDLE m_hFinished;                 // Manual reset event the workers set once every extent is done or an error occurred
+    HANDLE m_hHotRestored;              // Manual reset event set once every hot extent is on the target
+    ZeroBlockPolicy m_zeroBlockPolicy;
+    bool m_trimEnabled;                 // Unmapped ranges of the target read as zeros, zero extents are written otherwise
+    bool m_detectHotRanges;             // Find the hot ranges in the source's partition tables and boot sectors
+    std::vector<DiskExtent> m_hotRanges;
+    LONGLONG m_sourceSize;
+    DWORD m_blockSize;
+    DWORD m_storedSectorSize;           // Alignment of the stored bytes and of reads from m_hStored
+    DWORD m_targetSectorSize;
+    int m_numOfThreads;
+    int m_queueDepth;                   // Contexts in each thread's ring
+
+    std::vector<RestoreExtent> m_extents; // Hot extents first, each group in target offset order
+    size_t m_hotExtents;
+    std::atomic<size_t> m_nextExtent;
+    std::atomic<LONGLONG> m_hotRemaining;
+    std::atomic<int> m_pendingIOs;
+    std::atomic<bool> m_errOccurred;
+    std::atomic<LONGLONG> m_bytesRestored;
+    std::atomic<LONGLONG> m_bytesZero;  // Zero extents written, skipped or unmapped
+    ULONGLONG m_startMs;
+
+    BufferArena m_bufferArena;          // Declared before the contexts so it outlives them
+    std::vector<std::unique_ptr<RestoreContext>> m_cntxts; // m_queueDepth consecutive entries for each thread
+    std::vector<std::thread> m_workerThreads;
+    DiskUtils m_diskUtils;
+
+    // Opens the backup and sets m_sourceSize, m_blockSize, m_storedSectorSize and m_hStored
+    bool OpenSource(LPCWSTR sourcePath);
+
+    // Turns the backup's index into extents in target offset order, merging zero ranges
+    void BuildExtents();
+    void AddExtent(const RestoreExtent& extent, LONGLONG zeroRunLimit);
+
+    // Reads length bytes of the source at offset through the extents (still in target offset order), for the hot range search
+    bool ReadSource(LONGLONG offset, DWORD length, char* out, DECOMPRESSOR_HANDLE decompressor);
+
+    // Adds the hot ranges found in the source's partition tables and boot sectors
+    void FindHotRanges();
+    // The head of a volume or disk and, for an NTFS boot sector, the start of its $MFT. The partitions of a partition
+    // table (GPT or MBR primary) at the head are looked at in turn when partitionTable is set.
+    void AddVolumeHotRanges(LONGLONG volumeOffset, LONGLONG volumeLength, DECOMPRESSOR_HANDLE decompressor, bool partitionTable);
+    void AddHotRange(LONGLONG offset, LONGLONG length);
+    // Marks the extents overlapping a hot range and moves them first
+    void OrderExtents();
+
+    void WorkerThreadLoop(int workerIndex);
+
+    // Claims extents until one needs I/O and issues it on cntxt; zero extents not written are handled in place
+    void IssueNextExtent(RestoreContext* cntxt);
+    bool IssueRead(RestoreContext* cntxt, const RestoreExtent& extent);
+    bool IssueWrite(RestoreContext* cntxt, LONGLONG targetOffset, DWORD length, char* data);
+    // Writes the next block of zeros of the zero extent on cntxt, from cntxt->zeroDone on
+    bool IssueZeroWrite(RestoreContext* cntxt, const RestoreExtent& extent);
+    bool IssueUnmap(RestoreContext* cntxt, const RestoreExtent& extent);
+    void OnReadCompletion(RestoreContext* cntxt, DWORD errCode, DWORD bytesTransferred, DECOMPRESSOR_HANDLE decompressor);
+    void OnWriteCompletion(RestoreContext* cntxt, DWORD errCode);
+    // A failed TRIM falls back to writing the extent's zeros
+    void OnUnmapCompletion(RestoreContext* cntxt, DWORD errCode);
+    void MarkExtentDone(const RestoreExtent& extent);
+    void SignalIfFinished();
+
+public:
+    ImageRestorer() : m_sourceType(RestoreSourceType::COMPRESSED_IMAGE), m_chunkStore(nullptr), m_hStored(INVALID_HANDLE_VALUE), m_hTarget(INVALID_HANDLE_VALUE),
+        m_hIocp(nullptr), m_hFinished(nullptr), m_hHotRestored(nullptr), m_zeroBlockPolicy(ZeroBlockPolicy::WRITE), m_trimEnabled(false), m_detectHotRanges(true),
+        m_sourceSize(0), m_blockSize(0), m_storedSectorSize(0), m_targetSectorSize(0), m_numOfThreads(DEFAULT_MAX_OUTSTANDING_IO), m_queueDepth(DEFAULT_QUEUE_DEPTH),
+        m_hotExtents(0), m_nextExtent(0), m_hotRemaining(0), m_pendingIOs(0), m_errOccurred(false), m_bytesRestored(0), m_bytesZero(0), m_startMs(0) {}
+
+    // Getters
+    HANDLE getHotRestoredEvent();   // Set once the hot ranges are restored, nullptr before Initialize
+    LONGLONG getBytesRestored();
+    const std::vector<DiskExtent>& getHotRanges();
+
+    // Setters (must be called before Initialize)
+    void setZeroBlockPolicy(ZeroBlockPolicy policy);
+    // Resolves sourcePath as a chunk manifest of store, which must be open and outlive the restorer; nullptr for a compressed image
+    void setChunkStore(ChunkStore* store);
+    // Ranges of the source restored first besides the detected ones; detect false restores only these first
+    void setHotRanges(const std::vector<DiskExtent>& hotRanges, bool detect);
+
+    // Opens the backup at sourcePath and the target, which must hold the source, and plans the restore.
+    // Chunk store extents hold up to blockSizeMB, compressed image extents are the image's blocks.
+    bool Initialize(LPCWSTR sourcePath, LPCWSTR targetPath, int nThreads, int blockSizeMB, int queueDepth);
+
+    // Restores every extent, hot ones first, and flushes the target
+    bool Restore();
+
+    ~ImageRestorer();
+
+    ImageRestorer(const ImageRestorer&) = delete;
+    ImageRestorer& operator=(const ImageRestorer&) = delete;
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <mutex>
+#include <LogUtils.h>
+
+#define THROTTLE_BURST_MS 200   // Tokens a bucket holds at most, as time at the configured rate
+#define THROTTLE_MAX_MBPS (1024LL * 1024 * 1024) // Largest read bandwidth limit, in MB/s; its bytes per second still fit a LONGLONG
+#define THROTTLE_MAX_IOPS (1024LL * 1024 * 1024) // Largest read IOPS limit
+
+// Token buckets for read bandwidth and read IOPS. A read is admitted while both buckets hold tokens and
+// charged once its size is known, so a large read may leave a bucket in debt that later reads wait out.
+// Limits may change while copying, 0 leaves a bucket unlimited.
+class IoThrottle {
+private:
+    std::atomic<LONGLONG> m_bytesPerSecond;
+    std::atomic<LONGLONG> m_iopsLimit;
+    std::mutex m_lock;                  // Guards the buckets and m_lastTicks
+    double m_byteTokens;
+    double m_ioTokens;
+    LONGLONG m_lastTicks;
+    LONGLONG m_frequency;
+    std::atomic<LONGLONG> m_delayedReads; // Reads not admitted at once
+
+    // Tokens a bucket of the given rate holds at most. Never below one, or a slow IOPS bucket could not admit a read.
+    static double BucketSize(LONGLONG rate);
+    // Adds the tokens earned since the last refill, m_lock held
+    void Refill(LONGLONG bytesPerSecond, LONGLONG iopsLimit);
+
+public:
+    IoThrottle();
+
+    // Getters
+    LONGLONG getBytesPerSecond() const;
+    LONGLONG getIopsLimit() const;
+    LONGLONG getDelayedReads() const;
+    bool isLimited() const;
+
+    // Setters (may be called while copying). Limits above THROTTLE_MAX_MBPS and THROTTLE_MAX_IOPS are clamped to them.
+    void setLimits(LONGLONG bytesPerSecond, LONGLONG iopsLimit);
+
+    // Whether a read may be issued now
+    bool Admit();
+
+    // Takes a read of the given size from the buckets
+    void Charge(DWORD bytes);
+
+    IoThrottle(const IoThrottle&) = delete;
+    IoThrottle& operator=(const IoThrottle&) = delete;
+
+    ~IoThrottle() {}
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <BlockCopier.h>
+#include <BufferArena.h>
+#include <CompletionPool.h>
+#include <LogUtils.h>
+
+#define DEFAULT_MAX_JOBS 4          // Jobs copying at the same time
+#define DEFAULT_DEVICE_SLOTS 1      // Jobs that may use one disk (as source or destination) at the same time
+
+// One source/destination pair of a job list
+struct CopyJob {
+    std::wstring srcPath;
+    std::wstring destPath;
+    int priority = 0;                   // Higher starts first and gets a larger share of the pool, equal priorities start in list order
+    std::vector<std::wstring> devices;  // Disks the job uses, filled in by Run
+    bool started = false;
+    bool succeeded = false;
+    double seconds = 0.0;
+};
+
+// Runs many copies in one process. Jobs start by priority as long as fewer than the maximum are running
+// and every disk they touch has a free slot, so jobs on one spindle queue up while jobs on independent
+// disks run side by side. All jobs take their buffers from one arena sized for the memory budget, and
+// complete their I/O on one completion pool whose contexts the running jobs share by weight.
+class JobScheduler {
+public:
+    using Configure = std::function<void(BlockCopier&)>; // Applies the copy options to each job's copier
+
+private:
+    std::vector<CopyJob> m_jobs;
+    int m_maxJobs;
+    int m_deviceSlots;
+    BufferArena m_arena;
+    CompletionPool m_pool;
+    int m_poolContexts;                     // Contexts the running jobs keep active together, split by weight
+    std::mutex m_lock;                      // Guards m_deviceUse, m_running, m_copiers and the jobs' results
+    std::map<size_t, BlockCopier*> m_copiers; // Copier of each running job by job index
+    std::condition_variable m_jobDone;
+    std::map<std::wstring, int> m_deviceUse; // Running jobs per disk
+    int m_running;
+
+    // A disk number for disks and their volumes, the volume root for files
+    static std::wstring GetDeviceKey(const std::wstring& path);
+
+    // Whether the job fits the job and disk limits right now, m_lock held
+    bool CanStart(const CopyJob& job) const;
+
+    // Share weight of a job: 1 + its priority, at least 1
+    static int GetWeight(const CopyJob& job);
+
+    // Splits m_poolContexts between the copiers in m_copiers by weight, at least one context each, m_lock held
+    void Rebalance();
+
+public:
+    JobScheduler() : m_maxJobs(DEFAULT_MAX_JOBS), m_deviceSlots(DEFAULT_DEVICE_SLOTS), m_poolContexts(0), m_running(0) {}
+
+    // Getters
+    const std::vector<CopyJob>& getJobs() const;
+
+    // Setters (must be called before Run)
+    void setMaxJobs(int maxJobs);
+    void setDeviceSlots(int deviceSlots);
+
+    // Reads a job list, one "source|destination[|priority]" per line; empty lines and lines starting with # are skipped
+    bool LoadJobs(LPCWSTR jobFilePath);
+    void AddJob(const std::wstring& srcPath, const std::wstring& destPath, int priority);
+
+    // Runs every job to completion with the given copy parameters, splitting the memory budget (0 for the default)
+    // between the jobs that may run at once. nThreads and queueDepth size the completion pool all jobs share.
+    // False if any job failed.
+    bool Run(int nThreads, int blockSizeMB, int queueDepth, LONGLONG memoryBudgetMB, Configure configure);
+
+    JobScheduler(const JobScheduler&) = delete;
+    JobScheduler& operator=(const JobScheduler&) = delete;
+
+    ~JobScheduler() {}
+};
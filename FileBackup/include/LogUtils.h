@@ -4,18 +4,38 @@
 #include <fstream>
 #include <atomic>
 #include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
 #include <cstdarg>
 #include <windows.h>
 
 #define DEFAULT_LOG_FILE_PATH L"file_backup.log"
+#define LOG_RECORD_TEXT_CHARS 384   // Longer messages are truncated
+#define LOG_RING_RECORDS 512        // Records buffered per logging thread
+#define LOG_FLUSH_INTERVAL_MS 20    // How often the writer thread drains the rings
 
-// Convenience macros for logging
-#define LOG_DEBUG(format, ...) LogUtils::GetInstance().Debug(format, __VA_ARGS__)
-#define LOG_INFO(format, ...) LogUtils::GetInstance().Info(format, __VA_ARGS__)
-#define LOG_WARNING(format, ...) LogUtils::GetInstance().Warning(format, __VA_ARGS__)
-#define LOG_ERROR(format, ...) LogUtils::GetInstance().Error(format, __VA_ARGS__)
-#define LOG_CRITICAL(format, ...) LogUtils::GetInstance().Critical(format, __VA_ARGS__)
+// Calls below this level are removed at compile time: 0 DEBUG, 1 INFO, 2 WARNING, 3 ERROR, 4 CRITICAL.
+// Calls at or above it cost one relaxed load when their level is disabled at runtime.
+#ifndef FILEBACKUP_LOG_MIN_LEVEL
+#ifdef _DEBUG
+#define FILEBACKUP_LOG_MIN_LEVEL 0
+#else
+#define FILEBACKUP_LOG_MIN_LEVEL 1
+#endif
+#endif
 
+// Convenience macros for logging, arguments are only evaluated when the level is enabled
+#define LOG_DEBUG(format, ...) ((0 >= FILEBACKUP_LOG_MIN_LEVEL && LogUtils::IsEnabled(LogUtils::LogLevel::DEBUG)) ? LogUtils::GetInstance().Debug(format, __VA_ARGS__) : (void)0)
+#define LOG_INFO(format, ...) ((1 >= FILEBACKUP_LOG_MIN_LEVEL && LogUtils::IsEnabled(LogUtils::LogLevel::INFO)) ? LogUtils::GetInstance().Info(format, __VA_ARGS__) : (void)0)
+#define LOG_WARNING(format, ...) ((2 >= FILEBACKUP_LOG_MIN_LEVEL && LogUtils::IsEnabled(LogUtils::LogLevel::WARNING)) ? LogUtils::GetInstance().Warning(format, __VA_ARGS__) : (void)0)
+#define LOG_ERROR(format, ...) ((3 >= FILEBACKUP_LOG_MIN_LEVEL && LogUtils::IsEnabled(LogUtils::LogLevel::ERROR_LEVEL)) ? LogUtils::GetInstance().Error(format, __VA_ARGS__) : (void)0)
+#define LOG_CRITICAL(format, ...) ((4 >= FILEBACKUP_LOG_MIN_LEVEL && LogUtils::IsEnabled(LogUtils::LogLevel::CRITICAL)) ? LogUtils::GetInstance().Critical(format, __VA_ARGS__) : (void)0)
+
+class LogRing;
+
+// Asynchronous logger. Each logging thread formats into a record of its own lock-free ring,
+// a background writer thread drains all rings and writes the lines in batches.
 class LogUtils {
 public:
     enum class LogLevel {
@@ -29,18 +49,28 @@ public:
 
     static LogUtils& GetInstance();
 
+    static bool IsEnabled(LogLevel level) {
+        return level >= s_currentLogLevel.load(std::memory_order_relaxed);
+    }
+
     void SetLogLevel(LogLevel level);
     void EnableConsoleLogging(bool enable);
     void EnableFileLogging(bool enable, const std::wstring& filePath = DEFAULT_LOG_FILE_PATH, bool append = true);
     void CloseFileLog();
 
+    // Writes out everything logged so far
+    void Flush();
+
     void Debug(const wchar_t* format, ...);
     void Info(const wchar_t* format, ...);
     void Warning(const wchar_t* format, ...);
     void Error(const wchar_t* format, ...);
     void Critical(const wchar_t* format, ...);
 
+    // Asks on the console where to log and at which level, for the command line tool
     void Initialize();
+    // Sets up logging without console input, for a host running copies in-process. filePath nullptr logs to no file.
+    void Initialize(bool console, const wchar_t* filePath, LogLevel level);
     void DeInitialize();
 
 private:
@@ -52,13 +82,24 @@ private:
     LogUtils& operator=(LogUtils&&) = delete;
 
     void Log(LogLevel level, const wchar_t* format, va_list args);
-    std::wstring GetTimestamp();
+    LogRing* GetThreadRing();
+    void WriterThreadLoop();
+    void DrainRings();   // Caller holds m_mutex, which makes it the only consumer of the rings
+    void StopWriter();
+    std::wstring GetTimestamp(ULONGLONG fileTime);
     std::wstring LogLevelToString(LogLevel level);
     std::string WideToUtf8(const std::wstring& wstr);
 
+    static std::atomic<LogLevel> s_currentLogLevel;
+
     std::ofstream m_logFileStream;
-    std::mutex m_mutex;
-    std::atomic<LogLevel> m_currentLogLevel;
+    std::mutex m_mutex;             // Guards the output streams and draining
+    std::mutex m_ringsLock;         // Guards m_rings, only taken when a thread logs for the first time
+    std::vector<std::unique_ptr<LogRing>> m_rings;
+    std::thread m_writerThread;
+    HANDLE m_wakeEvent;             // Set to drain early, e.g. for errors or on shutdown
+    std::atomic<bool> m_stopWriter;
+    std::atomic<ULONGLONG> m_droppedRecords; // DEBUG/INFO records lost because a ring was full
     std::atomic<bool> m_consoleLoggingEnabled;
     std::atomic<bool> m_fileLoggingEnabled;
-};
\ No newline at end of file
+};
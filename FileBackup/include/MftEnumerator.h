@@ -0,0 +1,85 @@
+#pragma once
+#include <windows.h>
+#include <winioctl.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <DiskUtils.h>
+#include <LogUtils.h>
+
+#define MFT_ENUM_BUFFER_BYTES (1024 * 1024)     // Output of one FSCTL_ENUM_USN_DATA call
+#define MFT_READ_BYTES (4 * 1024 * 1024)        // MFT bytes read from the volume at once
+#define MFT_RECORD_NUMBER_MASK 0x0000FFFFFFFFFFFFULL // File reference: record number below, sequence number in the top 16 bits
+#define MFT_ROOT_RECORD 5                       // Record of the volume's root directory
+
+// A run of clusters of a file's data: clusters starting at lcn hold the file from cluster vcn on
+struct DataRun {
+    LONGLONG vcn;
+    LONGLONG lcn;   // -1 for a sparse run
+    LONGLONG clusters;
+};
+
+// One file or directory from the USN enumeration of the MFT
+struct MftName {
+    ULONGLONG fileRef;
+    ULONGLONG parentRef;
+    DWORD attributes;
+    std::wstring name;
+};
+
+// What a file's base record says about its unnamed data stream and its basic information
+struct MftFileData {
+    bool inRecord = false;      // Everything below was read from the record
+    bool readable = false;      // runs hold all size bytes and may be read straight from the volume:
+                                // not compressed, encrypted or sparse, fully initialized, no attribute list or named stream
+    bool resident = false;      // The data is inside the record, in residentData
+    bool namedStreams = false;  // The file has alternate data streams, which only a file system copy takes along
+    LONGLONG size = 0;
+    std::vector<DataRun> runs;
+    std::vector<BYTE> residentData;
+    FILE_BASIC_INFO basicInfo = {}; // Times and attributes from $STANDARD_INFORMATION
+};
+
+// Reads the namespace and file records of an NTFS volume without opening any file. Names and parents come from
+// FSCTL_ENUM_USN_DATA, which walks the MFT in the file system. Sizes, cluster runs and small file contents come
+// from the MFT itself, read from the volume in large sequential chunks, skipping chunks that hold no wanted record.
+class MftEnumerator {
+private:
+    HANDLE m_hVolume;           // Opened by the caller with FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED
+    DWORD m_clusterSize;
+    DWORD m_recordSize;
+    LONGLONG m_recordCount;     // Records in the MFT's valid data
+    std::vector<DataRun> m_mftRuns;
+    DiskUtils m_diskUtils;
+
+    // Undoes the update sequence protection of a record read from disk, false for a torn or foreign record
+    static bool ApplyFixups(BYTE* record, DWORD recordSize);
+    static bool DecodeRuns(const BYTE* mappingPairs, const BYTE* end, std::vector<DataRun>& runs);
+
+    // Fills data from a base record of the file fileRef, false if the record is not in use or belongs to another file
+    bool ParseRecord(BYTE* record, ULONGLONG fileRef, MftFileData& data);
+
+public:
+    using Handler = std::function<void(size_t fileIndex, MftFileData& data)>;
+
+    MftEnumerator() : m_hVolume(INVALID_HANDLE_VALUE), m_clusterSize(0), m_recordSize(0), m_recordCount(0) {}
+
+    // Getters
+    DWORD getClusterSize() const;
+    LONGLONG getRecordCount() const;
+
+    // Reads the volume geometry and the runs of the MFT from its own record 0
+    bool Open(HANDLE hVolume);
+
+    // Every record in use of the volume, files and directories
+    bool EnumerateNames(std::vector<MftName>& names);
+
+    // Reads the base records of fileRefs and calls handler with each one's index in fileRefs, in MFT order.
+    // Files whose record cannot be used are reported with data.inRecord false.
+    bool ReadFileRecords(const std::vector<ULONGLONG>& fileRefs, Handler handler);
+
+    ~MftEnumerator() {}
+
+    MftEnumerator(const MftEnumerator&) = delete;
+    MftEnumerator& operator=(const MftEnumerator&) = delete;
+};
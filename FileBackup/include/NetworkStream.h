@@ -0,0 +1,100 @@
+#pragma once
+// Winsock 2 must be included before windows.h, which otherwise pulls in the old winsock.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <windows.h>
+#include <string>
+#include <LogUtils.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+#define STREAM_PATH_PREFIX L"tcp://"     // Destination paths of this form stream to a FileBackupReceiver
+#define STREAM_MAGIC 0x53544246          // "FBTS", first field of every message of the stream protocol
+#define STREAM_PROTOCOL_VERSION 2        // 2: the receiver challenges every connection and the hello answers it
+#define STREAM_DEFAULT_PORT L"7447"      // Port a FileBackupReceiver listens on unless told otherwise
+#define STREAM_MAX_CONNECTIONS 16
+#define STREAM_MAX_BLOCK_SIZE (1024u * 1024 * 1024) // Largest frame payload a receiver allocates buffers for
+#define STREAM_END_OFFSET (-1LL)         // Offset of the frame that ends a connection's blocks
+#define STREAM_SOCKET_BUFFER_BYTES (4 * 1024 * 1024) // Kernel socket buffers, enough for a 25/100 GbE window per connection
+#define STREAM_NONCE_SIZE 32
+#define STREAM_AUTH_SIZE 32              // HMAC-SHA256
+#define STREAM_HANDSHAKE_TIMEOUT_MS 10000 // A peer that stalls the handshake longer is dropped
+#define STREAM_SECRET_ENV L"FILEBACKUP_STREAM_SECRET" // Shared secret used when none is given on the command line
+
+#pragma pack(push, 1)
+// First message of every connection, receiver to sender
+struct StreamChallenge {
+    DWORD magic;
+    DWORD version;
+    BYTE nonce[STREAM_NONCE_SIZE];  // Random, drawn for every connection so a recorded hello cannot be replayed
+};
+
+// Sender's answer to the challenge
+struct StreamHello {
+    DWORD magic;
+    DWORD version;
+    DWORD blockSize;        // Largest frame payload of the stream
+    DWORD connections;      // Connections the stream is made of, the receiver accepts this many
+    DWORD connectionIndex;
+    DWORD reserved;
+    LONGLONG sourceSize;    // Bytes the target must hold
+    BYTE auth[STREAM_AUTH_SIZE]; // HMAC-SHA256 of the challenge's nonce and the fields above, keyed with the shared secret
+};
+
+// Receiver's answer to a hello
+struct StreamHelloReply {
+    DWORD magic;
+    DWORD status;           // ERROR_SUCCESS, or the Win32 error the stream was refused with
+    DWORD sectorSize;       // Physical sector size of the receiver's target, payloads are padded to it
+    DWORD reserved;
+    LONGLONG capacity;      // Bytes the target holds
+};
+
+// Precedes every block. It carries the block's offset, so the connections may deliver blocks in any order.
+struct StreamFrameHeader {
+    DWORD magic;
+    DWORD length;           // Payload bytes following the header, 0 for the end frame
+    LONGLONG offset;        // Target offset of the payload, STREAM_END_OFFSET for the end frame
+};
+
+// Receiver's last message on every connection, once every connection has ended and the target is flushed
+struct StreamStatus {
+    DWORD magic;
+    DWORD status;           // ERROR_SUCCESS, or the Win32 error the stream failed with
+    LONGLONG bytesWritten;  // Payload bytes written to the target by the whole stream
+};
+#pragma pack(pop)
+
+// Socket helpers shared by the sender (NetworkTarget) and the receiver (BlockReceiver)
+class NetworkStream {
+public:
+    // True for "tcp://host:port"
+    static bool IsNetworkPath(LPCWSTR path);
+    // Splits "tcp://host:port" (or "tcp://[v6 address]:port") into host and port
+    static bool ParseEndpoint(LPCWSTR path, std::wstring& host, std::wstring& port);
+
+    // WSAStartup, every successful call is paired with WSACleanup
+    static bool Startup();
+
+    // Overlapped socket usable with Registered I/O, with Nagle disabled and large socket buffers
+    static SOCKET CreateSocket(int family);
+
+    // Fetches the Registered I/O function table through the socket
+    static bool LoadRioTable(SOCKET socket, RIO_EXTENSION_FUNCTION_TABLE& rio);
+
+    // The value of a --secret option, or STREAM_SECRET_ENV when it is nullptr, as UTF-8; empty if neither is set
+    static std::string LoadSecret(LPCWSTR secretOption);
+    // Fills hello.auth from the challenge's nonce, zeros if there is no secret
+    static bool SignHello(const std::string& secret, const StreamChallenge& challenge, StreamHello& hello);
+    // Compares hello.auth to the expected one in constant time
+    static bool CheckHello(const std::string& secret, const StreamChallenge& challenge, const StreamHello& hello);
+    static bool RandomNonce(StreamChallenge& challenge);
+
+    // Bounds the blocking receives of the handshake, 0 lifts the bound
+    static void SetReceiveTimeout(SOCKET socket, DWORD milliseconds);
+
+    // Blocking transfer of the whole buffer, used for the handshake and the final status only
+    static bool SendAll(SOCKET socket, const void* data, int length);
+    static bool ReceiveAll(SOCKET socket, void* data, int length);
+};
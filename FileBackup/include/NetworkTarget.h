@@ -0,0 +1,76 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <LogUtils.h>
+
+#define DEFAULT_NETWORK_CONNECTIONS 4
+#define NETWORK_DEQUEUE_BATCH 64    // RIO completions dequeued per RIODequeueCompletion call
+#define NETWORK_COMPLETION_KEY (~static_cast<ULONG_PTR>(0) - 1) // Completion key of the RIO completion queue's notifications
+
+struct IOContext;
+struct NetworkConnection;   // Socket and request queue of one connection; winsock types stay in NetworkTarget.cpp
+struct NetworkRio;          // RIO function table, completion queue and registered buffers
+
+// Destination reached over TCP: a FileBackupReceiver on the far side writes the blocks to its own device.
+// Blocks are sent with Registered I/O straight from the IOContext buffers, which are registered once,
+// each preceded by a frame header holding its offset. Contexts are spread over several connections, so
+// frames arrive in any order and the receiver writes each at its offset.
+class NetworkTarget {
+public:
+    // Called for every finished frame with the context it was sent from
+    using SendHandler = std::function<void(IOContext* cntxt, DWORD errCode, DWORD bytesSent)>;
+
+private:
+    std::vector<std::unique_ptr<NetworkConnection>> m_connections;
+    std::unique_ptr<NetworkRio> m_rio;
+    OVERLAPPED m_notifyOverlapped;      // Queued to the completion port when the completion queue holds results
+    std::mutex m_dequeueLock;           // RIODequeueCompletion takes one caller at a time
+    bool m_wsaStarted;
+    DWORD m_sectorSize;                 // Of the receiver's target
+    LONGLONG m_capacity;                // Of the receiver's target
+    std::atomic<LONGLONG> m_bytesSent;  // Payload bytes whose send completed
+
+public:
+    NetworkTarget();
+
+    // Getters
+    bool isConnected() const;
+    int getConnectionCount() const;
+    DWORD getSectorSize() const;
+    LONGLONG getCapacity() const;
+    LONGLONG getBytesSent() const;
+
+    static bool IsNetworkPath(LPCWSTR path);
+    // The value of a --secret option, or the FILEBACKUP_STREAM_SECRET environment variable when it is nullptr
+    static std::string LoadSecret(LPCWSTR secretOption);
+
+    // Opens nConnections connections to the receiver at "tcp://host:port" and exchanges the handshake, which answers
+    // the receiver's challenge with secret (may be empty) and reports the sector size and capacity of its target
+    bool Connect(LPCWSTR path, int nConnections, DWORD blockSize, LONGLONG sourceSize, const std::string& secret);
+
+    // Registers the buffer of every context and creates the request queues. Completions are announced on hIocp
+    // with completionKey (NETWORK_COMPLETION_KEY unless the port is shared), the thread dequeuing one must call DrainCompletions.
+    bool Start(const std::vector<std::unique_ptr<IOContext>>& cntxts, HANDLE hIocp, ULONG_PTR completionKey);
+
+    // Sends length bytes of cntxt's buffer as the frame of its read offset, on the connection the context is bound to
+    bool Send(IOContext* cntxt, DWORD length);
+
+    // Passes every finished frame to handler and re-arms the notification; false if the completion queue failed
+    bool DrainCompletions(const SendHandler& handler);
+
+    // Ends the stream. When complete, waits for the receiver to write and flush every frame and confirm it;
+    // otherwise the connections are dropped and the receiver discards the stream.
+    bool Finish(bool complete);
+
+    void Close();
+
+    ~NetworkTarget();
+
+    NetworkTarget(const NetworkTarget&) = delete;
+    NetworkTarget& operator=(const NetworkTarget&) = delete;
+};
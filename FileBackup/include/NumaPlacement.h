@@ -0,0 +1,31 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <LogUtils.h>
+
+#define NUMA_NODE_AUTO -1   // Use the node of the source (or destination) device when it can be found
+#define NUMA_NODE_NONE -2   // No node: threads are only spread over processor groups, buffers come from anywhere
+
+// Where worker threads run and where their buffers live. With a node, every worker is bound to that node's
+// processors and buffers are allocated from its memory. Without one, workers are spread over all processor
+// groups in proportion to their size, so machines with more than 64 logical processors use all of them.
+class NumaPlacement {
+private:
+    int m_node;                                 // NUMA node in use, NUMA_NODE_NONE for none
+    std::vector<GROUP_AFFINITY> m_affinities;   // Indexed by worker, empty when threads are left unpinned
+
+public:
+    NumaPlacement() : m_node(NUMA_NODE_NONE) {}
+
+    // Getters
+    int getNode() const;                        // NUMA_NODE_NONE unless Configure bound a node
+
+    // Highest NUMA node number of the machine, 0 on single node machines
+    static ULONG GetHighestNode();
+
+    // Prepares the affinity of nThreads workers for node (>= 0) or for no node (NUMA_NODE_NONE)
+    bool Configure(int node, int nThreads);
+
+    // Binds the calling thread to the processors of the given worker; nothing to do without a placement
+    bool ApplyToCurrentThread(int workerIndex) const;
+};
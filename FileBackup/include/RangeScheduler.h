@@ -0,0 +1,49 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <BlockSchedule.h>
+#include <LogUtils.h>
+
+// Hands out the blocks of a BlockSchedule to workers without a shared cursor. Each worker starts with one
+// contiguous range of the linear block indices and claims from its front, so its reads stay sequential.
+// A worker whose range is empty steals the back half of the largest remaining range.
+class RangeScheduler {
+private:
+    // One worker's unclaimed blocks [next, end), only its own contexts touch it between steals
+    struct WorkerRange {
+        std::mutex lock;
+        LONGLONG next = 0;
+        LONGLONG end = 0;
+        std::atomic<LONGLONG> remaining{ 0 }; // end - next, readable without the lock to pick a victim
+        char padding[64];                     // Keeps neighbouring ranges off each other's cache line
+    };
+
+    const BlockSchedule* m_schedule;
+    int m_nWorkers;
+    std::unique_ptr<WorkerRange[]> m_ranges;
+    std::atomic<LONGLONG> m_steals;
+
+    // Moves the back half of the fullest other range into the (empty) range of worker; false once all are empty
+    bool Steal(int worker);
+
+public:
+    RangeScheduler() : m_schedule(nullptr), m_nWorkers(0), m_steals(0) {}
+
+    // Getters
+    int getWorkers() const;
+    LONGLONG getSteals() const;     // Ranges moved between workers since Build
+
+    // Splits every block of schedule into nWorkers equal, contiguous ranges. The schedule must outlive the scheduler.
+    bool Build(const BlockSchedule& schedule, int nWorkers);
+
+    // Claims up to maxBlocks consecutive blocks of one extent for worker, stealing when its range is empty.
+    // False once every block has been claimed.
+    bool Claim(int worker, LONGLONG maxBlocks, LONGLONG& blockIndex, LONGLONG& blockCount);
+
+    RangeScheduler(const RangeScheduler&) = delete;
+    RangeScheduler& operator=(const RangeScheduler&) = delete;
+
+    ~RangeScheduler() {}
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <windows.h>
+#include <map>
+#include <vector>
+#include <iterator>
+#include <mutex>
+#include <functional>
+#include <IOUtils.h>
+#include <LogUtils.h>
+
+// Releases blocks to the write stage strictly in schedule order, for destinations that only handle sequential
+// writes well. Reads still complete in any order; a block read ahead of the next one to write waits here with
+// its IOContext, so the window is bounded by the number of contexts (and with them by the memory budget).
+// Blocks claimed in order from one shared index are required, so the next block is always already in flight.
+class ReorderBuffer {
+public:
+    using Handler = std::function<void(IOContext*)>;
+
+private:
+    // A run of blocks waiting for its turn, keyed by its first block. cntxt holds the data to write,
+    // nullptr for blocks that need no write (unchanged or zero), which only have to pass their turn.
+    struct Entry {
+        LONGLONG blockCount;
+        IOContext* cntxt;
+    };
+
+    std::mutex m_lock;
+    std::map<LONGLONG, Entry> m_waiting;
+    LONGLONG m_nextBlock;       // First block not yet released
+    int m_waitingWrites;        // Entries of m_waiting holding a context
+    int m_maxWaitingWrites;     // High water mark of m_waitingWrites
+    std::vector<IOContext*> m_ready; // Released in order, handler not called yet
+    bool m_releasing;           // A thread is calling the handler for m_ready
+    Handler m_handler;
+
+    // Moves every entry that is next in order to m_ready, with m_lock held so releases are never reordered
+    void Drain();
+
+    // Calls the handler for m_ready outside m_lock. Only one thread does so at a time, so writes are still issued
+    // in release order; a thread that finds another one at it leaves its releases to that thread.
+    void Release(std::unique_lock<std::mutex>& lock);
+
+public:
+    ReorderBuffer() : m_nextBlock(0), m_waitingWrites(0), m_maxWaitingWrites(0), m_releasing(false) {}
+
+    // Getters
+    LONGLONG getNextBlock();
+    int getMaxWaitingWrites();  // Most blocks that waited at once, how far reads ran ahead of the writes
+
+    // Starts at block 0, handler issues the write of a released block
+    void Start(Handler handler);
+
+    // The blocks read into cntxt (cntxt->blockIndex, cntxt->blockCount) are ready to be written
+    void Submit(IOContext* cntxt);
+
+    // The given blocks need no write, later blocks may pass once their turn has come
+    void Skip(LONGLONG blockIndex, LONGLONG blockCount);
+
+    ReorderBuffer(const ReorderBuffer&) = delete;
+    ReorderBuffer& operator=(const ReorderBuffer&) = delete;
+
+    ~ReorderBuffer() {}
+};
@@ -0,0 +1,116 @@
+#include "AutoTuner.h"
+
+//Getters
+AutoTunePhase AutoTuner::getPhase() const
+{
+    return m_phase;
+}
+
+int AutoTuner::getContexts() const
+{
+    return m_contexts;
+}
+
+int AutoTuner::getBlocksPerIo() const
+{
+    return m_blocksPerIo;
+}
+
+void AutoTuner::Start(int minContexts, int maxContexts, int maxBlocksPerIo)
+{
+    m_minContexts = minContexts > 0 ? minContexts : 1;
+    m_maxContexts = maxContexts > m_minContexts ? maxContexts : m_minContexts;
+    m_maxBlocksPerIo = maxBlocksPerIo > 0 ? maxBlocksPerIo : 1;
+    m_contexts = m_minContexts;
+    m_blocksPerIo = 1;
+    m_bestContexts = m_contexts;
+    m_bestBlocksPerIo = m_blocksPerIo;
+    m_bestThroughput = 0;
+    m_bestLatencyUs = 0;
+    m_phase = AutoTunePhase::QUEUE_DEPTH;
+    m_settling = true;
+    m_intervalStart = 0;
+    LOG_INFO(L"AutoTuner::Start: Probing from %d contexts and 1 block per I/O, limits %d contexts and %d blocks per I/O.\n", m_contexts, m_maxContexts, m_maxBlocksPerIo);
+}
+
+bool AutoTuner::TryGrow()
+{
+    if (m_phase == AutoTunePhase::QUEUE_DEPTH) {
+        if (m_contexts < m_maxContexts) {
+            m_contexts = (m_contexts * 2 < m_maxContexts) ? m_contexts * 2 : m_maxContexts;
+            return true;
+        }
+        m_phase = AutoTunePhase::IO_SIZE;
+    }
+    if (m_phase == AutoTunePhase::IO_SIZE) {
+        if (m_blocksPerIo < m_maxBlocksPerIo) {
+            m_blocksPerIo = (m_blocksPerIo * 2 < m_maxBlocksPerIo) ? m_blocksPerIo * 2 : m_maxBlocksPerIo;
+            return true;
+        }
+        m_phase = AutoTunePhase::STEADY;
+    }
+    return false;
+}
+
+bool AutoTuner::Sample(LONGLONG bytesDone, const CopyMetrics& metrics)
+{
+    if (m_phase == AutoTunePhase::STEADY) {
+        return false;
+    }
+
+    LONGLONG now = static_cast<LONGLONG>(GetTickCount64());
+    if (m_intervalStart != 0 && now - m_intervalStart < AUTOTUNE_INTERVAL_MS) {
+        return false;
+    }
+
+    // Completed operations and their summed latency, reads and writes together
+    CopyMetricsSummary summary = metrics.GetSummary();
+    ULONGLONG ops = summary.readLatency.count + summary.writeLatency.count;
+    double latencySumUs = summary.readLatency.mean * summary.readLatency.count + summary.writeLatency.mean * summary.writeLatency.count;
+
+    if (m_intervalStart == 0) {
+        m_intervalStart = now;
+        m_intervalBytes = bytesDone;
+        m_intervalOps = ops;
+        m_intervalLatencySumUs = latencySumUs;
+        return false;
+    }
+    LONGLONG elapsedMs = now - m_intervalStart;
+    double throughput = static_cast<double>(bytesDone - m_intervalBytes) * 1000.0 / elapsedMs;
+    double latencyUs = (ops > m_intervalOps) ? (latencySumUs - m_intervalLatencySumUs) / (ops - m_intervalOps) : 0.0;
+    m_intervalStart = now;
+    m_intervalBytes = bytesDone;
+    m_intervalOps = ops;
+    m_intervalLatencySumUs = latencySumUs;
+
+    // The interval right after a change still runs partly on the old configuration
+    if (m_settling) {
+        m_settling = false;
+        return false;
+    }
+
+    LOG_INFO(L"AutoTuner::Sample: %d contexts, %d blocks per I/O: %.1f MB/s, mean latency %.0f us.\n",
+        m_contexts, m_blocksPerIo, throughput / (1024 * 1024), latencyUs);
+
+    if (throughput >= m_bestThroughput * (1.0 + AUTOTUNE_MIN_GAIN_PCT / 100.0)) {
+        m_bestThroughput = throughput;
+        m_bestLatencyUs = latencyUs;
+        m_bestContexts = m_contexts;
+        m_bestBlocksPerIo = m_blocksPerIo;
+    }
+    else {
+        // No real gain, the extra depth or size only adds latency: go back to the best one and try the next parameter
+        m_contexts = m_bestContexts;
+        m_blocksPerIo = m_bestBlocksPerIo;
+        m_phase = (m_phase == AutoTunePhase::QUEUE_DEPTH) ? AutoTunePhase::IO_SIZE : AutoTunePhase::STEADY;
+    }
+
+    bool changed = TryGrow();
+    if (m_phase == AutoTunePhase::STEADY) {
+        LOG_INFO(L"AutoTuner::Sample: Holding %d contexts and %d blocks per I/O at %.1f MB/s, mean latency %.0f us.\n",
+            m_bestContexts, m_bestBlocksPerIo, m_bestThroughput / (1024 * 1024), m_bestLatencyUs);
+        changed = true; // The best configuration may differ from the one just measured
+    }
+    m_settling = true;
+    return changed;
+}
@@ -1,4 +1,6 @@
 ﻿#include "BlockCopier.h"
+#include "BufferUtils.h"
+#include "CopyTrace.h"
 #include <thread> 
 #include <chrono> 
 
@@ -7,177 +9,1130 @@ DWORD BlockCopier::getDestSectorSize()
     return m_destSectorSize;
 }
 
+DWORD BlockCopier::getSrcSectorSize()
+{
+    return m_srcSectorSize;
+}
+
 HANDLE BlockCopier::getDestHandle()
 {
     return m_hDest;
 }
 
-// Each thread runs this loop
-void BlockCopier::WorkerThreadLoop(IOContext* context, const HANDLE& hSrc, const HANDLE& hDest, const DWORD& blockSize, const LONGLONG& totalFileSize) {
+IOEngineType BlockCopier::getEngineType()
+{
+    return m_engineType;
+}
+
+void BlockCopier::setEngineType(IOEngineType engineType)
+{
+    m_engineType = engineType;
+}
+
+CompressedImage* BlockCopier::getImage()
+{
+    return (m_imageCompression == ImageCompression::NONE) ? nullptr : &m_image;
+}
+
+CompressionPool* BlockCopier::getCompressionPool()
+{
+    return (m_imageCompression == ImageCompression::NONE) ? nullptr : &m_compressionPool;
+}
+
+void BlockCopier::setImageCompression(ImageCompression compression, int nCompressionThreads)
+{
+    m_imageCompression = compression;
+    m_compressionThreads = nCompressionThreads;
+}
+
+CopyMetrics& BlockCopier::getMetrics()
+{
+    return m_metrics;
+}
+
+void BlockCopier::setMetricsPath(LPCWSTR metricsPath)
+{
+    m_metricsPath = (metricsPath != nullptr) ? metricsPath : L"";
+}
+
+HashManifest* BlockCopier::getHashManifest()
+{
+    return m_hashBlocks ? &m_hashManifest : nullptr;
+}
+
+HashPool* BlockCopier::getHashPool()
+{
+    return (m_hashBlocks && m_imageCompression == ImageCompression::NONE) ? &m_hashPool : nullptr;
+}
+
+bool BlockCopier::getVerifyPass()
+{
+    return m_verifyPass;
+}
+
+HANDLE BlockCopier::getCompletionPort()
+{
+    return (m_completionPool != nullptr) ? m_completionPool->getCompletionPort() : m_hIocp;
+}
+
+ULONG_PTR BlockCopier::getCompletionKey(ULONG_PTR key)
+{
+    if (m_routes == nullptr) {
+        return key;
+    }
+    // Fan-out keys index the routes directly, the special keys (~0, ~1, ~2) follow them
+    size_t route = (key <= FANOUT_MAX_DESTINATIONS) ? static_cast<size_t>(key) : FANOUT_MAX_DESTINATIONS + 1 + static_cast<size_t>(~key);
+    return reinterpret_cast<ULONG_PTR>(&m_routes[route]);
+}
+
+NetworkTarget* BlockCopier::getNetworkTarget()
+{
+    return m_networkMode ? &m_networkTarget : nullptr;
+}
+
+void BlockCopier::setNetworkConnections(int nConnections)
+{
+    m_networkConnections = nConnections;
+}
+
+void BlockCopier::setNetworkSecret(const std::string& secret)
+{
+    m_networkSecret = secret;
+}
+
+FileImage* BlockCopier::getFileImage()
+{
+    return m_fileImageMode ? &m_fileImage : nullptr;
+}
+
+FaultHandler* BlockCopier::getFaultHandler()
+{
+    // A verify pass must see the destination as it is, zeroing an unreadable range would hide it
+    return (m_faultHandler.getRetries() > 0 && !m_verifyPass) ? &m_faultHandler : nullptr;
+}
+
+ChunkStore* BlockCopier::getChunkStore()
+{
+    return m_chunkStore;
+}
+
+ChunkManifest* BlockCopier::getChunkManifest()
+{
+    return (m_chunkStore != nullptr) ? &m_chunkManifest : nullptr;
+}
+
+bool BlockCopier::getCancelled()
+{
+    return m_cancelled.load(std::memory_order_acquire);
+}
+
+void BlockCopier::setFileImage(bool fileImage, LPCWSTR baseImagePath)
+{
+    m_fileImageMode = fileImage;
+    m_baseImagePath = (baseImagePath != nullptr) ? baseImagePath : L"";
+}
+
+void BlockCopier::setFaultHandling(int retries, DWORD retryDelayMs, LONGLONG errorBudget, LPCWSTR badSectorPath)
+{
+    m_faultHandler.setRetries(retries);
+    m_faultHandler.setRetryDelay(retryDelayMs);
+    m_faultHandler.setErrorBudget(errorBudget);
+    m_faultHandler.setBadSectorPath(badSectorPath);
+}
+
+void BlockCopier::setChunkStore(ChunkStore* store)
+{
+    m_chunkStore = store;
+}
+
+void BlockCopier::setProgressCallback(CopyProgressCallback callback)
+{
+    m_progressCallback = std::move(callback);
+}
+
+void BlockCopier::setCompletionPool(CompletionPool* pool)
+{
+    m_completionPool = pool;
+}
+
+void BlockCopier::setShare(int contexts)
+{
+    m_share.store(contexts > 0 ? contexts : 0, std::memory_order_relaxed);
+}
+
+void BlockCopier::setBlockHashing(LPCWSTR manifestPath, bool verify, int nHashThreads)
+{
+    m_hashManifestPath = (manifestPath != nullptr) ? manifestPath : L"";
+    m_verify = verify;
+    m_hashBlocks = verify || !m_hashManifestPath.empty();
+    m_hashThreads = nHashThreads;
+}
+
+void BlockCopier::setAutoTune(bool autoTune)
+{
+    m_autoTune = autoTune;
+}
+
+void BlockCopier::setMemoryBudget(LONGLONG budgetMB)
+{
+    m_memoryBudget = (budgetMB > 0) ? budgetMB * 1024 * 1024 : 0;
+}
+
+FanOutTargets* BlockCopier::getFanOutTargets()
+{
+    return (m_fanOutTargets.getCount() > 1) ? &m_fanOutTargets : nullptr;
+}
+
+ReorderBuffer* BlockCopier::getReorderBuffer()
+{
+    return m_orderedWrites ? &m_reorderBuffer : nullptr;
+}
+
+void BlockCopier::setOrderedWrites(bool orderedWrites)
+{
+    m_orderedWrites = orderedWrites;
+}
+
+void BlockCopier::setSharedCursor(bool sharedCursor)
+{
+    m_sharedCursor = sharedCursor;
+}
+
+void BlockCopier::setNumaNode(int numaNode)
+{
+    m_numaNode = numaNode;
+}
+
+void BlockCopier::setIoPriority(PRIORITY_HINT priority)
+{
+    m_ioPriority = priority;
+}
+
+void BlockCopier::setThrottle(LONGLONG megabytesPerSecond, LONGLONG iops)
+{
+    m_throttle.setLimits(megabytesPerSecond * 1024 * 1024, iops);
+}
+
+void BlockCopier::setSharedArena(BufferArena* arena)
+{
+    m_sharedArena = arena;
+}
+
+LONGLONG BlockCopier::GetDefaultMemoryBudget()
+{
+    MEMORYSTATUSEX memoryStatus = {};
+    memoryStatus.dwLength = sizeof(memoryStatus);
+    if (GlobalMemoryStatusEx(&memoryStatus)) {
+        return static_cast<LONGLONG>(memoryStatus.ullTotalPhys / 100 * DEFAULT_MEMORY_BUDGET_PERCENT);
+    }
+    return static_cast<LONGLONG>(FALLBACK_MEMORY_BUDGET_MB) * 1024 * 1024;
+}
+
+bool BlockCopier::FitMemoryBudget(LONGLONG bytesPerContext)
+{
+    LOG_DEBUG(L"Inside BlockCopier::FitMemoryBudget\n");
+    if (m_memoryBudget == 0) {
+        m_memoryBudget = GetDefaultMemoryBudget();
+    }
+
+    LONGLONG maxContexts = m_memoryBudget / bytesPerContext;
+    if (maxContexts < 1) {
+        LOG_ERROR(L"BlockCopier::FitMemoryBudget: One buffer of %lld MB does not fit the memory budget of %lld MB.\n", bytesPerContext / (1024 * 1024), m_memoryBudget / (1024 * 1024));
+        LOG_DEBUG(L"End of BlockCopier::FitMemoryBudget\n");
+        return false;
+    }
+
+    // Give up queue depth first, every worker keeps at least one buffer; only then give up workers
+    if (static_cast<LONGLONG>(m_numOfThreads) * m_queueDepth > maxContexts) {
+        int requestedThreads = m_numOfThreads;
+        int requestedDepth = m_queueDepth;
+        if (maxContexts >= m_numOfThreads) {
+            m_queueDepth = static_cast<int>(maxContexts / m_numOfThreads);
+        }
+        else {
+            m_queueDepth = 1;
+            m_numOfThreads = static_cast<int>(maxContexts);
+        }
+        LOG_WARNING(L"Memory budget of %lld MB holds %lld buffers of %lld MB: using %d threads with queue depth %d instead of %d with %d.\n",
+            m_memoryBudget / (1024 * 1024), maxContexts, bytesPerContext / (1024 * 1024), m_numOfThreads, m_queueDepth, requestedThreads, requestedDepth);
+    }
+    LOG_INFO(L"Memory budget: %lld MB\n", m_memoryBudget / (1024 * 1024));
+    LOG_DEBUG(L"End of BlockCopier::FitMemoryBudget\n");
+    return true;
+}
+
+BlockDigestIndex* BlockCopier::getDigestIndex()
+{
+    return m_digestIndexPath.empty() ? nullptr : &m_digestIndex;
+}
+
+ZeroBlockPolicy BlockCopier::getZeroBlockPolicy()
+{
+    return m_zeroBlockPolicy;
+}
+
+void BlockCopier::setZeroBlockPolicy(ZeroBlockPolicy policy)
+{
+    m_zeroBlockPolicy = policy;
+}
+
+CopyJournal* BlockCopier::getJournal()
+{
+    return m_journalPath.empty() ? nullptr : &m_journal;
+}
+
+void BlockCopier::setJournalPath(LPCWSTR journalPath, bool resume)
+{
+    m_journalPath = (journalPath != nullptr) ? journalPath : L"";
+    m_resume = resume;
+}
+
+void BlockCopier::setUsedBlocksOnly(bool usedBlocksOnly)
+{
+    m_usedBlocksOnly = usedBlocksOnly;
+}
+
+void BlockCopier::setDigestIndexPath(LPCWSTR indexPath)
+{
+    m_digestIndexPath = (indexPath != nullptr) ? indexPath : L"";
+}
+
+// Each thread runs this loop over its own ring of m_queueDepth IOContexts
+void BlockCopier::WorkerThreadLoop(int workerIndex, const HANDLE& hSrc, const HANDLE& hDest) {
     LOG_DEBUG(L"Inside BlockCopier::WorkerThreadLoop\n");
     
-    LOG_INFO(L"BlockCopier::WorkerThreadLoop: Worker Thread started. ThreadId: %d\n", GetCurrentThreadId());
+    LOG_INFO(L"BlockCopier::WorkerThreadLoop: Worker Thread %d started. ThreadId: %d\n", workerIndex, GetCurrentThreadId());
+    m_numaPlacement.ApplyToCurrentThread(workerIndex);
+    // Reissued operations of this ring complete as APCs on this thread too
+    if (getFaultHandler() != nullptr && !m_faultHandler.RegisterWorkerThread(workerIndex)) {
+        ioUtilsObj.setErrorOccuredInfo(true);
+        ioUtilsObj.SignalIfFinished();
+        return;
+    }
 
-    context->curInst = this;
+    // This worker's slice of m_cntxts
+    std::vector<IOContext*> ring(m_queueDepth);
+    for (int i = 0; i < m_queueDepth; ++i) {
+        ring[i] = m_cntxts[static_cast<size_t>(workerIndex) * m_queueDepth + i].get();
+        ring[i]->curInst = this;
+    }
 
-    // Issue initial read for this context
-    if (!ioUtilsObj.IssueRead(hSrc, context, blockSize, totalFileSize)) {
-        LOG_DEBUG(L"BlockCopier::WorkerThreadLoop: Worker Thread %d: Initial IssueRead failed or no more reads. Exiting.\n", GetCurrentThreadId());
+    // Issue initial reads for every context in the ring so several reads are in flight at once.
+    // APCs for all of them are delivered to this thread, so it must stay alive until none are outstanding.
+    int inFlight = 0;
+    for (int i = 0; i < m_queueDepth; ++i) {
+        if (!ioUtilsObj.IssueRead(hSrc, ring[i])) {
+            LOG_DEBUG(L"BlockCopier::WorkerThreadLoop: Worker Thread %d: Initial IssueRead failed or no more reads for context %d.\n", GetCurrentThreadId(), i);
+            break;
+        }
+        ++inFlight;
+    }
+    if (inFlight == 0) {
+        LOG_DEBUG(L"BlockCopier::WorkerThreadLoop: Worker Thread %d: No initial reads issued. Exiting.\n", GetCurrentThreadId());
+        ioUtilsObj.SignalIfFinished();
         return;
     }
 
-
-    // Loop indefinitely until global read completion, error, or no more work
-    while (!ioUtilsObj.getErrorOccuredInfo() &&
-        !(ioUtilsObj.getReadCompleteInfo() && ioUtilsObj.getPendingIOs() == 0))
+    // Loop until every context of this ring is idle, or an error occurs
+    while (inFlight > 0 && !ioUtilsObj.getErrorOccuredInfo())
     {
-        // This thread will wake up when an APC for its context completes
+        // This thread will wake up when an APC for one of its contexts completes
         SleepEx(INFINITE, TRUE);
 
-        // An APC has been processed if the context's operation has completed try to issue the next logical operation
-        if (context->completed.load(std::memory_order_acquire)) {
+        // Several APCs may have been processed in one wake up, so check every context in the ring
+        for (int i = 0; i < m_queueDepth; ++i) {
+            IOContext* context = ring[i];
+            if (!context->completed.load(std::memory_order_acquire)) {
+                continue;
+            }
             context->completed.store(false, std::memory_order_release); // Reset completion flag
+            --inFlight;
 
             if (ioUtilsObj.getErrorOccuredInfo()) {
                 LOG_ERROR(L"BlockCopier::WorkerThreadLoop: Worker Thread %d: Global error detected, terminating loop.\n", GetCurrentThreadId());
                 break; 
             }
 
-            // If a read has just completed or if a write has just completed this context is now free to issue a new READ
+            // A read/write cycle has finished for this context, so its buffer is free to issue a new READ
             if (!ioUtilsObj.getReadCompleteInfo()) {
-                if (!ioUtilsObj.IssueRead(hSrc, context, blockSize, totalFileSize)) {
-
-                    if (ioUtilsObj.getReadCompleteInfo() || ioUtilsObj.getErrorOccuredInfo()) {
-                        LOG_DEBUG(L"BlockCopier::WorkerThreadLoop: Worker Thread %d: No more reads to issue or error during read issuance. Exiting loop.\n", GetCurrentThreadId());
-                        break; 
-                    }
-                    else {
-                        // This case implies an unexpected failure to issue read that didn't set global error/complete flags
-                        LOG_ERROR(L"BlockCopier::WorkerThreadLoop : Worker Thread %d: IssueRead failed unexpectedly. Terminating thread.\n", GetCurrentThreadId());
-                        break;
-                    }
+                if (ioUtilsObj.IssueRead(hSrc, context)) {
+                    ++inFlight;
+                }
+                else if (ioUtilsObj.getReadCompleteInfo() || ioUtilsObj.getErrorOccuredInfo()) {
+                    LOG_DEBUG(L"BlockCopier::WorkerThreadLoop: Worker Thread %d: No more reads to issue or error during read issuance. Context %d is idle.\n", GetCurrentThreadId(), i);
                 }
+                else {
+                    // This case implies an unexpected failure to issue read that didn't set global error/complete flags
+                    LOG_ERROR(L"BlockCopier::WorkerThreadLoop : Worker Thread %d: IssueRead failed unexpectedly. Context %d is idle.\n", GetCurrentThreadId(), i);
+                }
+            }
+            else {
+                LOG_DEBUG(L"BlockCopier::WorkerThreadLoop: Worker Thread %d: All reads issued. Waiting for %d remaining I/Os of this ring.\n", GetCurrentThreadId(), inFlight);
+            }
+        }
+
+        // The completions just handled may have been the copy's last ones
+        ioUtilsObj.SignalIfFinished();
+    }
+    ioUtilsObj.SignalIfFinished();
+
+    // After an error, contexts of this ring may still have I/O in flight whose APCs can only run on this thread.
+    // Stay alertable until none is pending, StartCopy wakes every worker once the count has dropped to zero.
+    while (ioUtilsObj.getPendingIOs() > 0) {
+        SleepEx(INFINITE, TRUE);
+        ioUtilsObj.SignalIfFinished();
+    }
+
+    LOG_INFO(L"BlockCopier::WorkerThreadLoop : Worker Thread %d finished.\n", GetCurrentThreadId());
+    LOG_DEBUG(L"End of BlockCopier::WorkerThreadLoop\n");
+}
+
+
+// Each IOCP pool thread runs this loop. It seeds reads for its share of m_cntxts, then services any
+// completion queued to the port, so a context is not tied to the thread that issued its I/O.
+void BlockCopier::IocpWorkerThreadLoop(int workerIndex, const HANDLE& hSrc, const HANDLE& hDest) {
+    LOG_DEBUG(L"Inside BlockCopier::IocpWorkerThreadLoop\n");
+
+    LOG_INFO(L"BlockCopier::IocpWorkerThreadLoop: Completion Thread %d started. ThreadId: %d\n", workerIndex, GetCurrentThreadId());
+    m_numaPlacement.ApplyToCurrentThread(workerIndex);
+
+    SeedReads(workerIndex, hSrc);
+    ioUtilsObj.SignalIfFinished(); // An empty schedule is done before any completion
+
+    OVERLAPPED_ENTRY entries[IOCP_DEQUEUE_BATCH];
+    bool shutdown = false;
+    while (!shutdown) {
+        ULONG numEntries = 0;
+        if (!GetQueuedCompletionStatusEx(m_hIocp, entries, IOCP_DEQUEUE_BATCH, &numEntries, INFINITE, FALSE)) {
+            LOG_ERROR(L"BlockCopier::IocpWorkerThreadLoop: GetQueuedCompletionStatusEx failed with error: %d. Thread ID: %d\n", GetLastError(), GetCurrentThreadId());
+            ioUtilsObj.setErrorOccuredInfo(true);
+            break;
+        }
+
+        int shutdownPackets = 0;
+        for (ULONG i = 0; i < numEntries; ++i) {
+            // A packet without OVERLAPPED is the shutdown signal posted by StartCopy
+            if (entries[i].lpOverlapped == nullptr) {
+                ++shutdownPackets;
+                continue;
+            }
+            DispatchCompletion(entries[i], entries[i].lpCompletionKey, hSrc, hDest);
+        }
+
+        // The completions of this batch may have been the copy's last ones
+        ioUtilsObj.SignalIfFinished();
+
+        // Each pool thread must consume exactly one shutdown packet, hand back any extra ones taken in this batch
+        if (shutdownPackets > 0) {
+            shutdown = true;
+            for (int i = 1; i < shutdownPackets; ++i) {
+                PostQueuedCompletionStatus(m_hIocp, 0, 0, nullptr);
+            }
+        }
+    }
+
+    LOG_INFO(L"BlockCopier::IocpWorkerThreadLoop : Completion Thread %d finished.\n", GetCurrentThreadId());
+    LOG_DEBUG(L"End of BlockCopier::IocpWorkerThreadLoop\n");
+}
+
+void BlockCopier::SeedReads(int workerIndex, const HANDLE& hSrc) {
+    for (int i = 0; i < m_queueDepth; ++i) {
+        IOContext* context = m_cntxts[static_cast<size_t>(workerIndex) * m_queueDepth + i].get();
+        context->curInst = this;
+        // Auto tuning and a pool share start with few active contexts, the rest wait parked until they are let in
+        ioUtilsObj.AddActiveContext();
+        if (ioUtilsObj.ParkIfOverLimit(context)) {
+            continue;
+        }
+        if (!ioUtilsObj.IssueRead(hSrc, context)) {
+            LOG_DEBUG(L"BlockCopier::SeedReads: Thread %d: Initial IssueRead failed or no more reads for context %d.\n", GetCurrentThreadId(), i);
+            break;
+        }
+    }
+}
+
+void BlockCopier::DispatchCompletion(const OVERLAPPED_ENTRY& entry, ULONG_PTR key, const HANDLE& hSrc, const HANDLE& hDest) {
+    // The hash stage finished a block after its write, the context only needs to be reused
+    if (key == HASH_COMPLETION_KEY) {
+        ReuseContext(reinterpret_cast<IOContext*>(entry.lpOverlapped), hSrc);
+        return;
+    }
+
+    // The fault handler reissued a failed operation, complete it with the outcome it recorded
+    if (key == FAULT_COMPLETION_KEY) {
+        IOContext* faultContext = reinterpret_cast<IOContext*>(entry.lpOverlapped);
+        FaultHandler::Deliver(faultContext);
+        ReuseContext(faultContext, hSrc);
+        return;
+    }
+
+    // The RIO completion queue of the network target holds finished frames
+    if (key == NETWORK_COMPLETION_KEY) {
+        bool drained = m_networkTarget.DrainCompletions([this, &hSrc](IOContext* sentContext, DWORD errCode, DWORD bytesSent) {
+            ioUtilsObj.OnNetworkSendCompletion(sentContext, errCode, bytesSent);
+            ReuseContext(sentContext, hSrc);
+        });
+        if (!drained) {
+            ioUtilsObj.setErrorOccuredInfo(true);
+        }
+        return;
+    }
+
+    // Fan-out writes carry their destination's index + 1 as the key and a FanOutWrite as the OVERLAPPED
+    IOContext* context = nullptr;
+    FanOutWrite* fanOutWrite = nullptr;
+    int destIndex = static_cast<int>(key) - 1;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    if (destIndex >= 0) {
+        fanOutWrite = reinterpret_cast<FanOutWrite*>(entry.lpOverlapped);
+        context = fanOutWrite->cntxt;
+        hFile = m_fanOutTargets.getTarget(destIndex).handle;
+    }
+    else {
+        context = reinterpret_cast<IOContext*>(entry.lpOverlapped);
+        hFile = (context->opType == IOOperationType::READ) ? hSrc : hDest;
+    }
+
+    // The operation has already completed, this only translates its status into a Win32 error code
+    DWORD bytesTransferred = entry.dwNumberOfBytesTransferred;
+    DWORD errCode = ERROR_SUCCESS;
+    if (!GetOverlappedResult(hFile, entry.lpOverlapped, &bytesTransferred, FALSE)) {
+        errCode = GetLastError();
+    }
+
+    if (fanOutWrite != nullptr) {
+        ioUtilsObj.OnFanOutWriteCompletion(destIndex, errCode, bytesTransferred, fanOutWrite);
+    }
+    else if (context->opType == IOOperationType::READ) {
+        ioUtilsObj.OnReadCompletion(errCode, bytesTransferred, entry.lpOverlapped);
+    }
+    else if (context->opType == IOOperationType::UNMAP) {
+        ioUtilsObj.OnUnmapCompletion(errCode, entry.lpOverlapped);
+    }
+    else {
+        ioUtilsObj.OnWriteCompletion(errCode, bytesTransferred, entry.lpOverlapped);
+    }
+
+    // The context finished its read/write cycle, reuse its buffer for the next block
+    ReuseContext(context, hSrc);
+}
+
+void BlockCopier::OnPoolCompletion(const OVERLAPPED_ENTRY& entry, ULONG_PTR key) {
+    // The verify pass reads the destination back, as the threads VerifyDestination starts without a pool do
+    const HANDLE& hRead = m_verifyPass ? m_hDest : m_hSrc;
+    DispatchCompletion(entry, key, hRead, m_hDest);
+    ioUtilsObj.SignalIfFinished();
+}
+
+void BlockCopier::ReuseContext(IOContext* context, const HANDLE& hSrc) {
+    bool contextDone = true;
+    if (!context->completed.compare_exchange_strong(contextDone, false, std::memory_order_acq_rel)) {
+        return;
+    }
+    if (!ioUtilsObj.getReadCompleteInfo() && !ioUtilsObj.getErrorOccuredInfo() && !ioUtilsObj.ParkIfOverLimit(context)) {
+        if (!ioUtilsObj.IssueRead(hSrc, context)) {
+            LOG_DEBUG(L"BlockCopier::ReuseContext: Thread %d: No more reads to issue or error during read issuance.\n", GetCurrentThreadId());
+        }
+    }
+}
+
+
+bool BlockCopier::Initialize(LPCWSTR srcPath, LPCWSTR destPath, int nThreads, int blockSizeMB, int queueDepth) {
+    return Initialize(srcPath, std::vector<std::wstring>{ destPath }, nThreads, blockSizeMB, queueDepth);
+}
+
+bool BlockCopier::Initialize(LPCWSTR srcPath, const std::vector<std::wstring>& destPaths, int nThreads, int blockSizeMB, int queueDepth) {
+    LOG_DEBUG(L"Inside BlockCopier::Initialize\n");
+    if (destPaths.empty() || destPaths.size() > FANOUT_MAX_DESTINATIONS) {
+        LOG_ERROR(L"BlockCopier::Initialize: Between 1 and %d destinations are supported, %zu were given.\n", FANOUT_MAX_DESTINATIONS, destPaths.size());
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
+    LPCWSTR destPath = destPaths[0].c_str();
+    m_mirrorPaths.assign(destPaths.begin() + 1, destPaths.end());
+    m_fanOutTargets.Clear();
+    m_numOfThreads = nThreads;
+    m_queueDepth = queueDepth;
+    m_blockSize = (blockSizeMB > 0 && blockSizeMB <= MAX_BLOCK_SIZE_MB) ? static_cast<DWORD>(blockSizeMB) * 1024 * 1024 : 0;
+
+    LOG_INFO(L"BlockCopier::Initialize: Source Path: %s\n", srcPath);
+    LOG_INFO(L"Destination Path: %s\n", destPath);
+    LOG_INFO(L"Configured Threads: %d\n", m_numOfThreads);
+    LOG_INFO(L"Configured Queue Depth per Thread: %d\n", m_queueDepth);
+    LOG_INFO(L"I/O Engine: %s\n", (m_engineType == IOEngineType::IOCP ? L"IOCP" : L"APC"));
+    LOG_INFO(L"Requested Block Size: %d MB\n", m_blockSize / (1024 * 1024));
+
+    // Validate parameters
+    if (m_numOfThreads <= 0 || m_numOfThreads > 64) {
+        LOG_ERROR(L"Invalid number of threads. Must be between 1 and 64.\n");
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
+    if (m_queueDepth <= 0 || m_queueDepth > MAX_QUEUE_DEPTH) {
+        LOG_ERROR(L"Invalid queue depth. Must be between 1 and %d.\n", MAX_QUEUE_DEPTH);
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
+    if (m_blockSize == 0) {
+        LOG_ERROR(L"Invalid block size %d MB. Must be between 1 and %d.\n", blockSizeMB, MAX_BLOCK_SIZE_MB);
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
+    // The workers set it as the copy ends, so the monitoring thread wakes at once instead of at its next sample
+    if (m_hFinished == nullptr || m_hDrained == nullptr) {
+        LOG_ERROR(L"BlockCopier::Initialize: Failed to create the completion events.\n");
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
+
+    // Compressed image: the compression pool issues the writes from its own threads, which only the IOCP engine supports
+    bool imageMode = (m_imageCompression != ImageCompression::NONE);
+    if (imageMode) {
+        if (!m_digestIndexPath.empty() || !m_journalPath.empty()) {
+            LOG_ERROR(L"BlockCopier::Initialize: Incremental and resumable copies are not supported when writing a compressed image.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        if (m_engineType != IOEngineType::IOCP) {
+            LOG_INFO(L"BlockCopier::Initialize: Compressed image output uses the IOCP engine.\n");
+            m_engineType = IOEngineType::IOCP;
+        }
+        m_zeroBlockPolicy = ZeroBlockPolicy::SKIP; // Zero blocks are stored as empty chunks
+    }
+
+    // Jobs of a shared pool complete on its threads, and the scheduler sets how many contexts each keeps active
+    if (m_completionPool != nullptr) {
+        if (m_autoTune) {
+            LOG_INFO(L"BlockCopier::Initialize: Auto tuning is off, the job scheduler shares the completion pool between the jobs.\n");
+            m_autoTune = false;
+        }
+        if (m_engineType != IOEngineType::IOCP) {
+            LOG_INFO(L"BlockCopier::Initialize: A shared completion pool uses the IOCP engine.\n");
+            m_engineType = IOEngineType::IOCP;
+        }
+    }
+
+    // Auto tuning parks and resumes contexts from the monitor thread, which only the IOCP engine supports
+    if (m_autoTune && m_engineType != IOEngineType::IOCP) {
+        LOG_INFO(L"BlockCopier::Initialize: Auto tuning uses the IOCP engine.\n");
+        m_engineType = IOEngineType::IOCP;
+    }
+
+    // Fan-out: every destination gets the same raw copy. Journal, digest index and image describe a single destination,
+    // and a destination that is dropped midway would make them lie about the others.
+    bool fanOut = !m_mirrorPaths.empty();
+    if (fanOut) {
+        if (imageMode || !m_digestIndexPath.empty() || !m_journalPath.empty() || m_zeroBlockPolicy == ZeroBlockPolicy::UNMAP) {
+            LOG_ERROR(L"BlockCopier::Initialize: Several destinations cannot be combined with --compress, --incremental, --journal or --zeroblocks unmap.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        if (m_engineType != IOEngineType::IOCP) {
+            LOG_INFO(L"BlockCopier::Initialize: Writing to several destinations uses the IOCP engine.\n");
+            m_engineType = IOEngineType::IOCP;
+        }
+    }
+
+    // Ordered writes: blocks are claimed in order from the shared index, so the next block to write is always in flight
+    // and reads can run ahead by every other context. Any pool thread may release a block, which needs the IOCP engine.
+    if (m_orderedWrites) {
+        if (imageMode) {
+            LOG_ERROR(L"BlockCopier::Initialize: Ordered writes are not supported when writing a compressed image.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        if (m_engineType != IOEngineType::IOCP) {
+            LOG_INFO(L"BlockCopier::Initialize: Ordered writes use the IOCP engine.\n");
+            m_engineType = IOEngineType::IOCP;
+        }
+        m_sharedCursor = true;
+    }
+
+    // Throttling delays reads by parking their contexts until the monitor thread finds tokens again, which needs the IOCP engine
+    m_throttleEnabled = m_throttle.isLimited();
+    if (m_throttleEnabled && m_engineType != IOEngineType::IOCP) {
+        LOG_INFO(L"BlockCopier::Initialize: Throttling uses the IOCP engine.\n");
+        m_engineType = IOEngineType::IOCP;
+    }
+
+    // Hashing: the hash stage may finish a block on its own thread and hand the context back through the completion port.
+    // The verify pass reads the raw destination back, which an image or several destinations do not give.
+    if (m_hashBlocks) {
+        if (m_verify && (imageMode || fanOut)) {
+            LOG_ERROR(L"BlockCopier::Initialize: Verifying the destination is not supported with --compress or several destinations.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        if (m_engineType != IOEngineType::IOCP) {
+            LOG_INFO(L"BlockCopier::Initialize: Hashing blocks uses the IOCP engine.\n");
+            m_engineType = IOEngineType::IOCP;
+        }
+    }
+
+    // Network target: the receiver owns the device. Journal checkpoints, TRIM and the verify pass need the device
+    // handle here, frames leave in completion order over several connections, and images and fan-out are local only.
+    m_networkMode = NetworkTarget::IsNetworkPath(destPath);
+    if (m_networkMode) {
+        if (imageMode || fanOut || m_orderedWrites || m_verify || !m_journalPath.empty() || m_zeroBlockPolicy == ZeroBlockPolicy::UNMAP) {
+            LOG_ERROR(L"BlockCopier::Initialize: A tcp:// destination cannot be combined with --compress, --mirror, --ordered, --verify, --journal or --zeroblocks unmap.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        // Send completions are dequeued by the pool threads when the completion queue notifies the port
+        if (m_engineType != IOEngineType::IOCP) {
+            LOG_INFO(L"BlockCopier::Initialize: A network destination uses the IOCP engine.\n");
+            m_engineType = IOEngineType::IOCP;
+        }
+    }
+
+    // File image: a raw copy into a file the copy creates, neither a compressed image nor a remote target. Blocks are
+    // only known to be unchanged, and so worth cloning from the previous image, through the digest index.
+    if (m_fileImageMode) {
+        if (imageMode || m_networkMode) {
+            LOG_ERROR(L"BlockCopier::Initialize: --fileimage cannot be combined with --compress or a tcp:// destination.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        if (!m_baseImagePath.empty() && m_digestIndexPath.empty()) {
+            LOG_ERROR(L"BlockCopier::Initialize: --baseimage needs the digest index of the previous image (--incremental).\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+    }
+
+    // Chunk store: a block is split into chunks that land wherever the store has room, so nothing else can address the
+    // destination by source offset. Zero chunks are recognized by the store itself.
+    bool chunkStoreMode = (m_chunkStore != nullptr);
+    if (chunkStoreMode) {
+        if (!m_chunkStore->isOpen() || imageMode || fanOut || m_networkMode || m_fileImageMode || m_orderedWrites || m_hashBlocks ||
+            !m_digestIndexPath.empty() || !m_journalPath.empty()) {
+            LOG_ERROR(L"BlockCopier::Initialize: A chunk store cannot be combined with --compress, --mirror, --fileimage, --ordered, --manifest, --verify, --incremental, --journal or a tcp:// destination.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        if (m_zeroBlockPolicy != ZeroBlockPolicy::WRITE) {
+            LOG_INFO(L"BlockCopier::Initialize: The chunk store keeps zero chunks out of the store, --zeroblocks is ignored.\n");
+            m_zeroBlockPolicy = ZeroBlockPolicy::WRITE;
+        }
+    }
+
+    // Open Source File with FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN
+    m_hSrc = CreateFileW(srcPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_hSrc == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"Failed to open source handle for the path:%s with the error:%d\n", srcPath, GetLastError());
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
+
+    // Open Destination File with FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN,
+    // or create the image file, whose chunks are appended in completion order. A network target is connected
+    // to once the source size is known. A file image is created, unless a resumed copy or an in-place
+    // incremental run continues the existing one.
+    bool fileImageCreated = false;
+    if (m_networkMode) {
+        m_hDest = INVALID_HANDLE_VALUE;
+    }
+    else if (m_fileImageMode) {
+        DWORD disposition = (m_resume || (!m_digestIndexPath.empty() && m_baseImagePath.empty())) ? OPEN_ALWAYS : CREATE_ALWAYS;
+        m_hDest = CreateFileW(destPath, GENERIC_READ | GENERIC_WRITE, 0, nullptr, disposition,
+            FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        fileImageCreated = (disposition == CREATE_ALWAYS || GetLastError() != ERROR_ALREADY_EXISTS);
+    }
+    else if (chunkStoreMode) {
+        // The destination path names the manifest, chunks go to the store's data file through a handle of this copy
+        m_hDest = m_chunkStore->OpenDataHandle();
+        m_chunkManifestPath = destPath;
+    }
+    else if (imageMode) {
+        m_hDest = CreateFileW(destPath, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+            FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, nullptr);
+    }
+    else {
+        m_hDest = CreateFileW(destPath, GENERIC_WRITE | (m_verify ? GENERIC_READ : 0), 0, nullptr, OPEN_EXISTING, // No share mode for exclusive write
+            FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    }
+    if (m_hDest == INVALID_HANDLE_VALUE && !m_networkMode) {
+        LOG_ERROR(L"Failed to open destination handle for the path %s with the error :%d\n", destPath, GetLastError());
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
+
+    // Get total folder/volume size from source
+    m_srcFileSize = diskUtilsObj.GetDiskOrDriveSize(m_hSrc, srcPath, TRUE);
+    if (m_srcFileSize == 0) {
+        LOG_ERROR(L"BlockCopier::Initialize: Failed to determine source file size.\n");
+        return false;
+    }
+
+    // The receiver refuses a stream its target cannot hold, and reports the target's capacity and sector size
+    if (m_networkMode) {
+        if (!m_networkTarget.Connect(destPath, m_networkConnections, m_blockSize, m_srcFileSize, m_networkSecret)) {
+            LOG_ERROR(L"BlockCopier::Initialize: Failed to connect to the receiver at %s.\n", destPath);
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        m_destCapacity = m_networkTarget.getCapacity();
+    }
+    // An image file grows as chunks are appended, there is no capacity to check up front.
+    // A chunk store run allocates room for every chunk it may add when it begins.
+    else if (imageMode || chunkStoreMode) {
+        m_destCapacity = 0;
+    }
+    // A file image is allocated whole before the first write, which also checks that its volume has room for it
+    else if (m_fileImageMode) {
+        DWORD imageSectorSize = diskUtilsObj.GetFileSectorSize(m_hDest);
+        LONGLONG imageSize = (imageSectorSize != 0) ? ((m_srcFileSize + imageSectorSize - 1) / imageSectorSize) * imageSectorSize : m_srcFileSize;
+        if (!m_baseImagePath.empty() && !m_fileImage.OpenBase(m_baseImagePath.c_str(), m_hDest, imageSize)) {
+            LOG_WARNING(L"BlockCopier::Initialize: Unchanged blocks cannot be cloned from %s, they will be written.\n", m_baseImagePath.c_str());
+        }
+        // The valid data length may only move past ranges that will be written: every block of a new image is written or cloned
+        bool setValidData = fileImageCreated && !m_usedBlocksOnly && m_zeroBlockPolicy == ZeroBlockPolicy::WRITE;
+        if (!m_fileImage.Prepare(m_hDest, imageSize, !fileImageCreated && m_baseImagePath.empty(), setValidData)) {
+            LOG_ERROR(L"BlockCopier::Initialize: Failed to allocate the image file %s.\n", destPath);
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        m_destCapacity = imageSize;
+    }
+    else {
+        // Get total folder/volume size from destination
+        m_destCapacity = diskUtilsObj.GetDiskOrDriveSize(m_hDest, destPath, FALSE);
+        if (m_destCapacity == 0) {
+            LOG_ERROR(L"BlockCopier::Initialize: Failed to determine destination capacity.\n");
+            return false;
+        }
+
+        // Destination Size Check
+        if (m_destCapacity < m_srcFileSize) {
+            LOG_ERROR(L"BlockCopier::Initialize: Destination size (%lld MB) is smaller than source size (%lld MB). \n", m_destCapacity / (1024 * 1024), m_srcFileSize / (1024 * 1024));
+            LOG_ERROR(L"BlockCopier::Initialize: Copy operation aborted to prevent data truncation.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+    }
+
+    // Physical sector size for the destination disk
+    DeviceAlignment destAlignment;
+    if (m_networkMode) {
+        m_destSectorSize = m_networkTarget.getSectorSize();
+    }
+    else {
+        m_destSectorSize = (imageMode || m_fileImageMode) ? diskUtilsObj.GetFileSectorSize(m_hDest) : diskUtilsObj.GetVolumeSectorSize(m_hDest, destPath, false, &destAlignment);
+    }
+    if (chunkStoreMode) {
+        m_destSectorSize = m_chunkStore->getSectorSize();
+    }
+    // 4096 is a multiple of every common sector size, so it keeps unbuffered I/O valid on unknown devices
+    if (m_destSectorSize == 0) {
+        LOG_WARNING(L"BlockCopier::Initialize: Failed to determine destination sector size, aligning to 4096 bytes.\n");
+        m_destSectorSize = 4096;
+    }
+
+    // Reads are unbuffered too, so blocks and buffers have to suit the source's sectors as well
+    DeviceAlignment srcAlignment;
+    m_srcSectorSize = diskUtilsObj.GetVolumeSectorSize(m_hSrc, srcPath, true, &srcAlignment);
+    if (m_srcSectorSize == 0) {
+        LOG_WARNING(L"BlockCopier::Initialize: Failed to determine source sector size, aligning to 4096 bytes.\n");
+        m_srcSectorSize = 4096;
+    }
+
+    // Fan-out: open and check the other destinations like the first one. Buffers are padded and aligned
+    // for the largest sector size among them.
+    if (fanOut) {
+        m_fanOutTargets.Add(destPath, m_hDest, false);
+        for (const std::wstring& mirrorPath : m_mirrorPaths) {
+            HANDLE hMirror = CreateFileW(mirrorPath.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+                FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (hMirror == INVALID_HANDLE_VALUE) {
+                LOG_ERROR(L"Failed to open destination handle for the path %s with the error :%d\n", mirrorPath.c_str(), GetLastError());
+                LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+                return false;
             }
-            else {
-                LOG_DEBUG(L"BlockCopier::WorkerThreadLoop: Worker Thread %d: All reads issued. Waiting for remaining pending I/Os for this context.\n", GetCurrentThreadId());
+            m_fanOutTargets.Add(mirrorPath.c_str(), hMirror, true);
+
+            LONGLONG mirrorCapacity = diskUtilsObj.GetDiskOrDriveSize(hMirror, mirrorPath.c_str(), FALSE);
+            if (mirrorCapacity < m_srcFileSize) {
+                LOG_ERROR(L"BlockCopier::Initialize: Destination %s (%lld MB) is smaller than source size (%lld MB).\n", mirrorPath.c_str(), mirrorCapacity / (1024 * 1024), m_srcFileSize / (1024 * 1024));
+                LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+                return false;
+            }
+            DWORD mirrorSectorSize = diskUtilsObj.GetVolumeSectorSize(hMirror, mirrorPath.c_str(), false);
+            if (mirrorSectorSize == 0) {
+                LOG_ERROR(L"BlockCopier::Initialize: Failed to determine the sector size of destination %s.\n", mirrorPath.c_str());
+                LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+                return false;
             }
+            m_destSectorSize = (mirrorSectorSize > m_destSectorSize) ? mirrorSectorSize : m_destSectorSize;
+            m_destCapacity = (mirrorCapacity < m_destCapacity) ? mirrorCapacity : m_destCapacity;
         }
+        LOG_INFO(L"Fan-out: writing every block to %d destinations\n", m_fanOutTargets.getCount());
     }
 
-    LOG_INFO(L"BlockCopier::WorkerThreadLoop : Worker Thread %d finished.\n", GetCurrentThreadId());
-    LOG_DEBUG(L"End of BlockCopier::WorkerThreadLoop\n");
-}
+    // Every block must be whole physical sectors of both sides. Sector sizes are powers of two, so the larger one suits both.
+    DWORD sectorUnit = (m_srcSectorSize > m_destSectorSize) ? m_srcSectorSize : m_destSectorSize;
+    m_bufferAlignment = sectorUnit;
+    m_bufferAlignment = (srcAlignment.bufferAlignment > m_bufferAlignment) ? srcAlignment.bufferAlignment : m_bufferAlignment;
+    m_bufferAlignment = (destAlignment.bufferAlignment > m_bufferAlignment) ? destAlignment.bufferAlignment : m_bufferAlignment;
+    DWORD alignedBlockSize = ((m_blockSize + sectorUnit - 1) / sectorUnit) * sectorUnit;
 
+    // A block larger than the adapter takes in one request is split by the storage stack, make the pieces equal
+    // and sector aligned as well
+    DWORD maxTransfer = srcAlignment.maxTransferLength;
+    if (destAlignment.maxTransferLength != 0 && (maxTransfer == 0 || destAlignment.maxTransferLength < maxTransfer)) {
+        maxTransfer = destAlignment.maxTransferLength;
+    }
+    if (maxTransfer != 0 && maxTransfer % sectorUnit == 0 && alignedBlockSize > maxTransfer && alignedBlockSize % maxTransfer != 0) {
+        alignedBlockSize = ((alignedBlockSize + maxTransfer - 1) / maxTransfer) * maxTransfer;
+    }
 
-bool BlockCopier::Initialize(LPCWSTR srcPath, LPCWSTR destPath, int nThreads, int blockSizeMB) {
-    LOG_DEBUG(L"Inside BlockCopier::Initialize\n");
-    m_numOfThreads = nThreads;
-    m_blockSize = static_cast<DWORD>(blockSizeMB) * 1024 * 1024;
+    // The receiver was told the block size, and shared arena slices are sized for it, so only a standalone local copy adjusts it
+    if (alignedBlockSize != m_blockSize) {
+        if (m_networkMode || m_sharedArena != nullptr) {
+            if (m_blockSize % sectorUnit != 0) {
+                LOG_ERROR(L"BlockCopier::Initialize: Configured block size (%d bytes) is not a multiple of the physical sector size (%d bytes).\n", m_blockSize, sectorUnit);
+                std::wcerr << L"Please choose a block size that is a multiple of " << sectorUnit << L".\n";
+                LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+                return false;
+            }
+        }
+        else {
+            LOG_INFO(L"BlockCopier::Initialize: Block size adjusted from %u KB to %u KB to stay aligned to %u byte sectors and %u KB transfers.\n",
+                m_blockSize / 1024, alignedBlockSize / 1024, sectorUnit, maxTransfer / 1024);
+            m_blockSize = alignedBlockSize;
+        }
+    }
+    LOG_INFO(L"Source physical sector size: %d bytes\n", m_srcSectorSize);
 
-    LOG_INFO(L"BlockCopier::Initialize: Source Path: %s\n", srcPath);
-    LOG_INFO(L"Destination Path: %s\n", destPath);
-    LOG_INFO(L"Configured Threads: %d\n", m_numOfThreads);
-    LOG_INFO(L"Requested Block Size: %d MB\n", m_blockSize / (1024 * 1024));
+    // Chunks are looked up per read, so every read must hold whole chunks and no more than StoreChunks takes at once
+    if (chunkStoreMode) {
+        DWORD chunkSize = m_chunkStore->getChunkSize();
+        DWORD largestRead = m_blockSize * (m_autoTune ? AUTOTUNE_MAX_BLOCKS_PER_IO : 1);
+        if (m_blockSize % chunkSize != 0 || largestRead / chunkSize > CHUNK_MAX_PER_CALL) {
+            LOG_ERROR(L"BlockCopier::Initialize: Block size (%u KB) must be a multiple of the %u KB chunks of the store, with at most %d chunks per I/O.\n",
+                m_blockSize / 1024, chunkSize / 1024, CHUNK_MAX_PER_CALL);
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+    }
 
-    // Validate parameters
-    if (m_numOfThreads <= 0 || m_numOfThreads > 64) {
-        LOG_ERROR(L"Invalid number of threads. Must be between 1 and 64.\n");
+    // Size the rings to the memory budget once the block size is final (aligning may have grown it), and before
+    // anything depends on the thread count
+    if (!FitMemoryBudget(static_cast<LONGLONG>(m_blockSize) * (imageMode ? 2 : 1))) {
         LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
         return false;
     }
-    if (m_blockSize <= 0) {
-        LOG_ERROR(L"Invalid block size. Must be a positive integer.\n");
-        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
-        return false;
+
+    // Decide which source ranges to copy: the whole source, or only blocks holding in-use clusters
+    std::vector<DiskExtent> extents;
+    if (m_usedBlocksOnly && !diskUtilsObj.GetUsedBlockExtents(m_hSrc, m_srcFileSize, m_blockSize, extents)) {
+        LOG_WARNING(L"BlockCopier::Initialize: Volume bitmap is not available for the source, copying every block.\n");
+        extents.clear();
+    }
+    if (extents.empty()) {
+        extents.push_back({ 0, m_srcFileSize });
     }
 
-    // Open Source File with FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN
-    m_hSrc = CreateFileW(srcPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
-        FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
-    if (m_hSrc == INVALID_HANDLE_VALUE) {
-        LOG_ERROR(L"Failed to open source handle for the path:%s with the error:%d\n", srcPath, GetLastError());
+    // Resumable copy: record finished blocks, and when resuming leave out the ones a previous run already finished
+    if (!m_journalPath.empty()) {
+        if (!m_journal.Open(m_journalPath.c_str(), m_blockSize, m_srcFileSize, destPath, m_resume)) {
+            LOG_ERROR(L"BlockCopier::Initialize: Failed to open the copy journal %s.\n", m_journalPath.c_str());
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        if (m_journal.getResumedBlocks() > 0) {
+            m_journal.RemoveCompleted(extents);
+            LOG_INFO(L"Resuming copy: %lld blocks (%lld MB) already on the destination.\n", m_journal.getResumedBlocks(),
+                (m_journal.getResumedBlocks() * m_blockSize) / (1024 * 1024));
+        }
+    }
+    if (!m_schedule.Build(extents, m_blockSize)) {
+        LOG_ERROR(L"BlockCopier::Initialize: Failed to build the block schedule.\n");
         LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
         return false;
     }
+    m_bytesToCopy = m_schedule.getTotalBytes();
+    ioUtilsObj.setSchedule(&m_schedule);
 
-    // Open Destination File with FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN
-    m_hDest = CreateFileW(destPath, GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, // No share mode for exclusive write
-        FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
-    if (m_hDest == INVALID_HANDLE_VALUE) {
-        LOG_ERROR(L"Failed to open destination handle for the path %s with the error :%d\n", destPath, GetLastError());
-        CloseHandle(m_hSrc); // Ensure source handle is closed
-        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
-        return false;
+    if (m_hashBlocks) {
+        if (!m_hashManifest.Create(m_hashManifestPath.empty() ? nullptr : m_hashManifestPath.c_str(), m_blockSize, m_srcFileSize)) {
+            LOG_ERROR(L"BlockCopier::Initialize: Failed to prepare the block hash manifest.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        LOG_INFO(L"Block hashing: xxHash64%s%s\n", (m_hashManifestPath.empty() ? L"" : L", manifest "), m_hashManifestPath.c_str());
     }
 
-    // Get total folder/volume size from source
-    m_srcFileSize = diskUtilsObj.GetDiskOrDriveSize(m_hSrc, srcPath, TRUE);
-    if (m_srcFileSize == 0) {
-        LOG_ERROR(L"BlockCopier::Initialize: Failed to determine source file size.\n");
-        CloseHandle(m_hSrc);
-        CloseHandle(m_hDest);
+    // Incremental mode: load the digests of the previous run to skip writing unchanged blocks
+    if (!m_digestIndexPath.empty() && !m_digestIndex.Load(m_digestIndexPath.c_str(), m_blockSize, m_srcFileSize, destPath,
+        (m_baseImagePath.empty() ? nullptr : m_baseImagePath.c_str()))) {
+        LOG_ERROR(L"BlockCopier::Initialize: Failed to load the digest index %s.\n", m_digestIndexPath.c_str());
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
         return false;
     }
 
-    // Get total folder/volume size from destination
-    m_destCapacity = diskUtilsObj.GetDiskOrDriveSize(m_hDest, destPath, FALSE);
-    if (m_destCapacity == 0) {
-        LOG_ERROR(L"BlockCopier::Initialize: Failed to determine destination capacity.\n");
-        CloseHandle(m_hSrc);
-        CloseHandle(m_hDest);
-        return false;
+    // Zero blocks can only be unmapped on devices that read unmapped blocks back as zeros, write them otherwise.
+    // The TRIM of a block is issued overlapped from its read completion and completes through the port.
+    if (m_zeroBlockPolicy == ZeroBlockPolicy::UNMAP) {
+        if (!diskUtilsObj.IsTrimZeroing(m_hDest)) {
+            LOG_WARNING(L"BlockCopier::Initialize: Destination does not guarantee that unmapped blocks read as zeros, zero blocks will be written.\n");
+            m_zeroBlockPolicy = ZeroBlockPolicy::WRITE;
+        }
+        else if (m_engineType != IOEngineType::IOCP) {
+            LOG_INFO(L"BlockCopier::Initialize: Unmapping zero blocks uses the IOCP engine.\n");
+            m_engineType = IOEngineType::IOCP;
+        }
+    }
+    if (m_zeroBlockPolicy != ZeroBlockPolicy::WRITE) {
+        LOG_INFO(L"Zero blocks: %s (%s scan)\n", (m_zeroBlockPolicy == ZeroBlockPolicy::SKIP ? L"skip" : L"unmap"), BufferUtils::GetZeroScanImplName());
     }
 
-    // Destination Size Check
-    if (m_destCapacity < m_srcFileSize) {
-        LOG_ERROR(L"BlockCopier::Initialize: Destination size (%lld MB) is smaller than source size (%lld MB). \n", m_destCapacity / (1024 * 1024), m_srcFileSize / (1024 * 1024));
-        LOG_ERROR(L"BlockCopier::Initialize: Copy operation aborted to prevent data truncation.\n");
-        CloseHandle(m_hSrc);
-        CloseHandle(m_hDest);
-        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
-        return false;
+    if (imageMode) {
+        if (!m_image.Create(CompressedImage::GetAlgorithm(m_imageCompression), m_blockSize, m_srcFileSize, m_destSectorSize)) {
+            LOG_ERROR(L"BlockCopier::Initialize: Failed to prepare the compressed image.\n");
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        LOG_INFO(L"Output: compressed image (%s)\n", CompressedImage::GetAlgorithmName(m_image.getAlgorithm()));
     }
 
-    // Physical sector size for the destination disk
-    m_destSectorSize = diskUtilsObj.GetVolumeSectorSize(m_hDest, destPath, false);
-    if (m_destSectorSize == 0) {
-        LOG_ERROR(L"BlockCopier::Initialize: Failed to determine destination sector size. Error: %d\n", GetLastError());
-        std::wcerr << L"Since destination sector size query failed, assuming Sector Size as 4096 bytes. This might lead to issues if the actual sector size is different.\n";
-        std::wcerr << L"To Proceed press 1, to exit press 0\n";
-        int proceed_choice;
-        std::wcin >> proceed_choice;
-        if (proceed_choice == 0) {
-            CloseHandle(m_hSrc);
-            CloseHandle(m_hDest);
+    // The copy is one run of the store, ended by StartCopy or, if the copy never gets that far, by the destructor
+    if (chunkStoreMode) {
+        if (!m_chunkStore->BeginRun(m_srcFileSize, m_chunkManifest)) {
+            LOG_ERROR(L"BlockCopier::Initialize: Failed to begin a run of the chunk store.\n");
             LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
             return false;
         }
-        else {
-            LOG_INFO(L"With user confirmation, considering Sector size as 4096 bytes and proceeding.\n");
-            m_destSectorSize = 4096;
+        m_chunkRunActive = true;
+        LOG_INFO(L"Output: chunk store (%u KB chunks), manifest %s\n", m_chunkStore->getChunkSize() / 1024, m_chunkManifestPath.c_str());
+    }
+
+    // Lower the priority of every request of this copy, so it yields to production I/O on the same devices
+    if (m_ioPriority != IoPriorityHintNormal) {
+        bool prioritySet = diskUtilsObj.SetIoPriorityHint(m_hSrc, m_ioPriority);
+        if (fanOut) {
+            for (int i = 0; i < m_fanOutTargets.getCount(); ++i) {
+                prioritySet = diskUtilsObj.SetIoPriorityHint(m_fanOutTargets.getTarget(i).handle, m_ioPriority) && prioritySet;
+            }
         }
+        else if (!m_networkMode) {
+            prioritySet = diskUtilsObj.SetIoPriorityHint(m_hDest, m_ioPriority) && prioritySet;
+        }
+        LOG_INFO(L"I/O priority: %s%s\n", (m_ioPriority == IoPriorityHintVeryLow ? L"very low" : L"low"), (prioritySet ? L"" : L" (not accepted by every device)"));
     }
+    ioUtilsObj.setThrottle(m_throttleEnabled ? &m_throttle : nullptr);
 
-    // Validate Block Size against Destination Sector Size
-    if (m_blockSize % m_destSectorSize != 0) {
-        LOG_ERROR(L"BlockCopier::Initialize: Configured block size (%d bytes) is not a multiple of destination's physical sector size (%d bytes).\n", m_blockSize, m_destSectorSize);
-        std::wcerr << L"Please choose a block size that is a multiple of " << m_destSectorSize << L".\n";
-        CloseHandle(m_hSrc);
-        CloseHandle(m_hDest);
-        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
-        return false;
+    // Compose the read completion from the stages this copy needs, a plain copy runs none it does not use
+    BlockPipelineConfig pipeline;
+    pipeline.hashBlocks = (getHashPool() != nullptr); // A compressed image hashes in the compression stage
+    pipeline.digestIndex = (getDigestIndex() != nullptr);
+    pipeline.cloneUnchanged = pipeline.digestIndex && m_fileImageMode && !m_fileImage.isInPlace();
+    pipeline.zeroBlocks = m_zeroBlockPolicy;
+    pipeline.sink = chunkStoreMode ? BlockSink::CHUNK_STORE : (imageMode ? BlockSink::COMPRESS : (m_orderedWrites ? BlockSink::REORDER : BlockSink::WRITE));
+    ioUtilsObj.setBlockHandler(BlockStages::Select(pipeline));
+    ioUtilsObj.setBufferRelease(BlockStages::SelectRelease(pipeline));
+    ioUtilsObj.setReadSectorSize(m_srcSectorSize);
+
+    // Bind both handles to one completion port, pool threads then dequeue completions from it.
+    // With a shared pool it is the pool's port, and the keys tell the pool which copy a completion belongs to.
+    ioUtilsObj.setEngineType(m_engineType);
+    if (m_engineType == IOEngineType::IOCP) {
+        if (m_completionPool != nullptr) {
+            if (m_routes == nullptr) {
+                m_routes = m_completionPool->Attach(this);
+            }
+        }
+        else {
+            m_hIocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, m_numOfThreads);
+        }
+        HANDLE hPort = getCompletionPort();
+        if (hPort == nullptr || CreateIoCompletionPort(m_hSrc, hPort, getCompletionKey(0), 0) == nullptr ||
+            (!fanOut && !m_networkMode && CreateIoCompletionPort(m_hDest, hPort, getCompletionKey(0), 0) == nullptr)) {
+            LOG_ERROR(L"BlockCopier::Initialize: Failed to bind handles to an I/O completion port. Error: %d\n", GetLastError());
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        // Fan-out destinations are told apart by their key, destination i completes with key i + 1
+        for (int i = 0; fanOut && i < m_fanOutTargets.getCount(); ++i) {
+            if (CreateIoCompletionPort(m_fanOutTargets.getTarget(i).handle, hPort, getCompletionKey(static_cast<ULONG_PTR>(i) + 1), 0) == nullptr) {
+                LOG_ERROR(L"BlockCopier::Initialize: Failed to bind destination %s to the I/O completion port. Error: %d\n", m_fanOutTargets.getTarget(i).path.c_str(), GetLastError());
+                LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+                return false;
+            }
+        }
     }
 
     LOG_INFO(L"Source size: %lld MB\n", m_srcFileSize / (1024 * 1024));
+    LOG_INFO(L"Bytes to copy: %lld MB\n", m_bytesToCopy / (1024 * 1024));
     LOG_INFO(L"Destination size: %lld MB\n", m_destCapacity / (1024 * 1024)); // Display destination capacity
     LOG_INFO(L"Destination physical sector size: %d bytes\n", m_destSectorSize);
     LOG_INFO(L"Actual Block Size used: %d MB\n", m_blockSize / (1024 * 1024));
 
-    // Prepare IOContexts (one for each thread)
-    m_cntxts.clear(); // Clear any previous contexts
-    m_cntxts.reserve(m_numOfThreads); //allocate memory for performance
-    for (int i = 0; i < m_numOfThreads; ++i) {
-        std::unique_ptr<IOContext> newCntxt = std::make_unique<IOContext>(m_blockSize);
+    // Prepare IOContexts (a ring of m_queueDepth for each thread)
+    int totalCntxts = m_numOfThreads * m_queueDepth;
+
+    // Auto tuning may read several blocks at once. The digest index and the image keep one entry per block,
+    // so their reads stay one block long, as do frames, which the receiver sizes its buffers for.
+    // The block size itself stays the unit of the schedule and journal.
+    m_maxBlocksPerIo = 1;
+    if (m_autoTune && getDigestIndex() == nullptr && !imageMode && !m_networkMode) {
+        LONGLONG budget = static_cast<LONGLONG>(AUTOTUNE_BUFFER_BUDGET_MB) * 1024 * 1024;
+        budget = (budget < m_memoryBudget) ? budget : m_memoryBudget;
+        LONGLONG budgetBlocks = budget / (static_cast<LONGLONG>(totalCntxts) * m_blockSize);
+        m_maxBlocksPerIo = static_cast<int>(budgetBlocks < AUTOTUNE_MAX_BLOCKS_PER_IO ? budgetBlocks : AUTOTUNE_MAX_BLOCKS_PER_IO);
+        if (m_sharedArena != nullptr) { // Shared slices are sized for the jobs' block size
+            LONGLONG sliceBlocks = static_cast<LONGLONG>(m_sharedArena->getSliceSize() / m_blockSize);
+            m_maxBlocksPerIo = static_cast<int>(sliceBlocks < m_maxBlocksPerIo ? sliceBlocks : m_maxBlocksPerIo);
+        }
+        if (m_maxBlocksPerIo < 1) {
+            m_maxBlocksPerIo = 1;
+        }
+        LOG_INFO(L"Auto tuning: up to %d contexts and %d blocks per I/O\n", totalCntxts, m_maxBlocksPerIo);
+    }
+    DWORD bufferSize = m_blockSize * static_cast<DWORD>(m_maxBlocksPerIo);
+    LOG_INFO(L"Total IOContexts: %d, Buffer memory: %lld MB\n", totalCntxts, (static_cast<LONGLONG>(totalCntxts) * bufferSize * (imageMode ? 2 : 1)) / (1024 * 1024));
+    m_cntxts.clear(); // Clear any previous contexts, handing their slices back before the arena is rebuilt
+
+    // Keep workers and their buffers on the node the devices are attached to, so completions and DMA stay local.
+    // The source is preferred since every block is read, the destination gets less traffic with skipped blocks.
+    int numaNode = m_numaNode;
+    if (numaNode == NUMA_NODE_AUTO) {
+        numaNode = NUMA_NODE_NONE;
+        if (NumaPlacement::GetHighestNode() > 0) {
+            int deviceNode = diskUtilsObj.GetDeviceNumaNode(m_hSrc);
+            if (deviceNode < 0 && !m_networkMode) {
+                deviceNode = diskUtilsObj.GetDeviceNumaNode(m_hDest);
+            }
+            numaNode = (deviceNode >= 0) ? deviceNode : NUMA_NODE_NONE;
+        }
+    }
+    if (!m_numaPlacement.Configure(numaNode, m_numOfThreads)) {
+        LOG_ERROR(L"BlockCopier::Initialize: Failed to place workers on NUMA node %d.\n", numaNode);
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
+    LOG_INFO(L"NUMA node: %d\n", m_numaPlacement.getNode());
+
+    // One locked (or large page) allocation for all buffers, so the kernel does not probe and lock pages per transfer.
+    // Jobs of a JobScheduler take their slices from its arena instead.
+    BufferArena* arena = &m_bufferArena;
+    if (m_sharedArena != nullptr) {
+        if (m_sharedArena->getSliceSize() < bufferSize || m_sharedArena->getFreeSlices() < static_cast<DWORD>(totalCntxts) * (imageMode ? 2 : 1)) {
+            LOG_ERROR(L"BlockCopier::Initialize: Shared buffer arena has %u free slices of %zu KB, %d of %u KB are needed.\n", m_sharedArena->getFreeSlices(),
+                m_sharedArena->getSliceSize() / 1024, totalCntxts * (imageMode ? 2 : 1), bufferSize / 1024);
+            LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+            return false;
+        }
+        arena = m_sharedArena;
+    }
+    else if (!m_bufferArena.Create(bufferSize, static_cast<DWORD>(totalCntxts) * (imageMode ? 2 : 1), m_numaPlacement.getNode())) {
+        LOG_ERROR(L"BlockCopier::Initialize: Failed to allocate the buffer arena.\n");
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
+    m_cntxts.reserve(totalCntxts); //allocate memory for performance
+    for (int i = 0; i < totalCntxts; ++i) {
+        std::unique_ptr<IOContext> newCntxt = std::make_unique<IOContext>(*arena, imageMode);
         if (!newCntxt->buf) { // Check if buffer allocation failed
             LOG_ERROR(L"BlockCopier::Initialize: Failed to allocate buffer for IOContext's Buffer %d\n", i);
             LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
@@ -185,23 +1140,33 @@ bool BlockCopier::Initialize(LPCWSTR srcPath, LPCWSTR destPath, int nThreads, in
         }
         // Set this pointer in IOContext call callbacks
         newCntxt->curInst = this;
+        newCntxt->workerIndex = i / m_queueDepth;
+        newCntxt->index = i;
+        if (fanOut) {
+            newCntxt->fanOutWrites.reset(new FanOutWrite[m_fanOutTargets.getCount()]);
+        }
 
         // Check buffer alignment
-        if (reinterpret_cast<uintptr_t>(newCntxt->buf) % m_destSectorSize != 0) {
-            LOG_ERROR(L"BlockCopier::Initialize: Allocated buffer address (%p) for context %d is not aligned to destination sector size (%d)!\n", newCntxt->buf, i, m_destSectorSize);
-            CloseHandle(m_hSrc);
-            CloseHandle(m_hDest);
+        if (reinterpret_cast<uintptr_t>(newCntxt->buf) % m_bufferAlignment != 0) {
+            LOG_ERROR(L"BlockCopier::Initialize: Allocated buffer address (%p) for context %d is not aligned to %d bytes (sector size and adapter alignment)!\n", newCntxt->buf, i, m_bufferAlignment);
             return false;
         }
         m_cntxts.push_back(std::move(newCntxt)); // Move the ownership from unique_ptr into the vector
     }
+
+    // Frames are sent straight from the context buffers, register them with RIO once
+    if (m_networkMode && !m_networkTarget.Start(m_cntxts, getCompletionPort(), getCompletionKey(NETWORK_COMPLETION_KEY))) {
+        LOG_ERROR(L"BlockCopier::Initialize: Failed to prepare the connections to the receiver.\n");
+        LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
+        return false;
+    }
     LOG_DEBUG(L"End of BlockCopier::Initialize:\n");
     return true;
 }
 
 bool BlockCopier::StartCopy() {
     LOG_DEBUG(L"Inside BlockCopier::StartCopy\n");
-    if (m_hSrc == INVALID_HANDLE_VALUE || m_hDest == INVALID_HANDLE_VALUE || m_cntxts.empty()) {
+    if (m_hSrc == INVALID_HANDLE_VALUE || (m_hDest == INVALID_HANDLE_VALUE && !m_networkMode) || m_cntxts.empty()) {
         LOG_ERROR(L"BlockCopier::StartCopy: BlockCopier not initialized correctly before calling StartCopy.\n");
         LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
         return false;
@@ -212,18 +1177,99 @@ bool BlockCopier::StartCopy() {
     // Reset global IOUtils states for a new copy operation
     ioUtilsObj.setReadCompleteInfo(false);
     ioUtilsObj.setErrorOccuredInfo(false);
-    ioUtilsObj.setFileOffset(0); 
+    ioUtilsObj.setNextBlock(0); 
     ioUtilsObj.setPendingIOs(0);
+    ioUtilsObj.ClearParkedContexts();
+    ResetEvent(m_hFinished);
+    // Checked after the error flag was cleared, a later Cancel sets it again
+    if (m_cancelled.load(std::memory_order_acquire)) {
+        LOG_ERROR(L"BlockCopier::StartCopy: The copy was cancelled before it started.\n");
+        LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
+        return false;
+    }
+    // Each worker (the ring its contexts belong to) reads one contiguous range and steals once it runs dry
+    if (!m_sharedCursor && !m_ranges.Build(m_schedule, m_numOfThreads)) {
+        LOG_ERROR(L"BlockCopier::StartCopy: Failed to split the schedule into worker ranges.\n");
+        LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
+        return false;
+    }
+    ioUtilsObj.setRanges(m_sharedCursor ? nullptr : &m_ranges);
     m_bytesReadTotal = 0;  
     m_bytesWrittenTotal = 0;    
+    m_bytesSkippedTotal = 0;
+    m_bytesZeroTotal = 0;
+
+    // The old digests stay in memory, the file goes away until this run has completed successfully
+    if (getDigestIndex() != nullptr && !m_digestIndex.Invalidate()) {
+        LOG_ERROR(L"BlockCopier::StartCopy: Failed to invalidate the digest index before copying.\n");
+        LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
+        return false;
+    }
+
+    if (!m_metrics.Start(m_numOfThreads, static_cast<int>(m_cntxts.size()))) {
+        LOG_ERROR(L"BlockCopier::StartCopy: Failed to set up copy metrics.\n");
+        LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
+        return false;
+    }
+
+    // Auto tuning: start from one active context per thread and single block reads, before any context is seeded
+    if (m_autoTune) {
+        m_autoTuner.Start(m_numOfThreads, static_cast<int>(m_cntxts.size()), m_maxBlocksPerIo);
+        ioUtilsObj.setActiveLimit(m_autoTuner.getContexts());
+        ioUtilsObj.setBlocksPerIo(m_autoTuner.getBlocksPerIo());
+    }
+    else if (m_completionPool != nullptr) {
+        ioUtilsObj.setActiveLimit(m_share.load(std::memory_order_relaxed));
+    }
+
+    if (getReorderBuffer() != nullptr) {
+        m_reorderBuffer.Start([this](IOContext* cntxt) {
+            ioUtilsObj.IssueBlockWrite(cntxt);
+        });
+    }
+
+    // Compressed image: start the compression stage before any block is read
+    if (getCompressionPool() != nullptr &&
+        !m_compressionPool.Start(m_compressionThreads, m_image.getAlgorithm(), [this](IOContext* cntxt, COMPRESSOR_HANDLE compressor) {
+            ioUtilsObj.CompressAndWrite(cntxt, compressor);
+        })) {
+        LOG_ERROR(L"BlockCopier::StartCopy: Failed to start the compression threads.\n");
+        LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
+        return false;
+    }
 
-    // Launch worker threads
+    if (getHashPool() != nullptr &&
+        !m_hashPool.Start(m_hashThreads, [this](IOContext* cntxt) {
+            ioUtilsObj.HashAndRelease(cntxt);
+        })) {
+        LOG_ERROR(L"BlockCopier::StartCopy: Failed to start the hash threads.\n");
+        LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
+        return false;
+    }
+
+    // Failed ranges are retried instead of ending the copy, the workers hand them over from their first read on
+    if (getFaultHandler() != nullptr &&
+        !m_faultHandler.Start(m_engineType, getCompletionPort(), getCompletionKey(FAULT_COMPLETION_KEY), m_numOfThreads, m_srcSectorSize, m_srcFileSize)) {
+        LOG_ERROR(L"BlockCopier::StartCopy: Failed to start the fault handler.\n");
+        LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
+        return false;
+    }
+
+    // Launch worker threads. A job of a shared pool only seeds its rings here, the pool's threads service its completions.
     m_workerThreads.clear(); // Clear any existing threads from previous runs
-    m_workerThreads.reserve(m_numOfThreads);
-    for (int i = 0; i < m_numOfThreads; ++i) {
-        m_workerThreads.emplace_back(&BlockCopier::WorkerThreadLoop, this,
-            m_cntxts[i].get(), // Pass the raw pointer to the IOContext for this thread
-            std::cref(m_hSrc), std::cref(m_hDest), std::cref(m_blockSize), std::cref(m_srcFileSize));
+    if (m_completionPool != nullptr) {
+        for (int i = 0; i < m_numOfThreads; ++i) {
+            SeedReads(i, m_hSrc);
+        }
+        ioUtilsObj.SignalIfFinished(); // An empty schedule is done before any completion
+    }
+    else {
+        m_workerThreads.reserve(m_numOfThreads);
+        for (int i = 0; i < m_numOfThreads; ++i) {
+            m_workerThreads.emplace_back((m_engineType == IOEngineType::IOCP ? &BlockCopier::IocpWorkerThreadLoop : &BlockCopier::WorkerThreadLoop), this,
+                i, // Worker index selects this thread's ring in m_cntxts
+                std::cref(m_hSrc), std::cref(m_hDest));
+        }
     }
 
     // Monitor progress and wait for all operations to complete
@@ -231,34 +1277,124 @@ bool BlockCopier::StartCopy() {
     LONGLONG lastReadPrinted = 0;
     LONGLONG lastWrittenPrinted = 0;
 
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    LONGLONG lastProgressBytes = 0;
+    ULONGLONG lastProgressMs = GetTickCount64();
+    bool stallReported = false;
+    auto reportProgress = [this]() {
+        if (m_progressCallback) {
+            CopyProgress progress;
+            progress.bytesRead = m_bytesReadTotal.load(std::memory_order_acquire);
+            progress.bytesWritten = m_bytesWrittenTotal.load(std::memory_order_acquire) + m_bytesSkippedTotal.load(std::memory_order_acquire) +
+                m_bytesZeroTotal.load(std::memory_order_acquire);
+            progress.bytesTotal = m_bytesToCopy;
+            progress.pendingIOs = ioUtilsObj.getPendingIOs();
+            m_progressCallback(progress);
+        }
+    };
+
     // Runs as long as there are pending I/Os OR not all reads have been issued,AND no error has occurred. This ensures we wait for all alive I/Os.
     while ((ioUtilsObj.getPendingIOs() > 0 || !ioUtilsObj.getReadCompleteInfo()) &&
         !ioUtilsObj.getErrorOccuredInfo()) {
 
         // Periodically log progress from the main thread
         LONGLONG currentRead = m_bytesReadTotal.load(std::memory_order_acquire);
-        LONGLONG currentWritten = m_bytesWrittenTotal.load(std::memory_order_acquire);
+        LONGLONG currentWritten = m_bytesWrittenTotal.load(std::memory_order_acquire) + m_bytesSkippedTotal.load(std::memory_order_acquire) +
+            m_bytesZeroTotal.load(std::memory_order_acquire);
+
+        // A copy that finished no block for a while is traced once per stall, with how long it lasted so far
+        ULONGLONG nowMs = GetTickCount64();
+        if (currentWritten != lastProgressBytes) {
+            lastProgressBytes = currentWritten;
+            lastProgressMs = nowMs;
+            stallReported = false;
+        }
+        else if (!stallReported && nowMs - lastProgressMs >= COPYTRACE_STALL_THRESHOLD_MS) {
+            CopyTrace::Stall(L"NoProgress", -1, -1, nowMs - lastProgressMs, ioUtilsObj.getPendingIOs());
+            stallReported = true;
+        }
 
         if (currentRead > lastReadPrinted + m_blockSize * 4 || currentWritten > lastWrittenPrinted + m_blockSize * 4 || // Log every few blocks
-            currentRead >= m_srcFileSize || currentWritten >= m_srcFileSize) { // Always log on completion
+            currentRead >= m_bytesToCopy || currentWritten >= m_bytesToCopy) { // Always log on completion
             LOG_INFO(L"Progress: Read %lld MB of %lld MB (%.2f%%) | Written %lld MB of %lld MB (%.2f%%). Pending IOs: %d\n",
-                currentRead / (1024 * 1024), m_srcFileSize / (1024 * 1024),
-                (m_srcFileSize > 0 ? (double)currentRead * 100.0 / m_srcFileSize : 0.0),
-                currentWritten / (1024 * 1024), m_srcFileSize / (1024 * 1024), // Assuming target size matches source
-                (m_srcFileSize > 0 ? (double)currentWritten * 100.0 / m_srcFileSize : 0.0),
+                currentRead / (1024 * 1024), m_bytesToCopy / (1024 * 1024),
+                (m_bytesToCopy > 0 ? (double)currentRead * 100.0 / m_bytesToCopy : 0.0),
+                currentWritten / (1024 * 1024), m_bytesToCopy / (1024 * 1024), // Assuming target size matches source
+                (m_bytesToCopy > 0 ? (double)currentWritten * 100.0 / m_bytesToCopy : 0.0),
                 ioUtilsObj.getPendingIOs());
             lastReadPrinted = currentRead;
             lastWrittenPrinted = currentWritten;
         }
+        reportProgress();
+
+        m_metrics.Sample();
+
+        // Apply the next configuration to try, contexts above a lowered limit park as they finish their cycle
+        if (m_autoTune && m_autoTuner.Sample(currentWritten, m_metrics)) {
+            ioUtilsObj.setBlocksPerIo(m_autoTuner.getBlocksPerIo());
+            ioUtilsObj.setActiveLimit(m_autoTuner.getContexts());
+            ioUtilsObj.UnparkContexts(m_hSrc);
+        }
+
+        // The scheduler moves shares as jobs start and end, contexts above a lowered share park as they finish their cycle
+        if (m_completionPool != nullptr) {
+            ioUtilsObj.setActiveLimit(m_share.load(std::memory_order_relaxed));
+        }
 
-        // Short sleep to prevent busy waiting and yield CPU to worker threads
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        // Contexts parked for lack of tokens or share resume as the buckets refill and shares grow
+        if (m_throttleEnabled || m_completionPool != nullptr) {
+            ioUtilsObj.UnparkContexts(m_hSrc);
+        }
+
+        // A destination that stopped completing writes holds its buffers back from every other one, let it go
+        if (getFanOutTargets() != nullptr) {
+            m_fanOutTargets.DropStalled(FANOUT_STALL_TIMEOUT_MS);
+        }
+
+        // Persist finished blocks in batches so an interrupted copy can resume close to where it stopped
+        if (getJournal() != nullptr &&
+            std::chrono::steady_clock::now() - lastCheckpoint >= std::chrono::milliseconds(JOURNAL_CHECKPOINT_INTERVAL_MS)) {
+            if (!m_journal.Checkpoint(m_hDest)) {
+                LOG_WARNING(L"BlockCopier::StartCopy: Journal checkpoint failed, resuming may repeat more blocks.\n");
+            }
+            lastCheckpoint = std::chrono::steady_clock::now();
+        }
+
+        // Sleep until the next sample, the workers wake this thread as soon as the copy is done or fails
+        WaitForSingleObject(m_hFinished, MONITOR_INTERVAL_MS);
     }
     LOG_INFO(L"Main thread: Copy loop finished. Final Pending IOs: %d Read Complete: %d with error: %d\n",
         ioUtilsObj.getPendingIOs(), ioUtilsObj.getReadCompleteInfo(), ioUtilsObj.getErrorOccuredInfo());
+    if (ioUtilsObj.getErrorOccuredInfo()) {
+        CancelInFlightIo();
+    }
+    reportProgress();
+
+    // Blocks queued for compression have their writes issued before the I/O threads are shut down
+    if (getCompressionPool() != nullptr) {
+        m_compressionPool.Stop();
+    }
+
+    // Nothing can be redelivered once the workers are gone
+    m_faultHandler.Stop();
+    if (m_faultHandler.getFaults() > 0) {
+        m_faultHandler.LogSummary();
+    }
 
+    // The threads of a shared pool go on serving the other jobs, the copy is over once none of its I/O is left
+    if (m_completionPool != nullptr) {
+        WaitUntilDrained();
+    }
+    // Signal IOCP pool threads to terminate, one shutdown packet per thread
+    else if (m_engineType == IOEngineType::IOCP) {
+        for (int i = 0; i < m_numOfThreads; ++i) {
+            if (!PostQueuedCompletionStatus(m_hIocp, 0, 0, nullptr)) {
+                LOG_ERROR(L"Failed to post shutdown packet to the completion port. Error: %d\n", GetLastError());
+            }
+        }
+    }
     // Signal worker threads to terminate if stucked with SleepEx
-    if (!ioUtilsObj.getErrorOccuredInfo()) {
+    else {
         for (int i = 0; i < m_numOfThreads; ++i) {
             // Check if thread is joinable, it might have already exited
             if (m_workerThreads[i].joinable()) {
@@ -281,10 +1417,6 @@ bool BlockCopier::StartCopy() {
             }
         }
     }
-    // Give a very small moment for APCs to be delivered before joining
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-
     // Join all worker threads to ensure they all have finished their work
     for (auto& t : m_workerThreads) {
         if (t.joinable()) {
@@ -293,8 +1425,31 @@ bool BlockCopier::StartCopy() {
         }
     }
 
-    // Final FlushFileBuffers after all worker threads are done
-    if (FlushFileBuffers(m_hDest)) {
+    m_metrics.Stop();
+    CopyMetricsSummary metricsSummary = m_metrics.GetSummary();
+    LOG_INFO(L"BlockCopier::StartCopy: Read latency p50/p99 %llu/%llu us, write latency p50/p99 %llu/%llu us, avg in flight %.1f reads %.1f writes of %d contexts, likely bottleneck: %s.\n",
+        metricsSummary.readLatency.p50, metricsSummary.readLatency.p99, metricsSummary.writeLatency.p50, metricsSummary.writeLatency.p99,
+        metricsSummary.avgReadsInFlight, metricsSummary.avgWritesInFlight, metricsSummary.totalContexts, metricsSummary.likelyBottleneck);
+    if (!m_metricsPath.empty() && !m_metrics.WriteJson(m_metricsPath.c_str())) {
+        LOG_WARNING(L"BlockCopier::StartCopy: Failed to write metrics to %s.\n", m_metricsPath.c_str());
+    }
+
+    // Every chunk is written, the image is complete once its index and header are
+    if (getImage() != nullptr && !ioUtilsObj.getErrorOccuredInfo() && !m_image.Finalize(m_hDest)) {
+        LOG_ERROR(L"BlockCopier::StartCopy: Failed to finalize the compressed image.\n");
+        ioUtilsObj.setErrorOccuredInfo(true);
+    }
+
+    // Final FlushFileBuffers after all worker threads are done, on every destination still live when fanning out.
+    // A receiver flushes its target once every connection has ended, and confirms it.
+    bool flushed = false;
+    if (getNetworkTarget() != nullptr) {
+        flushed = m_networkTarget.Finish(!ioUtilsObj.getErrorOccuredInfo());
+    }
+    else {
+        flushed = (getFanOutTargets() != nullptr) ? m_fanOutTargets.Flush() : (FlushFileBuffers(m_hDest) != FALSE);
+    }
+    if (flushed) {
         LOG_INFO(L"BlockCopier::StartCopy: Destination buffers flushed successfully.\n");
     }
     else {
@@ -302,15 +1457,224 @@ bool BlockCopier::StartCopy() {
         ioUtilsObj.setErrorOccuredInfo(true);
     }
 
+    // The store's index and the backup's manifest may only point at chunks the flush above made durable
+    if (m_chunkRunActive) {
+        m_chunkRunActive = false;
+        if (ioUtilsObj.getErrorOccuredInfo()) {
+            m_chunkStore->AbortRun(m_chunkManifest);
+        }
+        else if (!m_chunkStore->CommitRun(m_chunkManifest) || !m_chunkManifest.Save(m_chunkManifestPath.c_str())) {
+            LOG_ERROR(L"BlockCopier::StartCopy: Failed to commit the backup to the chunk store.\n");
+            ioUtilsObj.setErrorOccuredInfo(true);
+        }
+    }
+
+    // Every block is hashed once the I/O is done, the manifest describes the source whether or not verification passes
+    if (getHashManifest() != nullptr && !ioUtilsObj.getErrorOccuredInfo()) {
+        if (!m_hashManifest.Finish()) {
+            LOG_WARNING(L"BlockCopier::StartCopy: Failed to save the block hash manifest %s.\n", m_hashManifestPath.c_str());
+        }
+        LOG_INFO(L"BlockCopier::StartCopy: %lld blocks hashed, image digest %016llX.\n", m_hashManifest.getHashedBlocks(), m_hashManifest.getImageDigest());
+        if (m_verify && !VerifyDestination()) {
+            ioUtilsObj.setErrorOccuredInfo(true);
+        }
+    }
+    m_hashPool.Stop();
+
     if (ioUtilsObj.getErrorOccuredInfo()) {
-        LOG_ERROR(L"BlockCopier::StartCopy: Block copy completed with errors.\n");
+        // Keep what did complete, a later --resume run continues from there
+        if (getJournal() != nullptr && m_journal.Checkpoint(m_hDest)) {
+            LOG_INFO(L"BlockCopier::StartCopy: %lld blocks recorded in journal %s, rerun with --resume to continue.\n",
+                m_journal.getCompletedBlocks(), m_journalPath.c_str());
+        }
+        if (m_cancelled.load(std::memory_order_acquire)) {
+            LOG_ERROR(L"BlockCopier::StartCopy: Block copy was cancelled.\n");
+        }
+        else {
+            LOG_ERROR(L"BlockCopier::StartCopy: Block copy completed with errors.\n");
+        }
         LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
         return false;
     }
     else {
+        if (m_zeroBlockPolicy != ZeroBlockPolicy::WRITE) {
+            LOG_INFO(L"BlockCopier::StartCopy: %lld MB of zero blocks were %s instead of written.\n",
+                m_bytesZeroTotal.load() / (1024 * 1024), (m_zeroBlockPolicy == ZeroBlockPolicy::SKIP ? L"skipped" : L"unmapped"));
+        }
+        if (getFanOutTargets() != nullptr) {
+            m_fanOutTargets.LogSummary();
+        }
+        if (getReorderBuffer() != nullptr) {
+            LOG_INFO(L"BlockCopier::StartCopy: Writes were issued in offset order, reads ran up to %d blocks ahead.\n", m_reorderBuffer.getMaxWaitingWrites());
+        }
+        if (m_throttleEnabled) {
+            LOG_INFO(L"BlockCopier::StartCopy: Reads were held back by the throttle %lld times.\n", m_throttle.getDelayedReads());
+        }
+        if (!m_sharedCursor) {
+            LOG_INFO(L"BlockCopier::StartCopy: Workers stole ranges from each other %lld times.\n", m_ranges.getSteals());
+        }
+        if (getImage() != nullptr) {
+            LOG_INFO(L"BlockCopier::StartCopy: Compressed image stores %lld MB of source in %llu MB (%.2f%%) using %d compression threads.\n",
+                m_bytesToCopy / (1024 * 1024), m_image.getStoredBytes() / (1024 * 1024),
+                (m_bytesToCopy > 0 ? (double)m_image.getStoredBytes() * 100.0 / m_bytesToCopy : 0.0), m_compressionPool.getThreadCount());
+        }
+        if (getChunkStore() != nullptr) {
+            LOG_INFO(L"BlockCopier::StartCopy: Chunk store took %lld new chunks (%llu MB), %lld chunks were already stored and %lld were zero.\n",
+                m_chunkManifest.getStoredChunks(), m_chunkManifest.getStoredBytes() / (1024 * 1024), m_chunkManifest.getDedupChunks(), m_chunkManifest.getZeroChunks());
+        }
+        if (getDigestIndex() != nullptr) {
+            LOG_INFO(L"BlockCopier::StartCopy: Incremental copy wrote %lld MB and skipped %lld MB of unchanged blocks.\n",
+                m_bytesWrittenTotal.load() / (1024 * 1024), m_bytesSkippedTotal.load() / (1024 * 1024));
+            if (getFileImage() != nullptr && m_fileImage.hasBase()) {
+                LOG_INFO(L"BlockCopier::StartCopy: %lld MB of unchanged blocks were cloned from %s.\n", m_fileImage.getBytesCloned() / (1024 * 1024), m_baseImagePath.c_str());
+            }
+            if (!m_digestIndex.Save()) {
+                LOG_WARNING(L"BlockCopier::StartCopy: Failed to save the digest index, the next run will copy every block.\n");
+            }
+        }
+        // Nothing is left to resume
+        if (getJournal() != nullptr && !m_journal.Remove()) {
+            LOG_WARNING(L"BlockCopier::StartCopy: Failed to delete the copy journal %s.\n", m_journalPath.c_str());
+        }
         LOG_INFO(L"BlockCopier::StartCopy: Block copy completed successfully.\n"); 
         LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
         return true;
     }
     LOG_DEBUG(L"End of BlockCopier::StartCopy\n");
-}
\ No newline at end of file
+}
+
+void BlockCopier::Cancel() {
+    LOG_DEBUG(L"Inside BlockCopier::Cancel\n");
+    m_cancelled.store(true, std::memory_order_release);
+    // Stops reads from being issued and wakes StartCopy, which cancels what is in flight and waits for it
+    ioUtilsObj.setErrorOccuredInfo(true);
+    if (m_hFinished != nullptr) {
+        SetEvent(m_hFinished);
+    }
+    LOG_INFO(L"BlockCopier::Cancel: Cancel requested.\n");
+    LOG_DEBUG(L"End of BlockCopier::Cancel\n");
+}
+
+void BlockCopier::CancelInFlightIo() {
+    LOG_DEBUG(L"Inside BlockCopier::CancelInFlightIo\n");
+    // Cancelled operations complete with ERROR_OPERATION_ABORTED through the engine like any other failure.
+    // RIO sends cannot be cancelled, they complete (or fail) with their connection.
+    std::vector<HANDLE> handles = { m_hSrc };
+    if (getFanOutTargets() != nullptr) {
+        for (int i = 0; i < m_fanOutTargets.getCount(); ++i) {
+            handles.push_back(m_fanOutTargets.getTarget(i).handle);
+        }
+    }
+    else if (!m_networkMode) {
+        handles.push_back(m_hDest);
+    }
+    for (HANDLE handle : handles) {
+        if (handle != INVALID_HANDLE_VALUE && !CancelIoEx(handle, nullptr) && GetLastError() != ERROR_NOT_FOUND) {
+            LOG_WARNING(L"BlockCopier::CancelInFlightIo: CancelIoEx failed with error: %d\n", GetLastError());
+        }
+    }
+    // Ranges waiting for a reissue would only end after their delay, they are handed back failed now
+    m_faultHandler.Stop();
+
+    WaitUntilDrained();
+    LOG_INFO(L"BlockCopier::CancelInFlightIo: No I/O is in flight any more.\n");
+    LOG_DEBUG(L"End of BlockCopier::CancelInFlightIo\n");
+}
+
+void BlockCopier::WaitUntilDrained() {
+    // Every thread that ends an I/O signals the drained event once the count reaches zero. It is reset before the
+    // count is read, so a signal from before this point cannot end the wait early, and one from after it is not missed.
+    ResetEvent(m_hDrained);
+    while (ioUtilsObj.getPendingIOs() > 0) {
+        WaitForSingleObject(m_hDrained, INFINITE);
+        ResetEvent(m_hDrained);
+    }
+}
+
+bool BlockCopier::VerifyDestination() {
+    LOG_DEBUG(L"Inside BlockCopier::VerifyDestination\n");
+    LOG_INFO(L"BlockCopier::VerifyDestination: Reading back %lld MB from the destination...\n", m_bytesToCopy / (1024 * 1024));
+
+    // Same schedule and contexts as the copy, the pool threads read from the destination and hand every block to the hash stage
+    ioUtilsObj.setReadCompleteInfo(false);
+    ioUtilsObj.setNextBlock(0);
+    ioUtilsObj.setPendingIOs(0);
+    ioUtilsObj.setActiveLimit(m_share.load(std::memory_order_relaxed)); // Auto tuning is over, every context reads unless a pool share is set
+    ioUtilsObj.ClearParkedContexts();
+    ResetEvent(m_hFinished);
+    if (!m_sharedCursor && !m_ranges.Build(m_schedule, m_numOfThreads)) {
+        LOG_ERROR(L"BlockCopier::VerifyDestination: Failed to split the schedule into worker ranges.\n");
+        LOG_DEBUG(L"End of BlockCopier::VerifyDestination\n");
+        return false;
+    }
+    m_verifyPass = true;
+    BlockHandler copyHandler = ioUtilsObj.getBlockHandler();
+    ioUtilsObj.setBlockHandler(BlockStages::SelectVerify());
+    // The destination holds the last block padded to its own sector size
+    ioUtilsObj.setReadSectorSize(m_destSectorSize);
+    m_workerThreads.clear();
+    if (m_completionPool != nullptr) {
+        for (int i = 0; i < m_numOfThreads; ++i) {
+            SeedReads(i, m_hDest);
+        }
+        ioUtilsObj.SignalIfFinished();
+    }
+    else {
+        for (int i = 0; i < m_numOfThreads; ++i) {
+            m_workerThreads.emplace_back(&BlockCopier::IocpWorkerThreadLoop, this, i, std::cref(m_hDest), std::cref(m_hDest));
+        }
+    }
+
+    LONGLONG totalBlocks = m_schedule.getTotalBlocks();
+    LONGLONG lastPrinted = 0;
+    while ((ioUtilsObj.getPendingIOs() > 0 || !ioUtilsObj.getReadCompleteInfo()) && !ioUtilsObj.getErrorOccuredInfo()) {
+        LONGLONG verified = m_hashManifest.getVerifiedBlocks();
+        if (verified > lastPrinted + 4 || verified >= totalBlocks) {
+            LOG_INFO(L"Verify progress: %lld of %lld blocks (%.2f%%), %lld mismatches.\n", verified, totalBlocks,
+                (totalBlocks > 0 ? (double)verified * 100.0 / totalBlocks : 0.0), m_hashManifest.getMismatchedBlocks());
+            lastPrinted = verified;
+        }
+        if (m_completionPool != nullptr) {
+            ioUtilsObj.setActiveLimit(m_share.load(std::memory_order_relaxed));
+        }
+        if (m_throttleEnabled || m_completionPool != nullptr) {
+            ioUtilsObj.UnparkContexts(m_hDest);
+        }
+        WaitForSingleObject(m_hFinished, MONITOR_INTERVAL_MS);
+    }
+    if (ioUtilsObj.getErrorOccuredInfo()) {
+        CancelInFlightIo();
+    }
+
+    if (m_completionPool != nullptr) {
+        WaitUntilDrained();
+    }
+    for (int i = 0; i < static_cast<int>(m_workerThreads.size()); ++i) {
+        if (!PostQueuedCompletionStatus(m_hIocp, 0, 0, nullptr)) {
+            LOG_ERROR(L"Failed to post shutdown packet to the completion port. Error: %d\n", GetLastError());
+        }
+    }
+    for (auto& t : m_workerThreads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    m_verifyPass = false;
+    ioUtilsObj.setBlockHandler(copyHandler);
+    ioUtilsObj.setReadSectorSize(m_srcSectorSize);
+
+    if (ioUtilsObj.getErrorOccuredInfo()) {
+        LOG_ERROR(L"BlockCopier::VerifyDestination: Reading the destination back failed.\n");
+        LOG_DEBUG(L"End of BlockCopier::VerifyDestination\n");
+        return false;
+    }
+    if (m_hashManifest.getMismatchedBlocks() > 0) {
+        LOG_ERROR(L"BlockCopier::VerifyDestination: %lld of %lld blocks on the destination do not match the source.\n",
+            m_hashManifest.getMismatchedBlocks(), m_hashManifest.getVerifiedBlocks());
+        LOG_DEBUG(L"End of BlockCopier::VerifyDestination\n");
+        return false;
+    }
+    LOG_INFO(L"BlockCopier::VerifyDestination: All %lld blocks on the destination match the source.\n", m_hashManifest.getVerifiedBlocks());
+    LOG_DEBUG(L"End of BlockCopier::VerifyDestination\n");
+    return true;
+}
@@ -0,0 +1,171 @@
+#include "BlockDigestIndex.h"
+#include "HashUtils.h"
+
+//Getters
+LONGLONG BlockDigestIndex::getBlockCount() const
+{
+    return m_header.blockCount;
+}
+
+DWORD BlockDigestIndex::getBlockSize() const
+{
+    return m_header.blockSize;
+}
+
+LONGLONG BlockDigestIndex::getKnownBlocks() const
+{
+    LONGLONG known = 0;
+    for (ULONGLONG digest : m_previous) {
+        if (digest != 0) {
+            ++known;
+        }
+    }
+    return known;
+}
+
+bool BlockDigestIndex::Load(LPCWSTR path, DWORD blockSize, LONGLONG sourceSize, LPCWSTR destPath, LPCWSTR previousDestPath)
+{
+    LOG_DEBUG(L"Inside BlockDigestIndex::Load\n");
+    if (path == nullptr || blockSize == 0 || sourceSize <= 0) {
+        LOG_ERROR(L"BlockDigestIndex::Load: Invalid parameters.\n");
+        LOG_DEBUG(L"End of BlockDigestIndex::Load\n");
+        return false;
+    }
+
+    m_path = path;
+    m_header = {};
+    m_header.magic = DIGEST_INDEX_MAGIC;
+    m_header.version = DIGEST_INDEX_VERSION;
+    m_header.blockSize = blockSize;
+    m_header.sourceSize = sourceSize;
+    m_header.blockCount = (sourceSize + blockSize - 1) / blockSize;
+    m_header.destinationId = HashUtils::Hash64(destPath, wcslen(destPath) * sizeof(wchar_t));
+    LPCWSTR expectedPath = (previousDestPath != nullptr) ? previousDestPath : destPath;
+    ULONGLONG expectedDestinationId = HashUtils::Hash64(expectedPath, wcslen(expectedPath) * sizeof(wchar_t));
+
+    // The index is small (8 bytes per block), read it in one go with buffered I/O
+    m_previous.assign(static_cast<size_t>(m_header.blockCount), 0);
+    m_current.assign(static_cast<size_t>(m_header.blockCount), 0);
+
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_INFO(L"BlockDigestIndex::Load: No previous index at %s (error %d). Every block will be copied.\n", path, GetLastError());
+        LOG_DEBUG(L"End of BlockDigestIndex::Load\n");
+        return true;
+    }
+
+    DigestIndexHeader fileHeader = {};
+    DWORD bytesRead = 0;
+    if (!ReadFile(hFile, &fileHeader, sizeof(fileHeader), &bytesRead, nullptr) || bytesRead != sizeof(fileHeader) ||
+        fileHeader.magic != DIGEST_INDEX_MAGIC || fileHeader.version != DIGEST_INDEX_VERSION) {
+        LOG_WARNING(L"BlockDigestIndex::Load: %s is not a valid digest index. Every block will be copied.\n", path);
+        CloseHandle(hFile);
+        LOG_DEBUG(L"End of BlockDigestIndex::Load\n");
+        return true;
+    }
+    if (fileHeader.blockSize != m_header.blockSize || fileHeader.sourceSize != m_header.sourceSize ||
+        fileHeader.blockCount != m_header.blockCount || fileHeader.destinationId != expectedDestinationId) {
+        LOG_WARNING(L"BlockDigestIndex::Load: Index %s was built for a different block size, source size or destination. Every block will be copied.\n", path);
+        CloseHandle(hFile);
+        LOG_DEBUG(L"End of BlockDigestIndex::Load\n");
+        return true;
+    }
+
+    // Read the digests in chunks, ReadFile takes a DWORD length
+    char* dst = reinterpret_cast<char*>(m_previous.data());
+    ULONGLONG remaining = m_previous.size() * sizeof(ULONGLONG);
+    while (remaining > 0) {
+        DWORD chunk = static_cast<DWORD>(remaining < (64ULL * 1024 * 1024) ? remaining : (64ULL * 1024 * 1024));
+        if (!ReadFile(hFile, dst, chunk, &bytesRead, nullptr) || bytesRead != chunk) {
+            LOG_WARNING(L"BlockDigestIndex::Load: Index %s is truncated. Every block will be copied.\n", path);
+            m_previous.assign(m_previous.size(), 0);
+            break;
+        }
+        dst += chunk;
+        remaining -= chunk;
+    }
+    CloseHandle(hFile);
+
+    // Blocks that are not read in this run (e.g. free clusters) keep their previous digest
+    m_current = m_previous;
+    LOG_INFO(L"BlockDigestIndex::Load: Loaded %lld block digests from %s.\n", getKnownBlocks(), path);
+    LOG_DEBUG(L"End of BlockDigestIndex::Load\n");
+    return true;
+}
+
+bool BlockDigestIndex::Update(LONGLONG blockNumber, ULONGLONG digest)
+{
+    if (blockNumber < 0 || blockNumber >= m_header.blockCount) {
+        return false;
+    }
+    m_current[static_cast<size_t>(blockNumber)] = digest;
+    return digest != 0 && m_previous[static_cast<size_t>(blockNumber)] == digest;
+}
+
+bool BlockDigestIndex::Invalidate()
+{
+    LOG_DEBUG(L"Inside BlockDigestIndex::Invalidate\n");
+    if (!m_path.empty() && !DeleteFileW(m_path.c_str()) && GetLastError() != ERROR_FILE_NOT_FOUND) {
+        LOG_ERROR(L"BlockDigestIndex::Invalidate: Failed to remove %s. Error: %d\n", m_path.c_str(), GetLastError());
+        LOG_DEBUG(L"End of BlockDigestIndex::Invalidate\n");
+        return false;
+    }
+    LOG_DEBUG(L"End of BlockDigestIndex::Invalidate\n");
+    return true;
+}
+
+bool BlockDigestIndex::Save()
+{
+    LOG_DEBUG(L"Inside BlockDigestIndex::Save\n");
+    if (m_path.empty()) {
+        LOG_ERROR(L"BlockDigestIndex::Save: Index was not loaded.\n");
+        LOG_DEBUG(L"End of BlockDigestIndex::Save\n");
+        return false;
+    }
+
+    // Write next to the index and rename over it, so a crash never leaves a half written index behind
+    std::wstring tempPath = m_path + L".tmp";
+    HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"BlockDigestIndex::Save: Failed to create %s. Error: %d\n", tempPath.c_str(), GetLastError());
+        LOG_DEBUG(L"End of BlockDigestIndex::Save\n");
+        return false;
+    }
+
+    bool success = true;
+    DWORD bytesWritten = 0;
+    if (!WriteFile(hFile, &m_header, sizeof(m_header), &bytesWritten, nullptr) || bytesWritten != sizeof(m_header)) {
+        success = false;
+    }
+    const char* src = reinterpret_cast<const char*>(m_current.data());
+    ULONGLONG remaining = m_current.size() * sizeof(ULONGLONG);
+    while (success && remaining > 0) {
+        DWORD chunk = static_cast<DWORD>(remaining < (64ULL * 1024 * 1024) ? remaining : (64ULL * 1024 * 1024));
+        if (!WriteFile(hFile, src, chunk, &bytesWritten, nullptr) || bytesWritten != chunk) {
+            success = false;
+            break;
+        }
+        src += chunk;
+        remaining -= chunk;
+    }
+    if (success && !FlushFileBuffers(hFile)) {
+        success = false;
+    }
+    if (!success) {
+        LOG_ERROR(L"BlockDigestIndex::Save: Failed to write %s. Error: %d\n", tempPath.c_str(), GetLastError());
+    }
+    CloseHandle(hFile);
+
+    if (success && !MoveFileExW(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG_ERROR(L"BlockDigestIndex::Save: Failed to replace %s. Error: %d\n", m_path.c_str(), GetLastError());
+        success = false;
+    }
+    if (!success) {
+        DeleteFileW(tempPath.c_str());
+    }
+    else {
+        LOG_INFO(L"BlockDigestIndex::Save: Saved %lld block digests to %s.\n", m_header.blockCount, m_path.c_str());
+    }
+    LOG_DEBUG(L"End of BlockDigestIndex::Save\n");
+    return success;
+}
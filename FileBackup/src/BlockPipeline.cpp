@@ -0,0 +1,265 @@
+#include "BlockPipeline.h"
+#include "BlockCopier.h" // Needed to cast curInst back to BlockCopier*
+#include "HashUtils.h"
+#include "BufferUtils.h"
+
+//Stages
+
+StageResult BlockStages::CountRead(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // Update global total bytes read for this block copier instance
+    cntxt->curInst->m_bytesReadTotal.fetch_add(bytesRead, std::memory_order_relaxed);
+    return StageResult::NEXT;
+}
+
+StageResult BlockStages::Hash(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // End-to-end hashing: the pool hashes the block while it is written (or skipped), the buffer is free once both are done.
+    // The hash counts as a pending I/O of its own so the copy cannot end before every block is hashed.
+    cntxt->hashLength = bytesRead;
+    cntxt->bufferHolds.store(2, std::memory_order_release);
+    io.m_pendingIOs.fetch_add(1, std::memory_order_relaxed);
+    cntxt->curInst->getHashPool()->Submit(cntxt);
+    return StageResult::NEXT;
+}
+
+template <bool CloneUnchanged, bool Ordered>
+StageResult BlockStages::SkipUnchanged(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // Incremental mode: a block whose digest matches the previous run is already on the destination.
+    // A new file image holds none of the previous blocks, they are cloned from the previous image or written.
+    BlockDigestIndex* digestIndex = cntxt->curInst->getDigestIndex();
+    ULONGLONG digest = HashUtils::Hash64(cntxt->buf, bytesRead);
+    if (!digestIndex->Update(cntxt->readOffset / digestIndex->getBlockSize(), digest) ||
+        (CloneUnchanged && !cntxt->curInst->getFileImage()->CloneRange(cntxt->readOffset, bytesRead))) {
+        return StageResult::NEXT;
+    }
+    cntxt->curInst->m_bytesSkippedTotal.fetch_add(bytesRead, std::memory_order_relaxed);
+    FinishSkipped<Ordered>(io, cntxt);
+    LOG_DEBUG(L"BlockStages::SkipUnchanged: Block at offset %lld is unchanged, skipping write. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+    return StageResult::DONE;
+}
+
+StageResult BlockStages::PadToSector(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // Handling FILE_FLAG_NO_BUFFERING write alignment
+    DWORD bytesToWritePadded = bytesRead;
+    DWORD destSectorSize = cntxt->curInst->getDestSectorSize();
+    if (destSectorSize == 0) {
+        destSectorSize = 4096; // Fallback
+        LOG_WARNING(L"BlockStages::PadToSector: Destination sector size is 0, defaulting to 4096 bytes for padding. Thread ID: %d\n", GetCurrentThreadId());
+    }
+
+    if (bytesToWritePadded % destSectorSize != 0) {
+        DWORD padding = destSectorSize - (bytesToWritePadded % destSectorSize);
+        if (bytesToWritePadded + padding > cntxt->bufSize) {
+            LOG_ERROR(L"BlockStages::PadToSector: Buffer too small for padding at offset %lld. Required size: %d, Available buffer size:%d. Thread ID: %d\n", cntxt->readOffset, bytesToWritePadded + padding, cntxt->bufSize, GetCurrentThreadId());
+            io.m_errOccurred.store(true, std::memory_order_release);
+            io.PassTurn(cntxt);
+            io.m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+            cntxt->completed.store(true, std::memory_order_release);
+            return StageResult::DONE;
+        }
+        memset(cntxt->buf + bytesToWritePadded, 0, padding);
+        bytesToWritePadded += padding;
+    }
+    cntxt->bytesTransferred = bytesToWritePadded; // Store the actual padded bytes to write
+    return StageResult::NEXT;
+}
+
+template <bool Ordered>
+StageResult BlockStages::SkipZero(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // All-zero block: skip it, the destination is known to be zeroed
+    if (!BufferUtils::IsAllZero(cntxt->buf, cntxt->bytesTransferred)) {
+        return StageResult::NEXT;
+    }
+    cntxt->curInst->m_bytesZeroTotal.fetch_add(bytesRead, std::memory_order_relaxed);
+    FinishSkipped<Ordered>(io, cntxt);
+    LOG_DEBUG(L"BlockStages::SkipZero: Block at offset %lld is all zero, not written. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+    return StageResult::DONE;
+}
+
+template <bool Ordered>
+StageResult BlockStages::UnmapZero(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // All-zero block: unmap the range instead of writing it
+    if (!BufferUtils::IsAllZero(cntxt->buf, cntxt->bytesTransferred)) {
+        return StageResult::NEXT;
+    }
+    // The TRIM completes through the port like a write and is counted there. It is not a write the reorder
+    // buffer has to order, the block's turn passes now.
+    if (!io.IssueUnmap(cntxt)) {
+        return StageResult::NEXT;
+    }
+    PassTurn<Ordered>(cntxt);
+    io.m_pendingIOs.fetch_sub(1, std::memory_order_relaxed); // The read is done, the unmap holds its own count
+    return StageResult::DONE;
+}
+
+StageResult BlockStages::Compress(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // Compressed image: the pool compresses the block and issues its write, the read stays pending until then.
+    // With a manifest the compression stage hashes the block as well.
+    cntxt->hashLength = bytesRead;
+    cntxt->curInst->getCompressionPool()->Submit(cntxt);
+    LOG_DEBUG(L"BlockStages::Compress: Queued block at offset %lld for compression. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+    return StageResult::DONE;
+}
+
+StageResult BlockStages::Reorder(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // Ordered writes: the block waits, still counted as a pending read, until every block before it has been released
+    cntxt->curInst->getReorderBuffer()->Submit(cntxt);
+    LOG_DEBUG(L"BlockStages::Reorder: Handed block at offset %lld to the reorder buffer. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+    return StageResult::DONE;
+}
+
+StageResult BlockStages::Write(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    io.IssueBlockWrite(cntxt);
+    LOG_DEBUG(L"BlockStages::Write: Issued write for offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+    return StageResult::DONE;
+}
+
+StageResult BlockStages::StoreChunks(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // Chunk store: only the chunks the store does not hold yet are written, packed at the front of the buffer
+    ChunkStore* store = cntxt->curInst->getChunkStore();
+    ChunkWrite write;
+    if (!store->StoreChunks(*cntxt->curInst->getChunkManifest(), cntxt->readOffset / store->getChunkSize(), cntxt->buf, bytesRead, write)) {
+        LOG_ERROR(L"BlockStages::StoreChunks: Failed to store the chunks of offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        io.m_errOccurred.store(true, std::memory_order_release);
+        io.m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+        cntxt->completed.store(true, std::memory_order_release);
+        return StageResult::DONE;
+    }
+    cntxt->curInst->m_bytesSkippedTotal.fetch_add(bytesRead - write.newBytes, std::memory_order_relaxed);
+    if (write.bytesToWrite == 0) {
+        FinishSkipped<false>(io, cntxt);
+        LOG_DEBUG(L"BlockStages::StoreChunks: Every chunk of offset %lld is in the store already. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        return StageResult::DONE;
+    }
+
+    // The write completion counts the source bytes it stored
+    cntxt->bytesTransferred = write.newBytes;
+    cntxt->overlapped.Offset = static_cast<DWORD>(write.storeOffset & 0xFFFFFFFF);
+    cntxt->overlapped.OffsetHigh = static_cast<DWORD>((write.storeOffset >> 32) & 0xFFFFFFFF);
+    if (!io.IssueWrite(cntxt->curInst->getDestHandle(), cntxt, write.bytesToWrite)) {
+        LOG_ERROR(L"BlockStages::StoreChunks: Failed to issue write for the chunks of offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        io.m_errOccurred.store(true, std::memory_order_release);
+    }
+    io.m_pendingIOs.fetch_sub(1, std::memory_order_relaxed); // The read is done, the write (if issued) holds its own count
+    LOG_DEBUG(L"BlockStages::StoreChunks: Stored %d new bytes of offset %lld at %lld. Thread ID: %d\n", write.newBytes, cntxt->readOffset, write.storeOffset, GetCurrentThreadId());
+    return StageResult::DONE;
+}
+
+StageResult BlockStages::Verify(IOUtils& io, IOContext* cntxt, DWORD bytesRead)
+{
+    // Verify pass: a block read back from the destination is only hashed and compared, the read stays pending until then
+    cntxt->hashLength = bytesRead;
+    cntxt->bufferHolds.store(1, std::memory_order_release);
+    cntxt->curInst->getHashPool()->Submit(cntxt);
+    LOG_DEBUG(L"BlockStages::Verify: Queued block at offset %lld for verification. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+    return StageResult::DONE;
+}
+
+template <bool Ordered>
+void BlockStages::PassTurn(IOContext* cntxt)
+{
+    if (Ordered) {
+        cntxt->curInst->getReorderBuffer()->Skip(cntxt->blockIndex, cntxt->blockCount);
+    }
+}
+
+template <bool Ordered>
+void BlockStages::FinishSkipped(IOUtils& io, IOContext* cntxt)
+{
+    io.MarkBlockComplete(cntxt);
+    PassTurn<Ordered>(cntxt);
+    io.m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+    io.ReleaseBuffer(cntxt); // Buffer is free for the next read
+}
+
+void BlockStages::ReleaseOwned(IOContext* cntxt)
+{
+    cntxt->completed.store(true, std::memory_order_release);
+}
+
+void BlockStages::ReleaseShared(IOContext* cntxt)
+{
+    if (cntxt->bufferHolds.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        cntxt->completed.store(true, std::memory_order_release);
+    }
+}
+
+//Selection
+
+template <bool Ordered>
+BlockHandler BlockStages::SelectHash(const BlockPipelineConfig& config)
+{
+    if (config.hashBlocks) {
+        return SelectDigest<Ordered, &CountRead, &Hash>(config);
+    }
+    return SelectDigest<Ordered, &CountRead>(config);
+}
+
+template <bool Ordered, BlockStage... Stages>
+BlockHandler BlockStages::SelectDigest(const BlockPipelineConfig& config)
+{
+    // Digests are taken over the block as read, so the unchanged test comes before the padding
+    if (config.digestIndex && config.cloneUnchanged) {
+        return SelectZero<Ordered, Stages..., &SkipUnchanged<true, Ordered>, &PadToSector>(config);
+    }
+    if (config.digestIndex) {
+        return SelectZero<Ordered, Stages..., &SkipUnchanged<false, Ordered>, &PadToSector>(config);
+    }
+    return SelectZero<Ordered, Stages..., &PadToSector>(config);
+}
+
+template <bool Ordered, BlockStage... Stages>
+BlockHandler BlockStages::SelectZero(const BlockPipelineConfig& config)
+{
+    switch (config.zeroBlocks) {
+    case ZeroBlockPolicy::SKIP:
+        return SelectSink<Ordered, Stages..., &SkipZero<Ordered>>(config);
+    case ZeroBlockPolicy::UNMAP:
+        return SelectSink<Ordered, Stages..., &UnmapZero<Ordered>>(config);
+    default:
+        return SelectSink<Ordered, Stages...>(config);
+    }
+}
+
+template <bool Ordered, BlockStage... Stages>
+BlockHandler BlockStages::SelectSink(const BlockPipelineConfig& config)
+{
+    if (Ordered) {
+        return &BlockPipeline<Stages..., &Reorder>::Run;
+    }
+    if (config.sink == BlockSink::COMPRESS) {
+        return &BlockPipeline<Stages..., &Compress>::Run;
+    }
+    return &BlockPipeline<Stages..., &Write>::Run;
+}
+
+BlockHandler BlockStages::Select(const BlockPipelineConfig& config)
+{
+    // Chunk store copies take none of the other features, zero chunks are handled by the store itself
+    if (config.sink == BlockSink::CHUNK_STORE) {
+        return &BlockPipeline<&CountRead, &StoreChunks>::Run;
+    }
+    if (config.sink == BlockSink::REORDER) {
+        return SelectHash<true>(config);
+    }
+    return SelectHash<false>(config);
+}
+
+BufferRelease BlockStages::SelectRelease(const BlockPipelineConfig& config)
+{
+    return config.hashBlocks ? &ReleaseShared : &ReleaseOwned;
+}
+
+BlockHandler BlockStages::SelectVerify()
+{
+    return &BlockPipeline<&Verify>::Run;
+}
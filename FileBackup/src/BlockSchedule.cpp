@@ -0,0 +1,88 @@
+#include "BlockSchedule.h"
+#include <algorithm>
+
+//Getters
+DWORD BlockSchedule::getBlockSize() const
+{
+    return m_blockSize;
+}
+
+LONGLONG BlockSchedule::getTotalBlocks() const
+{
+    return m_totalBlocks;
+}
+
+LONGLONG BlockSchedule::getTotalBytes() const
+{
+    return m_totalBytes;
+}
+
+const std::vector<DiskExtent>& BlockSchedule::getExtents() const
+{
+    return m_extents;
+}
+
+bool BlockSchedule::Build(const std::vector<DiskExtent>& extents, DWORD blockSize)
+{
+    LOG_DEBUG(L"Inside BlockSchedule::Build\n");
+    m_extents.clear();
+    m_firstBlock.clear();
+    m_totalBlocks = 0;
+    m_totalBytes = 0;
+    m_blockSize = blockSize;
+
+    if (blockSize == 0) {
+        LOG_ERROR(L"BlockSchedule::Build: Block size must be positive.\n");
+        LOG_DEBUG(L"End of BlockSchedule::Build\n");
+        return false;
+    }
+
+    m_extents.reserve(extents.size());
+    m_firstBlock.reserve(extents.size());
+    for (const DiskExtent& extent : extents) {
+        if (extent.length <= 0) {
+            continue;
+        }
+        m_extents.push_back(extent);
+        m_firstBlock.push_back(m_totalBlocks);
+        m_totalBlocks += (extent.length + blockSize - 1) / blockSize;
+        m_totalBytes += extent.length;
+    }
+    LOG_INFO(L"BlockSchedule::Build: %zu extents, %lld blocks, %lld MB scheduled.\n", m_extents.size(), m_totalBlocks, m_totalBytes / (1024 * 1024));
+    LOG_DEBUG(L"End of BlockSchedule::Build\n");
+    return true;
+}
+
+bool BlockSchedule::GetBlock(LONGLONG blockIndex, LONGLONG& offset, DWORD& length) const
+{
+    return GetBlocks(blockIndex, 1, offset, length);
+}
+
+bool BlockSchedule::GetBlocks(LONGLONG blockIndex, LONGLONG count, LONGLONG& offset, DWORD& length) const
+{
+    if (blockIndex < 0 || blockIndex >= m_totalBlocks || count <= 0) {
+        return false;
+    }
+
+    // Last extent whose first block is <= blockIndex
+    size_t extentIndex = std::upper_bound(m_firstBlock.begin(), m_firstBlock.end(), blockIndex) - m_firstBlock.begin() - 1;
+    const DiskExtent& extent = m_extents[extentIndex];
+
+    LONGLONG offsetInExtent = (blockIndex - m_firstBlock[extentIndex]) * m_blockSize;
+    offset = extent.offset + offsetInExtent;
+    LONGLONG remaining = extent.length - offsetInExtent;
+    LONGLONG wanted = count * m_blockSize;
+    length = static_cast<DWORD>(remaining < wanted ? remaining : wanted);
+    return true;
+}
+
+LONGLONG BlockSchedule::GetRunLength(LONGLONG blockIndex, LONGLONG maxBlocks) const
+{
+    if (blockIndex < 0 || blockIndex >= m_totalBlocks) {
+        return 0;
+    }
+    size_t extentIndex = std::upper_bound(m_firstBlock.begin(), m_firstBlock.end(), blockIndex) - m_firstBlock.begin() - 1;
+    LONGLONG extentEnd = (extentIndex + 1 < m_firstBlock.size()) ? m_firstBlock[extentIndex + 1] : m_totalBlocks;
+    LONGLONG run = extentEnd - blockIndex;
+    return run < maxBlocks ? run : maxBlocks;
+}
@@ -0,0 +1,184 @@
+#include "BufferArena.h"
+
+//Getters
+SIZE_T BufferArena::getSliceSize() const
+{
+    return m_sliceSize;
+}
+
+DWORD BufferArena::getSliceCount() const
+{
+    return m_sliceCount;
+}
+
+DWORD BufferArena::getFreeSlices() const
+{
+    return m_freeSlices.load(std::memory_order_relaxed);
+}
+
+SIZE_T BufferArena::getTotalSize() const
+{
+    return m_totalSize;
+}
+
+bool BufferArena::isLargePages() const
+{
+    return m_largePages;
+}
+
+bool BufferArena::isLocked() const
+{
+    return m_locked;
+}
+
+// Large page allocations need SeLockMemoryPrivilege enabled in the process token
+bool BufferArena::EnableLockMemoryPrivilege()
+{
+    HANDLE hToken = nullptr;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken)) {
+        return false;
+    }
+    TOKEN_PRIVILEGES privileges = {};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    bool enabled = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, nullptr, nullptr) &&
+        GetLastError() != ERROR_NOT_ALL_ASSIGNED; // AdjustTokenPrivileges succeeds even if the account lacks the privilege
+    CloseHandle(hToken);
+    return enabled;
+}
+
+bool BufferArena::Create(SIZE_T sliceSize, DWORD sliceCount, int numaNode)
+{
+    LOG_DEBUG(L"Inside BufferArena::Create\n");
+    Destroy();
+    if (sliceSize == 0 || sliceCount == 0 || sliceCount == ARENA_NO_SLICE) {
+        LOG_ERROR(L"BufferArena::Create: Invalid arena of %u slices of %zu bytes.\n", sliceCount, sliceSize);
+        LOG_DEBUG(L"End of BufferArena::Create\n");
+        return false;
+    }
+
+    // Page aligned slices satisfy the sector alignment FILE_FLAG_NO_BUFFERING asks for
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    SIZE_T pageSize = systemInfo.dwPageSize;
+    m_sliceSize = ((sliceSize + pageSize - 1) / pageSize) * pageSize;
+    m_sliceCount = sliceCount;
+    SIZE_T bytesNeeded = m_sliceSize * sliceCount;
+
+    // With a node the pages come from its memory, VirtualAlloc would take them from wherever the first touch happens
+    DWORD preferredNode = (numaNode >= 0) ? static_cast<DWORD>(numaNode) : NUMA_NO_PREFERRED_NODE;
+
+    SIZE_T largePageSize = GetLargePageMinimum();
+    if (largePageSize != 0 && EnableLockMemoryPrivilege()) {
+        SIZE_T largeSize = ((bytesNeeded + largePageSize - 1) / largePageSize) * largePageSize;
+        m_base = static_cast<char*>(VirtualAllocExNuma(GetCurrentProcess(), nullptr, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, preferredNode));
+        if (m_base != nullptr) {
+            m_totalSize = largeSize;
+            m_largePages = true;
+            m_locked = true;
+        }
+        else {
+            LOG_WARNING(L"BufferArena::Create: Large page allocation of %zu MB failed with error: %d, using regular pages.\n", largeSize / (1024 * 1024), GetLastError());
+        }
+    }
+
+    if (m_base == nullptr) {
+        m_base = static_cast<char*>(VirtualAllocExNuma(GetCurrentProcess(), nullptr, bytesNeeded, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, preferredNode));
+        if (m_base == nullptr) {
+            LOG_ERROR(L"BufferArena::Create: Failed to allocate %zu MB with error: %d\n", bytesNeeded / (1024 * 1024), GetLastError());
+            LOG_DEBUG(L"End of BufferArena::Create\n");
+            return false;
+        }
+        m_totalSize = bytesNeeded;
+
+        // VirtualLock is bounded by the minimum working set, grow it by the arena first
+        SIZE_T minWorkingSet = 0;
+        SIZE_T maxWorkingSet = 0;
+        if (GetProcessWorkingSetSize(GetCurrentProcess(), &minWorkingSet, &maxWorkingSet) &&
+            SetProcessWorkingSetSize(GetCurrentProcess(), minWorkingSet + bytesNeeded, maxWorkingSet + bytesNeeded)) {
+            m_workingSetGrowth = bytesNeeded;
+        }
+        m_locked = VirtualLock(m_base, m_totalSize) != FALSE;
+        if (!m_locked) {
+            LOG_WARNING(L"BufferArena::Create: VirtualLock of %zu MB failed with error: %d, buffers stay pageable.\n", bytesNeeded / (1024 * 1024), GetLastError());
+        }
+    }
+
+    // Chain every slice into the free list, lowest address first
+    m_nextFree = std::vector<std::atomic<DWORD>>(sliceCount);
+    for (DWORD i = 0; i < sliceCount; ++i) {
+        m_nextFree[i].store(i + 1 < sliceCount ? i + 1 : ARENA_NO_SLICE, std::memory_order_relaxed);
+    }
+    m_freeHead.store(0, std::memory_order_release);
+    m_freeSlices.store(sliceCount, std::memory_order_relaxed);
+
+    LOG_INFO(L"BufferArena::Create: %u slices of %zu KB, %zu MB on %s pages%s, NUMA node %d.\n", m_sliceCount, m_sliceSize / 1024, m_totalSize / (1024 * 1024),
+        (m_largePages ? L"large" : L"regular"), (m_locked ? L", locked" : L""), numaNode);
+    LOG_DEBUG(L"End of BufferArena::Create\n");
+    return true;
+}
+
+void BufferArena::Destroy()
+{
+    if (m_base == nullptr) {
+        return;
+    }
+    if (m_freeSlices.load(std::memory_order_relaxed) != m_sliceCount) {
+        LOG_WARNING(L"BufferArena::Destroy: %u slices are still in use.\n", m_sliceCount - m_freeSlices.load(std::memory_order_relaxed));
+    }
+    if (m_locked && !m_largePages) {
+        VirtualUnlock(m_base, m_totalSize);
+    }
+    VirtualFree(m_base, 0, MEM_RELEASE);
+    if (m_workingSetGrowth != 0) {
+        SIZE_T minWorkingSet = 0;
+        SIZE_T maxWorkingSet = 0;
+        if (GetProcessWorkingSetSize(GetCurrentProcess(), &minWorkingSet, &maxWorkingSet) && minWorkingSet > m_workingSetGrowth) {
+            SetProcessWorkingSetSize(GetCurrentProcess(), minWorkingSet - m_workingSetGrowth, maxWorkingSet - m_workingSetGrowth);
+        }
+    }
+    m_base = nullptr;
+    m_totalSize = 0;
+    m_sliceCount = 0;
+    m_largePages = false;
+    m_locked = false;
+    m_workingSetGrowth = 0;
+    m_freeHead.store(ARENA_NO_SLICE, std::memory_order_relaxed);
+    m_freeSlices.store(0, std::memory_order_relaxed);
+    m_nextFree.clear();
+}
+
+char* BufferArena::Acquire()
+{
+    ULONGLONG head = m_freeHead.load(std::memory_order_acquire);
+    for (;;) {
+        DWORD index = static_cast<DWORD>(head & 0xFFFFFFFF);
+        if (index == ARENA_NO_SLICE) {
+            return nullptr;
+        }
+        DWORD next = m_nextFree[index].load(std::memory_order_relaxed);
+        ULONGLONG newHead = ((head >> 32) + 1) << 32 | next;
+        if (m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            m_freeSlices.fetch_sub(1, std::memory_order_relaxed);
+            return m_base + static_cast<SIZE_T>(index) * m_sliceSize;
+        }
+    }
+}
+
+void BufferArena::Release(char* slice)
+{
+    if (slice == nullptr || m_base == nullptr) {
+        return;
+    }
+    DWORD index = static_cast<DWORD>((slice - m_base) / m_sliceSize);
+    ULONGLONG head = m_freeHead.load(std::memory_order_relaxed);
+    for (;;) {
+        m_nextFree[index].store(static_cast<DWORD>(head & 0xFFFFFFFF), std::memory_order_relaxed);
+        ULONGLONG newHead = ((head >> 32) + 1) << 32 | index;
+        if (m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed)) {
+            m_freeSlices.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#include "BufferUtils.h"
+#include <intrin.h>
+#include <immintrin.h>
+
+namespace {
+    typedef bool (*IsAllZeroFn)(const unsigned char* p, size_t len);
+
+    bool IsAllZeroScalar(const unsigned char* p, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            if (p[i] != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 64 bytes per iteration: OR four vectors together and test once, so the loop is bound by memory bandwidth
+    bool IsAllZeroSse2(const unsigned char* p, size_t len) {
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 64 <= len; i += 64) {
+            __m128i acc = _mm_or_si128(
+                _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 16))),
+                _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 32)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 48))));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF) {
+                return false;
+            }
+        }
+        return IsAllZeroScalar(p + i, len - i);
+    }
+
+    // 128 bytes per iteration with 256 bit loads
+    bool IsAllZeroAvx2(const unsigned char* p, size_t len) {
+        size_t i = 0;
+        for (; i + 128 <= len; i += 128) {
+            __m256i acc = _mm256_or_si256(
+                _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 32))),
+                _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 64)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 96))));
+            if (!_mm256_testz_si256(acc, acc)) {
+                _mm256_zeroupper();
+                return false;
+            }
+        }
+        _mm256_zeroupper();
+        return IsAllZeroSse2(p + i, len - i);
+    }
+
+    // AVX2 needs CPU support and the OS saving YMM state on context switches
+    bool CpuSupportsAvx2() {
+        int info[4] = {};
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+
+    // Picked once on first use, x64 always has SSE2
+    IsAllZeroFn SelectIsAllZero() {
+        return CpuSupportsAvx2() ? IsAllZeroAvx2 : IsAllZeroSse2;
+    }
+
+    IsAllZeroFn GetIsAllZero() {
+        static const IsAllZeroFn fn = SelectIsAllZero();
+        return fn;
+    }
+}
+
+bool BufferUtils::IsAllZero(const void* data, size_t len)
+{
+    return GetIsAllZero()(static_cast<const unsigned char*>(data), len);
+}
+
+const wchar_t* BufferUtils::GetZeroScanImplName()
+{
+    return (GetIsAllZero() == IsAllZeroAvx2) ? L"AVX2" : L"SSE2";
+}
@@ -0,0 +1,865 @@
+#include "ChunkStore.h"
+#include "HashUtils.h"
+#include "BufferUtils.h"
+#include <xmmintrin.h>
+#include <bcrypt.h>
+
+#pragma comment(lib, "Bcrypt.lib")
+
+static_assert(sizeof(ChunkStoreHeader) <= CHUNK_STORE_HEADER_SIZE, "Chunk store header does not fit in front of the index");
+static_assert(sizeof(ChunkIndexEntry) == 32, "Two index entries are meant to share a cache line");
+
+//Getters
+DWORD ChunkManifest::getRun() const
+{
+    return m_run;
+}
+
+DWORD ChunkManifest::getChunkSize() const
+{
+    return m_header.chunkSize;
+}
+
+ULONGLONG ChunkManifest::getStoreId() const
+{
+    return m_header.storeId;
+}
+
+LONGLONG ChunkManifest::getSourceSize() const
+{
+    return m_header.sourceSize;
+}
+
+LONGLONG ChunkManifest::getChunkCount() const
+{
+    return m_header.chunkCount;
+}
+
+LONGLONG ChunkManifest::getStoredChunks() const
+{
+    return m_storedChunks.load(std::memory_order_relaxed);
+}
+
+LONGLONG ChunkManifest::getDedupChunks() const
+{
+    return m_dedupChunks.load(std::memory_order_relaxed);
+}
+
+LONGLONG ChunkManifest::getZeroChunks() const
+{
+    return m_zeroChunks.load(std::memory_order_relaxed);
+}
+
+ULONGLONG ChunkManifest::getStoredBytes() const
+{
+    return m_storedBytes.load(std::memory_order_relaxed);
+}
+
+const ChunkRef& ChunkManifest::getRef(LONGLONG chunkNumber) const
+{
+    return m_refs[static_cast<size_t>(chunkNumber)];
+}
+
+void ChunkManifest::Create(DWORD run, ULONGLONG storeId, DWORD chunkSize, LONGLONG sourceSize)
+{
+    m_header = {};
+    m_header.magic = CHUNK_MANIFEST_MAGIC;
+    m_header.version = CHUNK_MANIFEST_VERSION;
+    m_header.chunkSize = chunkSize;
+    m_header.storeId = storeId;
+    m_header.sourceSize = sourceSize;
+    m_header.chunkCount = (sourceSize + chunkSize - 1) / chunkSize;
+    m_refs.assign(static_cast<size_t>(m_header.chunkCount), ChunkRef{});
+    m_run = run;
+    m_storedChunks = 0;
+    m_dedupChunks = 0;
+    m_zeroChunks = 0;
+    m_storedBytes = 0;
+}
+
+ChunkRef* ChunkManifest::getRefs(LONGLONG firstChunk)
+{
+    return m_refs.data() + firstChunk;
+}
+
+void ChunkManifest::CountChunks(LONGLONG stored, LONGLONG deduped, LONGLONG zero, ULONGLONG storedBytes)
+{
+    m_storedChunks.fetch_add(stored, std::memory_order_relaxed);
+    m_dedupChunks.fetch_add(deduped, std::memory_order_relaxed);
+    m_zeroChunks.fetch_add(zero, std::memory_order_relaxed);
+    m_storedBytes.fetch_add(storedBytes, std::memory_order_relaxed);
+}
+
+bool ChunkManifest::Save(LPCWSTR path)
+{
+    LOG_DEBUG(L"Inside ChunkManifest::Save\n");
+    if (path == nullptr || m_header.magic != CHUNK_MANIFEST_MAGIC) {
+        LOG_ERROR(L"ChunkManifest::Save: Manifest was not created.\n");
+        LOG_DEBUG(L"End of ChunkManifest::Save\n");
+        return false;
+    }
+    m_header.storedChunks = getStoredChunks();
+    m_header.dedupChunks = getDedupChunks();
+    m_header.zeroChunks = getZeroChunks();
+    m_header.storedBytes = getStoredBytes();
+
+    // Write next to the manifest and rename over it, so a crash never leaves a half written manifest behind
+    std::wstring finalPath = path;
+    std::wstring tempPath = finalPath + L".tmp";
+    HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"ChunkManifest::Save: Failed to create %s. Error: %d\n", tempPath.c_str(), GetLastError());
+        LOG_DEBUG(L"End of ChunkManifest::Save\n");
+        return false;
+    }
+
+    bool success = true;
+    DWORD bytesWritten = 0;
+    if (!WriteFile(hFile, &m_header, sizeof(m_header), &bytesWritten, nullptr) || bytesWritten != sizeof(m_header)) {
+        success = false;
+    }
+    const char* src = reinterpret_cast<const char*>(m_refs.data());
+    ULONGLONG remaining = m_refs.size() * sizeof(ChunkRef);
+    while (success && remaining > 0) {
+        DWORD chunk = static_cast<DWORD>(remaining < (64ULL * 1024 * 1024) ? remaining : (64ULL * 1024 * 1024));
+        if (!WriteFile(hFile, src, chunk, &bytesWritten, nullptr) || bytesWritten != chunk) {
+            success = false;
+            break;
+        }
+        src += chunk;
+        remaining -= chunk;
+    }
+    if (success && !FlushFileBuffers(hFile)) {
+        success = false;
+    }
+    if (!success) {
+        LOG_ERROR(L"ChunkManifest::Save: Failed to write %s. Error: %d\n", tempPath.c_str(), GetLastError());
+    }
+    CloseHandle(hFile);
+
+    if (success && !MoveFileExW(tempPath.c_str(), finalPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG_ERROR(L"ChunkManifest::Save: Failed to replace %s. Error: %d\n", finalPath.c_str(), GetLastError());
+        success = false;
+    }
+    if (!success) {
+        DeleteFileW(tempPath.c_str());
+    }
+    else {
+        LOG_INFO(L"ChunkManifest::Save: Saved the references of %lld chunks to %s.\n", m_header.chunkCount, finalPath.c_str());
+    }
+    LOG_DEBUG(L"End of ChunkManifest::Save\n");
+    return success;
+}
+
+bool ChunkManifest::Load(LPCWSTR path)
+{
+    LOG_DEBUG(L"Inside ChunkManifest::Load\n");
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"ChunkManifest::Load: Failed to open %s. Error: %d\n", path, GetLastError());
+        LOG_DEBUG(L"End of ChunkManifest::Load\n");
+        return false;
+    }
+
+    ChunkManifestHeader fileHeader = {};
+    LARGE_INTEGER fileSize = {};
+    DWORD bytesRead = 0;
+    if (!GetFileSizeEx(hFile, &fileSize) || !ReadFile(hFile, &fileHeader, sizeof(fileHeader), &bytesRead, nullptr) || bytesRead != sizeof(fileHeader) ||
+        fileHeader.magic != CHUNK_MANIFEST_MAGIC || fileHeader.version != CHUNK_MANIFEST_VERSION || fileHeader.chunkSize == 0 || fileHeader.chunkCount < 0 ||
+        fileSize.QuadPart != static_cast<LONGLONG>(sizeof(fileHeader) + fileHeader.chunkCount * sizeof(ChunkRef))) {
+        LOG_ERROR(L"ChunkManifest::Load: %s is not a valid chunk manifest.\n", path);
+        CloseHandle(hFile);
+        LOG_DEBUG(L"End of ChunkManifest::Load\n");
+        return false;
+    }
+
+    std::vector<ChunkRef> refs(static_cast<size_t>(fileHeader.chunkCount));
+    char* dst = reinterpret_cast<char*>(refs.data());
+    ULONGLONG remaining = refs.size() * sizeof(ChunkRef);
+    while (remaining > 0) {
+        DWORD chunk = static_cast<DWORD>(remaining < (64ULL * 1024 * 1024) ? remaining : (64ULL * 1024 * 1024));
+        if (!ReadFile(hFile, dst, chunk, &bytesRead, nullptr) || bytesRead != chunk) {
+            LOG_ERROR(L"ChunkManifest::Load: Failed to read %s. Error: %d\n", path, GetLastError());
+            CloseHandle(hFile);
+            LOG_DEBUG(L"End of ChunkManifest::Load\n");
+            return false;
+        }
+        dst += chunk;
+        remaining -= chunk;
+    }
+    CloseHandle(hFile);
+
+    m_header = fileHeader;
+    m_refs.swap(refs);
+    m_run = 0;
+    m_storedChunks = fileHeader.storedChunks;
+    m_dedupChunks = fileHeader.dedupChunks;
+    m_zeroChunks = fileHeader.zeroChunks;
+    m_storedBytes = fileHeader.storedBytes;
+    LOG_DEBUG(L"End of ChunkManifest::Load\n");
+    return true;
+}
+
+//Getters
+bool ChunkStore::isOpen() const
+{
+    return m_header != nullptr;
+}
+
+DWORD ChunkStore::getChunkSize() const
+{
+    return m_header->chunkSize;
+}
+
+DWORD ChunkStore::getSectorSize() const
+{
+    return m_header->sectorSize;
+}
+
+ULONGLONG ChunkStore::getStoreId() const
+{
+    return m_header->storeId;
+}
+
+LONGLONG ChunkStore::getDataEnd() const
+{
+    return m_header->dataEnd;
+}
+
+std::wstring ChunkStore::getIndexPath() const
+{
+    return m_dir + L"\\index.fbx";
+}
+
+std::wstring ChunkStore::getDataPath() const
+{
+    return m_dir + L"\\chunks.dat";
+}
+
+bool ChunkStore::MapFile(LPCWSTR path, DWORD disposition, ULONGLONG size, MappedFile& file)
+{
+    // Not shared, which also keeps a second process off the store
+    file.hFile = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file.hFile == INVALID_HANDLE_VALUE) {
+        if (GetLastError() == ERROR_SHARING_VIOLATION) {
+            LOG_ERROR(L"ChunkStore::MapFile: %s is in use by another process.\n", path);
+        }
+        else {
+            LOG_ERROR(L"ChunkStore::MapFile: Failed to open %s. Error: %d\n", path, GetLastError());
+        }
+        return false;
+    }
+
+    LARGE_INTEGER mappingSize = {};
+    if (size == 0 && !GetFileSizeEx(file.hFile, &mappingSize)) {
+        LOG_ERROR(L"ChunkStore::MapFile: Failed to get the size of %s. Error: %d\n", path, GetLastError());
+        UnmapFile(file);
+        return false;
+    }
+    if (size != 0) {
+        mappingSize.QuadPart = static_cast<LONGLONG>(size);
+    }
+    if (mappingSize.QuadPart < CHUNK_STORE_HEADER_SIZE) {
+        LOG_ERROR(L"ChunkStore::MapFile: %s is too small to be a chunk index.\n", path);
+        UnmapFile(file);
+        return false;
+    }
+
+    // A mapping larger than the file extends it with zeros, which are free slots
+    file.hMapping = CreateFileMappingW(file.hFile, nullptr, PAGE_READWRITE, mappingSize.HighPart, mappingSize.LowPart, nullptr);
+    if (file.hMapping == nullptr) {
+        LOG_ERROR(L"ChunkStore::MapFile: CreateFileMappingW failed for %s. Error: %d\n", path, GetLastError());
+        UnmapFile(file);
+        return false;
+    }
+    file.view = static_cast<BYTE*>(MapViewOfFile(file.hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(mappingSize.QuadPart)));
+    if (file.view == nullptr) {
+        LOG_ERROR(L"ChunkStore::MapFile: MapViewOfFile failed for %s. Error: %d\n", path, GetLastError());
+        UnmapFile(file);
+        return false;
+    }
+    file.size = static_cast<ULONGLONG>(mappingSize.QuadPart);
+    return true;
+}
+
+void ChunkStore::UnmapFile(MappedFile& file)
+{
+    if (file.view != nullptr) {
+        UnmapViewOfFile(file.view);
+        file.view = nullptr;
+    }
+    if (file.hMapping != nullptr) {
+        CloseHandle(file.hMapping);
+        file.hMapping = nullptr;
+    }
+    if (file.hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(file.hFile);
+        file.hFile = INVALID_HANDLE_VALUE;
+    }
+    file.size = 0;
+}
+
+bool ChunkStore::AttachIndex()
+{
+    ChunkStoreHeader* header = reinterpret_cast<ChunkStoreHeader*>(m_index.view);
+    if (header->magic == CHUNK_STORE_MAGIC && header->version < CHUNK_STORE_VERSION) {
+        LOG_ERROR(L"ChunkStore::AttachIndex: %s was created by an older version with weaker fingerprints, back up into a new store.\n", getIndexPath().c_str());
+        return false;
+    }
+    if (header->magic != CHUNK_STORE_MAGIC || header->version != CHUNK_STORE_VERSION || header->chunkSize == 0 || header->sectorSize == 0 ||
+        header->slotCount == 0 || (header->slotCount & (header->slotCount - 1)) != 0 ||
+        m_index.size < CHUNK_STORE_HEADER_SIZE + header->slotCount * sizeof(ChunkIndexEntry)) {
+        LOG_ERROR(L"ChunkStore::AttachIndex: %s is not a valid chunk store index.\n", getIndexPath().c_str());
+        return false;
+    }
+    m_header = header;
+    m_slots = reinterpret_cast<ChunkIndexEntry*>(m_index.view + CHUNK_STORE_HEADER_SIZE);
+    m_slotMask = header->slotCount - 1;
+    return true;
+}
+
+bool ChunkStore::Open(LPCWSTR dir, DWORD chunkSize)
+{
+    LOG_DEBUG(L"Inside ChunkStore::Open\n");
+    Close();
+    if (dir == nullptr || *dir == L'\0') {
+        LOG_ERROR(L"ChunkStore::Open: Invalid parameters.\n");
+        LOG_DEBUG(L"End of ChunkStore::Open\n");
+        return false;
+    }
+    m_dir = dir;
+    while (m_dir.size() > 1 && (m_dir.back() == L'\\' || m_dir.back() == L'/')) {
+        m_dir.pop_back();
+    }
+    if (!CreateDirectoryW(m_dir.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        LOG_ERROR(L"ChunkStore::Open: Failed to create %s. Error: %d\n", m_dir.c_str(), GetLastError());
+        LOG_DEBUG(L"End of ChunkStore::Open\n");
+        return false;
+    }
+
+    // Shared, every copy writes through a handle of its own (see OpenDataHandle)
+    std::wstring dataPath = getDataPath();
+    m_hData = CreateFileW(dataPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_hData == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"ChunkStore::Open: Failed to open %s. Error: %d\n", dataPath.c_str(), GetLastError());
+        LOG_DEBUG(L"End of ChunkStore::Open\n");
+        return false;
+    }
+
+    std::wstring indexPath = getIndexPath();
+    if (GetFileAttributesW(indexPath.c_str()) == INVALID_FILE_ATTRIBUTES) {
+        if (chunkSize == 0) {
+            chunkSize = DEFAULT_CHUNK_SIZE_KB * 1024;
+        }
+        DWORD sectorSize = m_diskUtils.GetFileSectorSize(m_hData);
+        if (sectorSize == 0 || chunkSize < MIN_CHUNK_SIZE_KB * 1024 || chunkSize > MAX_CHUNK_SIZE_KB * 1024 ||
+            (chunkSize & (chunkSize - 1)) != 0 || chunkSize % sectorSize != 0) {
+            LOG_ERROR(L"ChunkStore::Open: Chunk size %u KB must be a power of two between %d KB and %d KB and a multiple of the %u byte sector of %s.\n",
+                chunkSize / 1024, MIN_CHUNK_SIZE_KB, MAX_CHUNK_SIZE_KB, sectorSize, m_dir.c_str());
+            Close();
+            LOG_DEBUG(L"End of ChunkStore::Open\n");
+            return false;
+        }
+        BYTE fingerprintKey[CHUNK_FINGERPRINT_KEY_SIZE];
+        if (!BCRYPT_SUCCESS(BCryptGenRandom(nullptr, fingerprintKey, sizeof(fingerprintKey), BCRYPT_USE_SYSTEM_PREFERRED_RNG))) {
+            LOG_ERROR(L"ChunkStore::Open: Failed to draw the fingerprint key of a new store.\n");
+            Close();
+            LOG_DEBUG(L"End of ChunkStore::Open\n");
+            return false;
+        }
+        if (!MapFile(indexPath.c_str(), CREATE_NEW, CHUNK_STORE_HEADER_SIZE + static_cast<ULONGLONG>(CHUNK_INDEX_MIN_SLOTS) * sizeof(ChunkIndexEntry), m_index)) {
+            Close();
+            LOG_DEBUG(L"End of ChunkStore::Open\n");
+            return false;
+        }
+
+        FILETIME now = {};
+        GetSystemTimeAsFileTime(&now);
+        ULONGLONG idSeed[2] = { (static_cast<ULONGLONG>(now.dwHighDateTime) << 32) | now.dwLowDateTime, GetTickCount64() ^ GetCurrentProcessId() };
+        ChunkStoreHeader* header = reinterpret_cast<ChunkStoreHeader*>(m_index.view);
+        header->magic = CHUNK_STORE_MAGIC;
+        header->version = CHUNK_STORE_VERSION;
+        header->chunkSize = chunkSize;
+        header->sectorSize = sectorSize;
+        header->storeId = HashUtils::Hash64(idSeed, sizeof(idSeed));
+        header->slotCount = CHUNK_INDEX_MIN_SLOTS;
+        header->nextRun = 1;
+        memcpy(header->fingerprintKey, fingerprintKey, sizeof(fingerprintKey));
+        SecureZeroMemory(fingerprintKey, sizeof(fingerprintKey));
+        if (!FlushViewOfFile(m_index.view, 0) || !FlushFileBuffers(m_index.hFile)) {
+            LOG_ERROR(L"ChunkStore::Open: Failed to initialize %s. Error: %d\n", indexPath.c_str(), GetLastError());
+            Close();
+            DeleteFileW(indexPath.c_str());
+            LOG_DEBUG(L"End of ChunkStore::Open\n");
+            return false;
+        }
+        LOG_INFO(L"ChunkStore::Open: Created a chunk store with %u KB chunks in %s.\n", chunkSize / 1024, m_dir.c_str());
+    }
+    else if (!MapFile(indexPath.c_str(), OPEN_EXISTING, 0, m_index)) {
+        Close();
+        LOG_DEBUG(L"End of ChunkStore::Open\n");
+        return false;
+    }
+
+    if (!AttachIndex()) {
+        Close();
+        LOG_DEBUG(L"End of ChunkStore::Open\n");
+        return false;
+    }
+    if (chunkSize != 0 && chunkSize != m_header->chunkSize) {
+        LOG_WARNING(L"ChunkStore::Open: %s was created with %u KB chunks, which it keeps using.\n", m_dir.c_str(), m_header->chunkSize / 1024);
+    }
+
+    std::lock_guard<std::mutex> lock(m_runLock);
+    if (m_header->activeRuns != 0 || m_header->needsRebuild != 0) {
+        // Entries of a run that never committed may point at chunks that were never written
+        LOG_WARNING(L"ChunkStore::Open: %s holds entries of runs that did not commit, dropping them from the index.\n", m_dir.c_str());
+        if (!Rebuild(m_header->slotCount)) {
+            Close();
+            LOG_DEBUG(L"End of ChunkStore::Open\n");
+            return false;
+        }
+    }
+    // Space preallocated for a run that did not end is given back
+    if (!ResizeData()) {
+        LOG_WARNING(L"ChunkStore::Open: Failed to trim %s to the chunks it holds.\n", dataPath.c_str());
+    }
+
+    LOG_INFO(L"ChunkStore::Open: %s holds %llu chunks (%lld MB) of %u KB, %u runs recorded.\n",
+        m_dir.c_str(), m_header->occupiedSlots, m_header->dataEnd / (1024 * 1024), m_header->chunkSize / 1024, m_header->nextRun - 1);
+    LOG_DEBUG(L"End of ChunkStore::Open\n");
+    return true;
+}
+
+HANDLE ChunkStore::OpenDataHandle()
+{
+    LOG_DEBUG(L"Inside ChunkStore::OpenDataHandle\n");
+    std::wstring dataPath = getDataPath();
+    HANDLE hFile = CreateFileW(dataPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+        FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"ChunkStore::OpenDataHandle: Failed to open %s. Error: %d\n", dataPath.c_str(), GetLastError());
+    }
+    LOG_DEBUG(L"End of ChunkStore::OpenDataHandle\n");
+    return hFile;
+}
+
+bool ChunkStore::Rebuild(ULONGLONG slotCount)
+{
+    LOG_DEBUG(L"Inside ChunkStore::Rebuild\n");
+    std::wstring indexPath = getIndexPath();
+    std::wstring tempPath = indexPath + L".tmp";
+    MappedFile rebuilt;
+    if (!MapFile(tempPath.c_str(), CREATE_ALWAYS, CHUNK_STORE_HEADER_SIZE + slotCount * sizeof(ChunkIndexEntry), rebuilt)) {
+        LOG_DEBUG(L"End of ChunkStore::Rebuild\n");
+        return false;
+    }
+
+    ChunkStoreHeader* header = reinterpret_cast<ChunkStoreHeader*>(rebuilt.view);
+    memcpy(header, m_header, sizeof(ChunkStoreHeader));
+    header->slotCount = slotCount;
+    header->activeRuns = 0;
+    header->needsRebuild = 0;
+    // Every entry kept is committed, so they can share run 1 and the numbers of the runs before are free again
+    memset(header->committedRuns, 0, sizeof(header->committedRuns));
+    header->committedRuns[0] = 1ULL << 1;
+    header->nextRun = 2;
+
+    ChunkIndexEntry* slots = reinterpret_cast<ChunkIndexEntry*>(rebuilt.view + CHUNK_STORE_HEADER_SIZE);
+    const ULONGLONG mask = slotCount - 1;
+    ULONGLONG kept = 0;
+    for (ULONGLONG i = 0; i < m_header->slotCount; ++i) {
+        const ChunkIndexEntry& entry = m_slots[i];
+        if (entry.keyHigh == 0 || entry.run == 0 || entry.offset < 0 || !IsCommitted(entry.run)) {
+            continue;
+        }
+        ULONGLONG pos = entry.keyLow & mask;
+        while (slots[pos].keyHigh != 0) {
+            pos = (pos + 1) & mask;
+        }
+        slots[pos].keyHigh = entry.keyHigh;
+        slots[pos].keyLow = entry.keyLow;
+        slots[pos].offset = entry.offset;
+        slots[pos].length = entry.length;
+        slots[pos].run = 1;
+        ++kept;
+    }
+    header->occupiedSlots = kept;
+
+    bool success = FlushViewOfFile(rebuilt.view, 0) && FlushFileBuffers(rebuilt.hFile);
+    if (!success) {
+        LOG_ERROR(L"ChunkStore::Rebuild: Failed to write %s. Error: %d\n", tempPath.c_str(), GetLastError());
+    }
+    UnmapFile(rebuilt);
+    if (!success) {
+        DeleteFileW(tempPath.c_str());
+        LOG_DEBUG(L"End of ChunkStore::Rebuild\n");
+        return false;
+    }
+
+    UnmapFile(m_index);
+    m_header = nullptr;
+    m_slots = nullptr;
+    if (!MoveFileExW(tempPath.c_str(), indexPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG_ERROR(L"ChunkStore::Rebuild: Failed to replace %s. Error: %d\n", indexPath.c_str(), GetLastError());
+        DeleteFileW(tempPath.c_str());
+        success = false;
+    }
+    // The old index is mapped again if the new one could not replace it
+    if (!MapFile(indexPath.c_str(), OPEN_EXISTING, 0, m_index) || !AttachIndex()) {
+        UnmapFile(m_index);
+        LOG_ERROR(L"ChunkStore::Rebuild: Failed to map %s again, the store is closed.\n", indexPath.c_str());
+        LOG_DEBUG(L"End of ChunkStore::Rebuild\n");
+        return false;
+    }
+    if (success) {
+        LOG_INFO(L"ChunkStore::Rebuild: Index rebuilt with %llu slots, %llu committed chunks kept.\n", slotCount, kept);
+    }
+    LOG_DEBUG(L"End of ChunkStore::Rebuild\n");
+    return success;
+}
+
+bool ChunkStore::ResizeData()
+{
+    const LONGLONG size = m_header->dataEnd + m_reservedBytes;
+    LARGE_INTEGER currentSize = {};
+    if (!GetFileSizeEx(m_hData, &currentSize)) {
+        LOG_ERROR(L"ChunkStore::ResizeData: Failed to get the size of the chunk data. Error: %d\n", GetLastError());
+        return false;
+    }
+    // While copies write, the end of file only moves forward, so their writes stay asynchronous
+    if (currentSize.QuadPart == size || (m_activeRuns > 0 && currentSize.QuadPart > size)) {
+        return true;
+    }
+
+    if (m_activeRuns > 0) {
+        FILE_ALLOCATION_INFO allocation = {};
+        allocation.AllocationSize.QuadPart = size;
+        if (!SetFileInformationByHandle(m_hData, FileAllocationInfo, &allocation, sizeof(allocation))) {
+            LOG_ERROR(L"ChunkStore::ResizeData: Failed to allocate %lld MB for new chunks. Error: %d\n", (size - currentSize.QuadPart) / (1024 * 1024), GetLastError());
+            return false;
+        }
+    }
+    FILE_END_OF_FILE_INFO endOfFile = {};
+    endOfFile.EndOfFile.QuadPart = size;
+    if (!SetFileInformationByHandle(m_hData, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile))) {
+        LOG_ERROR(L"ChunkStore::ResizeData: Failed to set the end of the chunk data to %lld bytes. Error: %d\n", size, GetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool ChunkStore::Fingerprint(const char* data, DWORD length, ChunkKey& key) const
+{
+    // A matching fingerprint is trusted without comparing the stored bytes, so it has to be collision resistant:
+    // HMAC-SHA256 keyed with the store's random key. Without the key, chunks cannot be crafted to collide with
+    // chunks of other backups. The top bit keeps keyHigh from ever reading as a free slot.
+    BYTE digest[32];
+    NTSTATUS status = BCryptHash(BCRYPT_HMAC_SHA256_ALG_HANDLE, m_header->fingerprintKey, CHUNK_FINGERPRINT_KEY_SIZE,
+        reinterpret_cast<PUCHAR>(const_cast<char*>(data)), length, digest, sizeof(digest));
+    if (!BCRYPT_SUCCESS(status)) {
+        LOG_ERROR(L"ChunkStore::Fingerprint: BCryptHash failed with status 0x%08X.\n", static_cast<unsigned int>(status));
+        return false;
+    }
+    memcpy(&key.high, digest, sizeof(key.high));
+    memcpy(&key.low, digest + sizeof(key.high), sizeof(key.low));
+    key.high |= 1ULL << 63;
+    return true;
+}
+
+bool ChunkStore::IsCommitted(DWORD run) const
+{
+    return run < CHUNK_STORE_MAX_RUNS && ((m_header->committedRuns[run / 64] >> (run % 64)) & 1) != 0;
+}
+
+bool ChunkStore::FindOrClaim(DWORD run, const ChunkKey& key, DWORD length, ULONGLONG& slot, bool& claimed)
+{
+    ULONGLONG pos = key.low & m_slotMask;
+    for (ULONGLONG probes = 0; probes <= m_slotMask; ++probes, pos = (pos + 1) & m_slotMask) {
+        ChunkIndexEntry& entry = m_slots[pos];
+        LONGLONG high = entry.keyHigh;
+        if (high == 0) {
+            high = InterlockedCompareExchange64(&entry.keyHigh, static_cast<LONGLONG>(key.high), 0);
+            if (high == 0) {
+                entry.keyLow = key.low;
+                entry.length = length;
+                entry.offset = -1;
+                // Publishes the entry, a later chunk of this run with the same content now matches it
+                InterlockedExchange(&entry.run, static_cast<LONG>(run));
+                slot = pos;
+                claimed = true;
+                return true;
+            }
+        }
+        if (high != static_cast<LONGLONG>(key.high)) {
+            continue;
+        }
+
+        // Claimed by another thread a moment ago, which is only filling in the fields above
+        LONG entryRun;
+        while ((entryRun = entry.run) == 0) {
+            YieldProcessor();
+        }
+        // Entries of runs still active elsewhere may never be committed, their chunks are stored again
+        if (entry.keyLow == key.low && entry.length == length && (static_cast<DWORD>(entryRun) == run || IsCommitted(static_cast<DWORD>(entryRun)))) {
+            slot = pos;
+            claimed = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ChunkStore::BeginRun(LONGLONG sourceSize, ChunkManifest& manifest)
+{
+    LOG_DEBUG(L"Inside ChunkStore::BeginRun\n");
+    std::unique_lock<std::mutex> lock(m_runLock);
+    if (!isOpen() || sourceSize <= 0) {
+        LOG_ERROR(L"ChunkStore::BeginRun: Invalid parameters.\n");
+        LOG_DEBUG(L"End of ChunkStore::BeginRun\n");
+        return false;
+    }
+
+    const DWORD chunkSize = m_header->chunkSize;
+    const LONGLONG chunks = (sourceSize + chunkSize - 1) / chunkSize;
+    // Every chunk of the source may turn out to be new, the run reserves a slot and room for each
+    const LONGLONG bytes = chunks * chunkSize;
+    if (m_activeRuns == 0 && m_header->needsRebuild != 0 && !Rebuild(m_header->slotCount)) {
+        LOG_WARNING(L"ChunkStore::BeginRun: Could not drop the entries of failed runs from the index.\n");
+    }
+    for (;;) {
+        if (!isOpen()) {
+            LOG_ERROR(L"ChunkStore::BeginRun: The store was closed.\n");
+            LOG_DEBUG(L"End of ChunkStore::BeginRun\n");
+            return false;
+        }
+        const ULONGLONG needed = m_header->occupiedSlots + m_reservedSlots + chunks;
+        const bool indexFull = needed * 100 > m_header->slotCount * CHUNK_INDEX_MAX_LOAD_PERCENT;
+        const bool runsUsedUp = m_header->nextRun >= CHUNK_STORE_MAX_RUNS;
+        if (!indexFull && !runsUsedUp) {
+            break;
+        }
+        if (m_activeRuns == 0) {
+            ULONGLONG slotCount = m_header->slotCount;
+            while (needed * 100 > slotCount * CHUNK_INDEX_MAX_LOAD_PERCENT) {
+                slotCount *= 2;
+            }
+            if (indexFull) {
+                LOG_INFO(L"ChunkStore::BeginRun: Growing the index from %llu to %llu slots.\n", m_header->slotCount, slotCount);
+            }
+            else {
+                LOG_INFO(L"ChunkStore::BeginRun: %s used up its %d run numbers, renumbering the committed runs.\n", m_dir.c_str(), CHUNK_STORE_MAX_RUNS);
+            }
+            if (!Rebuild(slotCount)) {
+                LOG_ERROR(L"ChunkStore::BeginRun: Failed to rebuild the index.\n");
+                LOG_DEBUG(L"End of ChunkStore::BeginRun\n");
+                return false;
+            }
+            continue;
+        }
+        // Slots are claimed without a lock, so the index is only rebuilt once nobody is claiming
+        LOG_INFO(L"ChunkStore::BeginRun: The index has no room for another run, waiting for the active ones to end.\n");
+        m_runEnded.wait(lock);
+    }
+
+    const DWORD run = m_header->nextRun++;
+    ++m_header->activeRuns;
+    ++m_activeRuns;
+    m_reservedSlots += chunks;
+    m_reservedBytes += bytes;
+    manifest.Create(run, m_header->storeId, chunkSize, sourceSize);
+
+    // From here on a crash leaves activeRuns set, so the next Open drops whatever this run added
+    if (!FlushViewOfFile(m_header, sizeof(ChunkStoreHeader)) || !FlushFileBuffers(m_index.hFile)) {
+        LOG_ERROR(L"ChunkStore::BeginRun: Failed to record the run in %s. Error: %d\n", getIndexPath().c_str(), GetLastError());
+        m_header->needsRebuild = 1;
+        EndRun(manifest);
+        LOG_DEBUG(L"End of ChunkStore::BeginRun\n");
+        return false;
+    }
+    if (!ResizeData()) {
+        m_header->needsRebuild = 1;
+        EndRun(manifest);
+        LOG_DEBUG(L"End of ChunkStore::BeginRun\n");
+        return false;
+    }
+    LOG_INFO(L"ChunkStore::BeginRun: Run %u started for %lld chunks.\n", run, chunks);
+    LOG_DEBUG(L"End of ChunkStore::BeginRun\n");
+    return true;
+}
+
+bool ChunkStore::StoreChunks(ChunkManifest& manifest, LONGLONG firstChunk, char* data, DWORD length, ChunkWrite& write)
+{
+    const DWORD chunkSize = m_header->chunkSize;
+    const DWORD sectorSize = m_header->sectorSize;
+    const DWORD run = manifest.getRun();
+    const DWORD count = (length + chunkSize - 1) / chunkSize;
+    write = ChunkWrite{};
+    if (count > CHUNK_MAX_PER_CALL || firstChunk < 0 || firstChunk + count > manifest.getChunkCount()) {
+        LOG_ERROR(L"ChunkStore::StoreChunks: Chunks %lld to %lld are out of range.\n", firstChunk, firstChunk + count);
+        return false;
+    }
+
+    ChunkRef* refs = manifest.getRefs(firstChunk);
+    ChunkKey keys[CHUNK_PROBE_BATCH];
+    DWORD newChunks[CHUNK_MAX_PER_CALL];
+    ULONGLONG newSlots[CHUNK_MAX_PER_CALL];
+    DWORD newCount = 0;
+    LONGLONG dedupCount = 0;
+    LONGLONG zeroCount = 0;
+    bool success = true;
+
+    for (DWORD first = 0; first < count && success; first += CHUNK_PROBE_BATCH) {
+        const DWORD batch = (count - first < CHUNK_PROBE_BATCH) ? (count - first) : CHUNK_PROBE_BATCH;
+
+        // Fingerprint the whole batch and prefetch each home slot, so the probes below rarely wait on memory
+        for (DWORD i = 0; i < batch; ++i) {
+            const DWORD chunk = first + i;
+            const DWORD chunkLength = (length - chunk * chunkSize < chunkSize) ? (length - chunk * chunkSize) : chunkSize;
+            const char* chunkData = data + static_cast<size_t>(chunk) * chunkSize;
+            if (BufferUtils::IsAllZero(chunkData, chunkLength)) {
+                keys[i].high = 0;
+                continue;
+            }
+            if (!Fingerprint(chunkData, chunkLength, keys[i])) {
+                success = false;
+                break;
+            }
+            _mm_prefetch(reinterpret_cast<const char*>(&m_slots[keys[i].low & m_slotMask]), _MM_HINT_T0);
+        }
+        if (!success) {
+            break;
+        }
+
+        for (DWORD i = 0; i < batch; ++i) {
+            const DWORD chunk = first + i;
+            const DWORD chunkLength = (length - chunk * chunkSize < chunkSize) ? (length - chunk * chunkSize) : chunkSize;
+            if (keys[i].high == 0) {
+                refs[chunk] = { 0, chunkLength, CHUNK_REF_ZERO };
+                ++zeroCount;
+                continue;
+            }
+            ULONGLONG slot = 0;
+            bool claimed = false;
+            if (!FindOrClaim(run, keys[i], chunkLength, slot, claimed)) {
+                LOG_ERROR(L"ChunkStore::StoreChunks: The chunk index of %s is full.\n", m_dir.c_str());
+                success = false;
+                break;
+            }
+            refs[chunk] = { static_cast<LONGLONG>(slot), chunkLength, CHUNK_REF_STORED };
+            if (claimed) {
+                newChunks[newCount] = chunk;
+                newSlots[newCount] = slot;
+                ++newCount;
+            }
+            else {
+                ++dedupCount;
+            }
+        }
+    }
+
+    // The new chunks get one piece of the data file, so they leave in a single write
+    for (DWORD k = 0; k < newCount; ++k) {
+        const DWORD chunkLength = refs[newChunks[k]].length;
+        write.newBytes += chunkLength;
+        write.bytesToWrite += ((chunkLength + sectorSize - 1) / sectorSize) * sectorSize;
+    }
+    if (newCount > 0) {
+        write.storeOffset = InterlockedExchangeAdd64(&m_header->dataEnd, write.bytesToWrite);
+        DWORD cursor = 0;
+        for (DWORD k = 0; k < newCount; ++k) {
+            const DWORD chunkLength = refs[newChunks[k]].length;
+            const DWORD paddedLength = ((chunkLength + sectorSize - 1) / sectorSize) * sectorSize;
+            // Chunks only ever move toward the front, a padded chunk is never longer than the chunk size
+            char* src = data + static_cast<size_t>(newChunks[k]) * chunkSize;
+            if (src != data + cursor) {
+                memmove(data + cursor, src, chunkLength);
+            }
+            memset(data + cursor + chunkLength, 0, paddedLength - chunkLength);
+            m_slots[newSlots[k]].offset = write.storeOffset + cursor;
+            cursor += paddedLength;
+        }
+    }
+    manifest.CountChunks(newCount, dedupCount, zeroCount, write.bytesToWrite);
+    return success;
+}
+
+bool ChunkStore::EndRun(const ChunkManifest& manifest)
+{
+    const LONGLONG chunks = manifest.getChunkCount();
+    m_header->occupiedSlots += manifest.getStoredChunks();
+    --m_header->activeRuns;
+    --m_activeRuns;
+    m_reservedSlots -= chunks;
+    m_reservedBytes -= chunks * m_header->chunkSize;
+    if (!ResizeData()) {
+        LOG_WARNING(L"ChunkStore::EndRun: Failed to resize the chunk data of %s.\n", m_dir.c_str());
+    }
+    bool success = FlushViewOfFile(m_header, sizeof(ChunkStoreHeader)) && FlushFileBuffers(m_index.hFile);
+    if (!success) {
+        LOG_ERROR(L"ChunkStore::EndRun: Failed to flush %s. Error: %d\n", getIndexPath().c_str(), GetLastError());
+    }
+    m_runEnded.notify_all();
+    return success;
+}
+
+bool ChunkStore::CommitRun(ChunkManifest& manifest)
+{
+    LOG_DEBUG(L"Inside ChunkStore::CommitRun\n");
+    const DWORD run = manifest.getRun();
+
+    // Chunks first, then the entries pointing at them, then the bit making those entries count
+    bool durable = FlushFileBuffers(m_hData) != FALSE;
+    if (!durable) {
+        LOG_ERROR(L"ChunkStore::CommitRun: Failed to flush %s. Error: %d\n", getDataPath().c_str(), GetLastError());
+    }
+    else if (!FlushViewOfFile(m_index.view, 0) || !FlushFileBuffers(m_index.hFile)) {
+        LOG_ERROR(L"ChunkStore::CommitRun: Failed to flush %s. Error: %d\n", getIndexPath().c_str(), GetLastError());
+        durable = false;
+    }
+    if (!durable) {
+        AbortRun(manifest);
+        LOG_DEBUG(L"End of ChunkStore::CommitRun\n");
+        return false;
+    }
+
+    ChunkRef* refs = manifest.getRefs(0);
+    for (LONGLONG i = 0; i < manifest.getChunkCount(); ++i) {
+        if ((refs[i].flags & CHUNK_REF_STORED) != 0) {
+            refs[i].offset = m_slots[refs[i].offset].offset;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_runLock);
+    m_header->committedRuns[run / 64] |= 1ULL << (run % 64);
+    bool success = EndRun(manifest);
+    if (success) {
+        LOG_INFO(L"ChunkStore::CommitRun: Run %u committed, %lld new chunks (%llu MB), %lld deduplicated, %lld zero.\n",
+            run, manifest.getStoredChunks(), manifest.getStoredBytes() / (1024 * 1024), manifest.getDedupChunks(), manifest.getZeroChunks());
+    }
+    LOG_DEBUG(L"End of ChunkStore::CommitRun\n");
+    return success;
+}
+
+void ChunkStore::AbortRun(ChunkManifest& manifest)
+{
+    LOG_DEBUG(L"Inside ChunkStore::AbortRun\n");
+    std::lock_guard<std::mutex> lock(m_runLock);
+    // Its entries stay in the index, never matching, until the next rebuild drops them
+    m_header->needsRebuild = 1;
+    EndRun(manifest);
+    LOG_WARNING(L"ChunkStore::AbortRun: Run %u did not complete, none of its chunks count as stored.\n", manifest.getRun());
+    LOG_DEBUG(L"End of ChunkStore::AbortRun\n");
+}
+
+void ChunkStore::Close()
+{
+    UnmapFile(m_index);
+    m_header = nullptr;
+    m_slots = nullptr;
+    m_slotMask = 0;
+    if (m_hData != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hData);
+        m_hData = INVALID_HANDLE_VALUE;
+    }
+}
@@ -0,0 +1,129 @@
+#include "CompletionPool.h"
+#include "BlockCopier.h"
+
+//Getters
+HANDLE CompletionPool::getCompletionPort() const
+{
+    return m_hIocp;
+}
+
+int CompletionPool::getThreadCount() const
+{
+    return static_cast<int>(m_threads.size());
+}
+
+bool CompletionPool::Start(int nThreads)
+{
+    LOG_DEBUG(L"Inside CompletionPool::Start\n");
+    Stop();
+    if (nThreads <= 0) {
+        nThreads = 1;
+    }
+    if (nThreads > MAX_POOL_THREADS) {
+        nThreads = MAX_POOL_THREADS;
+    }
+
+    m_hIocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, nThreads);
+    if (m_hIocp == nullptr) {
+        LOG_ERROR(L"CompletionPool::Start: Failed to create the I/O completion port. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of CompletionPool::Start\n");
+        return false;
+    }
+    m_threads.reserve(nThreads);
+    for (int i = 0; i < nThreads; ++i) {
+        m_threads.emplace_back(&CompletionPool::ThreadLoop, this);
+    }
+    LOG_INFO(L"CompletionPool::Start: %d completion threads started.\n", nThreads);
+    LOG_DEBUG(L"End of CompletionPool::Start\n");
+    return true;
+}
+
+CompletionRoute* CompletionPool::Attach(BlockCopier* copier)
+{
+    std::unique_ptr<CompletionMember> member(new CompletionMember());
+    InitializeSRWLock(&member->lock);
+    member->copier = copier;
+    for (int i = 0; i < POOL_ROUTES_PER_COPIER; ++i) {
+        member->routes[i].member = member.get();
+        // Fan-out keys map to themselves, the special keys count down from ~0
+        member->routes[i].key = (i <= FANOUT_MAX_DESTINATIONS) ? static_cast<ULONG_PTR>(i) : ~static_cast<ULONG_PTR>(i - FANOUT_MAX_DESTINATIONS - 1);
+    }
+    CompletionRoute* routes = member->routes;
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_members.push_back(std::move(member));
+    return routes;
+}
+
+void CompletionPool::Detach(CompletionRoute* routes)
+{
+    if (routes == nullptr) {
+        return;
+    }
+    CompletionMember* member = routes->member;
+    AcquireSRWLockExclusive(&member->lock);
+    member->copier = nullptr;
+    ReleaseSRWLockExclusive(&member->lock);
+}
+
+void CompletionPool::ThreadLoop()
+{
+    LOG_DEBUG(L"Inside CompletionPool::ThreadLoop\n");
+    OVERLAPPED_ENTRY entries[IOCP_DEQUEUE_BATCH];
+    bool shutdown = false;
+    while (!shutdown) {
+        ULONG numEntries = 0;
+        if (!GetQueuedCompletionStatusEx(m_hIocp, entries, IOCP_DEQUEUE_BATCH, &numEntries, INFINITE, FALSE)) {
+            LOG_ERROR(L"CompletionPool::ThreadLoop: GetQueuedCompletionStatusEx failed with error: %d. Thread ID: %d\n", GetLastError(), GetCurrentThreadId());
+            break;
+        }
+
+        int shutdownPackets = 0;
+        for (ULONG i = 0; i < numEntries; ++i) {
+            // A packet without OVERLAPPED is the shutdown signal posted by Stop
+            if (entries[i].lpOverlapped == nullptr) {
+                ++shutdownPackets;
+                continue;
+            }
+            CompletionRoute* route = reinterpret_cast<CompletionRoute*>(entries[i].lpCompletionKey);
+            CompletionMember* member = route->member;
+            AcquireSRWLockShared(&member->lock);
+            if (member->copier != nullptr) {
+                member->copier->OnPoolCompletion(entries[i], route->key);
+            }
+            else {
+                LOG_WARNING(L"CompletionPool::ThreadLoop: Dropped a completion of a copy that has ended.\n");
+            }
+            ReleaseSRWLockShared(&member->lock);
+        }
+
+        // Each thread must consume exactly one shutdown packet, hand back any extra ones taken in this batch
+        if (shutdownPackets > 0) {
+            shutdown = true;
+            for (int i = 1; i < shutdownPackets; ++i) {
+                PostQueuedCompletionStatus(m_hIocp, 0, 0, nullptr);
+            }
+        }
+    }
+    LOG_DEBUG(L"End of CompletionPool::ThreadLoop\n");
+}
+
+void CompletionPool::Stop()
+{
+    for (size_t i = 0; i < m_threads.size(); ++i) {
+        if (!PostQueuedCompletionStatus(m_hIocp, 0, 0, nullptr)) {
+            LOG_ERROR(L"CompletionPool::Stop: Failed to post shutdown packet to the completion port. Error: %d\n", GetLastError());
+        }
+    }
+    for (auto& t : m_threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    m_threads.clear();
+    if (m_hIocp != nullptr) {
+        CloseHandle(m_hIocp);
+        m_hIocp = nullptr;
+    }
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_members.clear();
+}
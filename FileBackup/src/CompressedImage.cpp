@@ -0,0 +1,308 @@
+#include "CompressedImage.h"
+
+#pragma comment(lib, "Cabinet.lib") // Compression API
+
+DWORD CompressedImage::GetAlgorithm(ImageCompression compression)
+{
+    return (compression == ImageCompression::RATIO) ? COMPRESS_ALGORITHM_LZMS : COMPRESS_ALGORITHM_XPRESS;
+}
+
+const wchar_t* CompressedImage::GetAlgorithmName(DWORD algorithm)
+{
+    switch (algorithm) {
+    case COMPRESS_ALGORITHM_XPRESS:
+        return L"XPRESS";
+    case COMPRESS_ALGORITHM_XPRESS_HUFF:
+        return L"XPRESS Huffman";
+    case COMPRESS_ALGORITHM_MSZIP:
+        return L"MSZIP";
+    case COMPRESS_ALGORITHM_LZMS:
+        return L"LZMS";
+    default:
+        return L"Unknown";
+    }
+}
+
+//Getters
+DWORD CompressedImage::getAlgorithm() const
+{
+    return m_header.algorithm;
+}
+
+DWORD CompressedImage::getBlockSize() const
+{
+    return m_header.blockSize;
+}
+
+LONGLONG CompressedImage::getBlockCount() const
+{
+    return m_header.blockCount;
+}
+
+LONGLONG CompressedImage::getSourceSize() const
+{
+    return m_header.sourceSize;
+}
+
+ULONGLONG CompressedImage::getStoredBytes() const
+{
+    if (m_hReadFile != INVALID_HANDLE_VALUE) {
+        return m_header.storedBytes;
+    }
+    return m_nextOffset.load(std::memory_order_acquire) - getDataStart();
+}
+
+DWORD CompressedImage::getSectorSize() const
+{
+    return m_header.sectorSize;
+}
+
+const CompressedImageChunk& CompressedImage::getChunk(LONGLONG blockNumber) const
+{
+    return m_chunks[static_cast<size_t>(blockNumber)];
+}
+
+ULONGLONG CompressedImage::getDataStart() const
+{
+    DWORD sectorSize = m_header.sectorSize;
+    return ((COMPRESSED_IMAGE_HEADER_SIZE + sectorSize - 1) / sectorSize) * sectorSize;
+}
+
+bool CompressedImage::Create(DWORD algorithm, DWORD blockSize, LONGLONG sourceSize, DWORD sectorSize)
+{
+    LOG_DEBUG(L"Inside CompressedImage::Create\n");
+    Close();
+    if (blockSize == 0 || sourceSize <= 0 || sectorSize == 0 || blockSize % sectorSize != 0) {
+        LOG_ERROR(L"CompressedImage::Create: Invalid parameters.\n");
+        LOG_DEBUG(L"End of CompressedImage::Create\n");
+        return false;
+    }
+
+    m_header = {};
+    m_header.magic = COMPRESSED_IMAGE_MAGIC;
+    m_header.version = COMPRESSED_IMAGE_VERSION;
+    m_header.algorithm = algorithm;
+    m_header.blockSize = blockSize;
+    m_header.sourceSize = sourceSize;
+    m_header.blockCount = (sourceSize + blockSize - 1) / blockSize;
+    m_header.sectorSize = sectorSize;
+    m_chunks.assign(static_cast<size_t>(m_header.blockCount), CompressedImageChunk{ 0, 0, 0 });
+
+    // Chunk data starts after the header area, which is written last
+    m_nextOffset.store(getDataStart(), std::memory_order_release);
+
+    LOG_INFO(L"CompressedImage::Create: %lld chunks of %d bytes, %s compression.\n", m_header.blockCount, blockSize, GetAlgorithmName(algorithm));
+    LOG_DEBUG(L"End of CompressedImage::Create\n");
+    return true;
+}
+
+DWORD CompressedImage::CompressChunk(COMPRESSOR_HANDLE compressor, const char* data, DWORD length, char* out, bool& compressed)
+{
+    compressed = false;
+    SIZE_T compressedSize = 0;
+    if (!Compress(compressor, data, length, out, length, &compressedSize)) {
+        DWORD err = GetLastError();
+        if (err != ERROR_INSUFFICIENT_BUFFER) { // Incompressible data does not fit, anything else is unexpected
+            LOG_WARNING(L"CompressedImage::CompressChunk: Compress failed with error: %d, storing the block uncompressed.\n", err);
+        }
+        return length;
+    }
+
+    // Only worth it when the chunk still shrinks after sector padding
+    DWORD sectorSize = m_header.sectorSize;
+    DWORD paddedSize = static_cast<DWORD>(((compressedSize + sectorSize - 1) / sectorSize) * sectorSize);
+    if (paddedSize >= length) {
+        return length;
+    }
+    compressed = true;
+    return static_cast<DWORD>(compressedSize);
+}
+
+ULONGLONG CompressedImage::ReserveChunk(LONGLONG blockNumber, DWORD storedLength, DWORD flags)
+{
+    DWORD sectorSize = m_header.sectorSize;
+    ULONGLONG paddedLength = ((static_cast<ULONGLONG>(storedLength) + sectorSize - 1) / sectorSize) * sectorSize;
+    ULONGLONG offset = m_nextOffset.fetch_add(paddedLength, std::memory_order_acq_rel);
+    if (blockNumber >= 0 && blockNumber < m_header.blockCount) {
+        m_chunks[static_cast<size_t>(blockNumber)] = { offset, storedLength, flags };
+    }
+    return offset;
+}
+
+// Synchronous write on a handle that may be bound to a completion port
+bool CompressedImage::WriteSync(HANDLE hFile, const void* data, DWORD length, ULONGLONG offset)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = static_cast<DWORD>((offset >> 32) & 0xFFFFFFFF);
+    overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (overlapped.hEvent == nullptr) {
+        LOG_ERROR(L"CompressedImage::WriteSync: Failed to create event. Error: %d\n", GetLastError());
+        return false;
+    }
+    // Setting the low order bit keeps the completion from being queued to the completion port
+    HANDLE hEvent = overlapped.hEvent;
+    overlapped.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(hEvent) | 1);
+
+    DWORD written = 0;
+    BOOL result = WriteFile(hFile, data, length, &written, &overlapped);
+    if (!result && GetLastError() == ERROR_IO_PENDING) {
+        result = GetOverlappedResult(hFile, &overlapped, &written, TRUE);
+    }
+    DWORD err = result ? ERROR_SUCCESS : GetLastError();
+    CloseHandle(hEvent);
+
+    if (!result || written != length) {
+        LOG_ERROR(L"CompressedImage::WriteSync: Write of %d bytes at offset %llu failed. Error: %d\n", length, offset, err);
+        return false;
+    }
+    return true;
+}
+
+bool CompressedImage::Finalize(HANDLE hFile)
+{
+    LOG_DEBUG(L"Inside CompressedImage::Finalize\n");
+    DWORD sectorSize = m_header.sectorSize;
+    ULONGLONG dataStart = getDataStart();
+    m_header.indexOffset = m_nextOffset.load(std::memory_order_acquire);
+    m_header.storedBytes = m_header.indexOffset - dataStart;
+
+    // Unbuffered writes need sector aligned buffers and lengths, VirtualAlloc gives page aligned zeroed memory
+    size_t indexBytes = m_chunks.size() * sizeof(CompressedImageChunk);
+    DWORD indexPadded = static_cast<DWORD>(((indexBytes + sectorSize - 1) / sectorSize) * sectorSize);
+    char* buffer = static_cast<char*>(VirtualAlloc(nullptr, (indexPadded > dataStart ? indexPadded : static_cast<SIZE_T>(dataStart)), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (buffer == nullptr) {
+        LOG_ERROR(L"CompressedImage::Finalize: Failed to allocate the index buffer. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of CompressedImage::Finalize\n");
+        return false;
+    }
+
+    bool result = true;
+    memcpy(buffer, m_chunks.data(), indexBytes);
+    if (!WriteSync(hFile, buffer, indexPadded, m_header.indexOffset)) {
+        LOG_ERROR(L"CompressedImage::Finalize: Failed to write the chunk index.\n");
+        result = false;
+    }
+    // The header goes last and only after the index is on disk, so it never points at a missing index
+    else if (!FlushFileBuffers(hFile)) {
+        LOG_ERROR(L"CompressedImage::Finalize: Failed to flush the image. Error: %d\n", GetLastError());
+        result = false;
+    }
+    else {
+        memset(buffer, 0, static_cast<size_t>(dataStart));
+        memcpy(buffer, &m_header, sizeof(m_header));
+        if (!WriteSync(hFile, buffer, static_cast<DWORD>(dataStart), 0)) {
+            LOG_ERROR(L"CompressedImage::Finalize: Failed to write the image header.\n");
+            result = false;
+        }
+    }
+    VirtualFree(buffer, 0, MEM_RELEASE);
+
+    if (result) {
+        LOG_INFO(L"CompressedImage::Finalize: Image holds %lld MB of source in %llu MB.\n", m_header.sourceSize / (1024 * 1024), m_header.storedBytes / (1024 * 1024));
+    }
+    LOG_DEBUG(L"End of CompressedImage::Finalize\n");
+    return result;
+}
+
+bool CompressedImage::Open(LPCWSTR path)
+{
+    LOG_DEBUG(L"Inside CompressedImage::Open\n");
+    Close();
+    m_hReadFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (m_hReadFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"CompressedImage::Open: Failed to open %s. Error: %d\n", path, GetLastError());
+        LOG_DEBUG(L"End of CompressedImage::Open\n");
+        return false;
+    }
+
+    DWORD bytesRead = 0;
+    if (!ReadFile(m_hReadFile, &m_header, sizeof(m_header), &bytesRead, nullptr) || bytesRead != sizeof(m_header) ||
+        m_header.magic != COMPRESSED_IMAGE_MAGIC || m_header.version != COMPRESSED_IMAGE_VERSION ||
+        m_header.blockSize == 0 || m_header.blockCount != (m_header.sourceSize + m_header.blockSize - 1) / m_header.blockSize) {
+        LOG_ERROR(L"CompressedImage::Open: %s is not a complete compressed image.\n", path);
+        Close();
+        LOG_DEBUG(L"End of CompressedImage::Open\n");
+        return false;
+    }
+
+    m_chunks.assign(static_cast<size_t>(m_header.blockCount), CompressedImageChunk{ 0, 0, 0 });
+    DWORD indexBytes = static_cast<DWORD>(m_chunks.size() * sizeof(CompressedImageChunk));
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(m_header.indexOffset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = static_cast<DWORD>((m_header.indexOffset >> 32) & 0xFFFFFFFF);
+    if (!ReadFile(m_hReadFile, m_chunks.data(), indexBytes, &bytesRead, &overlapped) || bytesRead != indexBytes) {
+        LOG_ERROR(L"CompressedImage::Open: Failed to read the chunk index of %s. Error: %d\n", path, GetLastError());
+        Close();
+        LOG_DEBUG(L"End of CompressedImage::Open\n");
+        return false;
+    }
+
+    if (!CreateDecompressor(m_header.algorithm, nullptr, &m_decompressor)) {
+        LOG_ERROR(L"CompressedImage::Open: CreateDecompressor failed for %s. Error: %d\n", GetAlgorithmName(m_header.algorithm), GetLastError());
+        Close();
+        LOG_DEBUG(L"End of CompressedImage::Open\n");
+        return false;
+    }
+    m_readBuf.resize(m_header.blockSize);
+
+    LOG_INFO(L"CompressedImage::Open: %s holds %lld blocks of %d bytes, %s compression.\n", path, m_header.blockCount, m_header.blockSize, GetAlgorithmName(m_header.algorithm));
+    LOG_DEBUG(L"End of CompressedImage::Open\n");
+    return true;
+}
+
+bool CompressedImage::ReadBlock(LONGLONG blockNumber, char* out, DWORD& length)
+{
+    length = 0;
+    if (m_hReadFile == INVALID_HANDLE_VALUE || blockNumber < 0 || blockNumber >= m_header.blockCount) {
+        LOG_ERROR(L"CompressedImage::ReadBlock: Block %lld is not in the image.\n", blockNumber);
+        return false;
+    }
+
+    LONGLONG remaining = m_header.sourceSize - blockNumber * m_header.blockSize;
+    DWORD sourceLength = static_cast<DWORD>(remaining < m_header.blockSize ? remaining : m_header.blockSize);
+    const CompressedImageChunk& chunk = m_chunks[static_cast<size_t>(blockNumber)];
+
+    // Zero and uncopied blocks have no chunk
+    if (chunk.storedLength == 0) {
+        memset(out, 0, sourceLength);
+        length = sourceLength;
+        return true;
+    }
+    if (chunk.storedLength > m_header.blockSize) {
+        LOG_ERROR(L"CompressedImage::ReadBlock: Chunk of block %lld has an invalid length %d.\n", blockNumber, chunk.storedLength);
+        return false;
+    }
+
+    char* target = (chunk.flags & IMAGE_CHUNK_COMPRESSED) ? m_readBuf.data() : out;
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(chunk.offset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = static_cast<DWORD>((chunk.offset >> 32) & 0xFFFFFFFF);
+    DWORD bytesRead = 0;
+    if (!ReadFile(m_hReadFile, target, chunk.storedLength, &bytesRead, &overlapped) || bytesRead != chunk.storedLength) {
+        LOG_ERROR(L"CompressedImage::ReadBlock: Failed to read chunk of block %lld. Error: %d\n", blockNumber, GetLastError());
+        return false;
+    }
+
+    if (chunk.flags & IMAGE_CHUNK_COMPRESSED) {
+        SIZE_T decompressedSize = 0;
+        if (!Decompress(m_decompressor, target, chunk.storedLength, out, m_header.blockSize, &decompressedSize) || decompressedSize < sourceLength) {
+            LOG_ERROR(L"CompressedImage::ReadBlock: Failed to decompress block %lld. Error: %d\n", blockNumber, GetLastError());
+            return false;
+        }
+    }
+    length = sourceLength;
+    return true;
+}
+
+void CompressedImage::Close()
+{
+    if (m_decompressor != nullptr) {
+        CloseDecompressor(m_decompressor);
+        m_decompressor = nullptr;
+    }
+    if (m_hReadFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hReadFile);
+        m_hReadFile = INVALID_HANDLE_VALUE;
+    }
+}
@@ -0,0 +1,94 @@
+#include "CompressionPool.h"
+#include "CompressedImage.h"
+
+//Getters
+int CompressionPool::getThreadCount() const
+{
+    return static_cast<int>(m_threads.size());
+}
+
+bool CompressionPool::Start(int nThreads, DWORD algorithm, Handler handler)
+{
+    LOG_DEBUG(L"Inside CompressionPool::Start\n");
+    Stop();
+    if (nThreads <= 0) {
+        nThreads = static_cast<int>(std::thread::hardware_concurrency());
+        if (nThreads <= 0) {
+            nThreads = 1;
+        }
+    }
+    if (nThreads > MAX_COMPRESSION_THREADS) {
+        nThreads = MAX_COMPRESSION_THREADS;
+    }
+
+    // Create every compressor up front so a failure is reported before any block is read
+    for (int i = 0; i < nThreads; ++i) {
+        COMPRESSOR_HANDLE compressor = nullptr;
+        if (!CreateCompressor(algorithm, nullptr, &compressor)) {
+            LOG_ERROR(L"CompressionPool::Start: CreateCompressor failed for %s. Error: %d\n", CompressedImage::GetAlgorithmName(algorithm), GetLastError());
+            Stop();
+            LOG_DEBUG(L"End of CompressionPool::Start\n");
+            return false;
+        }
+        m_compressors.push_back(compressor);
+    }
+
+    m_handler = handler;
+    m_stopping = false;
+    m_threads.reserve(nThreads);
+    for (int i = 0; i < nThreads; ++i) {
+        m_threads.emplace_back(&CompressionPool::ThreadLoop, this, i);
+    }
+    LOG_INFO(L"CompressionPool::Start: %d compression threads started.\n", nThreads);
+    LOG_DEBUG(L"End of CompressionPool::Start\n");
+    return true;
+}
+
+void CompressionPool::Submit(IOContext* cntxt)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_queue.push_back(cntxt);
+    }
+    m_wakeUp.notify_one();
+}
+
+void CompressionPool::ThreadLoop(int threadIndex)
+{
+    LOG_DEBUG(L"Inside CompressionPool::ThreadLoop\n");
+    COMPRESSOR_HANDLE compressor = m_compressors[threadIndex];
+    for (;;) {
+        IOContext* cntxt = nullptr;
+        {
+            std::unique_lock<std::mutex> guard(m_lock);
+            m_wakeUp.wait(guard, [this] { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                break; // Stopping and nothing left to compress
+            }
+            cntxt = m_queue.front();
+            m_queue.pop_front();
+        }
+        m_handler(cntxt, compressor);
+    }
+    LOG_DEBUG(L"End of CompressionPool::ThreadLoop\n");
+}
+
+void CompressionPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+    for (auto& t : m_threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    m_threads.clear();
+
+    for (COMPRESSOR_HANDLE compressor : m_compressors) {
+        CloseCompressor(compressor);
+    }
+    m_compressors.clear();
+}
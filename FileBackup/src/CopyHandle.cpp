@@ -0,0 +1,79 @@
+#include "CopyHandle.h"
+
+//Getters
+HANDLE CopyHandle::getDoneEvent() const
+{
+    return m_hDone;
+}
+
+bool CopyHandle::isDone() const
+{
+    return m_done.load(std::memory_order_acquire);
+}
+
+bool CopyHandle::getSucceeded() const
+{
+    return m_succeeded.load(std::memory_order_acquire);
+}
+
+CopyMetrics& CopyHandle::getMetrics()
+{
+    return m_copier.getMetrics();
+}
+
+std::unique_ptr<CopyHandle> CopyHandle::StartCopyAsync(const AsyncCopyRequest& request)
+{
+    LOG_DEBUG(L"Inside CopyHandle::StartCopyAsync\n");
+    if (request.srcPath.empty() || request.destPaths.empty()) {
+        LOG_ERROR(L"CopyHandle::StartCopyAsync: A source and at least one destination are required.\n");
+        LOG_DEBUG(L"End of CopyHandle::StartCopyAsync\n");
+        return nullptr;
+    }
+
+    std::unique_ptr<CopyHandle> handle(new CopyHandle());
+    handle->m_hDone = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (handle->m_hDone == nullptr) {
+        LOG_ERROR(L"CopyHandle::StartCopyAsync: Failed to create the completion event. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of CopyHandle::StartCopyAsync\n");
+        return nullptr;
+    }
+
+    // Options are applied on the calling thread, so the request's callbacks need not outlive this call
+    if (request.configure) {
+        request.configure(handle->m_copier);
+    }
+    if (request.onProgress) {
+        handle->m_copier.setProgressCallback(request.onProgress);
+    }
+    handle->m_thread = std::thread(&CopyHandle::Run, handle.get(), request);
+    LOG_INFO(L"CopyHandle::StartCopyAsync: Copy of %s started.\n", request.srcPath.c_str());
+    LOG_DEBUG(L"End of CopyHandle::StartCopyAsync\n");
+    return handle;
+}
+
+void CopyHandle::Run(AsyncCopyRequest request)
+{
+    LOG_DEBUG(L"Inside CopyHandle::Run\n");
+    bool succeeded = m_copier.Initialize(request.srcPath.c_str(), request.destPaths, request.threads, request.blockSizeMB, request.queueDepth) &&
+        m_copier.StartCopy();
+    LOG_INFO(L"CopyHandle::Run: Copy of %s %s.\n", request.srcPath.c_str(),
+        (succeeded ? L"completed" : (m_copier.getCancelled() ? L"was cancelled" : L"failed")));
+
+    m_succeeded.store(succeeded, std::memory_order_release);
+    if (request.onComplete) {
+        request.onComplete(succeeded);
+    }
+    m_done.store(true, std::memory_order_release);
+    SetEvent(m_hDone);
+    LOG_DEBUG(L"End of CopyHandle::Run\n");
+}
+
+void CopyHandle::Cancel()
+{
+    m_copier.Cancel();
+}
+
+bool CopyHandle::Wait(DWORD timeoutMs)
+{
+    return WaitForSingleObject(m_hDone, timeoutMs) == WAIT_OBJECT_0;
+}
@@ -0,0 +1,238 @@
+#include "CopyJournal.h"
+#include "HashUtils.h"
+
+//Getters
+bool CopyJournal::isOpen() const
+{
+    return m_view != nullptr;
+}
+
+DWORD CopyJournal::getBlockSize() const
+{
+    return m_header.blockSize;
+}
+
+LONGLONG CopyJournal::getResumedBlocks() const
+{
+    return m_resumedBlocks;
+}
+
+LONGLONG CopyJournal::getCompletedBlocks() const
+{
+    LONGLONG completed = 0;
+    for (const std::atomic<ULONGLONG>& word : m_completedBits) {
+        ULONGLONG bits = word.load(std::memory_order_relaxed);
+        while (bits) {
+            bits &= bits - 1;
+            ++completed;
+        }
+    }
+    return completed;
+}
+
+bool CopyJournal::Open(LPCWSTR path, DWORD blockSize, LONGLONG sourceSize, LPCWSTR destPath, bool resume)
+{
+    LOG_DEBUG(L"Inside CopyJournal::Open\n");
+    Close();
+    if (path == nullptr || blockSize == 0 || sourceSize <= 0) {
+        LOG_ERROR(L"CopyJournal::Open: Invalid parameters.\n");
+        LOG_DEBUG(L"End of CopyJournal::Open\n");
+        return false;
+    }
+
+    m_path = path;
+    m_header = {};
+    m_header.magic = COPY_JOURNAL_MAGIC;
+    m_header.version = COPY_JOURNAL_VERSION;
+    m_header.blockSize = blockSize;
+    m_header.sourceSize = sourceSize;
+    m_header.blockCount = (sourceSize + blockSize - 1) / blockSize;
+    m_header.destinationId = HashUtils::Hash64(destPath, wcslen(destPath) * sizeof(wchar_t));
+
+    const size_t words = static_cast<size_t>((m_header.blockCount + 63) / 64);
+    const LONGLONG fileSize = COPY_JOURNAL_HEADER_SIZE + static_cast<LONGLONG>(words) * sizeof(ULONGLONG);
+
+    m_hFile = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"CopyJournal::Open: Failed to open %s. Error: %d\n", path, GetLastError());
+        LOG_DEBUG(L"End of CopyJournal::Open\n");
+        return false;
+    }
+    bool existed = (GetLastError() == ERROR_ALREADY_EXISTS);
+
+    // A journal is only reusable if it describes this exact copy
+    bool reuse = false;
+    if (resume && existed) {
+        LARGE_INTEGER currentSize = {};
+        CopyJournalHeader fileHeader = {};
+        DWORD bytesRead = 0;
+        if (GetFileSizeEx(m_hFile, &currentSize) && currentSize.QuadPart == fileSize &&
+            ReadFile(m_hFile, &fileHeader, sizeof(fileHeader), &bytesRead, nullptr) && bytesRead == sizeof(fileHeader) &&
+            memcmp(&fileHeader, &m_header, sizeof(fileHeader)) == 0) {
+            reuse = true;
+        }
+        else {
+            LOG_WARNING(L"CopyJournal::Open: Journal %s does not match this copy (block size, source size or destination). Starting from the beginning.\n", path);
+        }
+    }
+    else if (resume) {
+        LOG_WARNING(L"CopyJournal::Open: No journal found at %s. Starting from the beginning.\n", path);
+    }
+
+    if (!reuse) {
+        // Start over with a zero filled file of the right size
+        LARGE_INTEGER zero = {};
+        if (!SetFilePointerEx(m_hFile, zero, nullptr, FILE_BEGIN) || !SetEndOfFile(m_hFile)) {
+            LOG_ERROR(L"CopyJournal::Open: Failed to reset %s. Error: %d\n", path, GetLastError());
+            Close();
+            LOG_DEBUG(L"End of CopyJournal::Open\n");
+            return false;
+        }
+    }
+
+    LARGE_INTEGER mappingSize = {};
+    mappingSize.QuadPart = fileSize;
+    m_hMapping = CreateFileMappingW(m_hFile, nullptr, PAGE_READWRITE, mappingSize.HighPart, mappingSize.LowPart, nullptr);
+    if (m_hMapping == nullptr) {
+        LOG_ERROR(L"CopyJournal::Open: CreateFileMappingW failed for %s. Error: %d\n", path, GetLastError());
+        Close();
+        LOG_DEBUG(L"End of CopyJournal::Open\n");
+        return false;
+    }
+    m_view = static_cast<BYTE*>(MapViewOfFile(m_hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(fileSize)));
+    if (m_view == nullptr) {
+        LOG_ERROR(L"CopyJournal::Open: MapViewOfFile failed for %s. Error: %d\n", path, GetLastError());
+        Close();
+        LOG_DEBUG(L"End of CopyJournal::Open\n");
+        return false;
+    }
+    m_durableBits = reinterpret_cast<ULONGLONG*>(m_view + COPY_JOURNAL_HEADER_SIZE);
+
+    std::vector<std::atomic<ULONGLONG>> completedBits(words);
+    m_completedBits.swap(completedBits);
+    m_snapshot.assign(words, 0);
+    for (size_t i = 0; i < words; ++i) {
+        m_completedBits[i].store(reuse ? m_durableBits[i] : 0, std::memory_order_relaxed);
+    }
+
+    if (!reuse) {
+        memcpy(m_view, &m_header, sizeof(m_header));
+        if (!FlushViewOfFile(m_view, 0) || !FlushFileBuffers(m_hFile)) {
+            LOG_ERROR(L"CopyJournal::Open: Failed to initialize %s. Error: %d\n", path, GetLastError());
+            Close();
+            LOG_DEBUG(L"End of CopyJournal::Open\n");
+            return false;
+        }
+    }
+
+    m_resumedBlocks = reuse ? getCompletedBlocks() : 0;
+    LOG_INFO(L"CopyJournal::Open: Journal %s opened, %lld of %lld blocks already complete.\n", path, m_resumedBlocks, m_header.blockCount);
+    LOG_DEBUG(L"End of CopyJournal::Open\n");
+    return true;
+}
+
+bool CopyJournal::IsBlockComplete(LONGLONG blockNumber) const
+{
+    if (blockNumber < 0 || blockNumber >= m_header.blockCount) {
+        return false;
+    }
+    return (m_completedBits[static_cast<size_t>(blockNumber / 64)].load(std::memory_order_relaxed) >> (blockNumber % 64)) & 1;
+}
+
+void CopyJournal::MarkBlockComplete(LONGLONG blockNumber)
+{
+    if (blockNumber < 0 || blockNumber >= m_header.blockCount) {
+        return;
+    }
+    m_completedBits[static_cast<size_t>(blockNumber / 64)].fetch_or(1ULL << (blockNumber % 64), std::memory_order_release);
+}
+
+void CopyJournal::RemoveCompleted(std::vector<DiskExtent>& extents) const
+{
+    const LONGLONG blockSize = m_header.blockSize;
+    std::vector<DiskExtent> remaining;
+    remaining.reserve(extents.size());
+
+    for (const DiskExtent& extent : extents) {
+        LONGLONG end = extent.offset + extent.length;
+        LONGLONG runStart = -1;
+        for (LONGLONG offset = extent.offset; offset < end; offset += blockSize) {
+            if (IsBlockComplete(offset / blockSize)) {
+                if (runStart >= 0) {
+                    remaining.push_back({ runStart, offset - runStart });
+                    runStart = -1;
+                }
+            }
+            else if (runStart < 0) {
+                runStart = offset;
+            }
+        }
+        if (runStart >= 0) {
+            remaining.push_back({ runStart, end - runStart });
+        }
+    }
+    extents.swap(remaining);
+}
+
+bool CopyJournal::Checkpoint(HANDLE hDest)
+{
+    LOG_DEBUG(L"Inside CopyJournal::Checkpoint\n");
+    if (!isOpen()) {
+        LOG_DEBUG(L"End of CopyJournal::Checkpoint\n");
+        return false;
+    }
+
+    // Bits set before the destination flush starts describe writes that the flush makes durable
+    for (size_t i = 0; i < m_snapshot.size(); ++i) {
+        m_snapshot[i] = m_completedBits[i].load(std::memory_order_acquire);
+    }
+    if (!FlushFileBuffers(hDest)) {
+        LOG_ERROR(L"CopyJournal::Checkpoint: Failed to flush the destination. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of CopyJournal::Checkpoint\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < m_snapshot.size(); ++i) {
+        if (m_durableBits[i] != m_snapshot[i]) {
+            m_durableBits[i] = m_snapshot[i];
+        }
+    }
+    if (!FlushViewOfFile(m_durableBits, m_snapshot.size() * sizeof(ULONGLONG)) || !FlushFileBuffers(m_hFile)) {
+        LOG_ERROR(L"CopyJournal::Checkpoint: Failed to flush journal %s. Error: %d\n", m_path.c_str(), GetLastError());
+        LOG_DEBUG(L"End of CopyJournal::Checkpoint\n");
+        return false;
+    }
+    LOG_DEBUG(L"End of CopyJournal::Checkpoint\n");
+    return true;
+}
+
+bool CopyJournal::Remove()
+{
+    LOG_DEBUG(L"Inside CopyJournal::Remove\n");
+    Close();
+    if (!m_path.empty() && !DeleteFileW(m_path.c_str()) && GetLastError() != ERROR_FILE_NOT_FOUND) {
+        LOG_ERROR(L"CopyJournal::Remove: Failed to delete %s. Error: %d\n", m_path.c_str(), GetLastError());
+        LOG_DEBUG(L"End of CopyJournal::Remove\n");
+        return false;
+    }
+    LOG_DEBUG(L"End of CopyJournal::Remove\n");
+    return true;
+}
+
+void CopyJournal::Close()
+{
+    if (m_view != nullptr) {
+        FlushViewOfFile(m_view, 0);
+        UnmapViewOfFile(m_view);
+        m_view = nullptr;
+        m_durableBits = nullptr;
+    }
+    if (m_hMapping != nullptr) {
+        CloseHandle(m_hMapping);
+        m_hMapping = nullptr;
+    }
+    if (m_hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+}
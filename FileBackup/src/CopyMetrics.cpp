@@ -0,0 +1,382 @@
+#include "CopyMetrics.h"
+#include <intrin.h>
+#include <malloc.h>
+#include <new>
+#include <sstream>
+#include <iomanip>
+
+// Index of the highest set bit of a non-zero value
+static int HighestBit(ULONGLONG value)
+{
+    unsigned long index = 0;
+    if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32))) {
+        return static_cast<int>(index) + 32;
+    }
+    _BitScanReverse(&index, static_cast<unsigned long>(value & 0xFFFFFFFF));
+    return static_cast<int>(index);
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+size_t LatencyHistogram::BucketIndex(ULONGLONG value)
+{
+    if (value < METRICS_SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    if (value >= (1ULL << METRICS_MAX_VALUE_BITS)) {
+        value = (1ULL << METRICS_MAX_VALUE_BITS) - 1;
+    }
+    // Values in [2^msb, 2^(msb+1)) share one power of two bucket split into METRICS_SUB_BUCKETS linear parts
+    int msb = HighestBit(value);
+    size_t major = static_cast<size_t>(msb - METRICS_SUB_BUCKET_BITS + 1);
+    size_t sub = static_cast<size_t>((value >> (msb - METRICS_SUB_BUCKET_BITS)) - METRICS_SUB_BUCKETS);
+    return major * METRICS_SUB_BUCKETS + sub;
+}
+
+ULONGLONG LatencyHistogram::BucketMidpoint(size_t index)
+{
+    size_t major = index / METRICS_SUB_BUCKETS;
+    size_t sub = index % METRICS_SUB_BUCKETS;
+    if (major == 0) {
+        return sub;
+    }
+    ULONGLONG lower = static_cast<ULONGLONG>(METRICS_SUB_BUCKETS + sub) << (major - 1);
+    ULONGLONG width = 1ULL << (major - 1);
+    return lower + width / 2;
+}
+
+void LatencyHistogram::Record(ULONGLONG value)
+{
+    m_counts[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    ULONGLONG currentMax = m_maxValue.load(std::memory_order_relaxed);
+    while (value > currentMax && !m_maxValue.compare_exchange_weak(currentMax, value, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::Reset()
+{
+    for (auto& count : m_counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    m_maxValue.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::AddTo(std::vector<ULONGLONG>& counts, ULONGLONG& maxValue) const
+{
+    for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i) {
+        counts[i] += m_counts[i].load(std::memory_order_relaxed);
+    }
+    ULONGLONG histogramMax = m_maxValue.load(std::memory_order_relaxed);
+    if (histogramMax > maxValue) {
+        maxValue = histogramMax;
+    }
+}
+
+void* WorkerMetrics::operator new[](size_t size)
+{
+    void* p = _aligned_malloc(size, METRICS_CACHE_LINE);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void WorkerMetrics::operator delete[](void* p)
+{
+    _aligned_free(p);
+}
+
+LONGLONG CopyMetrics::Now()
+{
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return ticks.QuadPart;
+}
+
+bool CopyMetrics::Start(int numOfWorkers, int totalContexts)
+{
+    LOG_DEBUG(L"Inside CopyMetrics::Start\n");
+    try {
+        m_workers.reset(new WorkerMetrics[numOfWorkers]);
+    }
+    catch (const std::bad_alloc&) {
+        LOG_ERROR(L"CopyMetrics::Start: Failed to allocate metrics for %d workers.\n", numOfWorkers);
+        LOG_DEBUG(L"End of CopyMetrics::Start\n");
+        return false;
+    }
+    m_numOfWorkers = numOfWorkers;
+    m_totalContexts = totalContexts;
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    m_frequency = frequency.QuadPart;
+    m_startTicks = Now();
+    m_endTicks.store(0, std::memory_order_release);
+
+    m_lastSampleTicks = m_startTicks;
+    m_lastBytesRead = 0;
+    m_lastBytesWritten = 0;
+    m_intervalReadsInFlight = 0;
+    m_intervalWritesInFlight = 0;
+    m_intervalSamples = 0;
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_timeline.clear();
+    m_totalReadsInFlight = 0;
+    m_totalWritesInFlight = 0;
+    m_totalSamples = 0;
+    LOG_DEBUG(L"End of CopyMetrics::Start\n");
+    return true;
+}
+
+void CopyMetrics::Stop()
+{
+    Sample();
+    m_endTicks.store(Now(), std::memory_order_release);
+}
+
+void CopyMetrics::OnReadIssued(int workerIndex)
+{
+    m_workers[workerIndex].readsIssued.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CopyMetrics::OnReadCompleted(int workerIndex, DWORD bytes, LONGLONG issueTicks)
+{
+    WorkerMetrics& worker = m_workers[workerIndex];
+    worker.readsCompleted.fetch_add(1, std::memory_order_relaxed);
+    worker.bytesRead.fetch_add(bytes, std::memory_order_relaxed);
+    worker.readLatency.Record(static_cast<ULONGLONG>((Now() - issueTicks) * 1000000 / m_frequency));
+}
+
+void CopyMetrics::OnWriteIssued(int workerIndex)
+{
+    m_workers[workerIndex].writesIssued.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CopyMetrics::OnWriteCompleted(int workerIndex, DWORD bytes, LONGLONG issueTicks)
+{
+    WorkerMetrics& worker = m_workers[workerIndex];
+    worker.writesCompleted.fetch_add(1, std::memory_order_relaxed);
+    worker.bytesWritten.fetch_add(bytes, std::memory_order_relaxed);
+    worker.writeLatency.Record(static_cast<ULONGLONG>((Now() - issueTicks) * 1000000 / m_frequency));
+}
+
+void CopyMetrics::GetInFlight(LONGLONG& reads, LONGLONG& writes) const
+{
+    reads = 0;
+    writes = 0;
+    for (int i = 0; i < m_numOfWorkers; ++i) {
+        // Counters move while they are read, a racing completion can make a difference briefly negative
+        LONGLONG readsCompleted = m_workers[i].readsCompleted.load(std::memory_order_relaxed);
+        LONGLONG writesCompleted = m_workers[i].writesCompleted.load(std::memory_order_relaxed);
+        reads += m_workers[i].readsIssued.load(std::memory_order_relaxed) - readsCompleted;
+        writes += m_workers[i].writesIssued.load(std::memory_order_relaxed) - writesCompleted;
+    }
+    if (reads < 0) {
+        reads = 0;
+    }
+    if (writes < 0) {
+        writes = 0;
+    }
+}
+
+void CopyMetrics::Sample()
+{
+    if (!m_workers || m_endTicks.load(std::memory_order_acquire) != 0) {
+        return;
+    }
+
+    LONGLONG readsInFlight = 0;
+    LONGLONG writesInFlight = 0;
+    GetInFlight(readsInFlight, writesInFlight);
+    m_intervalReadsInFlight += static_cast<double>(readsInFlight);
+    m_intervalWritesInFlight += static_cast<double>(writesInFlight);
+    ++m_intervalSamples;
+
+    LONGLONG now = Now();
+    if ((now - m_lastSampleTicks) * 1000 < static_cast<LONGLONG>(METRICS_TIMELINE_INTERVAL_MS) * m_frequency) {
+        return;
+    }
+
+    LONGLONG bytesRead = 0;
+    LONGLONG bytesWritten = 0;
+    for (int i = 0; i < m_numOfWorkers; ++i) {
+        bytesRead += m_workers[i].bytesRead.load(std::memory_order_relaxed);
+        bytesWritten += m_workers[i].bytesWritten.load(std::memory_order_relaxed);
+    }
+
+    ThroughputSample sample = {};
+    sample.seconds = static_cast<double>(now - m_startTicks) / m_frequency;
+    sample.bytesRead = bytesRead - m_lastBytesRead;
+    sample.bytesWritten = bytesWritten - m_lastBytesWritten;
+    sample.readsInFlight = m_intervalReadsInFlight / m_intervalSamples;
+    sample.writesInFlight = m_intervalWritesInFlight / m_intervalSamples;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_timeline.push_back(sample);
+        m_totalReadsInFlight += m_intervalReadsInFlight;
+        m_totalWritesInFlight += m_intervalWritesInFlight;
+        m_totalSamples += m_intervalSamples;
+    }
+
+    m_lastSampleTicks = now;
+    m_lastBytesRead = bytesRead;
+    m_lastBytesWritten = bytesWritten;
+    m_intervalReadsInFlight = 0;
+    m_intervalWritesInFlight = 0;
+    m_intervalSamples = 0;
+}
+
+LatencySummary CopyMetrics::Summarize(bool reads) const
+{
+    LatencySummary summary = {};
+    std::vector<ULONGLONG> counts(METRICS_HISTOGRAM_BUCKETS, 0);
+    for (int i = 0; i < m_numOfWorkers; ++i) {
+        (reads ? m_workers[i].readLatency : m_workers[i].writeLatency).AddTo(counts, summary.max);
+    }
+
+    double weightedSum = 0;
+    for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i) {
+        summary.count += counts[i];
+        weightedSum += static_cast<double>(counts[i]) * LatencyHistogram::BucketMidpoint(i);
+    }
+    if (summary.count == 0) {
+        return summary;
+    }
+    summary.mean = weightedSum / summary.count;
+
+    // Walk the buckets once, filling each percentile as the running count reaches it
+    const double quantiles[] = { 0.50, 0.90, 0.99, 0.999 };
+    ULONGLONG* targets[] = { &summary.p50, &summary.p90, &summary.p99, &summary.p999 };
+    size_t next = 0;
+    ULONGLONG running = 0;
+    for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS && next < 4; ++i) {
+        running += counts[i];
+        while (next < 4 && running >= static_cast<ULONGLONG>(quantiles[next] * summary.count + 0.5) && running > 0) {
+            ULONGLONG value = LatencyHistogram::BucketMidpoint(i);
+            *targets[next++] = (value < summary.max) ? value : summary.max;
+        }
+    }
+    return summary;
+}
+
+CopyMetricsSummary CopyMetrics::GetSummary() const
+{
+    CopyMetricsSummary summary = {};
+    if (!m_workers) {
+        return summary;
+    }
+
+    LONGLONG endTicks = m_endTicks.load(std::memory_order_acquire);
+    summary.elapsedSeconds = static_cast<double>((endTicks != 0 ? endTicks : Now()) - m_startTicks) / m_frequency;
+    summary.totalContexts = m_totalContexts;
+    summary.workers.resize(m_numOfWorkers);
+    for (int i = 0; i < m_numOfWorkers; ++i) {
+        WorkerSummary& worker = summary.workers[i];
+        worker.reads = m_workers[i].readsCompleted.load(std::memory_order_relaxed);
+        worker.writes = m_workers[i].writesCompleted.load(std::memory_order_relaxed);
+        worker.bytesRead = m_workers[i].bytesRead.load(std::memory_order_relaxed);
+        worker.bytesWritten = m_workers[i].bytesWritten.load(std::memory_order_relaxed);
+        summary.bytesRead += worker.bytesRead;
+        summary.bytesWritten += worker.bytesWritten;
+    }
+    summary.readLatency = Summarize(true);
+    summary.writeLatency = Summarize(false);
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (m_totalSamples > 0) {
+            summary.avgReadsInFlight = m_totalReadsInFlight / m_totalSamples;
+            summary.avgWritesInFlight = m_totalWritesInFlight / m_totalSamples;
+        }
+    }
+
+    // Where the IOContexts spend their time: waiting on the source, on the destination, or on neither (threads/CPU)
+    double busy = summary.avgReadsInFlight + summary.avgWritesInFlight;
+    if (m_totalContexts > 0 && busy < 0.5 * m_totalContexts) {
+        summary.likelyBottleneck = L"cpu";
+    }
+    else if (summary.avgReadsInFlight > 2.0 * summary.avgWritesInFlight) {
+        summary.likelyBottleneck = L"source";
+    }
+    else if (summary.avgWritesInFlight > 2.0 * summary.avgReadsInFlight) {
+        summary.likelyBottleneck = L"destination";
+    }
+    else {
+        summary.likelyBottleneck = L"balanced";
+    }
+    return summary;
+}
+
+std::vector<ThroughputSample> CopyMetrics::GetTimeline() const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_timeline;
+}
+
+static void WriteLatencyJson(std::ostringstream& json, const char* name, const LatencySummary& latency)
+{
+    json << "  \"" << name << "\": { \"count\": " << latency.count << ", \"meanUs\": " << latency.mean
+        << ", \"p50Us\": " << latency.p50 << ", \"p90Us\": " << latency.p90 << ", \"p99Us\": " << latency.p99
+        << ", \"p999Us\": " << latency.p999 << ", \"maxUs\": " << latency.max << " },\n";
+}
+
+bool CopyMetrics::WriteJson(LPCWSTR path) const
+{
+    LOG_DEBUG(L"Inside CopyMetrics::WriteJson\n");
+    CopyMetricsSummary summary = GetSummary();
+    std::vector<ThroughputSample> timeline = GetTimeline();
+    std::wstring bottleneck = summary.likelyBottleneck ? summary.likelyBottleneck : L"";
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "{\n";
+    json << "  \"elapsedSeconds\": " << summary.elapsedSeconds << ",\n";
+    json << "  \"bytesRead\": " << summary.bytesRead << ",\n";
+    json << "  \"bytesWritten\": " << summary.bytesWritten << ",\n";
+    json << "  \"totalContexts\": " << summary.totalContexts << ",\n";
+    json << "  \"avgReadsInFlight\": " << summary.avgReadsInFlight << ",\n";
+    json << "  \"avgWritesInFlight\": " << summary.avgWritesInFlight << ",\n";
+    json << "  \"likelyBottleneck\": \"" << std::string(bottleneck.begin(), bottleneck.end()) << "\",\n";
+    WriteLatencyJson(json, "readLatency", summary.readLatency);
+    WriteLatencyJson(json, "writeLatency", summary.writeLatency);
+
+    json << "  \"workers\": [\n";
+    for (size_t i = 0; i < summary.workers.size(); ++i) {
+        const WorkerSummary& worker = summary.workers[i];
+        json << "    { \"index\": " << i << ", \"reads\": " << worker.reads << ", \"writes\": " << worker.writes
+            << ", \"bytesRead\": " << worker.bytesRead << ", \"bytesWritten\": " << worker.bytesWritten << " }"
+            << (i + 1 < summary.workers.size() ? ",\n" : "\n");
+    }
+    json << "  ],\n";
+
+    json << "  \"timeline\": [\n";
+    for (size_t i = 0; i < timeline.size(); ++i) {
+        const ThroughputSample& sample = timeline[i];
+        json << "    { \"seconds\": " << sample.seconds << ", \"bytesRead\": " << sample.bytesRead << ", \"bytesWritten\": " << sample.bytesWritten
+            << ", \"readsInFlight\": " << sample.readsInFlight << ", \"writesInFlight\": " << sample.writesInFlight << " }"
+            << (i + 1 < timeline.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n";
+    json << "}\n";
+
+    std::string text = json.str();
+    HANDLE hFile = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"CopyMetrics::WriteJson: Failed to create %s. Error: %d\n", path, GetLastError());
+        LOG_DEBUG(L"End of CopyMetrics::WriteJson\n");
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    bool success = WriteFile(hFile, text.data(), static_cast<DWORD>(text.size()), &bytesWritten, nullptr) && bytesWritten == text.size();
+    if (!success) {
+        LOG_ERROR(L"CopyMetrics::WriteJson: Failed to write %s. Error: %d\n", path, GetLastError());
+    }
+    CloseHandle(hFile);
+    LOG_DEBUG(L"End of CopyMetrics::WriteJson\n");
+    return success;
+}
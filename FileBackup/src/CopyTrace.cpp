@@ -0,0 +1,21 @@
+#include "CopyTrace.h"
+
+// {0e269d8e-c4e8-4b2f-9f46-c312152133dc}
+TRACELOGGING_DEFINE_PROVIDER(g_copyTraceProvider, "FileBackup.BlockCopier",
+    (0x0e269d8e, 0xc4e8, 0x4b2f, 0x9f, 0x46, 0xc3, 0x12, 0x15, 0x21, 0x33, 0xdc));
+
+LONGLONG CopyTrace::s_ticksPerSecond = 1;
+
+void CopyTrace::Register()
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    s_ticksPerSecond = frequency.QuadPart;
+    // Tracing is optional, a failure leaves the provider unregistered and every event disabled
+    TraceLoggingRegister(g_copyTraceProvider);
+}
+
+void CopyTrace::Unregister()
+{
+    TraceLoggingUnregister(g_copyTraceProvider);
+}
@@ -1,31 +1,120 @@
+#include <windows.h>
+#include <initguid.h> // Defines, rather than declares, GUID_DEVINTERFACE_DISK and DEVPKEY_Device_Numa_Node in this file
 #include "DiskUtils.h"
 #include <string> 
+#include <setupapi.h>
+#include <cfgmgr32.h>
+#include <devpkey.h>
 
-// Gets the physical sector size of a volume/disk
-DWORD DiskUtils::GetVolumeSectorSize(HANDLE hFile, LPCWSTR path, bool isSrc) {
+#pragma comment(lib, "SetupAPI.lib")
+#pragma comment(lib, "Cfgmgr32.lib")
+
+// Gets the sector size to align I/O on a volume/disk to: the physical sector, unless the handle's offset 0 is not on a physical sector boundary
+DWORD DiskUtils::GetVolumeSectorSize(HANDLE hFile, LPCWSTR path, bool isSrc, DeviceAlignment* deviceAlignment) {
     LOG_DEBUG(L"Inside GetVolumeSectorSize\n");
-    DISK_GEOMETRY diskGeometry;
-    DWORD bytesReturned;
+    DeviceAlignment alignment;
+    bool found = GetDeviceAlignment(hFile, alignment);
+    if (deviceAlignment != nullptr) {
+        *deviceAlignment = alignment;
+    }
+    if (!found) {
+        LOG_ERROR(L"GetVolumeSectorSize: Failed to get physical sector size for %s for the path %s with the error : %d\n", (isSrc ? L"source" : L"destination"), path, GetLastError());
+        LOG_DEBUG(L"End of GetVolumeSectorSize\n");
+        return 0;
+    }
+    // A partition that starts mid sector (created by old tools at sector 63) cannot be written in whole physical sectors,
+    // larger units would not help there
+    if (alignment.alignmentOffset != 0) {
+        LOG_WARNING(L"GetVolumeSectorSize: %s starts %u bytes past a %u byte physical sector boundary, every write to it is read-modify-write on the device. Aligning to the %u byte logical sector instead.\n",
+            path, alignment.alignmentOffset, alignment.physicalSectorSize, alignment.logicalSectorSize);
+        LOG_DEBUG(L"End of GetVolumeSectorSize\n");
+        return alignment.logicalSectorSize;
+    }
+    LOG_INFO(L"GetVolumeSectorSize : %s Sector Size:%d (logical %d)\n", path, alignment.physicalSectorSize, alignment.logicalSectorSize);
+    LOG_DEBUG(L"End of GetVolumeSectorSize\n");
+    return alignment.physicalSectorSize;
+}
 
-    if (DeviceIoControl(hFile, IOCTL_DISK_GET_DRIVE_GEOMETRY, nullptr, 0,
-        &diskGeometry, sizeof(diskGeometry), &bytesReturned, nullptr)) {
-        LOG_INFO(L"GetVolumeSectorSize : DeviceIoControl Succeeded. Sector Size:%d\n", diskGeometry.BytesPerSector);
-        return diskGeometry.BytesPerSector;
+// Gets the sector sizes, alignment and transfer limits of the device behind a disk, volume or regular file handle
+bool DiskUtils::GetDeviceAlignment(HANDLE handle, DeviceAlignment& alignment)
+{
+    LOG_DEBUG(L"Inside GetDeviceAlignment\n");
+    alignment = DeviceAlignment();
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageAccessAlignmentProperty;
+    query.QueryType = PropertyStandardQuery;
+    STORAGE_ACCESS_ALIGNMENT_DESCRIPTOR accessAlignment = {};
+    DISK_GEOMETRY diskGeometry = {};
+    DWORD bytesReturned = 0;
+
+    // IOCTL_DISK_GET_DRIVE_GEOMETRY only reports the logical sector, which is 512 on 512e drives
+    if (DeviceIoControlSync(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &accessAlignment, sizeof(accessAlignment), &bytesReturned) &&
+        bytesReturned >= sizeof(accessAlignment) && accessAlignment.BytesPerLogicalSector != 0) {
+        alignment.logicalSectorSize = accessAlignment.BytesPerLogicalSector;
+        alignment.physicalSectorSize = accessAlignment.BytesPerPhysicalSector;
+        alignment.alignmentOffset = accessAlignment.BytesOffsetForSectorAlignment;
+    }
+    else if (DeviceIoControlSync(handle, IOCTL_DISK_GET_DRIVE_GEOMETRY, nullptr, 0, &diskGeometry, sizeof(diskGeometry), &bytesReturned) &&
+        diskGeometry.BytesPerSector != 0) {
+        LOG_WARNING(L"GetDeviceAlignment: StorageAccessAlignmentProperty is not supported, the physical sector size is assumed to be the logical one.\n");
+        alignment.logicalSectorSize = diskGeometry.BytesPerSector;
     }
     else {
-        DWORD err = GetLastError();
-        // Check if it's a logical drive letter path (e.g., "\\.\E:") for which this IOCTL often fails.
-        if ((err == ERROR_INVALID_PARAMETER || err == ERROR_NOT_SUPPORTED) &&
-            path && path[0] == L'\\' && path[1] == L'.' && path[2] == L'\\' && iswalpha(path[3]) && path[4] == L':') {
-            LOG_WARNING(L"GetVolumeSectorSize: IOCTL_DISK_GET_DRIVE_GEOMETRY is often not supported for logical drive letter handles. Path: %s. Error:%d\n", path, err);
-            LOG_DEBUG(L"End of GetVolumeSectorSize\n");
-            return 0; 
+        // A regular file (benchmarks, image targets) has no geometry, align to the volume that holds it
+        FILE_STORAGE_INFO storageInfo = {};
+        if (!GetFileInformationByHandleEx(handle, FileStorageInfo, &storageInfo, sizeof(storageInfo)) || storageInfo.LogicalBytesPerSector == 0) {
+            LOG_DEBUG(L"End of GetDeviceAlignment\n");
+            return false;
         }
+        alignment.logicalSectorSize = storageInfo.LogicalBytesPerSector;
+        alignment.physicalSectorSize = storageInfo.PhysicalBytesPerSectorForPerformance;
+        LOG_DEBUG(L"End of GetDeviceAlignment\n");
+        return true;
+    }
+    if (alignment.physicalSectorSize < alignment.logicalSectorSize) {
+        alignment.physicalSectorSize = alignment.logicalSectorSize;
+    }
 
-        LOG_ERROR(L"GetVolumeSectorSize: Failed to get physical sector size for %s for the path %s with the error : %d\n", (isSrc ? L"source" : L"destination"), path, err);
-        LOG_DEBUG(L"End of GetVolumeSectorSize\n");
+    // Offsets of a volume handle are relative to the partition, which may itself start off a physical sector boundary
+    PARTITION_INFORMATION_EX partitionInfo = {};
+    if (DeviceIoControlSync(handle, IOCTL_DISK_GET_PARTITION_INFO_EX, nullptr, 0, &partitionInfo, sizeof(partitionInfo), &bytesReturned)) {
+        alignment.partitionOffset = partitionInfo.StartingOffset.QuadPart;
+        alignment.alignmentOffset = static_cast<DWORD>((alignment.alignmentOffset + alignment.partitionOffset) % alignment.physicalSectorSize);
+    }
+
+    // Requests beyond the adapter's limit are split by the storage stack
+    STORAGE_ADAPTER_DESCRIPTOR adapter = {};
+    query.PropertyId = StorageAdapterProperty;
+    if (DeviceIoControlSync(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &adapter, sizeof(adapter), &bytesReturned) &&
+        bytesReturned >= offsetof(STORAGE_ADAPTER_DESCRIPTOR, AdapterUsesPio)) {
+        alignment.maxTransferLength = adapter.MaximumTransferLength;
+        alignment.bufferAlignment = adapter.AlignmentMask + 1;
+    }
+    LOG_INFO(L"GetDeviceAlignment: Logical sector %u, physical sector %u, alignment offset %u, partition offset %lld, max transfer %u KB, buffer alignment %u\n",
+        alignment.logicalSectorSize, alignment.physicalSectorSize, alignment.alignmentOffset, alignment.partitionOffset,
+        alignment.maxTransferLength / 1024, alignment.bufferAlignment);
+    LOG_DEBUG(L"End of GetDeviceAlignment\n");
+    return true;
+}
+
+// Gets the sector size to align unbuffered I/O on a regular file to
+DWORD DiskUtils::GetFileSectorSize(HANDLE hFile)
+{
+    LOG_DEBUG(L"Inside GetFileSectorSize\n");
+    FILE_STORAGE_INFO storageInfo = {};
+    if (!GetFileInformationByHandleEx(hFile, FileStorageInfo, &storageInfo, sizeof(storageInfo))) {
+        LOG_ERROR(L"GetFileSectorSize: GetFileInformationByHandleEx failed with error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of GetFileSectorSize\n");
         return 0;
     }
+    // The performance sector size is a multiple of the logical one, so it satisfies FILE_FLAG_NO_BUFFERING as well
+    DWORD sectorSize = storageInfo.PhysicalBytesPerSectorForPerformance;
+    if (sectorSize == 0) {
+        sectorSize = storageInfo.LogicalBytesPerSector;
+    }
+    LOG_INFO(L"GetFileSectorSize: Sector Size:%d\n", sectorSize);
+    LOG_DEBUG(L"End of GetFileSectorSize\n");
+    return sectorSize;
 }
 
 LONGLONG DiskUtils::GetDiskOrDriveSize(HANDLE handle, LPCWSTR path, bool isSrc)
@@ -133,14 +222,372 @@ LONGLONG DiskUtils::GetDiskOrDriveSize(HANDLE handle, LPCWSTR path, bool isSrc)
                     destCapacity = diskGeometryEx.DiskSize.QuadPart;
                     LOG_INFO(L"Got destination size using IOCTL_DISK_GET_DRIVE_GEOMETRY_EX: %lld bytes.\n", destCapacity);
                 }
-                else {  // If this also fails, then you're truly blocked.
+                else {
                     DWORD errGeometry = GetLastError();
-                    LOG_ERROR(L"Failed IOCTL_DISK_GET_DRIVE_GEOMETRY_EX Error: %d. Cannot determine destination size for path: %s\n", errGeometry, path);
-                    return 0;
+                    LOG_DEBUG(L"Failed IOCTL_DISK_GET_DRIVE_GEOMETRY_EX Error: %d. Falling back to GetFileSizeEx.\n", errGeometry);
+
+                    // A regular file destination has no disk geometry, its capacity is its current size
+                    LARGE_INTEGER tempFileSize;
+                    if (GetFileSizeEx(handle, &tempFileSize)) {
+                        destCapacity = tempFileSize.QuadPart;
+                        LOG_INFO(L"Got destination size using GetFileSizeEx: %lld bytes.\n", destCapacity);
+                    }
+                    else {  // If this also fails, then you're truly blocked.
+                        LOG_ERROR(L"Failed GetFileSizeEx Error: %d. Cannot determine destination size for path: %s\n", GetLastError(), path);
+                        return 0;
+                    }
                 }
             }
         }
         LOG_DEBUG(L"End of GetDiskOrDriveSize\n");
         return destCapacity;
     }
-}
\ No newline at end of file
+}
+
+bool DiskUtils::DeviceIoControlSync(HANDLE handle, DWORD ioControlCode, LPVOID inBuf, DWORD inBufSize, LPVOID outBuf, DWORD outBufSize, DWORD* bytesReturned)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (overlapped.hEvent == nullptr) {
+        LOG_ERROR(L"DeviceIoControlSync: Failed to create event. Error: %d\n", GetLastError());
+        return false;
+    }
+    // Setting the low order bit keeps the completion from being queued to a completion port bound to the handle
+    overlapped.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(overlapped.hEvent) | 1);
+    HANDLE hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(overlapped.hEvent) & ~static_cast<ULONG_PTR>(1));
+
+    DWORD bytes = 0;
+    BOOL result = DeviceIoControl(handle, ioControlCode, inBuf, inBufSize, outBuf, outBufSize, &bytes, &overlapped);
+    if (!result && GetLastError() == ERROR_IO_PENDING) {
+        result = GetOverlappedResult(handle, &overlapped, &bytes, TRUE);
+    }
+    DWORD err = result ? ERROR_SUCCESS : GetLastError();
+    CloseHandle(hEvent);
+
+    if (bytesReturned) {
+        *bytesReturned = bytes;
+    }
+    SetLastError(err); // Preserve the DeviceIoControl error (e.g. ERROR_MORE_DATA) for the caller
+    return result != FALSE;
+}
+
+bool DiskUtils::ReadSync(HANDLE handle, LONGLONG offset, LPVOID buf, DWORD length, DWORD* bytesRead)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = static_cast<DWORD>((offset >> 32) & 0xFFFFFFFF);
+    overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (overlapped.hEvent == nullptr) {
+        LOG_ERROR(L"ReadSync: Failed to create event. Error: %d\n", GetLastError());
+        return false;
+    }
+    // Setting the low order bit keeps the completion from being queued to a completion port bound to the handle
+    overlapped.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(overlapped.hEvent) | 1);
+    HANDLE hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(overlapped.hEvent) & ~static_cast<ULONG_PTR>(1));
+
+    DWORD bytes = 0;
+    BOOL result = ReadFile(handle, buf, length, nullptr, &overlapped);
+    if (result || GetLastError() == ERROR_IO_PENDING) {
+        result = GetOverlappedResult(handle, &overlapped, &bytes, TRUE);
+    }
+    DWORD err = result ? ERROR_SUCCESS : GetLastError();
+    CloseHandle(hEvent);
+
+    if (bytesRead) {
+        *bytesRead = bytes;
+    }
+    SetLastError(err);
+    return result != FALSE;
+}
+
+bool DiskUtils::WriteSync(HANDLE handle, LONGLONG offset, LPCVOID buf, DWORD length, DWORD* bytesWritten)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = static_cast<DWORD>((offset >> 32) & 0xFFFFFFFF);
+    overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (overlapped.hEvent == nullptr) {
+        LOG_ERROR(L"WriteSync: Failed to create event. Error: %d\n", GetLastError());
+        return false;
+    }
+    // Setting the low order bit keeps the completion from being queued to a completion port bound to the handle
+    overlapped.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(overlapped.hEvent) | 1);
+    HANDLE hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(overlapped.hEvent) & ~static_cast<ULONG_PTR>(1));
+
+    DWORD bytes = 0;
+    BOOL result = WriteFile(handle, buf, length, nullptr, &overlapped);
+    if (result || GetLastError() == ERROR_IO_PENDING) {
+        result = GetOverlappedResult(handle, &overlapped, &bytes, TRUE);
+    }
+    DWORD err = result ? ERROR_SUCCESS : GetLastError();
+    CloseHandle(hEvent);
+
+    if (bytesWritten) {
+        *bytesWritten = bytes;
+    }
+    SetLastError(err);
+    return result != FALSE;
+}
+
+// Walks the volume bitmap and returns block aligned ranges that contain at least one used cluster.
+// The region past the last cluster (e.g. the NTFS backup boot sector) is always included.
+bool DiskUtils::GetUsedBlockExtents(HANDLE hVolume, LONGLONG volumeSize, DWORD blockSize, std::vector<DiskExtent>& extents)
+{
+    LOG_DEBUG(L"Inside GetUsedBlockExtents\n");
+    extents.clear();
+
+    NTFS_VOLUME_DATA_BUFFER volumeData = {};
+    DWORD bytesReturned = 0;
+    if (!DeviceIoControlSync(hVolume, FSCTL_GET_NTFS_VOLUME_DATA, nullptr, 0, &volumeData, sizeof(volumeData), &bytesReturned)) {
+        LOG_WARNING(L"GetUsedBlockExtents: FSCTL_GET_NTFS_VOLUME_DATA failed with error: %d. Source is not an NTFS volume.\n", GetLastError());
+        LOG_DEBUG(L"End of GetUsedBlockExtents\n");
+        return false;
+    }
+    const LONGLONG clusterSize = volumeData.BytesPerCluster;
+    const LONGLONG totalClusters = volumeData.TotalClusters.QuadPart;
+    LOG_INFO(L"GetUsedBlockExtents: Cluster size: %lld bytes, Total clusters: %lld, Free clusters: %lld\n", clusterSize, totalClusters, volumeData.FreeClusters.QuadPart);
+
+    // Adds a used byte range widened to block boundaries, merging it with the previous range when they touch
+    auto addRange = [&](LONGLONG start, LONGLONG end) {
+        start = (start / blockSize) * blockSize;
+        end = ((end + blockSize - 1) / blockSize) * blockSize;
+        if (end > volumeSize) {
+            end = volumeSize;
+        }
+        if (start >= end) {
+            return;
+        }
+        if (!extents.empty() && extents.back().offset + extents.back().length >= start) {
+            LONGLONG lastEnd = extents.back().offset + extents.back().length;
+            if (end > lastEnd) {
+                extents.back().length = end - extents.back().offset;
+            }
+            return;
+        }
+        extents.push_back({ start, end - start });
+    };
+
+    std::vector<BYTE> outBuf(VOLUME_BITMAP_QUERY_BYTES);
+    STARTING_LCN_INPUT_BUFFER input = {};
+    input.StartingLcn.QuadPart = 0;
+    LONGLONG runStart = -1; // First cluster of the current run of used clusters
+
+    while (input.StartingLcn.QuadPart < totalClusters) {
+        if (!DeviceIoControlSync(hVolume, FSCTL_GET_VOLUME_BITMAP, &input, sizeof(input), outBuf.data(), static_cast<DWORD>(outBuf.size()), &bytesReturned)) {
+            if (GetLastError() != ERROR_MORE_DATA) {
+                LOG_ERROR(L"GetUsedBlockExtents: FSCTL_GET_VOLUME_BITMAP failed at LCN %lld with error: %d\n", input.StartingLcn.QuadPart, GetLastError());
+                extents.clear();
+                LOG_DEBUG(L"End of GetUsedBlockExtents\n");
+                return false;
+            }
+        }
+        const VOLUME_BITMAP_BUFFER* bitmap = reinterpret_cast<const VOLUME_BITMAP_BUFFER*>(outBuf.data());
+        const LONGLONG firstLcn = bitmap->StartingLcn.QuadPart;
+        const LONGLONG headerSize = offsetof(VOLUME_BITMAP_BUFFER, Buffer);
+        LONGLONG numClusters = (static_cast<LONGLONG>(bytesReturned) - headerSize) * 8;
+        if (numClusters > bitmap->BitmapSize.QuadPart) {
+            numClusters = bitmap->BitmapSize.QuadPart;
+        }
+        if (numClusters <= 0) {
+            break;
+        }
+
+        // Scan 64 clusters at a time, only runs that start or end inside a word need bit level work
+        const BYTE* bits = bitmap->Buffer;
+        for (LONGLONG i = 0; i < numClusters; ) {
+            if ((i % 64) == 0 && i + 64 <= numClusters) {
+                ULONGLONG word;
+                memcpy(&word, bits + i / 8, sizeof(word));
+                if (word == 0 && runStart < 0) { i += 64; continue; }
+                if (word == ~0ULL && runStart >= 0) { i += 64; continue; }
+            }
+            bool used = (bits[i / 8] >> (i % 8)) & 1;
+            if (used && runStart < 0) {
+                runStart = firstLcn + i;
+            }
+            else if (!used && runStart >= 0) {
+                addRange(runStart * clusterSize, (firstLcn + i) * clusterSize);
+                runStart = -1;
+            }
+            ++i;
+        }
+        input.StartingLcn.QuadPart = firstLcn + numClusters;
+    }
+    if (runStart >= 0) {
+        addRange(runStart * clusterSize, totalClusters * clusterSize);
+    }
+    // Bytes past the last whole cluster are not tracked by the bitmap
+    addRange(totalClusters * clusterSize, volumeSize);
+
+    LONGLONG usedBytes = 0;
+    for (const DiskExtent& extent : extents) {
+        usedBytes += extent.length;
+    }
+    LOG_INFO(L"GetUsedBlockExtents: %zu extents, %lld MB of %lld MB to copy.\n", extents.size(), usedBytes / (1024 * 1024), volumeSize / (1024 * 1024));
+    LOG_DEBUG(L"End of GetUsedBlockExtents\n");
+    return true;
+}
+
+
+bool DiskUtils::IsTrimEnabled(HANDLE handle)
+{
+    LOG_DEBUG(L"Inside IsTrimEnabled\n");
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageDeviceTrimProperty;
+    query.QueryType = PropertyStandardQuery;
+    DEVICE_TRIM_DESCRIPTOR trimDescriptor = {};
+    DWORD bytesReturned = 0;
+    if (!DeviceIoControlSync(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &trimDescriptor, sizeof(trimDescriptor), &bytesReturned) ||
+        bytesReturned < sizeof(trimDescriptor)) {
+        LOG_WARNING(L"IsTrimEnabled: StorageDeviceTrimProperty query failed with error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of IsTrimEnabled\n");
+        return false;
+    }
+    LOG_INFO(L"IsTrimEnabled: Device TRIM enabled: %d\n", trimDescriptor.TrimEnabled);
+    LOG_DEBUG(L"End of IsTrimEnabled\n");
+    return trimDescriptor.TrimEnabled != FALSE;
+}
+
+bool DiskUtils::IsTrimZeroing(HANDLE handle)
+{
+    LOG_DEBUG(L"Inside IsTrimZeroing\n");
+    if (!IsTrimEnabled(handle)) {
+        LOG_DEBUG(L"End of IsTrimZeroing\n");
+        return false;
+    }
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageDeviceLBProvisioningProperty;
+    query.QueryType = PropertyStandardQuery;
+    DEVICE_LB_PROVISIONING_DESCRIPTOR provisioning = {};
+    DWORD bytesReturned = 0;
+    // Older descriptors end before the thin provisioning flags, those devices do not promise anything
+    if (!DeviceIoControlSync(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &provisioning, sizeof(provisioning), &bytesReturned) ||
+        bytesReturned < offsetof(DEVICE_LB_PROVISIONING_DESCRIPTOR, Reserved1)) {
+        LOG_WARNING(L"IsTrimZeroing: StorageDeviceLBProvisioningProperty query failed with error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of IsTrimZeroing\n");
+        return false;
+    }
+    LOG_INFO(L"IsTrimZeroing: Thin provisioning enabled: %d, unmapped blocks read zeros: %d\n",
+        provisioning.ThinProvisioningEnabled, provisioning.ThinProvisioningReadZeros);
+    LOG_DEBUG(L"End of IsTrimZeroing\n");
+    return provisioning.ThinProvisioningReadZeros != 0;
+}
+
+bool DiskUtils::IssueTrim(HANDLE handle, LONGLONG offset, LONGLONG length, TrimRequest& request, OVERLAPPED* overlapped)
+{
+    request = {};
+    request.attributes.Size = sizeof(DEVICE_MANAGE_DATA_SET_ATTRIBUTES);
+    request.attributes.Action = DeviceDsmAction_Trim;
+    request.attributes.DataSetRangesOffset = offsetof(TrimRequest, range);
+    request.attributes.DataSetRangesLength = sizeof(DEVICE_DATA_SET_RANGE);
+    request.range.StartingOffset = offset;
+    request.range.LengthInBytes = static_cast<ULONGLONG>(length);
+
+    if (!DeviceIoControl(handle, IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES, &request, sizeof(request), nullptr, 0, nullptr, overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        LOG_WARNING(L"IssueTrim: TRIM of offset %lld, length %lld failed with error: %d\n", offset, length, GetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool DiskUtils::SetIoPriorityHint(HANDLE handle, PRIORITY_HINT priority)
+{
+    FILE_IO_PRIORITY_HINT_INFO priorityInfo = {};
+    priorityInfo.PriorityHint = priority;
+    if (!SetFileInformationByHandle(handle, FileIoPriorityHintInfo, &priorityInfo, sizeof(priorityInfo))) {
+        LOG_WARNING(L"SetIoPriorityHint: Setting I/O priority %d failed with error: %d\n", static_cast<int>(priority), GetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool DiskUtils::GetDiskNumber(HANDLE handle, DWORD& diskNumber)
+{
+    STORAGE_DEVICE_NUMBER deviceNumber = {};
+    DWORD bytesReturned = 0;
+    if (!DeviceIoControlSync(handle, IOCTL_STORAGE_GET_DEVICE_NUMBER, nullptr, 0, &deviceNumber, sizeof(deviceNumber), &bytesReturned) ||
+        deviceNumber.DeviceType != FILE_DEVICE_DISK) {
+        return false;
+    }
+    diskNumber = deviceNumber.DeviceNumber;
+    return true;
+}
+
+int DiskUtils::GetDeviceNumaNode(HANDLE handle)
+{
+    LOG_DEBUG(L"Inside GetDeviceNumaNode\n");
+    STORAGE_DEVICE_NUMBER deviceNumber = {};
+    DWORD bytesReturned = 0;
+    if (!GetDiskNumber(handle, deviceNumber.DeviceNumber)) {
+        LOG_WARNING(L"GetDeviceNumaNode: Handle is not backed by a disk device. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of GetDeviceNumaNode\n");
+        return -1;
+    }
+
+    HDEVINFO devInfo = SetupDiGetClassDevsW(&GUID_DEVINTERFACE_DISK, nullptr, nullptr, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (devInfo == INVALID_HANDLE_VALUE) {
+        LOG_WARNING(L"GetDeviceNumaNode: SetupDiGetClassDevsW failed with error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of GetDeviceNumaNode\n");
+        return -1;
+    }
+
+    // Find the disk interface with the same device number, then ask its devnode (or the nearest parent, usually the controller) for its node
+    int numaNode = -1;
+    SP_DEVICE_INTERFACE_DATA interfaceData = {};
+    interfaceData.cbSize = sizeof(interfaceData);
+    for (DWORD i = 0; numaNode < 0 && SetupDiEnumDeviceInterfaces(devInfo, nullptr, &GUID_DEVINTERFACE_DISK, i, &interfaceData); ++i) {
+        DWORD detailSize = 0;
+        SetupDiGetDeviceInterfaceDetailW(devInfo, &interfaceData, nullptr, 0, &detailSize, nullptr);
+        if (detailSize == 0) {
+            continue;
+        }
+        std::vector<BYTE> detailBuf(detailSize);
+        SP_DEVICE_INTERFACE_DETAIL_DATA_W* detail = reinterpret_cast<SP_DEVICE_INTERFACE_DETAIL_DATA_W*>(detailBuf.data());
+        detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W);
+        SP_DEVINFO_DATA devInfoData = {};
+        devInfoData.cbSize = sizeof(devInfoData);
+        if (!SetupDiGetDeviceInterfaceDetailW(devInfo, &interfaceData, detail, detailSize, nullptr, &devInfoData)) {
+            continue;
+        }
+
+        HANDLE hDisk = CreateFileW(detail->DevicePath, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (hDisk == INVALID_HANDLE_VALUE) {
+            continue;
+        }
+        STORAGE_DEVICE_NUMBER diskNumber = {};
+        BOOL matched = DeviceIoControl(hDisk, IOCTL_STORAGE_GET_DEVICE_NUMBER, nullptr, 0, &diskNumber, sizeof(diskNumber), &bytesReturned, nullptr) &&
+            diskNumber.DeviceNumber == deviceNumber.DeviceNumber;
+        CloseHandle(hDisk);
+        if (!matched) {
+            continue;
+        }
+
+        DEVINST devInst = devInfoData.DevInst;
+        while (true) {
+            DEVPROPTYPE propType = 0;
+            ULONG node = 0;
+            ULONG propSize = sizeof(node);
+            if (CM_Get_DevNode_PropertyW(devInst, &DEVPKEY_Device_Numa_Node, &propType, reinterpret_cast<PBYTE>(&node), &propSize, 0) == CR_SUCCESS) {
+                numaNode = static_cast<int>(node);
+                break;
+            }
+            DEVINST parent = 0;
+            if (CM_Get_Parent(&parent, devInst, 0) != CR_SUCCESS) {
+                break;
+            }
+            devInst = parent;
+        }
+        break;
+    }
+    SetupDiDestroyDeviceInfoList(devInfo);
+
+    if (numaNode < 0) {
+        LOG_WARNING(L"GetDeviceNumaNode: No NUMA node reported for disk %u.\n", deviceNumber.DeviceNumber);
+    }
+    else {
+        LOG_INFO(L"GetDeviceNumaNode: Disk %u is attached to NUMA node %d.\n", deviceNumber.DeviceNumber, numaNode);
+    }
+    LOG_DEBUG(L"End of GetDeviceNumaNode\n");
+    return numaNode;
+}
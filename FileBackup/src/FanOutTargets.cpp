@@ -0,0 +1,100 @@
+#include "FanOutTargets.h"
+#include "CopyTrace.h"
+
+//Getters
+int FanOutTargets::getCount() const
+{
+    return static_cast<int>(m_targets.size());
+}
+
+int FanOutTargets::getLiveCount() const
+{
+    return m_live.load(std::memory_order_acquire);
+}
+
+FanOutTarget& FanOutTargets::getTarget(int index)
+{
+    return *m_targets[index];
+}
+
+void FanOutTargets::Add(LPCWSTR path, HANDLE handle, bool ownsHandle)
+{
+    std::unique_ptr<FanOutTarget> target = std::make_unique<FanOutTarget>();
+    target->path = path;
+    target->handle = handle;
+    target->ownsHandle = ownsHandle;
+    target->lastProgressMs.store(GetTickCount64(), std::memory_order_relaxed);
+    m_targets.push_back(std::move(target));
+    m_live.fetch_add(1, std::memory_order_release);
+}
+
+bool FanOutTargets::Drop(int index, DWORD errCode)
+{
+    FanOutTarget& target = *m_targets[index];
+    bool wasDropped = false;
+    if (!target.dropped.compare_exchange_strong(wasDropped, true, std::memory_order_acq_rel)) {
+        return false;
+    }
+    int live = m_live.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    LOG_ERROR(L"FanOutTargets::Drop: Destination %s dropped with error: %d, %d destinations continue.\n", target.path.c_str(), errCode, live);
+    // Its queued writes complete with ERROR_OPERATION_ABORTED and release their buffers
+    if (!CancelIoEx(target.handle, nullptr) && GetLastError() != ERROR_NOT_FOUND) {
+        LOG_WARNING(L"FanOutTargets::Drop: CancelIoEx on %s failed with error: %d\n", target.path.c_str(), GetLastError());
+    }
+    return true;
+}
+
+int FanOutTargets::DropStalled(ULONGLONG timeoutMs)
+{
+    int dropped = 0;
+    ULONGLONG now = GetTickCount64();
+    for (int i = 0; i < getCount(); ++i) {
+        FanOutTarget& target = *m_targets[i];
+        if (target.dropped.load(std::memory_order_acquire) || target.writesInFlight.load(std::memory_order_acquire) == 0) {
+            continue;
+        }
+        ULONGLONG lastProgress = target.lastProgressMs.load(std::memory_order_acquire);
+        if (now > lastProgress && now - lastProgress >= timeoutMs) {
+            LOG_ERROR(L"FanOutTargets::DropStalled: No write to %s completed for %llu ms.\n", target.path.c_str(), now - lastProgress);
+            CopyTrace::Stall(L"DestinationStalled", -1, i, now - lastProgress, target.writesInFlight.load(std::memory_order_acquire));
+            if (Drop(i, ERROR_TIMEOUT)) {
+                ++dropped;
+            }
+        }
+    }
+    return dropped;
+}
+
+bool FanOutTargets::Flush()
+{
+    for (int i = 0; i < getCount(); ++i) {
+        FanOutTarget& target = *m_targets[i];
+        if (!target.dropped.load(std::memory_order_acquire) && !FlushFileBuffers(target.handle)) {
+            Drop(i, GetLastError());
+        }
+    }
+    return getLiveCount() > 0;
+}
+
+void FanOutTargets::LogSummary() const
+{
+    for (const std::unique_ptr<FanOutTarget>& target : m_targets) {
+        if (target->dropped.load(std::memory_order_acquire)) {
+            LOG_ERROR(L"FanOutTargets: %s was dropped after %lld MB and is incomplete.\n", target->path.c_str(), target->bytesWritten.load() / (1024 * 1024));
+        }
+        else {
+            LOG_INFO(L"FanOutTargets: %s received %lld MB.\n", target->path.c_str(), target->bytesWritten.load() / (1024 * 1024));
+        }
+    }
+}
+
+void FanOutTargets::Clear()
+{
+    for (std::unique_ptr<FanOutTarget>& target : m_targets) {
+        if (target->ownsHandle && target->handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(target->handle);
+        }
+    }
+    m_targets.clear();
+    m_live.store(0, std::memory_order_release);
+}
@@ -0,0 +1,380 @@
+#include "FaultHandler.h"
+#include "BlockCopier.h" // Needed to cast curInst back to BlockCopier*
+#include <sstream>
+#include <algorithm>
+
+//Getters
+int FaultHandler::getRetries() const
+{
+    return m_retries;
+}
+
+LONGLONG FaultHandler::getFaults() const
+{
+    return m_faults.load(std::memory_order_relaxed);
+}
+
+LONGLONG FaultHandler::getReissues() const
+{
+    return m_reissues.load(std::memory_order_relaxed);
+}
+
+LONGLONG FaultHandler::getRecovered() const
+{
+    return m_recovered.load(std::memory_order_relaxed);
+}
+
+LONGLONG FaultHandler::getBadSectors() const
+{
+    return m_badSectorCount;
+}
+
+//Setters
+void FaultHandler::setRetries(int retries)
+{
+    m_retries = (retries > 0) ? retries : 0;
+}
+
+void FaultHandler::setRetryDelay(DWORD retryDelayMs)
+{
+    m_retryDelayMs = (retryDelayMs < FAULT_MAX_RETRY_DELAY_MS) ? retryDelayMs : FAULT_MAX_RETRY_DELAY_MS;
+}
+
+void FaultHandler::setErrorBudget(LONGLONG sectors)
+{
+    m_errorBudget = (sectors > 0) ? sectors : 0;
+}
+
+void FaultHandler::setBadSectorPath(LPCWSTR path)
+{
+    m_badSectorPath = (path != nullptr) ? path : L"";
+}
+
+bool FaultHandler::Start(IOEngineType engineType, HANDLE hIocp, ULONG_PTR completionKey, int nThreads, DWORD sectorSize, LONGLONG srcSize)
+{
+    LOG_DEBUG(L"Inside FaultHandler::Start\n");
+    Stop();
+    m_engineType = engineType;
+    m_hIocp = hIocp;
+    m_completionKey = completionKey;
+    m_workerThreads.assign(static_cast<size_t>(nThreads), nullptr);
+    m_sectorSize = (sectorSize != 0) ? sectorSize : 512;
+    m_srcSize = srcSize;
+    m_badSectors.clear();
+    m_badSectorCount = 0;
+    m_faults = 0;
+    m_reissues = 0;
+    m_recovered = 0;
+
+    m_stopping = false;
+    m_thread = std::thread(&FaultHandler::ThreadLoop, this);
+    LOG_INFO(L"FaultHandler::Start: Failed ranges are reissued up to %d times starting after %d ms, %lld bad sectors tolerated.\n",
+        m_retries, m_retryDelayMs, m_errorBudget);
+    LOG_DEBUG(L"End of FaultHandler::Start\n");
+    return true;
+}
+
+bool FaultHandler::RegisterWorkerThread(int workerIndex)
+{
+    if (workerIndex < 0 || workerIndex >= static_cast<int>(m_workerThreads.size())) {
+        LOG_ERROR(L"FaultHandler::RegisterWorkerThread: Worker index %d is out of range.\n", workerIndex);
+        return false;
+    }
+    // GetCurrentThread is a pseudo handle, the retry thread needs a real one to queue APCs to this worker
+    if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &m_workerThreads[workerIndex], THREAD_SET_CONTEXT, FALSE, 0)) {
+        LOG_ERROR(L"FaultHandler::RegisterWorkerThread: Failed to duplicate the handle of worker %d. Error: %d\n", workerIndex, GetLastError());
+        m_workerThreads[workerIndex] = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool FaultHandler::Submit(IOContext* cntxt, DWORD errCode)
+{
+    if (m_retries <= 0 || !IsRetryable(errCode)) {
+        return false;
+    }
+    ULONGLONG delayMs = GetRetryDelay(0);
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (m_stopping) {
+            return false;
+        }
+        m_pending.push_back({ cntxt, errCode, 0, GetTickCount64() + delayMs });
+    }
+    m_faults.fetch_add(1, std::memory_order_relaxed);
+    LOG_WARNING(L"FaultHandler::Submit: %s at offset %lld failed with error %d, reissuing in %llu ms.\n",
+        (cntxt->opType == IOOperationType::READ ? L"Read" : L"Write"),
+        (static_cast<LONGLONG>(cntxt->overlapped.OffsetHigh) << 32) | cntxt->overlapped.Offset, errCode, delayMs);
+    m_wakeUp.notify_one();
+    return true;
+}
+
+void FaultHandler::ThreadLoop()
+{
+    LOG_DEBUG(L"Inside FaultHandler::ThreadLoop\n");
+    for (;;) {
+        PendingFault fault = {};
+        {
+            std::unique_lock<std::mutex> guard(m_lock);
+            for (;;) {
+                if (m_stopping) {
+                    LOG_DEBUG(L"End of FaultHandler::ThreadLoop\n");
+                    return;
+                }
+                if (m_pending.empty()) {
+                    m_wakeUp.wait(guard);
+                    continue;
+                }
+                auto next = std::min_element(m_pending.begin(), m_pending.end(), [](const PendingFault& a, const PendingFault& b) {
+                    return a.dueMs < b.dueMs;
+                });
+                ULONGLONG nowMs = GetTickCount64();
+                if (next->dueMs <= nowMs) {
+                    fault = *next;
+                    m_pending.erase(next);
+                    break;
+                }
+                m_wakeUp.wait_for(guard, std::chrono::milliseconds(next->dueMs - nowMs));
+            }
+        }
+        Reissue(fault);
+    }
+}
+
+void FaultHandler::Reissue(PendingFault fault)
+{
+    IOContext* cntxt = fault.cntxt;
+    // The copy has failed meanwhile. The range still counts as pending and its worker may be waiting for it,
+    // so it goes back failed instead of being reissued.
+    if (cntxt->curInst->ioUtilsObj.getErrorOccuredInfo()) {
+        LOG_DEBUG(L"FaultHandler::Reissue: Copy already failed, handing back the fault at offset %lld.\n", cntxt->readOffset);
+        Redeliver(cntxt, ERROR_OPERATION_ABORTED, 0);
+        return;
+    }
+
+    bool isRead = (cntxt->opType == IOOperationType::READ);
+    LONGLONG offset = (static_cast<LONGLONG>(cntxt->overlapped.OffsetHigh) << 32) | cntxt->overlapped.Offset;
+    DWORD bytesTransferred = 0;
+    m_reissues.fetch_add(1, std::memory_order_relaxed);
+    bool done = isRead ? m_diskUtils.ReadSync(cntxt->ioHandle, offset, cntxt->buf, cntxt->ioLength, &bytesTransferred) :
+        m_diskUtils.WriteSync(cntxt->ioHandle, offset, cntxt->buf, cntxt->ioLength, &bytesTransferred);
+    DWORD errCode = done ? ERROR_SUCCESS : GetLastError();
+    if (done || (isRead && errCode == ERROR_HANDLE_EOF)) {
+        LOG_INFO(L"FaultHandler::Reissue: %s at offset %lld succeeded on reissue %d.\n", (isRead ? L"Read" : L"Write"), offset, fault.attempts + 1);
+        m_recovered.fetch_add(1, std::memory_order_relaxed);
+        Redeliver(cntxt, errCode, bytesTransferred);
+        return;
+    }
+
+    ++fault.attempts;
+    fault.errCode = errCode;
+    if (fault.attempts < m_retries && IsRetryable(errCode)) {
+        ULONGLONG delayMs = GetRetryDelay(fault.attempts);
+        LOG_WARNING(L"FaultHandler::Reissue: %s at offset %lld failed again with error %d (reissue %d of %d), next one in %llu ms.\n",
+            (isRead ? L"Read" : L"Write"), offset, errCode, fault.attempts, m_retries, delayMs);
+        fault.dueMs = GetTickCount64() + delayMs;
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_pending.push_back(fault);
+        return;
+    }
+
+    // The media itself is damaged: keep whatever of the block is still readable
+    if (isRead && IsMediaError(errCode)) {
+        LOG_WARNING(L"FaultHandler::Reissue: Read at offset %lld keeps failing with error %d, isolating bad sectors.\n", offset, errCode);
+        LONGLONG dataEnd = offset;
+        if (ReadAroundBadSectors(cntxt, offset, cntxt->ioLength, dataEnd, errCode)) {
+            LONGLONG available = (std::min)(dataEnd, m_srcSize) - offset;
+            m_recovered.fetch_add(1, std::memory_order_relaxed);
+            Redeliver(cntxt, ERROR_SUCCESS, static_cast<DWORD>((std::max)(available, 0LL)));
+            return;
+        }
+    }
+
+    LOG_ERROR(L"FaultHandler::Reissue: Giving up on %s at offset %lld after %d reissues. Error: %d\n", (isRead ? L"read" : L"write"), offset, fault.attempts, errCode);
+    Redeliver(cntxt, errCode, 0);
+}
+
+bool FaultHandler::ReadAroundBadSectors(IOContext* cntxt, LONGLONG offset, DWORD length, LONGLONG& dataEnd, DWORD& errCode)
+{
+    char* buf = cntxt->buf + (offset - cntxt->readOffset);
+    DWORD bytesRead = 0;
+    if (m_diskUtils.ReadSync(cntxt->ioHandle, offset, buf, length, &bytesRead) || GetLastError() == ERROR_HANDLE_EOF) {
+        dataEnd = (std::max)(dataEnd, offset + static_cast<LONGLONG>(bytesRead));
+        return true;
+    }
+    errCode = GetLastError();
+    if (!IsMediaError(errCode)) {
+        return false;
+    }
+    if (length <= m_sectorSize) {
+        memset(buf, 0, length);
+        RecordBadSectors(offset, length, errCode);
+        dataEnd = (std::max)(dataEnd, offset + static_cast<LONGLONG>(length));
+        if (m_badSectorCount > m_errorBudget) {
+            LOG_ERROR(L"FaultHandler::ReadAroundBadSectors: %lld bad sectors exceed the error budget of %lld.\n", m_badSectorCount, m_errorBudget);
+            return false;
+        }
+        return true;
+    }
+    // Halves stay sector aligned, so unbuffered reads of them remain valid
+    DWORD half = ((length / 2 + m_sectorSize - 1) / m_sectorSize) * m_sectorSize;
+    return ReadAroundBadSectors(cntxt, offset, half, dataEnd, errCode) &&
+        ReadAroundBadSectors(cntxt, offset + half, length - half, dataEnd, errCode);
+}
+
+void FaultHandler::RecordBadSectors(LONGLONG offset, LONGLONG length, DWORD errCode)
+{
+    LOG_WARNING(L"FaultHandler::RecordBadSectors: %lld bytes at offset %lld are unreadable (error %d), copied as zeros.\n", length, offset, errCode);
+    m_badSectorCount += (length + m_sectorSize - 1) / m_sectorSize;
+    if (!m_badSectors.empty()) {
+        BadSectorRange& last = m_badSectors.back();
+        if (last.offset + last.length == offset && last.errCode == errCode) {
+            last.length += length;
+            return;
+        }
+    }
+    m_badSectors.push_back({ offset, length, errCode });
+}
+
+bool FaultHandler::SaveBadSectors() const
+{
+    LOG_DEBUG(L"Inside FaultHandler::SaveBadSectors\n");
+    std::ostringstream list;
+    list << "offset,length,error\n";
+    for (const BadSectorRange& range : m_badSectors) {
+        list << range.offset << "," << range.length << "," << range.errCode << "\n";
+    }
+
+    std::string text = list.str();
+    HANDLE hFile = CreateFileW(m_badSectorPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"FaultHandler::SaveBadSectors: Failed to create %s. Error: %d\n", m_badSectorPath.c_str(), GetLastError());
+        LOG_DEBUG(L"End of FaultHandler::SaveBadSectors\n");
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    bool success = WriteFile(hFile, text.data(), static_cast<DWORD>(text.size()), &bytesWritten, nullptr) && bytesWritten == text.size();
+    if (!success) {
+        LOG_ERROR(L"FaultHandler::SaveBadSectors: Failed to write %s. Error: %d\n", m_badSectorPath.c_str(), GetLastError());
+    }
+    CloseHandle(hFile);
+    LOG_DEBUG(L"End of FaultHandler::SaveBadSectors\n");
+    return success;
+}
+
+void FaultHandler::Redeliver(IOContext* cntxt, DWORD errCode, DWORD bytesTransferred)
+{
+    // A failure coming back is final, IOUtils must not submit it again
+    cntxt->recovered = true;
+    cntxt->faultError = errCode;
+    cntxt->faultBytes = bytesTransferred;
+
+    BOOL queued = FALSE;
+    if (m_engineType == IOEngineType::IOCP) {
+        queued = PostQueuedCompletionStatus(m_hIocp, bytesTransferred, m_completionKey, &cntxt->overlapped);
+    }
+    else {
+        // APC engine: the worker owning the context is the only thread allowed to complete its I/O
+        HANDLE hThread = m_workerThreads[static_cast<size_t>(cntxt->workerIndex)];
+        queued = (hThread != nullptr) && QueueUserAPC(RedeliverApc, hThread, reinterpret_cast<ULONG_PTR>(cntxt));
+    }
+    if (!queued) {
+        LOG_ERROR(L"FaultHandler::Redeliver: Failed to hand the context of offset %lld back to the I/O threads. Error: %d\n", cntxt->readOffset, GetLastError());
+        cntxt->curInst->ioUtilsObj.setErrorOccuredInfo(true);
+    }
+}
+
+void CALLBACK FaultHandler::RedeliverApc(ULONG_PTR param)
+{
+    Deliver(reinterpret_cast<IOContext*>(param));
+}
+
+void FaultHandler::Deliver(IOContext* cntxt)
+{
+    IOUtils& io = cntxt->curInst->ioUtilsObj;
+    if (cntxt->opType == IOOperationType::READ) {
+        io.OnReadCompletion(cntxt->faultError, cntxt->faultBytes, &cntxt->overlapped);
+    }
+    else {
+        io.OnWriteCompletion(cntxt->faultError, cntxt->faultBytes, &cntxt->overlapped);
+    }
+}
+
+ULONGLONG FaultHandler::GetRetryDelay(int attempts) const
+{
+    ULONGLONG delayMs = m_retryDelayMs;
+    for (int i = 0; i < attempts && delayMs < FAULT_MAX_RETRY_DELAY_MS; ++i) {
+        delayMs *= 2;
+    }
+    return (delayMs < FAULT_MAX_RETRY_DELAY_MS) ? delayMs : FAULT_MAX_RETRY_DELAY_MS;
+}
+
+// Errors a reissue cannot fix: cancelled I/O, a full volume, or a request the device rejects outright
+bool FaultHandler::IsRetryable(DWORD errCode)
+{
+    switch (errCode) {
+    case ERROR_SUCCESS:
+    case ERROR_HANDLE_EOF:
+    case ERROR_OPERATION_ABORTED:
+    case ERROR_ACCESS_DENIED:
+    case ERROR_INVALID_HANDLE:
+    case ERROR_INVALID_PARAMETER:
+    case ERROR_DISK_FULL:
+    case ERROR_HANDLE_DISK_FULL:
+        return false;
+    default:
+        return true;
+    }
+}
+
+bool FaultHandler::IsMediaError(DWORD errCode)
+{
+    switch (errCode) {
+    case ERROR_CRC:
+    case ERROR_SECTOR_NOT_FOUND:
+    case ERROR_READ_FAULT:
+    case ERROR_IO_DEVICE:
+    case ERROR_DEVICE_HARDWARE_ERROR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void FaultHandler::Stop()
+{
+    bool wasRunning = m_thread.joinable();
+    std::vector<PendingFault> dropped;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+        dropped.swap(m_pending);
+    }
+    m_wakeUp.notify_all();
+    if (wasRunning) {
+        m_thread.join();
+    }
+    // Every dropped range still counts as pending, hand it back failed while its worker can still take it
+    for (const PendingFault& fault : dropped) {
+        Redeliver(fault.cntxt, ERROR_OPERATION_ABORTED, 0);
+    }
+    for (HANDLE& hThread : m_workerThreads) {
+        if (hThread != nullptr) {
+            CloseHandle(hThread);
+            hThread = nullptr;
+        }
+    }
+    if (!dropped.empty()) {
+        LOG_WARNING(L"FaultHandler::Stop: %zu failed ranges were still waiting for a reissue, they were handed back as failed.\n", dropped.size());
+    }
+    if (wasRunning && !m_badSectorPath.empty() && SaveBadSectors()) {
+        LOG_INFO(L"FaultHandler::Stop: %zu bad sector ranges saved to %s.\n", m_badSectors.size(), m_badSectorPath.c_str());
+    }
+}
+
+void FaultHandler::LogSummary() const
+{
+    LOG_INFO(L"FaultHandler: %lld operations failed, %lld reissues recovered %lld of them, %lld bad sectors were copied as zeros (budget %lld).\n",
+        getFaults(), getReissues(), getRecovered(), m_badSectorCount, m_errorBudget);
+}
@@ -0,0 +1,188 @@
+#include "FileImage.h"
+
+//Getters
+LONGLONG FileImage::getSize() const
+{
+    return m_size;
+}
+
+bool FileImage::isInPlace() const
+{
+    return m_inPlace;
+}
+
+bool FileImage::isValidDataSet() const
+{
+    return m_validDataSet;
+}
+
+bool FileImage::hasBase() const
+{
+    return m_hBase != INVALID_HANDLE_VALUE;
+}
+
+LONGLONG FileImage::getBytesCloned() const
+{
+    return m_bytesCloned.load(std::memory_order_relaxed);
+}
+
+// SetFileValidData needs SeManageVolumePrivilege enabled in the process token
+bool FileImage::EnableManageVolumePrivilege()
+{
+    HANDLE hToken = nullptr;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken)) {
+        return false;
+    }
+    TOKEN_PRIVILEGES privileges = {};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    bool enabled = LookupPrivilegeValueW(nullptr, SE_MANAGE_VOLUME_NAME, &privileges.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, nullptr, nullptr) &&
+        GetLastError() != ERROR_NOT_ALL_ASSIGNED; // AdjustTokenPrivileges succeeds even if the account lacks the privilege
+    CloseHandle(hToken);
+    return enabled;
+}
+
+bool FileImage::OpenBase(LPCWSTR basePath, HANDLE hFile, LONGLONG size)
+{
+    LOG_DEBUG(L"Inside FileImage::OpenBase\n");
+    Close();
+    m_hBase = CreateFileW(basePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_hBase == INVALID_HANDLE_VALUE) {
+        LOG_WARNING(L"FileImage::OpenBase: Failed to open the previous image %s with the error: %d\n", basePath, GetLastError());
+        LOG_DEBUG(L"End of FileImage::OpenBase\n");
+        return false;
+    }
+
+    // Block cloning is a ReFS feature, and extents are only shared within one volume
+    DWORD fileSystemFlags = 0;
+    BY_HANDLE_FILE_INFORMATION baseInfo = {};
+    BY_HANDLE_FILE_INFORMATION imageInfo = {};
+    LARGE_INTEGER baseSize = {};
+    if (!GetVolumeInformationByHandleW(m_hBase, nullptr, 0, nullptr, nullptr, &fileSystemFlags, nullptr, 0) ||
+        (fileSystemFlags & FILE_SUPPORTS_BLOCK_REFCOUNTING) == 0) {
+        LOG_WARNING(L"FileImage::OpenBase: The volume of %s does not support block cloning (ReFS only).\n", basePath);
+        Close();
+        LOG_DEBUG(L"End of FileImage::OpenBase\n");
+        return false;
+    }
+    if (!GetFileInformationByHandle(m_hBase, &baseInfo) || !GetFileInformationByHandle(hFile, &imageInfo) ||
+        baseInfo.dwVolumeSerialNumber != imageInfo.dwVolumeSerialNumber) {
+        LOG_WARNING(L"FileImage::OpenBase: The previous image %s is not on the volume of the new image.\n", basePath);
+        Close();
+        LOG_DEBUG(L"End of FileImage::OpenBase\n");
+        return false;
+    }
+    if (!GetFileSizeEx(m_hBase, &baseSize) || baseSize.QuadPart < size) {
+        LOG_WARNING(L"FileImage::OpenBase: The previous image %s is smaller than the new one.\n", basePath);
+        Close();
+        LOG_DEBUG(L"End of FileImage::OpenBase\n");
+        return false;
+    }
+
+    // Source and target of a clone must agree on integrity streams and sparseness, which can only change while hFile is empty.
+    // A resumed image was matched by the run that created it.
+    LARGE_INTEGER imageSize = {};
+    FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity = {};
+    DWORD bytesReturned = 0;
+    if (!DeviceIoControl(m_hBase, FSCTL_GET_INTEGRITY_INFORMATION, nullptr, 0, &integrity, sizeof(integrity), &bytesReturned, nullptr) ||
+        integrity.ClusterSizeInBytes == 0) {
+        LOG_WARNING(L"FileImage::OpenBase: Failed to query the integrity information of %s. Error: %d\n", basePath, GetLastError());
+        Close();
+        LOG_DEBUG(L"End of FileImage::OpenBase\n");
+        return false;
+    }
+    m_clusterSize = integrity.ClusterSizeInBytes;
+    FSCTL_SET_INTEGRITY_INFORMATION_BUFFER imageIntegrity = {};
+    imageIntegrity.ChecksumAlgorithm = integrity.ChecksumAlgorithm;
+    imageIntegrity.Flags = integrity.Flags;
+    if (!GetFileSizeEx(hFile, &imageSize)) {
+        imageSize.QuadPart = 0;
+    }
+    bool baseSparse = (baseInfo.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0;
+    if (imageSize.QuadPart == 0 &&
+        (!m_diskUtils.DeviceIoControlSync(hFile, FSCTL_SET_INTEGRITY_INFORMATION, &imageIntegrity, sizeof(imageIntegrity), nullptr, 0, &bytesReturned) ||
+        (baseSparse && !m_diskUtils.DeviceIoControlSync(hFile, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytesReturned)))) {
+        LOG_WARNING(L"FileImage::OpenBase: Failed to match the new image to %s. Error: %d\n", basePath, GetLastError());
+        Close();
+        LOG_DEBUG(L"End of FileImage::OpenBase\n");
+        return false;
+    }
+    LOG_INFO(L"FileImage::OpenBase: Unchanged blocks are cloned from %s (%u KB clusters).\n", basePath, m_clusterSize / 1024);
+    LOG_DEBUG(L"End of FileImage::OpenBase\n");
+    return true;
+}
+
+bool FileImage::Prepare(HANDLE hFile, LONGLONG size, bool inPlace, bool setValidData)
+{
+    LOG_DEBUG(L"Inside FileImage::Prepare\n");
+    m_hFile = hFile;
+    m_size = size;
+    m_inPlace = inPlace;
+    m_validDataSet = false;
+    m_bytesCloned.store(0, std::memory_order_relaxed);
+
+    // Allocating up front also checks that the volume has room for the whole image
+    FILE_ALLOCATION_INFO allocation = {};
+    allocation.AllocationSize.QuadPart = size;
+    if (!SetFileInformationByHandle(hFile, FileAllocationInfo, &allocation, sizeof(allocation))) {
+        LOG_ERROR(L"FileImage::Prepare: Failed to allocate %lld MB for the image. Error: %d\n", size / (1024 * 1024), GetLastError());
+        LOG_DEBUG(L"End of FileImage::Prepare\n");
+        return false;
+    }
+    FILE_END_OF_FILE_INFO endOfFile = {};
+    endOfFile.EndOfFile.QuadPart = size;
+    if (!SetFileInformationByHandle(hFile, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile))) {
+        LOG_ERROR(L"FileImage::Prepare: Failed to set the end of the image to %lld bytes. Error: %d\n", size, GetLastError());
+        LOG_DEBUG(L"End of FileImage::Prepare\n");
+        return false;
+    }
+
+    if (setValidData) {
+        if (!EnableManageVolumePrivilege()) {
+            LOG_INFO(L"FileImage::Prepare: SeManageVolumePrivilege is not held, the file system zero fills the image ahead of the writes.\n");
+        }
+        else if (!SetFileValidData(hFile, size)) {
+            LOG_WARNING(L"FileImage::Prepare: SetFileValidData failed with error: %d, the file system zero fills the image ahead of the writes.\n", GetLastError());
+        }
+        else {
+            m_validDataSet = true;
+        }
+    }
+    LOG_INFO(L"FileImage::Prepare: %lld MB allocated%s.\n", size / (1024 * 1024), (m_validDataSet ? L", valid data length set" : L""));
+    LOG_DEBUG(L"End of FileImage::Prepare\n");
+    return true;
+}
+
+bool FileImage::CloneRange(LONGLONG offset, DWORD length)
+{
+    if (m_hBase == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    // Clones cover whole clusters within the image, a short last block past that is written instead
+    LONGLONG byteCount = ((static_cast<LONGLONG>(length) + m_clusterSize - 1) / m_clusterSize) * m_clusterSize;
+    if (offset % m_clusterSize != 0 || offset + byteCount > m_size) {
+        return false;
+    }
+
+    DUPLICATE_EXTENTS_DATA extents = {};
+    extents.FileHandle = m_hBase;
+    extents.SourceFileOffset.QuadPart = offset;
+    extents.TargetFileOffset.QuadPart = offset;
+    extents.ByteCount.QuadPart = byteCount;
+    DWORD bytesReturned = 0;
+    if (!m_diskUtils.DeviceIoControlSync(m_hFile, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents), nullptr, 0, &bytesReturned)) {
+        LOG_WARNING(L"FileImage::CloneRange: Cloning offset %lld, length %lld failed with error: %d, writing it instead.\n", offset, byteCount, GetLastError());
+        return false;
+    }
+    m_bytesCloned.fetch_add(length, std::memory_order_relaxed);
+    return true;
+}
+
+void FileImage::Close()
+{
+    if (m_hBase != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hBase);
+        m_hBase = INVALID_HANDLE_VALUE;
+    }
+}
@@ -0,0 +1,464 @@
+#include "FileTreeCopier.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+
+// Attributes carried over to the copies, the rest describe how the source stores the file
+#define FILETREE_COPIED_ATTRIBUTES (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED)
+
+//Setters
+void FileTreeCopier::setMaxJobs(int maxJobs)
+{
+    m_scheduler.setMaxJobs(maxJobs);
+}
+
+void FileTreeCopier::setDeviceSlots(int deviceSlots)
+{
+    m_scheduler.setDeviceSlots(deviceSlots);
+}
+
+FileTreeCopier::~FileTreeCopier()
+{
+    if (m_hVolume != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hVolume);
+    }
+}
+
+std::wstring FileTreeCopier::ToExtendedPath(const std::wstring& path)
+{
+    if (path.compare(0, 4, L"\\\\?\\") == 0 || path.compare(0, 4, L"\\\\.\\") == 0) {
+        return path;
+    }
+    wchar_t fullPath[MAX_PATH * 4] = {};
+    DWORD length = GetFullPathNameW(path.c_str(), MAX_PATH * 4, fullPath, nullptr);
+    std::wstring result = (length > 0 && length < MAX_PATH * 4) ? std::wstring(fullPath, length) : path;
+    if (result.compare(0, 2, L"\\\\") == 0) {
+        return L"\\\\?\\UNC\\" + result.substr(2); // \\server\share
+    }
+    return L"\\\\?\\" + result;
+}
+
+bool FileTreeCopier::OpenVolume(LPCWSTR srcDir, ULONGLONG& srcDirRef)
+{
+    LOG_DEBUG(L"Inside FileTreeCopier::OpenVolume\n");
+    HANDLE hDir = CreateFileW(m_srcRoot.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    BY_HANDLE_FILE_INFORMATION dirInfo = {};
+    if (hDir == INVALID_HANDLE_VALUE || !GetFileInformationByHandle(hDir, &dirInfo) || !(dirInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        LOG_ERROR(L"FileTreeCopier::OpenVolume: %s is not a directory that can be opened. Error: %d\n", srcDir, GetLastError());
+        if (hDir != INVALID_HANDLE_VALUE) {
+            CloseHandle(hDir);
+        }
+        LOG_DEBUG(L"End of FileTreeCopier::OpenVolume\n");
+        return false;
+    }
+    CloseHandle(hDir);
+    srcDirRef = (static_cast<ULONGLONG>(dirInfo.nFileIndexHigh) << 32) | dirInfo.nFileIndexLow;
+
+    // The volume root without its trailing backslash opens the volume itself: \\.\C: for a drive letter,
+    // the device for \\?\GLOBALROOT\Device\HarddiskVolumeShadowCopyN\ and \\?\Volume{...}\ roots
+    wchar_t volumePath[MAX_PATH] = {};
+    if (!GetVolumePathNameW(m_srcRoot.c_str(), volumePath, MAX_PATH)) {
+        LOG_ERROR(L"FileTreeCopier::OpenVolume: Failed to get the volume of %s. Error: %d\n", srcDir, GetLastError());
+        LOG_DEBUG(L"End of FileTreeCopier::OpenVolume\n");
+        return false;
+    }
+    std::wstring volume = volumePath;
+    if (!volume.empty() && volume.back() == L'\\') {
+        volume.pop_back();
+    }
+    if (volume.compare(0, 4, L"\\\\?\\") == 0 && volume.size() == 6 && volume[5] == L':') {
+        volume = L"\\\\.\\" + volume.substr(4);
+    }
+    else if (volume.size() == 2 && volume[1] == L':') {
+        volume = L"\\\\.\\" + volume;
+    }
+    m_hVolume = CreateFileW(volume.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+        FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, nullptr);
+    if (m_hVolume == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"FileTreeCopier::OpenVolume: Failed to open the volume %s with error: %d\n", volume.c_str(), GetLastError());
+        LOG_DEBUG(L"End of FileTreeCopier::OpenVolume\n");
+        return false;
+    }
+    bool opened = m_mft.Open(m_hVolume);
+    LOG_INFO(L"FileTreeCopier::OpenVolume: Reading the MFT of %s, source directory is file %llx.\n", volume.c_str(), srcDirRef);
+    LOG_DEBUG(L"End of FileTreeCopier::OpenVolume\n");
+    return opened;
+}
+
+bool FileTreeCopier::BuildTree(ULONGLONG srcDirRef)
+{
+    LOG_DEBUG(L"Inside FileTreeCopier::BuildTree\n");
+    std::vector<MftName> names;
+    if (!m_mft.EnumerateNames(names)) {
+        LOG_DEBUG(L"End of FileTreeCopier::BuildTree\n");
+        return false;
+    }
+    std::unordered_map<ULONGLONG, size_t> byRef;
+    byRef.reserve(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        byRef[names[i].fileRef] = i;
+    }
+
+    // Walk each entry's parents up to the source directory, remembering every directory's answer and path,
+    // so each directory is resolved once however many files it holds
+    enum : char { UNKNOWN = 0, INSIDE, OUTSIDE };
+    std::vector<char> state(names.size(), UNKNOWN);
+    std::vector<std::wstring> relPaths(names.size());
+    std::vector<size_t> chain;
+    for (size_t i = 0; i < names.size(); ++i) {
+        chain.clear();
+        size_t cur = i;
+        char result = OUTSIDE;
+        while (true) {
+            if (state[cur] != UNKNOWN) {
+                result = state[cur];
+                break;
+            }
+            chain.push_back(cur);
+            ULONGLONG parentRef = names[cur].parentRef;
+            if (parentRef == srcDirRef) {
+                result = INSIDE;
+                break;
+            }
+            auto parent = byRef.find(parentRef);
+            if (parent == byRef.end() || chain.size() > names.size()) {
+                break;
+            }
+            // Nothing below a directory reparse point (junction, mount point) belongs to this tree
+            if (names[parent->second].attributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+                if (state[parent->second] == UNKNOWN) {
+                    state[parent->second] = OUTSIDE;
+                }
+                break;
+            }
+            cur = parent->second;
+        }
+        for (auto entry = chain.rbegin(); entry != chain.rend(); ++entry) {
+            state[*entry] = result;
+            if (result == INSIDE) {
+                ULONGLONG parentRef = names[*entry].parentRef;
+                relPaths[*entry] = (parentRef == srcDirRef) ? names[*entry].name : relPaths[byRef[parentRef]] + L"\\" + names[*entry].name;
+            }
+        }
+    }
+
+    std::vector<ULONGLONG> fileRefs;
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (state[i] != INSIDE) {
+            continue;
+        }
+        if (names[i].attributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+            ++m_skipped;
+            LOG_DEBUG(L"FileTreeCopier::BuildTree: Skipping reparse point %s\n", relPaths[i].c_str());
+            continue;
+        }
+        TreeFile file;
+        file.relPath = std::move(relPaths[i]);
+        file.kind = (names[i].attributes & FILE_ATTRIBUTE_DIRECTORY) ? TreeFileKind::DIRECTORY : TreeFileKind::COPIED;
+        m_files.push_back(std::move(file));
+        fileRefs.push_back(names[i].fileRef);
+    }
+    names.clear();
+    names.shrink_to_fit();
+
+    // One pass over the MFT in volume order brings in every record of the tree
+    DWORD clusterSize = m_mft.getClusterSize();
+    bool recordsRead = m_mft.ReadFileRecords(fileRefs, [this, clusterSize](size_t index, MftFileData& data) {
+        TreeFile& file = m_files[index];
+        file.data = std::move(data);
+        if (file.kind == TreeFileKind::DIRECTORY || !file.data.inRecord) {
+            return;
+        }
+        if (file.data.readable && (file.data.resident || file.data.size == 0)) {
+            file.kind = TreeFileKind::IN_RECORD;
+        }
+        else if (file.data.size >= FILETREE_ENGINE_FILE_BYTES && !file.data.namedStreams) {
+            file.kind = TreeFileKind::ENGINE;
+        }
+        else if (file.data.readable && file.data.size <= FILETREE_SMALL_FILE_BYTES && file.data.runs.size() == 1) {
+            file.kind = TreeFileKind::BATCHED;
+            file.volumeOffset = file.data.runs[0].lcn * clusterSize;
+        }
+        file.data.runs.clear();
+        file.data.runs.shrink_to_fit();
+    });
+    LOG_DEBUG(L"End of FileTreeCopier::BuildTree\n");
+    return recordsRead;
+}
+
+void FileTreeCopier::BuildBatches()
+{
+    for (size_t i = 0; i < m_files.size(); ++i) {
+        switch (m_files[i].kind) {
+        case TreeFileKind::BATCHED:
+            m_batchOrder.push_back(i);
+            break;
+        case TreeFileKind::IN_RECORD:
+        case TreeFileKind::COPIED:
+            m_singles.push_back(i);
+            break;
+        case TreeFileKind::ENGINE:
+            m_engineFiles.push_back(i);
+            break;
+        default:
+            break;
+        }
+    }
+    std::sort(m_batchOrder.begin(), m_batchOrder.end(), [this](size_t a, size_t b) { return m_files[a].volumeOffset < m_files[b].volumeOffset; });
+
+    // Neighbouring files share a read as long as the gap between them is small and the read stays within the buffer.
+    // Each file is read to the end of its last cluster, so every read starts and ends on a cluster boundary.
+    LONGLONG clusterSize = m_mft.getClusterSize();
+    for (size_t i = 0; i < m_batchOrder.size(); ++i) {
+        const TreeFile& file = m_files[m_batchOrder[i]];
+        LONGLONG fileEnd = file.volumeOffset + ((file.data.size + clusterSize - 1) / clusterSize) * clusterSize;
+        if (!m_batches.empty()) {
+            FileBatch& batch = m_batches.back();
+            LONGLONG batchEnd = batch.volumeOffset + batch.length;
+            if (file.volumeOffset >= batchEnd && file.volumeOffset - batchEnd <= FILETREE_BATCH_GAP_BYTES &&
+                fileEnd - batch.volumeOffset <= FILETREE_BATCH_BYTES) {
+                batch.length = static_cast<DWORD>(fileEnd - batch.volumeOffset);
+                ++batch.count;
+                continue;
+            }
+        }
+        m_batches.push_back({ file.volumeOffset, static_cast<DWORD>(fileEnd - file.volumeOffset), i, 1 });
+    }
+}
+
+bool FileTreeCopier::CreateDirectories()
+{
+    LOG_DEBUG(L"Inside FileTreeCopier::CreateDirectories\n");
+    std::vector<size_t> directories;
+    for (size_t i = 0; i < m_files.size(); ++i) {
+        if (m_files[i].kind == TreeFileKind::DIRECTORY) {
+            directories.push_back(i);
+        }
+    }
+    // A parent's path is a prefix of its children's, so shorter paths first creates parents first
+    std::sort(directories.begin(), directories.end(), [this](size_t a, size_t b) { return m_files[a].relPath.size() < m_files[b].relPath.size(); });
+    if (!CreateDirectoryW(m_destRoot.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        LOG_ERROR(L"FileTreeCopier::CreateDirectories: Failed to create %s with error: %d\n", m_destRoot.c_str(), GetLastError());
+        LOG_DEBUG(L"End of FileTreeCopier::CreateDirectories\n");
+        return false;
+    }
+    for (size_t index : directories) {
+        std::wstring path = m_destRoot + L"\\" + m_files[index].relPath;
+        if (!CreateDirectoryW(path.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+            LOG_ERROR(L"FileTreeCopier::CreateDirectories: Failed to create %s with error: %d\n", path.c_str(), GetLastError());
+            LOG_DEBUG(L"End of FileTreeCopier::CreateDirectories\n");
+            return false;
+        }
+    }
+    LOG_INFO(L"FileTreeCopier::CreateDirectories: %zu directories created.\n", directories.size());
+    LOG_DEBUG(L"End of FileTreeCopier::CreateDirectories\n");
+    return true;
+}
+
+bool FileTreeCopier::ApplyBasicInfo(HANDLE hFile, const FILE_BASIC_INFO& basicInfo)
+{
+    FILE_BASIC_INFO info = basicInfo;
+    bool directory = (info.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    info.FileAttributes &= FILETREE_COPIED_ATTRIBUTES;
+    if (info.FileAttributes == 0 && !directory) {
+        info.FileAttributes = FILE_ATTRIBUTE_NORMAL; // 0 would leave the attributes as they are
+    }
+    return SetFileInformationByHandle(hFile, FileBasicInfo, &info, sizeof(info)) != FALSE;
+}
+
+bool FileTreeCopier::WriteFileData(const TreeFile& file, const BYTE* data, DWORD size)
+{
+    std::wstring path = m_destRoot + L"\\" + file.relPath;
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"FileTreeCopier::WriteFileData: Failed to create %s with error: %d\n", path.c_str(), GetLastError());
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    bool written = (size == 0) || (WriteFile(hFile, data, size, &bytesWritten, nullptr) && bytesWritten == size);
+    if (!written) {
+        LOG_ERROR(L"FileTreeCopier::WriteFileData: Failed to write %u bytes to %s with error: %d\n", size, path.c_str(), GetLastError());
+    }
+    else if (!ApplyBasicInfo(hFile, file.data.basicInfo)) {
+        LOG_WARNING(L"FileTreeCopier::WriteFileData: Failed to set the times and attributes of %s. Error: %d\n", path.c_str(), GetLastError());
+    }
+    CloseHandle(hFile);
+    m_bytesCopied.fetch_add(size, std::memory_order_relaxed);
+    return written;
+}
+
+bool FileTreeCopier::CopyBatch(const FileBatch& batch, BYTE* buf)
+{
+    DWORD bytesRead = 0;
+    if (!DiskUtils().ReadSync(m_hVolume, batch.volumeOffset, buf, batch.length, &bytesRead) || bytesRead != batch.length) {
+        LOG_ERROR(L"FileTreeCopier::CopyBatch: Failed to read %u bytes at volume offset %lld with error: %d\n", batch.length, batch.volumeOffset, GetLastError());
+        return false;
+    }
+    bool succeeded = true;
+    for (size_t i = batch.first; i < batch.first + batch.count; ++i) {
+        const TreeFile& file = m_files[m_batchOrder[i]];
+        succeeded = WriteFileData(file, buf + (file.volumeOffset - batch.volumeOffset), static_cast<DWORD>(file.data.size)) && succeeded;
+    }
+    return succeeded;
+}
+
+bool FileTreeCopier::CopySingle(const TreeFile& file)
+{
+    if (file.kind == TreeFileKind::IN_RECORD) {
+        return WriteFileData(file, file.data.residentData.data(), static_cast<DWORD>(file.data.size));
+    }
+    // Compressed, encrypted, sparse, fragmented or multi-stream files, and files whose record could not be used
+    std::wstring srcPath = m_srcRoot + L"\\" + file.relPath;
+    std::wstring destPath = m_destRoot + L"\\" + file.relPath;
+    DWORD flags = COPY_FILE_COPY_SYMLINK | ((file.data.size > FILETREE_SMALL_FILE_BYTES) ? COPY_FILE_NO_BUFFERING : 0);
+    if (!CopyFileExW(srcPath.c_str(), destPath.c_str(), nullptr, nullptr, nullptr, flags)) {
+        LOG_ERROR(L"FileTreeCopier::CopySingle: Failed to copy %s with error: %d\n", srcPath.c_str(), GetLastError());
+        return false;
+    }
+    if (file.data.inRecord) {
+        HANDLE hFile = CreateFileW(destPath.c_str(), FILE_WRITE_ATTRIBUTES, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE || !ApplyBasicInfo(hFile, file.data.basicInfo)) {
+            LOG_WARNING(L"FileTreeCopier::CopySingle: Failed to set the times and attributes of %s. Error: %d\n", destPath.c_str(), GetLastError());
+        }
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+        }
+    }
+    m_bytesCopied.fetch_add(file.data.size, std::memory_order_relaxed);
+    return true;
+}
+
+void FileTreeCopier::WorkerLoop(int workerIndex)
+{
+    LOG_DEBUG(L"Inside FileTreeCopier::WorkerLoop, worker %d\n", workerIndex);
+    // Batches are whole clusters at cluster offsets, a page aligned buffer suits unbuffered reads of any sector size
+    BYTE* buf = static_cast<BYTE*>(VirtualAlloc(nullptr, FILETREE_BATCH_BYTES, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (buf == nullptr) {
+        LOG_ERROR(L"FileTreeCopier::WorkerLoop: Failed to allocate the batch buffer of worker %d. Error: %d\n", workerIndex, GetLastError());
+        m_failures.fetch_add(1, std::memory_order_relaxed);
+        LOG_DEBUG(L"End of FileTreeCopier::WorkerLoop, worker %d\n", workerIndex);
+        return;
+    }
+    size_t totalItems = m_batches.size() + m_singles.size();
+    for (size_t item = m_nextItem.fetch_add(1); item < totalItems; item = m_nextItem.fetch_add(1)) {
+        bool succeeded = (item < m_batches.size()) ? CopyBatch(m_batches[item], buf) : CopySingle(m_files[m_singles[item - m_batches.size()]]);
+        if (!succeeded) {
+            m_failures.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    VirtualFree(buf, 0, MEM_RELEASE);
+    LOG_DEBUG(L"End of FileTreeCopier::WorkerLoop, worker %d\n", workerIndex);
+}
+
+bool FileTreeCopier::FinishEngineFiles()
+{
+    bool succeeded = true;
+    for (size_t index : m_engineFiles) {
+        const TreeFile& file = m_files[index];
+        std::wstring path = m_destRoot + L"\\" + file.relPath;
+        HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        FILE_END_OF_FILE_INFO endOfFile = {};
+        endOfFile.EndOfFile.QuadPart = file.data.size;
+        if (hFile == INVALID_HANDLE_VALUE || !SetFileInformationByHandle(hFile, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile))) {
+            LOG_ERROR(L"FileTreeCopier::FinishEngineFiles: Failed to set the size of %s with error: %d\n", path.c_str(), GetLastError());
+            succeeded = false;
+        }
+        else if (!ApplyBasicInfo(hFile, file.data.basicInfo)) {
+            LOG_WARNING(L"FileTreeCopier::FinishEngineFiles: Failed to set the times and attributes of %s. Error: %d\n", path.c_str(), GetLastError());
+        }
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+        }
+    }
+    return succeeded;
+}
+
+bool FileTreeCopier::Run(LPCWSTR srcDir, LPCWSTR destDir, int nThreads, int blockSizeMB, int queueDepth, LONGLONG memoryBudgetMB, JobScheduler::Configure configure)
+{
+    LOG_DEBUG(L"Inside FileTreeCopier::Run\n");
+    auto start = std::chrono::steady_clock::now();
+    m_srcRoot = ToExtendedPath(srcDir);
+    m_destRoot = ToExtendedPath(destDir);
+    while (m_srcRoot.size() > 7 && m_srcRoot.back() == L'\\') {
+        m_srcRoot.pop_back();
+    }
+    while (m_destRoot.size() > 7 && m_destRoot.back() == L'\\') {
+        m_destRoot.pop_back();
+    }
+
+    ULONGLONG srcDirRef = 0;
+    if (!OpenVolume(srcDir, srcDirRef) || !BuildTree(srcDirRef)) {
+        LOG_ERROR(L"FileTreeCopier::Run: Failed to enumerate %s from the MFT.\n", srcDir);
+        LOG_DEBUG(L"End of FileTreeCopier::Run\n");
+        return false;
+    }
+    BuildBatches();
+    if (!CreateDirectories()) {
+        LOG_DEBUG(L"End of FileTreeCopier::Run\n");
+        return false;
+    }
+    auto enumerated = std::chrono::steady_clock::now();
+    LONGLONG batchedBytes = 0;
+    for (size_t index : m_batchOrder) {
+        batchedBytes += m_files[index].data.size;
+    }
+    LOG_INFO(L"FileTreeCopier::Run: %zu entries in %.1f s: %zu small files in %zu batch reads (%lld MB), %zu copied singly, %zu large files, %d reparse points skipped.\n",
+        m_files.size(), std::chrono::duration<double>(enumerated - start).count(), m_batchOrder.size(), m_batches.size(), batchedBytes / (1024 * 1024),
+        m_singles.size(), m_engineFiles.size(), m_skipped);
+
+    // Large files go through the block engine on the scheduler's thread while the workers copy everything else
+    bool jobsSucceeded = true;
+    LONGLONG engineBytes = 0;
+    std::thread jobThread;
+    if (!m_engineFiles.empty()) {
+        for (size_t index : m_engineFiles) {
+            m_scheduler.AddJob(m_srcRoot + L"\\" + m_files[index].relPath, m_destRoot + L"\\" + m_files[index].relPath, 0);
+            engineBytes += m_files[index].data.size;
+        }
+        jobThread = std::thread([this, &jobsSucceeded, nThreads, blockSizeMB, queueDepth, memoryBudgetMB, configure]() {
+            jobsSucceeded = m_scheduler.Run(nThreads, blockSizeMB, queueDepth, memoryBudgetMB, [&configure](BlockCopier& copier) {
+                if (configure) {
+                    configure(copier);
+                }
+                copier.setFileImage(true, nullptr);
+            });
+        });
+    }
+    int nWorkers = (nThreads > 0) ? nThreads : 1;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < nWorkers; ++i) {
+        workers.emplace_back(&FileTreeCopier::WorkerLoop, this, i);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    if (jobThread.joinable()) {
+        jobThread.join();
+        jobsSucceeded = FinishEngineFiles() && jobsSucceeded;
+    }
+
+    // Creating the files changed the directories' times, they are set last
+    for (const TreeFile& file : m_files) {
+        if (file.kind != TreeFileKind::DIRECTORY || !file.data.inRecord) {
+            continue;
+        }
+        std::wstring path = m_destRoot + L"\\" + file.relPath;
+        HANDLE hDir = CreateFileW(path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+        if (hDir == INVALID_HANDLE_VALUE || !ApplyBasicInfo(hDir, file.data.basicInfo)) {
+            LOG_WARNING(L"FileTreeCopier::Run: Failed to set the times and attributes of %s. Error: %d\n", path.c_str(), GetLastError());
+        }
+        if (hDir != INVALID_HANDLE_VALUE) {
+            CloseHandle(hDir);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LONGLONG totalBytes = m_bytesCopied.load() + (jobsSucceeded ? engineBytes : 0);
+    LOG_INFO(L"FileTreeCopier::Run: %lld MB in %zu files copied in %.1f s (%.1f MB/s), %d failures.\n", totalBytes / (1024 * 1024),
+        m_batchOrder.size() + m_singles.size() + m_engineFiles.size(), seconds, (seconds > 0) ? (totalBytes / (1024.0 * 1024.0)) / seconds : 0.0,
+        m_failures.load());
+    LOG_DEBUG(L"End of FileTreeCopier::Run\n");
+    return m_failures.load() == 0 && jobsSucceeded;
+}
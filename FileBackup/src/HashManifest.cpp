@@ -0,0 +1,151 @@
+#include "HashManifest.h"
+#include "HashUtils.h"
+
+//Getters
+DWORD HashManifest::getBlockSize() const
+{
+    return m_header.blockSize;
+}
+
+ULONGLONG HashManifest::getImageDigest() const
+{
+    return m_header.imageDigest;
+}
+
+LONGLONG HashManifest::getHashedBlocks() const
+{
+    LONGLONG hashed = 0;
+    for (ULONGLONG hash : m_hashes) {
+        if (hash != 0) {
+            ++hashed;
+        }
+    }
+    return hashed;
+}
+
+LONGLONG HashManifest::getVerifiedBlocks() const
+{
+    return m_verifiedBlocks.load(std::memory_order_relaxed);
+}
+
+LONGLONG HashManifest::getMismatchedBlocks() const
+{
+    return m_mismatchedBlocks.load(std::memory_order_relaxed);
+}
+
+bool HashManifest::Create(LPCWSTR path, DWORD blockSize, LONGLONG sourceSize)
+{
+    LOG_DEBUG(L"Inside HashManifest::Create\n");
+    if (blockSize == 0 || sourceSize <= 0) {
+        LOG_ERROR(L"HashManifest::Create: Invalid parameters.\n");
+        LOG_DEBUG(L"End of HashManifest::Create\n");
+        return false;
+    }
+    m_path = (path != nullptr) ? path : L"";
+    m_header = {};
+    m_header.magic = HASH_MANIFEST_MAGIC;
+    m_header.version = HASH_MANIFEST_VERSION;
+    m_header.blockSize = blockSize;
+    m_header.sourceSize = sourceSize;
+    m_header.blockCount = (sourceSize + blockSize - 1) / blockSize;
+    m_hashes.assign(static_cast<size_t>(m_header.blockCount), 0);
+    m_verifiedBlocks.store(0, std::memory_order_relaxed);
+    m_mismatchedBlocks.store(0, std::memory_order_relaxed);
+    LOG_DEBUG(L"End of HashManifest::Create\n");
+    return true;
+}
+
+DWORD HashManifest::GetBlockLength(LONGLONG blockNumber) const
+{
+    LONGLONG remaining = m_header.sourceSize - blockNumber * m_header.blockSize;
+    if (remaining <= 0) {
+        return 0;
+    }
+    return (remaining < m_header.blockSize) ? static_cast<DWORD>(remaining) : m_header.blockSize;
+}
+
+void HashManifest::Record(LONGLONG blockNumber, ULONGLONG hash)
+{
+    if (blockNumber < 0 || blockNumber >= m_header.blockCount) {
+        return;
+    }
+    m_hashes[static_cast<size_t>(blockNumber)] = (hash != 0) ? hash : 1; // 0 is reserved for blocks not copied
+}
+
+bool HashManifest::Verify(LONGLONG blockNumber, ULONGLONG hash)
+{
+    if (blockNumber < 0 || blockNumber >= m_header.blockCount || m_hashes[static_cast<size_t>(blockNumber)] == 0) {
+        return true;
+    }
+    if (m_hashes[static_cast<size_t>(blockNumber)] != ((hash != 0) ? hash : 1)) {
+        ReportMismatch(blockNumber);
+        return false;
+    }
+    m_verifiedBlocks.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void HashManifest::ReportMismatch(LONGLONG blockNumber)
+{
+    m_verifiedBlocks.fetch_add(1, std::memory_order_relaxed);
+    if (m_mismatchedBlocks.fetch_add(1, std::memory_order_relaxed) < HASH_MANIFEST_LOGGED_MISMATCHES) {
+        LOG_ERROR(L"HashManifest::ReportMismatch: Destination block %lld (offset %lld) does not match the source.\n",
+            blockNumber, blockNumber * m_header.blockSize);
+    }
+}
+
+bool HashManifest::Finish()
+{
+    LOG_DEBUG(L"Inside HashManifest::Finish\n");
+    m_header.imageDigest = HashUtils::Hash64(m_hashes.data(), m_hashes.size() * sizeof(ULONGLONG));
+    if (m_path.empty()) {
+        LOG_DEBUG(L"End of HashManifest::Finish\n");
+        return true;
+    }
+
+    // Write next to the manifest and rename over it, so a crash never leaves a half written manifest behind
+    std::wstring tempPath = m_path + L".tmp";
+    HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"HashManifest::Finish: Failed to create %s. Error: %d\n", tempPath.c_str(), GetLastError());
+        LOG_DEBUG(L"End of HashManifest::Finish\n");
+        return false;
+    }
+
+    bool success = true;
+    DWORD bytesWritten = 0;
+    if (!WriteFile(hFile, &m_header, sizeof(m_header), &bytesWritten, nullptr) || bytesWritten != sizeof(m_header)) {
+        success = false;
+    }
+    const char* src = reinterpret_cast<const char*>(m_hashes.data());
+    ULONGLONG remaining = m_hashes.size() * sizeof(ULONGLONG);
+    while (success && remaining > 0) {
+        DWORD chunk = static_cast<DWORD>(remaining < (64ULL * 1024 * 1024) ? remaining : (64ULL * 1024 * 1024));
+        if (!WriteFile(hFile, src, chunk, &bytesWritten, nullptr) || bytesWritten != chunk) {
+            success = false;
+            break;
+        }
+        src += chunk;
+        remaining -= chunk;
+    }
+    if (success && !FlushFileBuffers(hFile)) {
+        success = false;
+    }
+    if (!success) {
+        LOG_ERROR(L"HashManifest::Finish: Failed to write %s. Error: %d\n", tempPath.c_str(), GetLastError());
+    }
+    CloseHandle(hFile);
+
+    if (success && !MoveFileExW(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG_ERROR(L"HashManifest::Finish: Failed to replace %s. Error: %d\n", m_path.c_str(), GetLastError());
+        success = false;
+    }
+    if (!success) {
+        DeleteFileW(tempPath.c_str());
+    }
+    else {
+        LOG_INFO(L"HashManifest::Finish: Saved %lld block hashes to %s.\n", getHashedBlocks(), m_path.c_str());
+    }
+    LOG_DEBUG(L"End of HashManifest::Finish\n");
+    return success;
+}
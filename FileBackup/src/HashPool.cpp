@@ -0,0 +1,75 @@
+#include "HashPool.h"
+
+//Getters
+int HashPool::getThreadCount() const
+{
+    return static_cast<int>(m_threads.size());
+}
+
+bool HashPool::Start(int nThreads, Handler handler)
+{
+    LOG_DEBUG(L"Inside HashPool::Start\n");
+    Stop();
+    if (nThreads <= 0) {
+        nThreads = static_cast<int>(std::thread::hardware_concurrency());
+        if (nThreads <= 0) {
+            nThreads = 1;
+        }
+    }
+    if (nThreads > MAX_HASH_THREADS) {
+        nThreads = MAX_HASH_THREADS;
+    }
+
+    m_handler = handler;
+    m_stopping = false;
+    m_threads.reserve(nThreads);
+    for (int i = 0; i < nThreads; ++i) {
+        m_threads.emplace_back(&HashPool::ThreadLoop, this);
+    }
+    LOG_INFO(L"HashPool::Start: %d hash threads started.\n", nThreads);
+    LOG_DEBUG(L"End of HashPool::Start\n");
+    return true;
+}
+
+void HashPool::Submit(IOContext* cntxt)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_queue.push_back(cntxt);
+    }
+    m_wakeUp.notify_one();
+}
+
+void HashPool::ThreadLoop()
+{
+    LOG_DEBUG(L"Inside HashPool::ThreadLoop\n");
+    for (;;) {
+        IOContext* cntxt = nullptr;
+        {
+            std::unique_lock<std::mutex> guard(m_lock);
+            m_wakeUp.wait(guard, [this] { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                break; // Stopping and nothing left to hash
+            }
+            cntxt = m_queue.front();
+            m_queue.pop_front();
+        }
+        m_handler(cntxt);
+    }
+    LOG_DEBUG(L"End of HashPool::ThreadLoop\n");
+}
+
+void HashPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+    for (auto& t : m_threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    m_threads.clear();
+}
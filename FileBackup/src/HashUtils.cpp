@@ -0,0 +1,94 @@
+#include "HashUtils.h"
+#include <cstring>
+
+// xxHash64 (https://github.com/Cyan4973/xxHash), reference algorithm
+namespace {
+    const ULONGLONG PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    const ULONGLONG PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    const ULONGLONG PRIME64_3 = 0x165667B19E3779F9ULL;
+    const ULONGLONG PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+    const ULONGLONG PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+    inline ULONGLONG RotL64(ULONGLONG x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline ULONGLONG Read64(const unsigned char* p) {
+        ULONGLONG v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline DWORD Read32(const unsigned char* p) {
+        DWORD v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline ULONGLONG Round(ULONGLONG acc, ULONGLONG input) {
+        acc += input * PRIME64_2;
+        acc = RotL64(acc, 31);
+        return acc * PRIME64_1;
+    }
+
+    inline ULONGLONG MergeRound(ULONGLONG acc, ULONGLONG val) {
+        acc ^= Round(0, val);
+        return acc * PRIME64_1 + PRIME64_4;
+    }
+}
+
+ULONGLONG HashUtils::Hash64(const void* data, size_t len, ULONGLONG seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + len;
+    ULONGLONG h64;
+
+    if (len >= 32) {
+        // Four independent lanes keep the multipliers of the CPU busy
+        const unsigned char* limit = end - 32;
+        ULONGLONG v1 = seed + PRIME64_1 + PRIME64_2;
+        ULONGLONG v2 = seed + PRIME64_2;
+        ULONGLONG v3 = seed;
+        ULONGLONG v4 = seed - PRIME64_1;
+        do {
+            v1 = Round(v1, Read64(p)); p += 8;
+            v2 = Round(v2, Read64(p)); p += 8;
+            v3 = Round(v3, Read64(p)); p += 8;
+            v4 = Round(v4, Read64(p)); p += 8;
+        } while (p <= limit);
+
+        h64 = RotL64(v1, 1) + RotL64(v2, 7) + RotL64(v3, 12) + RotL64(v4, 18);
+        h64 = MergeRound(h64, v1);
+        h64 = MergeRound(h64, v2);
+        h64 = MergeRound(h64, v3);
+        h64 = MergeRound(h64, v4);
+    }
+    else {
+        h64 = seed + PRIME64_5;
+    }
+
+    h64 += static_cast<ULONGLONG>(len);
+
+    while (p + 8 <= end) {
+        h64 ^= Round(0, Read64(p));
+        h64 = RotL64(h64, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h64 ^= static_cast<ULONGLONG>(Read32(p)) * PRIME64_1;
+        h64 = RotL64(h64, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h64 ^= (*p) * PRIME64_5;
+        h64 = RotL64(h64, 11) * PRIME64_1;
+        ++p;
+    }
+
+    h64 ^= h64 >> 33;
+    h64 *= PRIME64_2;
+    h64 ^= h64 >> 29;
+    h64 *= PRIME64_3;
+    h64 ^= h64 >> 32;
+    return h64;
+}
@@ -1,5 +1,14 @@
 #include "IOUtils.h"
 #include "BlockCopier.h" // Needed to cast curInst back to BlockCopier*
+#include "HashUtils.h"
+#include "BufferUtils.h"
+#include "CopyTrace.h"
+#include <utility>
+
+IOUtils::IOUtils() : m_pendingIOs(0), m_nextBlock(0), m_readComplete(false), m_errOccurred(false), m_engineType(IOEngineType::APC), m_schedule(nullptr), m_ranges(nullptr), m_throttle(nullptr),
+    m_blocksPerIo(1), m_activeLimit(0), m_activeContexts(0), m_blockHandler(nullptr), m_bufferRelease(&BlockStages::ReleaseOwned), m_readSectorSize(0), m_hFinished(nullptr), m_hDrained(nullptr)
+{
+}
 
 //getters
 int IOUtils::getPendingIOs()
@@ -17,9 +26,39 @@ bool IOUtils::getErrorOccuredInfo()
     return m_errOccurred.load(std::memory_order_acquire); 
 }
 
-LONGLONG IOUtils::getFileOffset()
+LONGLONG IOUtils::getNextBlock()
+{
+    return m_nextBlock.load(std::memory_order_acquire);
+}
+
+IOEngineType IOUtils::getEngineType()
+{
+    return m_engineType;
+}
+
+int IOUtils::getBlocksPerIo()
+{
+    return m_blocksPerIo.load(std::memory_order_relaxed);
+}
+
+int IOUtils::getActiveLimit()
+{
+    return m_activeLimit.load(std::memory_order_relaxed);
+}
+
+BlockHandler IOUtils::getBlockHandler()
+{
+    return m_blockHandler;
+}
+
+BufferRelease IOUtils::getBufferRelease()
+{
+    return m_bufferRelease;
+}
+
+DWORD IOUtils::getReadSectorSize()
 {
-    return m_fileOffset.load(std::memory_order_acquire);
+    return m_readSectorSize;
 }
 
 //Setters
@@ -37,13 +76,132 @@ void IOUtils::setPendingIOs(int value)
 {
     m_pendingIOs.store(value, std::memory_order_acquire);
 }
-void IOUtils::setFileOffset(LONGLONG offset)
+void IOUtils::setNextBlock(LONGLONG blockIndex)
+{
+    m_nextBlock.store(blockIndex, std::memory_order_release);
+}
+
+void IOUtils::setEngineType(IOEngineType engineType)
+{
+    m_engineType = engineType;
+}
+
+void IOUtils::setSchedule(const BlockSchedule* schedule)
+{
+    m_schedule = schedule;
+}
+
+void IOUtils::setRanges(RangeScheduler* ranges)
+{
+    m_ranges = ranges;
+}
+
+void IOUtils::setBlocksPerIo(int blocksPerIo)
+{
+    m_blocksPerIo.store(blocksPerIo > 0 ? blocksPerIo : 1, std::memory_order_relaxed);
+}
+
+void IOUtils::setActiveLimit(int activeLimit)
+{
+    m_activeLimit.store(activeLimit > 0 ? activeLimit : 0, std::memory_order_relaxed);
+}
+
+void IOUtils::setThrottle(IoThrottle* throttle)
+{
+    m_throttle = throttle;
+}
+
+void IOUtils::setFinishedEvent(HANDLE hFinished)
+{
+    m_hFinished = hFinished;
+}
+
+void IOUtils::setDrainedEvent(HANDLE hDrained)
+{
+    m_hDrained = hDrained;
+}
+
+void IOUtils::setBlockHandler(BlockHandler blockHandler)
+{
+    m_blockHandler = blockHandler;
+}
+
+void IOUtils::setBufferRelease(BufferRelease bufferRelease)
 {
-    m_fileOffset.store(offset, std::memory_order_acquire);
+    m_bufferRelease = bufferRelease;
 }
 
-// Issues an asynchronous read operation using the given IOContext
-bool IOUtils::IssueRead(const HANDLE& handle, IOContext* cntxt, const DWORD& blockSize, const LONGLONG& totalFileSize) {
+void IOUtils::setReadSectorSize(DWORD sectorSize)
+{
+    m_readSectorSize = sectorSize;
+}
+
+void IOUtils::AddActiveContext()
+{
+    m_activeContexts.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool IOUtils::ParkIfOverLimit(IOContext* cntxt)
+{
+    // Out of tokens: the read is delayed by parking rather than by sleeping this I/O thread
+    bool throttled = (m_throttle != nullptr && !m_throttle->Admit());
+    int limit = m_activeLimit.load(std::memory_order_relaxed);
+    if (!throttled && (limit == 0 || m_activeContexts.load(std::memory_order_relaxed) <= limit)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_parkedLock);
+    if (!throttled && m_activeContexts.load(std::memory_order_relaxed) <= limit) { // Another context parked first
+        return false;
+    }
+    m_activeContexts.fetch_sub(1, std::memory_order_relaxed);
+    m_parkedContexts.push_back(cntxt);
+    CopyTrace::Stall(throttled ? L"Throttled" : L"OverActiveLimit", cntxt->index, -1, 0, m_pendingIOs.load(std::memory_order_relaxed));
+    LOG_DEBUG(L"IOUtils::ParkIfOverLimit: Parked a context, %d active. Thread ID: %d\n", m_activeContexts.load(), GetCurrentThreadId());
+    return true;
+}
+
+void IOUtils::UnparkContexts(const HANDLE& handle)
+{
+    // One context at a time, each read is charged to the throttle before the next one is admitted
+    for (;;) {
+        IOContext* cntxt = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_parkedLock);
+            int limit = m_activeLimit.load(std::memory_order_relaxed);
+            if (m_parkedContexts.empty() || (limit != 0 && m_activeContexts.load(std::memory_order_relaxed) >= limit) ||
+                (m_throttle != nullptr && !m_throttle->Admit())) {
+                break;
+            }
+            cntxt = m_parkedContexts.back();
+            m_parkedContexts.pop_back();
+            m_activeContexts.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!IssueRead(handle, cntxt)) {
+            LOG_DEBUG(L"IOUtils::UnparkContexts: No more reads to issue for a resumed context.\n");
+        }
+    }
+}
+
+void IOUtils::ClearParkedContexts()
+{
+    std::lock_guard<std::mutex> lock(m_parkedLock);
+    m_parkedContexts.clear();
+    m_activeContexts.store(0, std::memory_order_relaxed);
+}
+
+void IOUtils::SignalIfFinished()
+{
+    bool drained = (m_pendingIOs.load(std::memory_order_acquire) == 0);
+    if (m_hFinished != nullptr && (m_errOccurred.load(std::memory_order_acquire) || (m_readComplete.load(std::memory_order_acquire) && drained))) {
+        SetEvent(m_hFinished);
+    }
+    if (m_hDrained != nullptr && drained) {
+        SetEvent(m_hDrained);
+    }
+}
+
+// Claims the next scheduled block (or run of blocks) of the context's worker and issues an asynchronous read of it using the given IOContext
+bool IOUtils::IssueRead(const HANDLE& handle, IOContext* cntxt) {
     LOG_DEBUG(L"Inside IOUtils::IssueRead, Thread ID: %d\n", GetCurrentThreadId());
 
     if (m_readComplete.load(std::memory_order_acquire) || m_errOccurred.load(std::memory_order_acquire))
@@ -51,48 +209,112 @@ bool IOUtils::IssueRead(const HANDLE& handle, IOContext* cntxt, const DWORD& blo
         LOG_DEBUG(L"IOUtils::IssueRead: Read already completed or error occurred. Returning false.\n");
         return false;
     }
+    if (m_schedule == nullptr) {
+        LOG_ERROR(L"IOUtils::IssueRead: No block schedule set.\n");
+        m_errOccurred.store(true, std::memory_order_release);
+        return false;
+    }
 
-    // increment the global file offset to claim a block
-    LONGLONG curOffset = m_fileOffset.fetch_add(blockSize, std::memory_order_relaxed);
-
-    if (curOffset >= totalFileSize) {
-        m_readComplete.store(true, std::memory_order_release); // Mark read as complete
-        LOG_DEBUG(L"IOUtils::IssueRead: Current offset (%lld) exceeded total file size (%lld). No more reads to issue.\n", curOffset, totalFileSize);
+    // Count the read as pending before claiming its block, so that once the last block is claimed
+    // and m_readComplete is set, every claimed block is already visible in m_pendingIOs
+    m_pendingIOs.fetch_add(1, std::memory_order_acq_rel);
+    // Checked again once counted: after an error StartCopy waits for the count to drop to zero, a read counted
+    // after it saw zero would outlive that wait
+    if (m_errOccurred.load(std::memory_order_acquire)) {
+        m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
         return false;
     }
 
-    DWORD bytesToRead = blockSize;
-    if (curOffset + bytesToRead > totalFileSize) {
-        bytesToRead = static_cast<DWORD>(totalFileSize - curOffset);
+    // Claim from the worker's own range, or increment the global block index to claim a block
+    // (or a run of them within one extent when reads span several blocks)
+    LONGLONG blockIndex = 0;
+    LONGLONG blockCount = 1;
+    int blocksPerIo = m_blocksPerIo.load(std::memory_order_relaxed);
+    if (m_ranges != nullptr) {
+        if (!m_ranges->Claim(cntxt->workerIndex, blocksPerIo, blockIndex, blockCount)) {
+            blockIndex = m_schedule->getTotalBlocks(); // Every range is empty
+            blockCount = 1;
+        }
     }
-    if (bytesToRead == 0) {
-        m_readComplete.store(true, std::memory_order_release);
-        LOG_DEBUG(L"IOUtils::IssueRead: Calculated bytesToRead is 0. Marking read complete.\n");
+    else if (blocksPerIo <= 1) {
+        blockIndex = m_nextBlock.fetch_add(1, std::memory_order_acq_rel);
+    }
+    else {
+        blockIndex = m_nextBlock.load(std::memory_order_acquire);
+        do {
+            blockCount = m_schedule->GetRunLength(blockIndex, blocksPerIo);
+            if (blockCount == 0) { // Past the last block
+                blockCount = 1;
+                break;
+            }
+        } while (!m_nextBlock.compare_exchange_weak(blockIndex, blockIndex + blockCount, std::memory_order_acq_rel));
+    }
+
+    LONGLONG curOffset = 0;
+    DWORD bytesToRead = 0;
+    if (!m_schedule->GetBlocks(blockIndex, blockCount, curOffset, bytesToRead) || bytesToRead == 0) {
+        m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+        m_readComplete.store(true, std::memory_order_release); // Mark read as complete
+        LOG_DEBUG(L"IOUtils::IssueRead: Block index (%lld) exceeded scheduled blocks (%lld). No more reads to issue.\n", blockIndex, m_schedule->getTotalBlocks());
         return false;
     }
+    if (m_throttle != nullptr) {
+        m_throttle->Charge(bytesToRead);
+    }
+    // Unbuffered reads are whole sectors: the last block of a file source is read up to its sector and the read
+    // stops at the end of the file. A verify pass reads the destination, which holds that block padded to its own sector size.
+    const DWORD sectorSize = m_readSectorSize;
+    if (sectorSize != 0) {
+        DWORD paddedBytes = ((bytesToRead + sectorSize - 1) / sectorSize) * sectorSize;
+        bytesToRead = (paddedBytes <= cntxt->bufSize) ? paddedBytes : bytesToRead;
+    }
 
     cntxt->overlapped.Offset = static_cast<DWORD>(curOffset & 0xFFFFFFFF);
     cntxt->overlapped.OffsetHigh = static_cast<DWORD>((curOffset >> 32) & 0xFFFFFFFF);
     cntxt->overlapped.hEvent = nullptr; // For APCs, hEvent should be null if it's not null it'll just notify and wont trigger callbacks
     cntxt->completed.store(false, std::memory_order_release); 
     cntxt->readOffset = curOffset; 
+    cntxt->blockIndex = blockIndex;
+    cntxt->blockCount = blockCount;
     cntxt->bytesTransferred = 0; 
-
-    m_pendingIOs.fetch_add(1, std::memory_order_relaxed); // Increment pending IOs before issuing
-
-    if (!ReadFileEx(handle, cntxt->buf, bytesToRead, &cntxt->overlapped, StaticReadCompletion)) {
+    cntxt->opType = IOOperationType::READ;
+    cntxt->ioHandle = handle;
+    cntxt->ioLength = bytesToRead;
+    cntxt->recovered = false;
+
+    CopyTrace::BlockClaimed(cntxt->index, cntxt->workerIndex, blockIndex, blockCount);
+    cntxt->issueTicks = CopyMetrics::Now();
+    CopyTrace::ReadIssued(cntxt->index, cntxt->workerIndex, curOffset, bytesToRead);
+
+    BOOL issued = FALSE;
+    if (m_engineType == IOEngineType::IOCP) {
+        // The completion packet is queued to the port the handle is bound to, even if ReadFile completes synchronously
+        issued = ReadFile(handle, cntxt->buf, bytesToRead, nullptr, &cntxt->overlapped) || GetLastError() == ERROR_IO_PENDING;
+    }
+    else {
+        issued = ReadFileEx(handle, cntxt->buf, bytesToRead, &cntxt->overlapped, StaticReadCompletion);
+    }
+    if (!issued) {
         DWORD err = GetLastError();
-        if (err != ERROR_HANDLE_EOF) {
-            LOG_ERROR(L"ReadFileEx failed at offset %lld with error:%d. Thread ID: %d\n", curOffset, err, GetCurrentThreadId());
-            m_errOccurred.store(true, std::memory_order_release);
+        FaultHandler* faults = cntxt->curInst->getFaultHandler();
+        if (err != ERROR_HANDLE_EOF && faults != nullptr && faults->Submit(cntxt, err)) {
+            // The fault handler reissues the read and completes it like the engine would, it stays pending meanwhile
+            LOG_DEBUG(L"IOUtils::IssueRead: Read failed at offset %lld with error:%d, handed to the fault handler. Thread ID: %d\n", curOffset, err, GetCurrentThreadId());
         }
         else {
-            LOG_DEBUG(L"ReadFileEx hit EOF at offset %lld. Thread ID: %d\n", curOffset, GetCurrentThreadId());
-            m_readComplete.store(true, std::memory_order_release);
+            if (err != ERROR_HANDLE_EOF) {
+                LOG_ERROR(L"IOUtils::IssueRead: Read failed at offset %lld with error:%d. Thread ID: %d\n", curOffset, err, GetCurrentThreadId());
+                m_errOccurred.store(true, std::memory_order_release);
+            }
+            else {
+                LOG_DEBUG(L"IOUtils::IssueRead: Read hit EOF at offset %lld. Thread ID: %d\n", curOffset, GetCurrentThreadId());
+                m_readComplete.store(true, std::memory_order_release);
+            }
+            m_pendingIOs.fetch_sub(1, std::memory_order_relaxed); // Decrement on immediate failure
+            return false;
         }
-        m_pendingIOs.fetch_sub(1, std::memory_order_relaxed); // Decrement on immediate failure
-        return false;
     }
+    cntxt->curInst->getMetrics().OnReadIssued(cntxt->workerIndex);
     LOG_DEBUG(L"IOUtils::IssueRead: Successfully issued read for offset %lld, Bytes: %d. Pending IOs: %d. Thread ID: %d\n", curOffset, bytesToRead, m_pendingIOs.load(), GetCurrentThreadId());
     return true;
 }
@@ -108,6 +330,10 @@ bool IOUtils::IssueWrite(const HANDLE& handle, IOContext* cntxt, DWORD bytesToWr
 
     cntxt->overlapped.hEvent = nullptr; // Ensure hEvent is null for APCs
     cntxt->completed.store(false, std::memory_order_release); 
+    cntxt->opType = IOOperationType::WRITE;
+    cntxt->ioHandle = handle;
+    cntxt->ioLength = bytesToWrite;
+    cntxt->recovered = false;
 
     m_pendingIOs.fetch_add(1, std::memory_order_relaxed); // Increment pending IOs before issuing
 
@@ -115,19 +341,53 @@ bool IOUtils::IssueWrite(const HANDLE& handle, IOContext* cntxt, DWORD bytesToWr
         (static_cast<LONGLONG>(cntxt->overlapped.OffsetHigh) << 32) | cntxt->overlapped.Offset,
         bytesToWrite, GetCurrentThreadId());
 
-    if (!WriteFileEx(handle, cntxt->buf, bytesToWrite, &cntxt->overlapped, StaticWriteCompletion)) {
+    cntxt->issueTicks = CopyMetrics::Now();
+    CopyTrace::WriteIssued(cntxt->index, cntxt->workerIndex, 0, (static_cast<LONGLONG>(cntxt->overlapped.OffsetHigh) << 32) | cntxt->overlapped.Offset, bytesToWrite);
+
+    BOOL issued = FALSE;
+    if (m_engineType == IOEngineType::IOCP) {
+        issued = WriteFile(handle, cntxt->buf, bytesToWrite, nullptr, &cntxt->overlapped) || GetLastError() == ERROR_IO_PENDING;
+    }
+    else {
+        issued = WriteFileEx(handle, cntxt->buf, bytesToWrite, &cntxt->overlapped, StaticWriteCompletion);
+    }
+    if (!issued) {
         DWORD err = GetLastError();
-        LOG_ERROR(L"WriteFileEx failed for offset %lld with error : %d. Thread ID: %d\n",
-            (static_cast<LONGLONG>(cntxt->overlapped.OffsetHigh) << 32) | cntxt->overlapped.Offset,
-            err, GetCurrentThreadId());
-        m_errOccurred.store(true, std::memory_order_release);
-        m_pendingIOs.fetch_sub(1, std::memory_order_relaxed); // Decrement on immediate failure
-        return false;
+        FaultHandler* faults = cntxt->curInst->getFaultHandler();
+        if (faults == nullptr || !faults->Submit(cntxt, err)) {
+            LOG_ERROR(L"IOUtils::IssueWrite: Write failed for offset %lld with error : %d. Thread ID: %d\n",
+                (static_cast<LONGLONG>(cntxt->overlapped.OffsetHigh) << 32) | cntxt->overlapped.Offset,
+                err, GetCurrentThreadId());
+            m_errOccurred.store(true, std::memory_order_release);
+            m_pendingIOs.fetch_sub(1, std::memory_order_relaxed); // Decrement on immediate failure
+            return false;
+        }
     }
+    cntxt->curInst->getMetrics().OnWriteIssued(cntxt->workerIndex);
     LOG_DEBUG(L"IOUtils::IssueWrite: Successfully issued write. Pending IOs: %d. Thread ID: %d\n", m_pendingIOs.load(), GetCurrentThreadId());
     return true;
 }
 
+bool IOUtils::IssueUnmap(IOContext* cntxt) {
+    if (m_errOccurred.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    cntxt->overlapped.hEvent = nullptr;
+    cntxt->completed.store(false, std::memory_order_release);
+    cntxt->opType = IOOperationType::UNMAP;
+
+    m_pendingIOs.fetch_add(1, std::memory_order_relaxed);
+    cntxt->issueTicks = CopyMetrics::Now();
+    if (!cntxt->curInst->diskUtilsObj.IssueTrim(cntxt->curInst->getDestHandle(), cntxt->readOffset, cntxt->bytesTransferred, cntxt->trim, &cntxt->overlapped)) {
+        LOG_WARNING(L"IOUtils::IssueUnmap: Unmap failed for offset %lld, writing zeros instead. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    LOG_DEBUG(L"IOUtils::IssueUnmap: Issued unmap for offset %lld, Bytes: %d. Thread ID: %d\n", cntxt->readOffset, cntxt->bytesTransferred, GetCurrentThreadId());
+    return true;
+}
+
 
 //On Completion Callbacks (called by static bridge functions)
 
@@ -139,10 +399,21 @@ void IOUtils::OnReadCompletion(DWORD errCode, DWORD numOfBytesTransfered, LPOVER
         return; 
     }
 
-    // Decrement pending IO count for this operation
-    m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+    cntxt->curInst->getMetrics().OnReadCompleted(cntxt->workerIndex, numOfBytesTransfered, cntxt->issueTicks);
+    CopyTrace::ReadCompleted(cntxt->index, cntxt->workerIndex, cntxt->readOffset, numOfBytesTransfered, cntxt->issueTicks, errCode);
+
+    // A failed read is reissued by the fault handler, the context comes back through here with the outcome
+    FaultHandler* faults = cntxt->curInst->getFaultHandler();
+    if (errCode != ERROR_SUCCESS && errCode != ERROR_HANDLE_EOF && !cntxt->recovered && faults != nullptr && faults->Submit(cntxt, errCode)) {
+        LOG_DEBUG(L"End of IOUtils::OnReadCompletion: Read at offset %lld handed to the fault handler. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        return;
+    }
 
+    // The read stays counted in m_pendingIOs until its write has been issued, so the count never
+    // drops to zero in between and the main thread cannot conclude the copy while a block is in hand.
     if (errCode != ERROR_SUCCESS) {
+        PassTurn(cntxt);
+        m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
         if (errCode != ERROR_HANDLE_EOF) {
             LOG_ERROR(L"IOUtils::OnReadCompletion: Read error for offset %lld : %d. Thread ID: %d\n", cntxt->readOffset, errCode, GetCurrentThreadId());
             m_errOccurred.store(true, std::memory_order_release); 
@@ -158,42 +429,169 @@ void IOUtils::OnReadCompletion(DWORD errCode, DWORD numOfBytesTransfered, LPOVER
     }
 
     if (numOfBytesTransfered == 0) {
+        PassTurn(cntxt);
+        m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
         m_readComplete.store(true, std::memory_order_release);
         cntxt->completed.store(true, std::memory_order_release); 
         LOG_DEBUG(L"IOUtils::OnReadCompletion: 0 bytes transferred. Marking read complete. Thread ID: %d\n", GetCurrentThreadId());
         return;
     }
 
-    // Update global total bytes read for this block copier instance
-    cntxt->curInst->m_bytesReadTotal.fetch_add(numOfBytesTransfered, std::memory_order_relaxed);
+    // The stages for this copy's features were composed into one handler up front, see BlockPipeline.h
+    m_blockHandler(*this, cntxt, numOfBytesTransfered);
+    LOG_DEBUG(L"End of IOUtils::OnReadCompletion, Thread ID: %d\n", GetCurrentThreadId());
+}
 
-    // Handling FILE_FLAG_NO_BUFFERING write alignment
-    DWORD bytesToWritePadded = numOfBytesTransfered;
-    DWORD destSectorSize = cntxt->curInst->getDestSectorSize();
-    if (destSectorSize == 0) {
-        destSectorSize = 4096; // Fallback
-        LOG_WARNING(L"IOUtils::OnReadCompletion: Destination sector size is 0, defaulting to 4096 bytes for padding. Thread ID: %d\n", GetCurrentThreadId());
+void IOUtils::PassTurn(IOContext* cntxt) {
+    // A write released by this may fail at once if the copy already failed, which still ends its pending read
+    ReorderBuffer* reorderBuffer = cntxt->curInst->getReorderBuffer();
+    if (reorderBuffer != nullptr) {
+        reorderBuffer->Skip(cntxt->blockIndex, cntxt->blockCount);
     }
+}
 
-    if (bytesToWritePadded % destSectorSize != 0) {
-        DWORD padding = destSectorSize - (bytesToWritePadded % destSectorSize);
-        if (bytesToWritePadded + padding > cntxt->bufSize) {
-            LOG_ERROR(L"IOUtils::OnReadCompletion: Buffer too small for padding at offset %lld. Required size: %d, Available buffer size:%d. Thread ID: %d\n", cntxt->readOffset, bytesToWritePadded + padding, cntxt->bufSize, GetCurrentThreadId());
+void IOUtils::IssueBlockWrite(IOContext* cntxt) {
+    FanOutTargets* targets = cntxt->curInst->getFanOutTargets();
+    NetworkTarget* networkTarget = cntxt->curInst->getNetworkTarget();
+    if (targets != nullptr) {
+        IssueFanOutWrites(cntxt, *targets);
+    }
+    else if (networkTarget != nullptr) {
+        if (!IssueSend(*networkTarget, cntxt, cntxt->bytesTransferred)) {
+            LOG_ERROR(L"IOUtils::IssueBlockWrite: Failed to send the block at offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
             m_errOccurred.store(true, std::memory_order_release);
-            cntxt->completed.store(true, std::memory_order_release);
-            return;
         }
-        memset(cntxt->buf + bytesToWritePadded, 0, padding);
-        bytesToWritePadded += padding;
     }
-    cntxt->bytesTransferred = bytesToWritePadded; // Store the actual padded bytes to write
+    else if (!IssueWrite(cntxt->curInst->getDestHandle(), cntxt, cntxt->bytesTransferred)) {
+        LOG_ERROR(L"IOUtils::IssueBlockWrite: Failed to issue write for offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        m_errOccurred.store(true, std::memory_order_release);
+    }
+    m_pendingIOs.fetch_sub(1, std::memory_order_relaxed); // The read is done, the write (if issued) holds its own count
+}
+
+bool IOUtils::IssueSend(NetworkTarget& target, IOContext* cntxt, DWORD bytesToSend) {
+    LOG_DEBUG(L"Inside IOUtils::IssueSend, Thread ID: %d\n", GetCurrentThreadId());
+    if (m_errOccurred.load(std::memory_order_acquire)) {
+        LOG_DEBUG(L"IOUtils::IssueSend: Error already occurred. Returning false.\n");
+        return false;
+    }
 
-    // Now procced with the corresponding write operation
-    if (!cntxt->curInst->ioUtilsObj.IssueWrite(cntxt->curInst->getDestHandle(), cntxt, cntxt->bytesTransferred)) {
-        LOG_ERROR(L"IOUtils::OnReadCompletion: Failed to issue WriteFileEx for offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+    cntxt->completed.store(false, std::memory_order_release);
+    cntxt->opType = IOOperationType::WRITE;
+    m_pendingIOs.fetch_add(1, std::memory_order_relaxed);
+    cntxt->issueTicks = CopyMetrics::Now();
+    CopyTrace::WriteIssued(cntxt->index, cntxt->workerIndex, 0, cntxt->readOffset, bytesToSend);
+    if (!target.Send(cntxt, bytesToSend)) {
         m_errOccurred.store(true, std::memory_order_release);
+        m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    cntxt->curInst->getMetrics().OnWriteIssued(cntxt->workerIndex);
+    LOG_DEBUG(L"End of IOUtils::IssueSend: Sent frame for offset %lld, Bytes: %d. Thread ID: %d\n", cntxt->readOffset, bytesToSend, GetCurrentThreadId());
+    return true;
+}
+
+void IOUtils::OnNetworkSendCompletion(IOContext* cntxt, DWORD errCode, DWORD numOfBytesTransfered) {
+    LOG_DEBUG(L"Inside IOUtils::OnNetworkSendCompletion, Thread ID: %d\n", GetCurrentThreadId());
+    cntxt->curInst->getMetrics().OnWriteCompleted(cntxt->workerIndex, numOfBytesTransfered, cntxt->issueTicks);
+    CopyTrace::WriteCompleted(cntxt->index, cntxt->workerIndex, 0, cntxt->readOffset, numOfBytesTransfered, cntxt->issueTicks, errCode);
+
+    // A frame is sent whole or the connection is broken, the receiver cannot resynchronize on a short one
+    if (errCode != ERROR_SUCCESS || numOfBytesTransfered != cntxt->bytesTransferred) {
+        LOG_ERROR(L"IOUtils::OnNetworkSendCompletion: Send failed for offset %lld after %d of %d bytes : %d. Thread ID: %d\n", cntxt->readOffset,
+            numOfBytesTransfered, cntxt->bytesTransferred, errCode, GetCurrentThreadId());
+        m_errOccurred.store(true, std::memory_order_release);
+    }
+    else {
+        MarkBlockComplete(cntxt);
+        cntxt->curInst->m_bytesWrittenTotal.fetch_add(numOfBytesTransfered, std::memory_order_relaxed);
+    }
+
+    // Release the buffer before the send stops counting as pending, so the copy cannot end in between
+    ReleaseBuffer(cntxt);
+    m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+    LOG_DEBUG(L"End of IOUtils::OnNetworkSendCompletion: Send completed for offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+}
+
+void IOUtils::IssueFanOutWrites(IOContext* cntxt, FanOutTargets& targets) {
+    cntxt->completed.store(false, std::memory_order_release);
+    cntxt->opType = IOOperationType::WRITE;
+    // One reference per destination and one for this function, so the block cannot finish while writes are still being issued
+    int count = targets.getCount();
+    cntxt->writesLeft.store(count + 1, std::memory_order_release);
+    for (int i = 0; i < count; ++i) {
+        FanOutTarget& target = targets.getTarget(i);
+        if (target.dropped.load(std::memory_order_acquire)) {
+            cntxt->writesLeft.fetch_sub(1, std::memory_order_acq_rel);
+            continue;
+        }
+        FanOutWrite& write = cntxt->fanOutWrites[i];
+        write.overlapped = {};
+        write.overlapped.Offset = static_cast<DWORD>(cntxt->readOffset & 0xFFFFFFFF);
+        write.overlapped.OffsetHigh = static_cast<DWORD>((cntxt->readOffset >> 32) & 0xFFFFFFFF);
+        write.cntxt = cntxt;
+        write.issueTicks = CopyMetrics::Now();
+        CopyTrace::WriteIssued(cntxt->index, cntxt->workerIndex, i, cntxt->readOffset, cntxt->bytesTransferred);
+
+        m_pendingIOs.fetch_add(1, std::memory_order_relaxed);
+        if (target.writesInFlight.fetch_add(1, std::memory_order_acq_rel) == 0) {
+            target.lastProgressMs.store(GetTickCount64(), std::memory_order_release); // Idle time does not count as a stall
+        }
+        if (!WriteFile(target.handle, cntxt->buf, cntxt->bytesTransferred, nullptr, &write.overlapped) && GetLastError() != ERROR_IO_PENDING) {
+            DWORD err = GetLastError();
+            LOG_ERROR(L"IOUtils::IssueFanOutWrites: Write to %s failed for offset %lld with error : %d. Thread ID: %d\n", target.path.c_str(), cntxt->readOffset, err, GetCurrentThreadId());
+            target.writesInFlight.fetch_sub(1, std::memory_order_acq_rel);
+            m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+            targets.Drop(i, err);
+            cntxt->writesLeft.fetch_sub(1, std::memory_order_acq_rel);
+            continue;
+        }
+        cntxt->curInst->getMetrics().OnWriteIssued(cntxt->workerIndex);
+    }
+    ReleaseFanOutWrite(cntxt, targets);
+}
+
+void IOUtils::ReleaseFanOutWrite(IOContext* cntxt, FanOutTargets& targets) {
+    if (cntxt->writesLeft.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    // Last reference: the block is on every destination still live
+    if (targets.getLiveCount() == 0) {
+        LOG_ERROR(L"IOUtils::ReleaseFanOutWrite: Every destination has been dropped. Thread ID: %d\n", GetCurrentThreadId());
+        m_errOccurred.store(true, std::memory_order_release);
+    }
+    else {
+        MarkBlockComplete(cntxt);
+        cntxt->curInst->m_bytesWrittenTotal.fetch_add(cntxt->bytesTransferred, std::memory_order_relaxed);
+    }
+    ReleaseBuffer(cntxt);
+}
+
+void IOUtils::OnFanOutWriteCompletion(int destIndex, DWORD errCode, DWORD numOfBytesTransfered, FanOutWrite* write) {
+    LOG_DEBUG(L"Inside IOUtils::OnFanOutWriteCompletion, Thread ID: %d\n", GetCurrentThreadId());
+    IOContext* cntxt = write->cntxt;
+    FanOutTargets& targets = *cntxt->curInst->getFanOutTargets();
+    FanOutTarget& target = targets.getTarget(destIndex);
+
+    cntxt->curInst->getMetrics().OnWriteCompleted(cntxt->workerIndex, numOfBytesTransfered, write->issueTicks);
+    CopyTrace::WriteCompleted(cntxt->index, cntxt->workerIndex, destIndex, cntxt->readOffset, numOfBytesTransfered, write->issueTicks, errCode);
+    target.lastProgressMs.store(GetTickCount64(), std::memory_order_release);
+    target.writesInFlight.fetch_sub(1, std::memory_order_acq_rel);
+
+    if (errCode != ERROR_SUCCESS) {
+        // Writes cancelled by Drop come back aborted, only the first failure of a destination is news
+        if (targets.Drop(destIndex, errCode)) {
+            LOG_ERROR(L"IOUtils::OnFanOutWriteCompletion: Write to %s failed for offset %lld : %d. Thread ID: %d\n", target.path.c_str(), cntxt->readOffset, errCode, GetCurrentThreadId());
+        }
     }
-    LOG_DEBUG(L"End of IOUtils::OnReadCompletion: Issued write for offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+    else {
+        target.bytesWritten.fetch_add(numOfBytesTransfered, std::memory_order_relaxed);
+    }
+
+    // Finish the block before the write stops counting as pending, so the copy cannot end in between
+    ReleaseFanOutWrite(cntxt, targets);
+    m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+    LOG_DEBUG(L"End of IOUtils::OnFanOutWriteCompletion: Write to destination %d completed for offset %lld. Thread ID: %d\n", destIndex, cntxt->readOffset, GetCurrentThreadId());
 }
 
 void IOUtils::OnWriteCompletion(DWORD errCode, DWORD numOfBytesTransfered, LPOVERLAPPED lpOverlapped) {
@@ -204,20 +602,163 @@ void IOUtils::OnWriteCompletion(DWORD errCode, DWORD numOfBytesTransfered, LPOVE
         return;
     }
 
+    cntxt->curInst->getMetrics().OnWriteCompleted(cntxt->workerIndex, numOfBytesTransfered, cntxt->issueTicks);
+    CopyTrace::WriteCompleted(cntxt->index, cntxt->workerIndex, 0, (static_cast<LONGLONG>(cntxt->overlapped.OffsetHigh) << 32) | cntxt->overlapped.Offset,
+        numOfBytesTransfered, cntxt->issueTicks, errCode);
+
+    // The write stays pending while the fault handler reissues it
+    FaultHandler* faults = cntxt->curInst->getFaultHandler();
+    if (errCode != ERROR_SUCCESS && !cntxt->recovered && faults != nullptr && faults->Submit(cntxt, errCode)) {
+        LOG_DEBUG(L"End of IOUtils::OnWriteCompletion: Write at offset %lld handed to the fault handler. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        return;
+    }
     m_pendingIOs.fetch_sub(1, std::memory_order_relaxed); // Decrement pending IOs
 
     if (errCode != ERROR_SUCCESS) {
         LOG_ERROR(L"IOUtils::OnWriteCompletion: Write error for offset %lld : %d. Thread ID: %d\n", cntxt->readOffset, errCode, GetCurrentThreadId());
         m_errOccurred.store(true, std::memory_order_release); 
     }
+    else {
+        MarkBlockComplete(cntxt);
+    }
 
-    //numOfBytesTransfered here is what Windows actually wrote which should be the updated
-    cntxt->curInst->m_bytesWrittenTotal.fetch_add(numOfBytesTransfered, std::memory_order_relaxed);
+    //numOfBytesTransfered here is what Windows actually wrote which should be the updated.
+    //A compressed image or a chunk store writes fewer bytes than it reads, so progress counts the source bytes of the block.
+    DWORD bytesDone = (cntxt->curInst->getImage() != nullptr || cntxt->curInst->getChunkStore() != nullptr) ? cntxt->bytesTransferred : numOfBytesTransfered;
+    cntxt->curInst->m_bytesWrittenTotal.fetch_add(bytesDone, std::memory_order_relaxed);
 
-    cntxt->completed.store(true, std::memory_order_release); 
+    ReleaseBuffer(cntxt);
     LOG_DEBUG(L"End of IOUtils::OnWriteCompletion: Write completed for offset %lld. Pending IOs: %d. Thread ID: %d\n", cntxt->readOffset, m_pendingIOs.load(), GetCurrentThreadId());
 }
 
+void IOUtils::OnUnmapCompletion(DWORD errCode, LPOVERLAPPED lpOverlapped) {
+    LOG_DEBUG(L"Inside IOUtils::OnUnmapCompletion, Thread ID: %d\n", GetCurrentThreadId());
+    auto cntxt = reinterpret_cast<IOContext*>(lpOverlapped);
+    if (!cntxt || !cntxt->curInst) {
+        LOG_ERROR(L"IOUtils::OnUnmapCompletion: IOContext object or BlockCopier Instance is invalid. Returning.\n");
+        return;
+    }
+
+    if (errCode == ERROR_SUCCESS) {
+        cntxt->curInst->m_bytesZeroTotal.fetch_add(cntxt->bytesTransferred, std::memory_order_relaxed);
+        MarkBlockComplete(cntxt);
+        m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+        ReleaseBuffer(cntxt);
+        LOG_DEBUG(L"End of IOUtils::OnUnmapCompletion: Block at offset %lld is all zero, unmapped. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        return;
+    }
+
+    // The write takes over the unmap's pending count, the buffer still holds the zeros at the block's offset
+    if (!m_errOccurred.load(std::memory_order_acquire)) {
+        LOG_WARNING(L"IOUtils::OnUnmapCompletion: Unmap failed for offset %lld with error: %d, writing zeros instead. Thread ID: %d\n", cntxt->readOffset, errCode, GetCurrentThreadId());
+    }
+    if (!IssueWrite(cntxt->curInst->getDestHandle(), cntxt, cntxt->bytesTransferred)) {
+        LOG_ERROR(L"IOUtils::OnUnmapCompletion: Failed to issue write for offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        m_errOccurred.store(true, std::memory_order_release);
+    }
+    m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+    LOG_DEBUG(L"End of IOUtils::OnUnmapCompletion, Thread ID: %d\n", GetCurrentThreadId());
+}
+
+void IOUtils::CompressAndWrite(IOContext* cntxt, COMPRESSOR_HANDLE compressor) {
+    LOG_DEBUG(L"Inside IOUtils::CompressAndWrite, Thread ID: %d\n", GetCurrentThreadId());
+    CompressedImage* image = cntxt->curInst->getImage();
+
+    // Hash the source block before the compressed copy takes its place, this stage is off the I/O threads already
+    HashManifest* hashManifest = cntxt->curInst->getHashManifest();
+    if (hashManifest != nullptr) {
+        HashBlocks(cntxt, *hashManifest, false);
+    }
+
+    bool compressed = false;
+    DWORD storedLength = image->CompressChunk(compressor, cntxt->buf, cntxt->bytesTransferred, cntxt->auxBuf, compressed);
+    if (compressed) {
+        // Write from the compressed copy, the next read of this context fills the other buffer
+        std::swap(cntxt->buf, cntxt->auxBuf);
+    }
+
+    // Chunks are sector padded for FILE_FLAG_NO_BUFFERING, raw blocks already are
+    DWORD sectorSize = cntxt->curInst->getDestSectorSize();
+    DWORD bytesToWrite = ((storedLength + sectorSize - 1) / sectorSize) * sectorSize;
+    memset(cntxt->buf + storedLength, 0, bytesToWrite - storedLength);
+
+    ULONGLONG imageOffset = image->ReserveChunk(cntxt->readOffset / image->getBlockSize(), storedLength, (compressed ? IMAGE_CHUNK_COMPRESSED : 0));
+    cntxt->overlapped.Offset = static_cast<DWORD>(imageOffset & 0xFFFFFFFF);
+    cntxt->overlapped.OffsetHigh = static_cast<DWORD>((imageOffset >> 32) & 0xFFFFFFFF);
+
+    if (!IssueWrite(cntxt->curInst->getDestHandle(), cntxt, bytesToWrite)) {
+        LOG_ERROR(L"IOUtils::CompressAndWrite: Failed to issue write for the chunk of offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+        m_errOccurred.store(true, std::memory_order_release);
+    }
+    m_pendingIOs.fetch_sub(1, std::memory_order_relaxed); // The read is done, the write (if issued) holds its own count
+    SignalIfFinished();
+    LOG_DEBUG(L"End of IOUtils::CompressAndWrite: Block at offset %lld stored in %d bytes at image offset %llu. Thread ID: %d\n", cntxt->readOffset, storedLength, imageOffset, GetCurrentThreadId());
+}
+
+void IOUtils::HashAndRelease(IOContext* cntxt) {
+    LOG_DEBUG(L"Inside IOUtils::HashAndRelease, Thread ID: %d\n", GetCurrentThreadId());
+    HashBlocks(cntxt, *cntxt->curInst->getHashManifest(), cntxt->curInst->getVerifyPass());
+
+    // Last stage to finish: no completion of this context is left to reuse it, queue one for the I/O threads.
+    // It is queued before the hash stops counting as pending, so it is dequeued before any shutdown packet.
+    if (cntxt->bufferHolds.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        cntxt->completed.store(true, std::memory_order_release);
+        if (!PostQueuedCompletionStatus(cntxt->curInst->getCompletionPort(), 0, cntxt->curInst->getCompletionKey(HASH_COMPLETION_KEY), &cntxt->overlapped)) {
+            LOG_ERROR(L"IOUtils::HashAndRelease: Failed to hand the context of offset %lld back to the I/O threads. Error: %d\n", cntxt->readOffset, GetLastError());
+            m_errOccurred.store(true, std::memory_order_release);
+        }
+    }
+    m_pendingIOs.fetch_sub(1, std::memory_order_relaxed);
+    SignalIfFinished();
+    LOG_DEBUG(L"End of IOUtils::HashAndRelease: Hashed block at offset %lld. Thread ID: %d\n", cntxt->readOffset, GetCurrentThreadId());
+}
+
+void IOUtils::HashBlocks(IOContext* cntxt, HashManifest& manifest, bool verifyPass) {
+    DWORD blockSize = manifest.getBlockSize();
+    LONGLONG firstBlock = cntxt->readOffset / blockSize;
+    for (LONGLONG i = 0; i < cntxt->blockCount; ++i) {
+        DWORD blockLength = manifest.GetBlockLength(firstBlock + i);
+        LONGLONG start = i * blockSize;
+        LONGLONG available = static_cast<LONGLONG>(cntxt->hashLength) - start;
+        if (blockLength == 0) {
+            break;
+        }
+        if (available < blockLength) {
+            // The source ends here, the destination must hold every byte that was copied
+            if (verifyPass) {
+                manifest.ReportMismatch(firstBlock + i);
+                continue;
+            }
+            if (available <= 0) {
+                break;
+            }
+            blockLength = static_cast<DWORD>(available);
+        }
+        ULONGLONG hash = HashUtils::Hash64(cntxt->buf + start, blockLength);
+        if (verifyPass) {
+            manifest.Verify(firstBlock + i, hash);
+        }
+        else {
+            manifest.Record(firstBlock + i, hash);
+        }
+    }
+}
+
+void IOUtils::ReleaseBuffer(IOContext* cntxt) {
+    m_bufferRelease(cntxt);
+}
+
+// Records the blocks held by cntxt in the resume journal, once they no longer need to be copied
+void IOUtils::MarkBlockComplete(IOContext* cntxt) {
+    CopyJournal* journal = cntxt->curInst->getJournal();
+    if (journal != nullptr) {
+        LONGLONG firstBlock = cntxt->readOffset / journal->getBlockSize();
+        for (LONGLONG i = 0; i < cntxt->blockCount; ++i) {
+            journal->MarkBlockComplete(firstBlock + i);
+        }
+    }
+}
+
 //Static Callbacks (Bridge functions)
 void CALLBACK StaticReadCompletion(DWORD errCode, DWORD numOfBytesTransfered, LPOVERLAPPED lpOverlapped) {
     LOG_DEBUG(L"Inside StaticReadCompletion, Thread ID: %d\n", GetCurrentThreadId());
@@ -0,0 +1,834 @@
+#include "ImageRestorer.h"
+#include <algorithm>
+
+// Partition type of an EFI system partition, in the byte order of a GPT entry
+static const GUID EFI_SYSTEM_PARTITION_TYPE = { 0xC12A7328, 0xF81F, 0x11D2, { 0xBA, 0x4B, 0x00, 0xA0, 0xC9, 0x3E, 0xC9, 0x3B } };
+
+static DWORD RoundUp(DWORD length, DWORD sectorSize)
+{
+    return ((length + sectorSize - 1) / sectorSize) * sectorSize;
+}
+
+//Getters
+HANDLE ImageRestorer::getHotRestoredEvent()
+{
+    return m_hHotRestored;
+}
+
+LONGLONG ImageRestorer::getBytesRestored()
+{
+    return m_bytesRestored.load(std::memory_order_acquire) + m_bytesZero.load(std::memory_order_acquire);
+}
+
+const std::vector<DiskExtent>& ImageRestorer::getHotRanges()
+{
+    return m_hotRanges;
+}
+
+//Setters
+void ImageRestorer::setZeroBlockPolicy(ZeroBlockPolicy policy)
+{
+    m_zeroBlockPolicy = policy;
+}
+
+void ImageRestorer::setChunkStore(ChunkStore* store)
+{
+    m_chunkStore = store;
+}
+
+void ImageRestorer::setHotRanges(const std::vector<DiskExtent>& hotRanges, bool detect)
+{
+    m_hotRanges = hotRanges;
+    m_detectHotRanges = detect;
+}
+
+bool ImageRestorer::OpenSource(LPCWSTR sourcePath)
+{
+    LOG_DEBUG(L"Inside ImageRestorer::OpenSource\n");
+    if (m_chunkStore != nullptr) {
+        m_sourceType = RestoreSourceType::CHUNK_STORE;
+        if (!m_chunkStore->isOpen() || !m_chunkManifest.Load(sourcePath)) {
+            LOG_ERROR(L"ImageRestorer::OpenSource: Failed to load the chunk manifest %s.\n", sourcePath);
+            LOG_DEBUG(L"End of ImageRestorer::OpenSource\n");
+            return false;
+        }
+        if (m_chunkManifest.getStoreId() != m_chunkStore->getStoreId() || m_chunkManifest.getChunkSize() != m_chunkStore->getChunkSize()) {
+            LOG_ERROR(L"ImageRestorer::OpenSource: %s references another chunk store.\n", sourcePath);
+            LOG_DEBUG(L"End of ImageRestorer::OpenSource\n");
+            return false;
+        }
+        if (m_blockSize < m_chunkManifest.getChunkSize()) {
+            LOG_ERROR(L"ImageRestorer::OpenSource: The block size must hold at least one chunk of %d KB.\n", m_chunkManifest.getChunkSize() / 1024);
+            LOG_DEBUG(L"End of ImageRestorer::OpenSource\n");
+            return false;
+        }
+        m_sourceSize = m_chunkManifest.getSourceSize();
+        m_storedSectorSize = m_chunkStore->getSectorSize();
+        m_hStored = m_chunkStore->OpenDataHandle();
+        if (m_hStored == INVALID_HANDLE_VALUE) {
+            LOG_DEBUG(L"End of ImageRestorer::OpenSource\n");
+            return false;
+        }
+        LOG_INFO(L"ImageRestorer::OpenSource: %s references %lld chunks of %d KB, %lld MB of source.\n", sourcePath,
+            m_chunkManifest.getChunkCount(), m_chunkManifest.getChunkSize() / 1024, m_sourceSize / (1024 * 1024));
+        LOG_DEBUG(L"End of ImageRestorer::OpenSource\n");
+        return true;
+    }
+
+    m_sourceType = RestoreSourceType::COMPRESSED_IMAGE;
+    if (!m_image.Open(sourcePath)) {
+        LOG_DEBUG(L"End of ImageRestorer::OpenSource\n");
+        return false;
+    }
+    m_sourceSize = m_image.getSourceSize();
+    m_blockSize = m_image.getBlockSize();
+    m_storedSectorSize = m_image.getSectorSize();
+    if (m_storedSectorSize == 0 || m_blockSize % m_storedSectorSize != 0) {
+        LOG_ERROR(L"ImageRestorer::OpenSource: %s has an invalid sector size %d.\n", sourcePath, m_storedSectorSize);
+        LOG_DEBUG(L"End of ImageRestorer::OpenSource\n");
+        return false;
+    }
+
+    // Chunks start on the sector size of the volume the image was written to. Read them unbuffered unless the image
+    // has since moved to a volume with larger sectors.
+    m_hStored = CreateFileW(sourcePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, nullptr);
+    DWORD fileSectorSize = (m_hStored != INVALID_HANDLE_VALUE) ? m_diskUtils.GetFileSectorSize(m_hStored) : 0;
+    if (m_hStored != INVALID_HANDLE_VALUE && (fileSectorSize == 0 || m_storedSectorSize % fileSectorSize != 0)) {
+        LOG_INFO(L"ImageRestorer::OpenSource: Image chunks are not aligned to the %d byte sectors of its volume, reading it buffered.\n", fileSectorSize);
+        CloseHandle(m_hStored);
+        m_hStored = CreateFileW(sourcePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    }
+    if (m_hStored == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"ImageRestorer::OpenSource: Failed to open %s for reading chunks. Error: %d\n", sourcePath, GetLastError());
+        LOG_DEBUG(L"End of ImageRestorer::OpenSource\n");
+        return false;
+    }
+    LOG_DEBUG(L"End of ImageRestorer::OpenSource\n");
+    return true;
+}
+
+void ImageRestorer::AddExtent(const RestoreExtent& extent, LONGLONG zeroRunLimit)
+{
+    if (!m_extents.empty()) {
+        RestoreExtent& last = m_extents.back();
+        if (last.targetOffset + last.length == extent.targetOffset) {
+            // Zero ranges are written, skipped or unmapped in one piece
+            if ((last.flags & RESTORE_EXTENT_ZERO) && (extent.flags & RESTORE_EXTENT_ZERO) && last.length + extent.length <= zeroRunLimit) {
+                last.length += extent.length;
+                return;
+            }
+            // Raw chunks stored back to back are read in one piece, as long as the first ones fill their sectors
+            if (last.flags == 0 && extent.flags == 0 && last.length % m_storedSectorSize == 0 &&
+                last.storedOffset + last.storedLength == extent.storedOffset && last.length + extent.length <= m_blockSize) {
+                last.length += extent.length;
+                last.storedLength += extent.storedLength;
+                return;
+            }
+        }
+    }
+    m_extents.push_back(extent);
+}
+
+void ImageRestorer::BuildExtents()
+{
+    LOG_DEBUG(L"Inside ImageRestorer::BuildExtents\n");
+    m_extents.clear();
+    LONGLONG zeroRunLimit = (m_zeroBlockPolicy == ZeroBlockPolicy::WRITE) ? m_blockSize : RESTORE_ZERO_RUN_MAX_BYTES;
+
+    if (m_sourceType == RestoreSourceType::COMPRESSED_IMAGE) {
+        for (LONGLONG block = 0; block < m_image.getBlockCount(); ++block) {
+            const CompressedImageChunk& chunk = m_image.getChunk(block);
+            LONGLONG targetOffset = block * m_blockSize;
+            LONGLONG remaining = m_sourceSize - targetOffset;
+            RestoreExtent extent = { targetOffset, (remaining < m_blockSize ? remaining : m_blockSize), chunk.offset, chunk.storedLength, 0, false };
+            if (chunk.storedLength == 0) {
+                extent.flags = RESTORE_EXTENT_ZERO;
+            }
+            else if (chunk.flags & IMAGE_CHUNK_COMPRESSED) {
+                extent.flags = RESTORE_EXTENT_COMPRESSED;
+            }
+            AddExtent(extent, zeroRunLimit);
+        }
+    }
+    else {
+        DWORD chunkSize = m_chunkManifest.getChunkSize();
+        for (LONGLONG chunkNumber = 0; chunkNumber < m_chunkManifest.getChunkCount(); ++chunkNumber) {
+            const ChunkRef& ref = m_chunkManifest.getRef(chunkNumber);
+            LONGLONG targetOffset = chunkNumber * chunkSize;
+            LONGLONG remaining = m_sourceSize - targetOffset;
+            LONGLONG length = (remaining < chunkSize) ? remaining : chunkSize;
+            // Zero chunks and chunks the backup did not copy are both zero ranges of the target
+            RestoreExtent extent = { targetOffset, length, 0, 0, RESTORE_EXTENT_ZERO, false };
+            if (ref.flags & CHUNK_REF_STORED) {
+                extent.storedOffset = static_cast<ULONGLONG>(ref.offset);
+                extent.storedLength = static_cast<DWORD>(length);
+                extent.flags = 0;
+            }
+            AddExtent(extent, zeroRunLimit);
+        }
+    }
+    LOG_INFO(L"ImageRestorer::BuildExtents: %zu extents cover %lld MB of source.\n", m_extents.size(), m_sourceSize / (1024 * 1024));
+    LOG_DEBUG(L"End of ImageRestorer::BuildExtents\n");
+}
+
+bool ImageRestorer::ReadSource(LONGLONG offset, DWORD length, char* out, DECOMPRESSOR_HANDLE decompressor)
+{
+    memset(out, 0, length);
+    LONGLONG end = offset + length;
+    if (end > m_sourceSize) {
+        end = m_sourceSize;
+    }
+
+    // Last extent starting at or before offset
+    auto it = std::upper_bound(m_extents.begin(), m_extents.end(), offset, [](LONGLONG value, const RestoreExtent& extent) {
+        return value < extent.targetOffset;
+    });
+    if (it != m_extents.begin()) {
+        --it;
+    }
+
+    SIZE_T bufferSize = static_cast<SIZE_T>(m_blockSize) + m_storedSectorSize;
+    char* stored = static_cast<char*>(VirtualAlloc(nullptr, bufferSize * 2, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (stored == nullptr) {
+        LOG_ERROR(L"ImageRestorer::ReadSource: Failed to allocate read buffers. Error: %d\n", GetLastError());
+        return false;
+    }
+    char* block = stored + bufferSize;
+
+    bool succeeded = true;
+    for (; it != m_extents.end() && it->targetOffset < end && succeeded; ++it) {
+        const RestoreExtent& extent = *it;
+        if (extent.flags & RESTORE_EXTENT_ZERO) {
+            continue;
+        }
+        DWORD bytesRead = 0;
+        if (!m_diskUtils.ReadSync(m_hStored, static_cast<LONGLONG>(extent.storedOffset), stored, RoundUp(extent.storedLength, m_storedSectorSize), &bytesRead) ||
+            bytesRead < extent.storedLength) {
+            LOG_ERROR(L"ImageRestorer::ReadSource: Failed to read the extent at offset %lld. Error: %d\n", extent.targetOffset, GetLastError());
+            succeeded = false;
+            break;
+        }
+        const char* data = stored;
+        if (extent.flags & RESTORE_EXTENT_COMPRESSED) {
+            SIZE_T decompressedSize = 0;
+            if (!Decompress(decompressor, stored, extent.storedLength, block, m_blockSize, &decompressedSize) || decompressedSize < static_cast<SIZE_T>(extent.length)) {
+                LOG_ERROR(L"ImageRestorer::ReadSource: Failed to decompress the block at offset %lld. Error: %d\n", extent.targetOffset, GetLastError());
+                succeeded = false;
+                break;
+            }
+            data = block;
+        }
+        LONGLONG from = (offset > extent.targetOffset) ? offset : extent.targetOffset;
+        LONGLONG to = (end < extent.targetOffset + extent.length) ? end : extent.targetOffset + extent.length;
+        memcpy(out + (from - offset), data + (from - extent.targetOffset), static_cast<size_t>(to - from));
+    }
+    VirtualFree(stored, 0, MEM_RELEASE);
+    return succeeded;
+}
+
+void ImageRestorer::AddHotRange(LONGLONG offset, LONGLONG length)
+{
+    if (offset < 0 || offset >= m_sourceSize || length <= 0) {
+        return;
+    }
+    if (length > m_sourceSize - offset) {
+        length = m_sourceSize - offset;
+    }
+    m_hotRanges.push_back(DiskExtent{ offset, length });
+}
+
+void ImageRestorer::AddVolumeHotRanges(LONGLONG volumeOffset, LONGLONG volumeLength, DECOMPRESSOR_HANDLE decompressor, bool partitionTable)
+{
+    AddHotRange(volumeOffset, (volumeLength < RESTORE_HOT_HEAD_BYTES) ? volumeLength : RESTORE_HOT_HEAD_BYTES);
+
+    // Boot sector, and the GPT header if the head holds a partition table (LBA 1, with 512 or 4096 byte sectors)
+    std::vector<char> head(8192);
+    if (!ReadSource(volumeOffset, static_cast<DWORD>(head.size()), head.data(), decompressor)) {
+        return;
+    }
+    const BYTE* sector = reinterpret_cast<const BYTE*>(head.data());
+
+    if (memcmp(sector + 3, "NTFS    ", 8) == 0) {
+        // The boot sector comes from the backup, so nothing in it is trusted
+        DWORD bytesPerSector = *reinterpret_cast<const WORD*>(sector + 0x0B);
+        BYTE sectorsPerCluster = sector[0x0D];
+        if (bytesPerSector < 512 || bytesPerSector > 4096 || (bytesPerSector & (bytesPerSector - 1)) != 0) {
+            return;
+        }
+        // Cluster sizes above 64 KB are stored as a negative power of two
+        LONGLONG clusterSize = 0;
+        if (sectorsPerCluster > 0x80) {
+            DWORD shift = 256 - sectorsPerCluster;
+            if (shift > 31) {
+                return;
+            }
+            clusterSize = static_cast<LONGLONG>(bytesPerSector) << shift;
+        }
+        else {
+            clusterSize = static_cast<LONGLONG>(bytesPerSector) * sectorsPerCluster;
+        }
+        LONGLONG mftLcn = *reinterpret_cast<const LONGLONG*>(sector + 0x30);
+        if (clusterSize <= 0 || mftLcn <= 0 || mftLcn >= volumeLength / clusterSize) {
+            return;
+        }
+        LONGLONG mftOffset = mftLcn * clusterSize;
+        LOG_INFO(L"ImageRestorer::AddVolumeHotRanges: NTFS volume at offset %lld, $MFT at offset %lld.\n", volumeOffset, volumeOffset + mftOffset);
+        AddHotRange(volumeOffset + mftOffset, RESTORE_HOT_MFT_BYTES);
+        return;
+    }
+    if (!partitionTable || sector[510] != 0x55 || sector[511] != 0xAA) {
+        return;
+    }
+
+    // GPT: the protective MBR is followed by the header, which gives where the partition entries are
+    for (DWORD lbaSize : { 512u, 4096u }) {
+        const BYTE* header = sector + lbaSize;
+        if (memcmp(header, "EFI PART", 8) != 0) {
+            continue;
+        }
+        ULONGLONG entriesLba = *reinterpret_cast<const ULONGLONG*>(header + 72);
+        DWORD entryCount = *reinterpret_cast<const DWORD*>(header + 80);
+        DWORD entrySize = *reinterpret_cast<const DWORD*>(header + 84);
+        if (entrySize < 128 || entrySize > 4096 || entriesLba >= static_cast<ULONGLONG>(m_sourceSize) / lbaSize) {
+            return;
+        }
+        entryCount = (entryCount < RESTORE_MAX_PARTITIONS) ? entryCount : RESTORE_MAX_PARTITIONS;
+        std::vector<char> entries(static_cast<size_t>(entryCount) * entrySize);
+        if (entries.empty() || !ReadSource(static_cast<LONGLONG>(entriesLba * lbaSize), static_cast<DWORD>(entries.size()), entries.data(), decompressor)) {
+            return;
+        }
+        AddHotRange(static_cast<LONGLONG>(entriesLba * lbaSize), static_cast<LONGLONG>(entries.size()));
+        for (DWORD i = 0; i < entryCount; ++i) {
+            const BYTE* entry = reinterpret_cast<const BYTE*>(entries.data()) + static_cast<size_t>(i) * entrySize;
+            ULONGLONG firstLba = *reinterpret_cast<const ULONGLONG*>(entry + 32);
+            ULONGLONG lastLba = *reinterpret_cast<const ULONGLONG*>(entry + 40);
+            static const BYTE unused[16] = {};
+            if (memcmp(entry, unused, 16) == 0 || lastLba < firstLba || lastLba >= static_cast<ULONGLONG>(m_sourceSize) / lbaSize) {
+                continue;
+            }
+            LONGLONG partitionOffset = static_cast<LONGLONG>(firstLba * lbaSize);
+            LONGLONG partitionLength = static_cast<LONGLONG>((lastLba - firstLba + 1) * lbaSize);
+            // The boot loader and its configuration are read before anything else of the disk
+            if (memcmp(entry, &EFI_SYSTEM_PARTITION_TYPE, sizeof(GUID)) == 0 && partitionLength <= RESTORE_HOT_ESP_MAX_BYTES) {
+                AddHotRange(partitionOffset, partitionLength);
+            }
+            AddVolumeHotRanges(partitionOffset, partitionLength, decompressor, false);
+        }
+        return;
+    }
+
+    // MBR: the four primary entries, logical drives of an extended partition are not looked into
+    for (int i = 0; i < 4; ++i) {
+        const BYTE* entry = sector + 446 + i * 16;
+        BYTE type = entry[4];
+        DWORD firstLba = *reinterpret_cast<const DWORD*>(entry + 8);
+        DWORD lbaCount = *reinterpret_cast<const DWORD*>(entry + 12);
+        if (type == 0 || type == 0x05 || type == 0x0F || type == 0xEE || lbaCount == 0) {
+            continue;
+        }
+        AddVolumeHotRanges(static_cast<LONGLONG>(firstLba) * 512, static_cast<LONGLONG>(lbaCount) * 512, decompressor, false);
+    }
+}
+
+void ImageRestorer::FindHotRanges()
+{
+    LOG_DEBUG(L"Inside ImageRestorer::FindHotRanges\n");
+    DECOMPRESSOR_HANDLE decompressor = nullptr;
+    if (m_sourceType == RestoreSourceType::COMPRESSED_IMAGE && !CreateDecompressor(m_image.getAlgorithm(), nullptr, &decompressor)) {
+        LOG_WARNING(L"ImageRestorer::FindHotRanges: CreateDecompressor failed with error: %d, only the head of the source is restored first.\n", GetLastError());
+        AddHotRange(0, RESTORE_HOT_HEAD_BYTES);
+        LOG_DEBUG(L"End of ImageRestorer::FindHotRanges\n");
+        return;
+    }
+    AddVolumeHotRanges(0, m_sourceSize, decompressor, true);
+    if (decompressor != nullptr) {
+        CloseDecompressor(decompressor);
+    }
+    LOG_DEBUG(L"End of ImageRestorer::FindHotRanges\n");
+}
+
+void ImageRestorer::OrderExtents()
+{
+    LOG_DEBUG(L"Inside ImageRestorer::OrderExtents\n");
+    LONGLONG hotBytes = 0;
+    for (RestoreExtent& extent : m_extents) {
+        for (const DiskExtent& range : m_hotRanges) {
+            if (extent.targetOffset < range.offset + range.length && range.offset < extent.targetOffset + extent.length) {
+                extent.hot = true;
+                hotBytes += extent.length;
+                break;
+            }
+        }
+    }
+    // Stable, so each group keeps the target offset order and the writes stay sequential within it
+    auto firstCold = std::stable_partition(m_extents.begin(), m_extents.end(), [](const RestoreExtent& extent) {
+        return extent.hot;
+    });
+    m_hotExtents = static_cast<size_t>(firstCold - m_extents.begin());
+    m_hotRemaining.store(static_cast<LONGLONG>(m_hotExtents), std::memory_order_relaxed);
+    LOG_INFO(L"ImageRestorer::OrderExtents: %zu hot ranges, %zu extents (%lld MB) are restored first.\n", m_hotRanges.size(), m_hotExtents, hotBytes / (1024 * 1024));
+    LOG_DEBUG(L"End of ImageRestorer::OrderExtents\n");
+}
+
+bool ImageRestorer::Initialize(LPCWSTR sourcePath, LPCWSTR targetPath, int nThreads, int blockSizeMB, int queueDepth)
+{
+    LOG_DEBUG(L"Inside ImageRestorer::Initialize\n");
+    m_numOfThreads = nThreads;
+    m_queueDepth = queueDepth;
+    m_blockSize = (blockSizeMB > 0 && blockSizeMB <= MAX_BLOCK_SIZE_MB) ? static_cast<DWORD>(blockSizeMB) * 1024 * 1024 : 0;
+    LOG_INFO(L"ImageRestorer::Initialize: Backup: %s\n", sourcePath);
+    LOG_INFO(L"Restore target: %s\n", targetPath);
+
+    if (m_numOfThreads <= 0 || m_numOfThreads > 64) {
+        LOG_ERROR(L"Invalid number of threads. Must be between 1 and 64.\n");
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+    if (m_queueDepth <= 0 || m_queueDepth > MAX_QUEUE_DEPTH) {
+        LOG_ERROR(L"Invalid queue depth. Must be between 1 and %d.\n", MAX_QUEUE_DEPTH);
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+    if (m_blockSize == 0) {
+        LOG_ERROR(L"Invalid block size %d MB. Must be between 1 and %d.\n", blockSizeMB, MAX_BLOCK_SIZE_MB);
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+    if (!OpenSource(sourcePath)) {
+        LOG_ERROR(L"ImageRestorer::Initialize: Failed to open the backup %s.\n", sourcePath);
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+
+    m_hTarget = CreateFileW(targetPath, GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, nullptr); // No share mode for exclusive write
+    if (m_hTarget == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"Failed to open restore target %s with the error: %d\n", targetPath, GetLastError());
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+    m_targetSectorSize = m_diskUtils.GetVolumeSectorSize(m_hTarget, targetPath, false);
+    LONGLONG targetCapacity = m_diskUtils.GetDiskOrDriveSize(m_hTarget, targetPath, FALSE);
+    if (m_targetSectorSize == 0 || m_blockSize % m_targetSectorSize != 0) {
+        LOG_ERROR(L"ImageRestorer::Initialize: Block size %d is not a multiple of the target sector size %d.\n", m_blockSize, m_targetSectorSize);
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+    LONGLONG targetBytes = ((m_sourceSize + m_targetSectorSize - 1) / m_targetSectorSize) * m_targetSectorSize;
+    if (targetCapacity < targetBytes) {
+        LOG_ERROR(L"ImageRestorer::Initialize: Target holds %lld MB, the backup needs %lld MB.\n", targetCapacity / (1024 * 1024), targetBytes / (1024 * 1024));
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+
+    // Zero ranges can only be unmapped on devices that read unmapped blocks back as zeros, write them otherwise
+    m_trimEnabled = (m_zeroBlockPolicy == ZeroBlockPolicy::UNMAP && m_diskUtils.IsTrimZeroing(m_hTarget));
+    if (m_zeroBlockPolicy == ZeroBlockPolicy::UNMAP && !m_trimEnabled) {
+        LOG_WARNING(L"ImageRestorer::Initialize: Target does not guarantee that unmapped blocks read as zeros, zero ranges will be written.\n");
+        m_zeroBlockPolicy = ZeroBlockPolicy::WRITE;
+    }
+
+    // Plan the restore; the hot range search reads the source synchronously, before the handle is bound to the port
+    BuildExtents();
+    if (m_detectHotRanges) {
+        FindHotRanges();
+    }
+    OrderExtents();
+
+    m_hFinished = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    m_hHotRestored = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (m_hFinished == nullptr || m_hHotRestored == nullptr) {
+        LOG_ERROR(L"ImageRestorer::Initialize: Failed to create the restore events. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+    m_hIocp = CreateIoCompletionPort(m_hStored, nullptr, 0, m_numOfThreads);
+    if (m_hIocp == nullptr || CreateIoCompletionPort(m_hTarget, m_hIocp, 0, 0) == nullptr) {
+        LOG_ERROR(L"ImageRestorer::Initialize: Failed to bind handles to an I/O completion port. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+
+    // A ring of m_queueDepth contexts for each thread. Reads may run a sector past the block, as may padded writes.
+    int totalCntxts = m_numOfThreads * m_queueDepth;
+    bool compressed = (m_sourceType == RestoreSourceType::COMPRESSED_IMAGE);
+    DWORD padding = (m_storedSectorSize > m_targetSectorSize) ? m_storedSectorSize : m_targetSectorSize;
+    if (!m_bufferArena.Create(static_cast<SIZE_T>(m_blockSize) + padding, static_cast<DWORD>(totalCntxts) * (compressed ? 2 : 1))) {
+        LOG_ERROR(L"ImageRestorer::Initialize: Failed to allocate buffers for %d contexts.\n", totalCntxts);
+        LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+        return false;
+    }
+    m_cntxts.clear();
+    for (int i = 0; i < totalCntxts; ++i) {
+        std::unique_ptr<RestoreContext> context(new RestoreContext());
+        context->buf = m_bufferArena.Acquire();
+        context->auxBuf = compressed ? m_bufferArena.Acquire() : nullptr;
+        m_cntxts.push_back(std::move(context));
+    }
+
+    LOG_INFO(L"Source size: %lld MB\n", m_sourceSize / (1024 * 1024));
+    LOG_INFO(L"Target size: %lld MB\n", targetCapacity / (1024 * 1024));
+    LOG_INFO(L"Configured Threads: %d, Queue Depth per Thread: %d, Block Size: %d KB\n", m_numOfThreads, m_queueDepth, m_blockSize / 1024);
+    LOG_DEBUG(L"End of ImageRestorer::Initialize\n");
+    return true;
+}
+
+void ImageRestorer::MarkExtentDone(const RestoreExtent& extent)
+{
+    if (!extent.hot || m_hotRemaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    // Durable before anyone is told, a VM started now must find these ranges on the target
+    if (!FlushFileBuffers(m_hTarget)) {
+        LOG_WARNING(L"ImageRestorer::MarkExtentDone: Failed to flush the hot ranges. Error: %d\n", GetLastError());
+    }
+    LOG_INFO(L"ImageRestorer: Hot ranges restored after %.1f s, the target can be started while the rest is restored.\n",
+        (GetTickCount64() - m_startMs) / 1000.0);
+    SetEvent(m_hHotRestored);
+}
+
+void ImageRestorer::SignalIfFinished()
+{
+    if (m_errOccurred.load(std::memory_order_acquire) ||
+        (m_nextExtent.load(std::memory_order_acquire) >= m_extents.size() && m_pendingIOs.load(std::memory_order_acquire) == 0)) {
+        SetEvent(m_hFinished);
+    }
+}
+
+bool ImageRestorer::IssueRead(RestoreContext* cntxt, const RestoreExtent& extent)
+{
+    cntxt->opType = RestoreOpType::READ;
+    cntxt->overlapped = {};
+    cntxt->overlapped.Offset = static_cast<DWORD>(extent.storedOffset & 0xFFFFFFFF);
+    cntxt->overlapped.OffsetHigh = static_cast<DWORD>((extent.storedOffset >> 32) & 0xFFFFFFFF);
+    if (!ReadFile(m_hStored, cntxt->buf, RoundUp(extent.storedLength, m_storedSectorSize), nullptr, &cntxt->overlapped) && GetLastError() != ERROR_IO_PENDING) {
+        LOG_ERROR(L"ImageRestorer::IssueRead: Read of the extent at offset %lld failed. Error: %d\n", extent.targetOffset, GetLastError());
+        m_errOccurred.store(true, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+bool ImageRestorer::IssueWrite(RestoreContext* cntxt, LONGLONG targetOffset, DWORD length, char* data)
+{
+    // The end of a source that is not a whole number of target sectors is padded with zeros
+    DWORD bytesToWrite = RoundUp(length, m_targetSectorSize);
+    memset(data + length, 0, bytesToWrite - length);
+
+    cntxt->opType = RestoreOpType::WRITE;
+    cntxt->overlapped = {};
+    cntxt->overlapped.Offset = static_cast<DWORD>(targetOffset & 0xFFFFFFFF);
+    cntxt->overlapped.OffsetHigh = static_cast<DWORD>((targetOffset >> 32) & 0xFFFFFFFF);
+    if (!WriteFile(m_hTarget, data, bytesToWrite, nullptr, &cntxt->overlapped) && GetLastError() != ERROR_IO_PENDING) {
+        LOG_ERROR(L"ImageRestorer::IssueWrite: Write at offset %lld failed. Error: %d\n", targetOffset, GetLastError());
+        m_errOccurred.store(true, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+bool ImageRestorer::IssueZeroWrite(RestoreContext* cntxt, const RestoreExtent& extent)
+{
+    LONGLONG remaining = extent.length - cntxt->zeroDone;
+    DWORD length = static_cast<DWORD>(remaining < m_blockSize ? remaining : m_blockSize);
+    LONGLONG targetOffset = extent.targetOffset + cntxt->zeroDone;
+    memset(cntxt->buf, 0, length);
+    cntxt->zeroDone += length;
+    return IssueWrite(cntxt, targetOffset, length, cntxt->buf);
+}
+
+bool ImageRestorer::IssueUnmap(RestoreContext* cntxt, const RestoreExtent& extent)
+{
+    cntxt->opType = RestoreOpType::UNMAP;
+    cntxt->overlapped = {};
+    if (!m_diskUtils.IssueTrim(m_hTarget, extent.targetOffset, extent.length, cntxt->trim, &cntxt->overlapped)) {
+        LOG_WARNING(L"ImageRestorer::IssueUnmap: Unmap of the range at offset %lld failed, writing zeros instead.\n", extent.targetOffset);
+        return false;
+    }
+    return true;
+}
+
+void ImageRestorer::IssueNextExtent(RestoreContext* cntxt)
+{
+    while (!m_errOccurred.load(std::memory_order_acquire)) {
+        // Counted before the claim, so no thread sees every extent claimed and none pending while this one starts
+        m_pendingIOs.fetch_add(1, std::memory_order_acq_rel);
+        size_t index = m_nextExtent.fetch_add(1, std::memory_order_acq_rel);
+        if (index >= m_extents.size()) {
+            m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+            return;
+        }
+        const RestoreExtent& extent = m_extents[index];
+        cntxt->extentIndex = index;
+
+        if (!(extent.flags & RESTORE_EXTENT_ZERO)) {
+            if (!IssueRead(cntxt, extent)) {
+                m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+            }
+            return;
+        }
+
+        // Written, or unmapped with an overlapped TRIM; a range that cannot be unmapped is written with zeros a block at a time
+        if (m_zeroBlockPolicy != ZeroBlockPolicy::SKIP) {
+            cntxt->zeroDone = 0;
+            if ((m_zeroBlockPolicy != ZeroBlockPolicy::UNMAP || !IssueUnmap(cntxt, extent)) && !IssueZeroWrite(cntxt, extent)) {
+                m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+            }
+            return;
+        }
+
+        m_bytesZero.fetch_add(extent.length, std::memory_order_relaxed);
+        MarkExtentDone(extent);
+        m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void ImageRestorer::OnReadCompletion(RestoreContext* cntxt, DWORD errCode, DWORD bytesTransferred, DECOMPRESSOR_HANDLE decompressor)
+{
+    const RestoreExtent& extent = m_extents[cntxt->extentIndex];
+    if (errCode != ERROR_SUCCESS || bytesTransferred < extent.storedLength) {
+        LOG_ERROR(L"ImageRestorer::OnReadCompletion: Read of the extent at offset %lld failed, %d of %d bytes. Error: %d\n",
+            extent.targetOffset, bytesTransferred, extent.storedLength, errCode);
+        m_errOccurred.store(true, std::memory_order_release);
+        m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+        return;
+    }
+
+    // Decompressed on the thread that dequeued the read, so every pool thread decompresses blocks side by side
+    char* data = cntxt->buf;
+    if (extent.flags & RESTORE_EXTENT_COMPRESSED) {
+        SIZE_T decompressedSize = 0;
+        if (!Decompress(decompressor, cntxt->buf, extent.storedLength, cntxt->auxBuf, m_blockSize, &decompressedSize) ||
+            decompressedSize < static_cast<SIZE_T>(extent.length)) {
+            LOG_ERROR(L"ImageRestorer::OnReadCompletion: Failed to decompress the block at offset %lld. Error: %d\n", extent.targetOffset, GetLastError());
+            m_errOccurred.store(true, std::memory_order_release);
+            m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+            return;
+        }
+        data = cntxt->auxBuf;
+    }
+    if (!IssueWrite(cntxt, extent.targetOffset, static_cast<DWORD>(extent.length), data)) {
+        m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void ImageRestorer::OnWriteCompletion(RestoreContext* cntxt, DWORD errCode)
+{
+    const RestoreExtent& extent = m_extents[cntxt->extentIndex];
+    if (errCode != ERROR_SUCCESS) {
+        LOG_ERROR(L"ImageRestorer::OnWriteCompletion: Write at offset %lld failed. Error: %d\n", extent.targetOffset, errCode);
+        m_errOccurred.store(true, std::memory_order_release);
+        m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+        return;
+    }
+    if (extent.flags & RESTORE_EXTENT_ZERO) {
+        // An extent larger than a block is written by one context, a block after the other
+        if (cntxt->zeroDone < extent.length) {
+            if (!IssueZeroWrite(cntxt, extent)) {
+                m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+            }
+            return;
+        }
+        m_bytesZero.fetch_add(extent.length, std::memory_order_relaxed);
+    }
+    else {
+        m_bytesRestored.fetch_add(extent.length, std::memory_order_relaxed);
+    }
+    MarkExtentDone(extent);
+    m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+
+    // The context's buffers are free, go on with the next extent
+    IssueNextExtent(cntxt);
+}
+
+void ImageRestorer::OnUnmapCompletion(RestoreContext* cntxt, DWORD errCode)
+{
+    const RestoreExtent& extent = m_extents[cntxt->extentIndex];
+    if (errCode != ERROR_SUCCESS) {
+        LOG_WARNING(L"ImageRestorer::OnUnmapCompletion: Unmap of the range at offset %lld failed with error: %d, writing zeros instead.\n", extent.targetOffset, errCode);
+        if (m_errOccurred.load(std::memory_order_acquire) || !IssueZeroWrite(cntxt, extent)) {
+            m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+        }
+        return;
+    }
+    m_bytesZero.fetch_add(extent.length, std::memory_order_relaxed);
+    MarkExtentDone(extent);
+    m_pendingIOs.fetch_sub(1, std::memory_order_acq_rel);
+
+    IssueNextExtent(cntxt);
+}
+
+void ImageRestorer::WorkerThreadLoop(int workerIndex)
+{
+    LOG_DEBUG(L"Inside ImageRestorer::WorkerThreadLoop\n");
+    LOG_INFO(L"ImageRestorer::WorkerThreadLoop: Restore Thread %d started. ThreadId: %d\n", workerIndex, GetCurrentThreadId());
+
+    // One decompressor per thread, a read completion is decompressed by whichever thread dequeued it
+    DECOMPRESSOR_HANDLE decompressor = nullptr;
+    if (m_sourceType == RestoreSourceType::COMPRESSED_IMAGE && !CreateDecompressor(m_image.getAlgorithm(), nullptr, &decompressor)) {
+        LOG_ERROR(L"ImageRestorer::WorkerThreadLoop: CreateDecompressor failed with error: %d\n", GetLastError());
+        m_errOccurred.store(true, std::memory_order_release);
+    }
+
+    for (int i = 0; i < m_queueDepth; ++i) {
+        IssueNextExtent(m_cntxts[static_cast<size_t>(workerIndex) * m_queueDepth + i].get());
+    }
+    SignalIfFinished(); // A restore with nothing to read may be done already
+
+    OVERLAPPED_ENTRY entries[IOCP_DEQUEUE_BATCH];
+    bool shutdown = false;
+    while (!shutdown) {
+        ULONG numEntries = 0;
+        if (!GetQueuedCompletionStatusEx(m_hIocp, entries, IOCP_DEQUEUE_BATCH, &numEntries, INFINITE, FALSE)) {
+            LOG_ERROR(L"ImageRestorer::WorkerThreadLoop: GetQueuedCompletionStatusEx failed with error: %d. Thread ID: %d\n", GetLastError(), GetCurrentThreadId());
+            m_errOccurred.store(true, std::memory_order_release);
+            SetEvent(m_hFinished);
+            break;
+        }
+
+        int shutdownPackets = 0;
+        for (ULONG i = 0; i < numEntries; ++i) {
+            // A packet without OVERLAPPED is the shutdown signal posted by Restore
+            if (entries[i].lpOverlapped == nullptr) {
+                ++shutdownPackets;
+                continue;
+            }
+            RestoreContext* context = reinterpret_cast<RestoreContext*>(entries[i].lpOverlapped);
+            HANDLE hFile = (context->opType == RestoreOpType::READ) ? m_hStored : m_hTarget;
+            DWORD bytesTransferred = entries[i].dwNumberOfBytesTransferred;
+            DWORD errCode = ERROR_SUCCESS;
+            if (!GetOverlappedResult(hFile, entries[i].lpOverlapped, &bytesTransferred, FALSE)) {
+                errCode = GetLastError();
+            }
+            if (context->opType == RestoreOpType::READ) {
+                OnReadCompletion(context, errCode, bytesTransferred, decompressor);
+            }
+            else if (context->opType == RestoreOpType::UNMAP) {
+                OnUnmapCompletion(context, errCode);
+            }
+            else {
+                OnWriteCompletion(context, errCode);
+            }
+        }
+
+        // The completions of this batch may have been the restore's last ones
+        SignalIfFinished();
+
+        // Each pool thread must consume exactly one shutdown packet, hand back any extra ones taken in this batch
+        if (shutdownPackets > 0) {
+            shutdown = true;
+            for (int i = 1; i < shutdownPackets; ++i) {
+                PostQueuedCompletionStatus(m_hIocp, 0, 0, nullptr);
+            }
+        }
+    }
+
+    if (decompressor != nullptr) {
+        CloseDecompressor(decompressor);
+    }
+    LOG_INFO(L"ImageRestorer::WorkerThreadLoop : Restore Thread %d finished.\n", GetCurrentThreadId());
+    LOG_DEBUG(L"End of ImageRestorer::WorkerThreadLoop\n");
+}
+
+bool ImageRestorer::Restore()
+{
+    LOG_DEBUG(L"Inside ImageRestorer::Restore\n");
+    if (m_hTarget == INVALID_HANDLE_VALUE || m_hIocp == nullptr || m_cntxts.empty()) {
+        LOG_ERROR(L"ImageRestorer::Restore: ImageRestorer not initialized correctly before calling Restore.\n");
+        LOG_DEBUG(L"End of ImageRestorer::Restore\n");
+        return false;
+    }
+    LOG_INFO(L"ImageRestorer::Restore: Restoring %lld MB...\n", m_sourceSize / (1024 * 1024));
+
+    m_startMs = GetTickCount64();
+    if (m_hotExtents == 0) {
+        SetEvent(m_hHotRestored);
+    }
+    m_workerThreads.clear();
+    for (int i = 0; i < m_numOfThreads; ++i) {
+        m_workerThreads.emplace_back(&ImageRestorer::WorkerThreadLoop, this, i);
+    }
+
+    LONGLONG lastPrinted = 0;
+    while ((m_nextExtent.load(std::memory_order_acquire) < m_extents.size() || m_pendingIOs.load(std::memory_order_acquire) > 0) &&
+        !m_errOccurred.load(std::memory_order_acquire)) {
+        LONGLONG restored = getBytesRestored();
+        if (restored > lastPrinted + static_cast<LONGLONG>(m_blockSize) * 4 || restored >= m_sourceSize) {
+            LOG_INFO(L"Restore progress: %lld MB of %lld MB (%.2f%%). Pending IOs: %d\n", restored / (1024 * 1024), m_sourceSize / (1024 * 1024),
+                (m_sourceSize > 0 ? (double)restored * 100.0 / m_sourceSize : 0.0), m_pendingIOs.load(std::memory_order_relaxed));
+            lastPrinted = restored;
+        }
+        // The workers wake this thread as soon as the restore is done or fails
+        WaitForSingleObject(m_hFinished, MONITOR_INTERVAL_MS);
+    }
+    // After an error no new I/O is issued, the workers still dequeue the ones in flight before their buffers go away
+    while (m_pendingIOs.load(std::memory_order_acquire) > 0) {
+        Sleep(1);
+    }
+
+    for (int i = 0; i < m_numOfThreads; ++i) {
+        if (!PostQueuedCompletionStatus(m_hIocp, 0, 0, nullptr)) {
+            LOG_ERROR(L"Failed to post shutdown packet to the completion port. Error: %d\n", GetLastError());
+        }
+    }
+    for (auto& t : m_workerThreads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+
+    if (!m_errOccurred.load(std::memory_order_acquire) && !FlushFileBuffers(m_hTarget)) {
+        LOG_ERROR(L"ImageRestorer::Restore: Failed to flush the target. Error: %d\n", GetLastError());
+        m_errOccurred.store(true, std::memory_order_release);
+    }
+    if (m_errOccurred.load(std::memory_order_acquire)) {
+        LOG_ERROR(L"ImageRestorer::Restore: Restore completed with errors.\n");
+        LOG_DEBUG(L"End of ImageRestorer::Restore\n");
+        return false;
+    }
+
+    double seconds = (GetTickCount64() - m_startMs) / 1000.0;
+    LOG_INFO(L"ImageRestorer::Restore: %lld MB written from the backup and %lld MB of zero ranges %s in %.1f s (%.1f MB/s).\n",
+        m_bytesRestored.load() / (1024 * 1024), m_bytesZero.load() / (1024 * 1024),
+        (m_zeroBlockPolicy == ZeroBlockPolicy::WRITE ? L"written" : (m_zeroBlockPolicy == ZeroBlockPolicy::SKIP ? L"skipped" : L"unmapped")),
+        seconds, (seconds > 0.0 ? (m_sourceSize / (1024.0 * 1024.0)) / seconds : 0.0));
+    LOG_INFO(L"ImageRestorer::Restore: Restore completed successfully.\n");
+    LOG_DEBUG(L"End of ImageRestorer::Restore\n");
+    return true;
+}
+
+ImageRestorer::~ImageRestorer()
+{
+    for (auto& t : m_workerThreads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    for (auto& context : m_cntxts) {
+        m_bufferArena.Release(context->buf);
+        if (context->auxBuf != nullptr) {
+            m_bufferArena.Release(context->auxBuf);
+        }
+    }
+    m_cntxts.clear();
+
+    if (m_hStored != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hStored);
+        m_hStored = INVALID_HANDLE_VALUE;
+    }
+    if (m_hTarget != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hTarget);
+        m_hTarget = INVALID_HANDLE_VALUE;
+    }
+    if (m_hIocp != nullptr) {
+        CloseHandle(m_hIocp);
+        m_hIocp = nullptr;
+    }
+    if (m_hFinished != nullptr) {
+        CloseHandle(m_hFinished);
+        m_hFinished = nullptr;
+    }
+    if (m_hHotRestored != nullptr) {
+        CloseHandle(m_hHotRestored);
+        m_hHotRestored = nullptr;
+    }
+}
@@ -0,0 +1,96 @@
+#include "IoThrottle.h"
+
+IoThrottle::IoThrottle() : m_bytesPerSecond(0), m_iopsLimit(0), m_byteTokens(0.0), m_ioTokens(0.0), m_lastTicks(0), m_frequency(1), m_delayedReads(0)
+{
+    LARGE_INTEGER frequency;
+    if (QueryPerformanceFrequency(&frequency) && frequency.QuadPart > 0) {
+        m_frequency = frequency.QuadPart;
+    }
+}
+
+//Getters
+LONGLONG IoThrottle::getBytesPerSecond() const
+{
+    return m_bytesPerSecond.load(std::memory_order_relaxed);
+}
+
+LONGLONG IoThrottle::getIopsLimit() const
+{
+    return m_iopsLimit.load(std::memory_order_relaxed);
+}
+
+LONGLONG IoThrottle::getDelayedReads() const
+{
+    return m_delayedReads.load(std::memory_order_relaxed);
+}
+
+bool IoThrottle::isLimited() const
+{
+    return getBytesPerSecond() > 0 || getIopsLimit() > 0;
+}
+
+//Setters
+void IoThrottle::setLimits(LONGLONG bytesPerSecond, LONGLONG iopsLimit)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    bytesPerSecond = (bytesPerSecond > 0) ? bytesPerSecond : 0;
+    bytesPerSecond = (bytesPerSecond < THROTTLE_MAX_MBPS * 1024 * 1024) ? bytesPerSecond : THROTTLE_MAX_MBPS * 1024 * 1024;
+    iopsLimit = (iopsLimit > 0) ? iopsLimit : 0;
+    iopsLimit = (iopsLimit < THROTTLE_MAX_IOPS) ? iopsLimit : THROTTLE_MAX_IOPS;
+    // A new limit starts with a full burst, debt run up under the old one is forgiven
+    m_byteTokens = BucketSize(bytesPerSecond);
+    m_ioTokens = BucketSize(iopsLimit);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    m_lastTicks = now.QuadPart;
+    m_bytesPerSecond.store(bytesPerSecond, std::memory_order_relaxed);
+    m_iopsLimit.store(iopsLimit, std::memory_order_relaxed);
+    LOG_INFO(L"IoThrottle::setLimits: Reads limited to %lld MB/s and %lld IOPS (0 for unlimited).\n", bytesPerSecond / (1024 * 1024), iopsLimit);
+}
+
+double IoThrottle::BucketSize(LONGLONG rate)
+{
+    double size = static_cast<double>(rate) * THROTTLE_BURST_MS / 1000.0;
+    return (size > 1.0) ? size : 1.0;
+}
+
+void IoThrottle::Refill(LONGLONG bytesPerSecond, LONGLONG iopsLimit)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    double seconds = static_cast<double>(now.QuadPart - m_lastTicks) / m_frequency;
+    m_lastTicks = now.QuadPart;
+
+    double maxByteTokens = BucketSize(bytesPerSecond);
+    double maxIoTokens = BucketSize(iopsLimit);
+    m_byteTokens += bytesPerSecond * seconds;
+    m_ioTokens += iopsLimit * seconds;
+    m_byteTokens = (m_byteTokens < maxByteTokens) ? m_byteTokens : maxByteTokens;
+    m_ioTokens = (m_ioTokens < maxIoTokens) ? m_ioTokens : maxIoTokens;
+}
+
+bool IoThrottle::Admit()
+{
+    LONGLONG bytesPerSecond = getBytesPerSecond();
+    LONGLONG iopsLimit = getIopsLimit();
+    if (bytesPerSecond == 0 && iopsLimit == 0) {
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(m_lock);
+    Refill(bytesPerSecond, iopsLimit);
+    if ((bytesPerSecond > 0 && m_byteTokens <= 0.0) || (iopsLimit > 0 && m_ioTokens < 1.0)) {
+        m_delayedReads.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void IoThrottle::Charge(DWORD bytes)
+{
+    if (!isLimited()) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_byteTokens -= bytes;
+    m_ioTokens -= 1.0;
+}
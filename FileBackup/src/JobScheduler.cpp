@@ -0,0 +1,288 @@
+#include "JobScheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cwctype>
+#include <sstream>
+#include <thread>
+
+//Getters
+const std::vector<CopyJob>& JobScheduler::getJobs() const
+{
+    return m_jobs;
+}
+
+//Setters
+void JobScheduler::setMaxJobs(int maxJobs)
+{
+    m_maxJobs = (maxJobs > 0) ? maxJobs : 1;
+}
+
+void JobScheduler::setDeviceSlots(int deviceSlots)
+{
+    m_deviceSlots = (deviceSlots > 0) ? deviceSlots : 1;
+}
+
+void JobScheduler::AddJob(const std::wstring& srcPath, const std::wstring& destPath, int priority)
+{
+    CopyJob job;
+    job.srcPath = srcPath;
+    job.destPath = destPath;
+    job.priority = priority;
+    m_jobs.push_back(job);
+}
+
+bool JobScheduler::LoadJobs(LPCWSTR jobFilePath)
+{
+    LOG_DEBUG(L"Inside JobScheduler::LoadJobs\n");
+    HANDLE hFile = CreateFileW(jobFilePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"JobScheduler::LoadJobs: Failed to open job list %s with error: %d\n", jobFilePath, GetLastError());
+        LOG_DEBUG(L"End of JobScheduler::LoadJobs\n");
+        return false;
+    }
+    std::string content;
+    char chunk[4096];
+    DWORD bytesRead = 0;
+    while (ReadFile(hFile, chunk, sizeof(chunk), &bytesRead, nullptr) && bytesRead > 0) {
+        content.append(chunk, bytesRead);
+    }
+    CloseHandle(hFile);
+
+    // UTF-8 (with or without BOM), paths may hold any character except '|', which Windows does not allow in them
+    if (content.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+        content.erase(0, 3);
+    }
+    std::wstring text;
+    if (!content.empty()) {
+        int wideLength = MultiByteToWideChar(CP_UTF8, 0, content.data(), static_cast<int>(content.size()), nullptr, 0);
+        text.resize(wideLength);
+        MultiByteToWideChar(CP_UTF8, 0, content.data(), static_cast<int>(content.size()), &text[0], wideLength);
+    }
+
+    auto trim = [](const std::wstring& value) {
+        size_t first = value.find_first_not_of(L" \t\r");
+        size_t last = value.find_last_not_of(L" \t\r");
+        return (first == std::wstring::npos) ? std::wstring() : value.substr(first, last - first + 1);
+    };
+
+    std::wistringstream lines(text);
+    std::wstring line;
+    int lineNumber = 0;
+    while (std::getline(lines, line)) {
+        ++lineNumber;
+        line = trim(line);
+        if (line.empty() || line[0] == L'#') {
+            continue;
+        }
+        std::vector<std::wstring> fields;
+        std::wistringstream fieldStream(line);
+        std::wstring field;
+        while (std::getline(fieldStream, field, L'|')) {
+            fields.push_back(trim(field));
+        }
+        if (fields.size() < 2 || fields.size() > 3 || fields[0].empty() || fields[1].empty()) {
+            LOG_ERROR(L"JobScheduler::LoadJobs: Line %d of %s is not \"source|destination[|priority]\".\n", lineNumber, jobFilePath);
+            LOG_DEBUG(L"End of JobScheduler::LoadJobs\n");
+            return false;
+        }
+        AddJob(fields[0], fields[1], (fields.size() == 3) ? _wtoi(fields[2].c_str()) : 0);
+    }
+    if (m_jobs.empty()) {
+        LOG_ERROR(L"JobScheduler::LoadJobs: Job list %s holds no jobs.\n", jobFilePath);
+        LOG_DEBUG(L"End of JobScheduler::LoadJobs\n");
+        return false;
+    }
+    LOG_INFO(L"JobScheduler::LoadJobs: %zu jobs read from %s.\n", m_jobs.size(), jobFilePath);
+    LOG_DEBUG(L"End of JobScheduler::LoadJobs\n");
+    return true;
+}
+
+std::wstring JobScheduler::GetDeviceKey(const std::wstring& path)
+{
+    // Query access is enough for IOCTL_STORAGE_GET_DEVICE_NUMBER and does not conflict with the copy's own handles
+    HANDLE hDevice = CreateFileW(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hDevice != INVALID_HANDLE_VALUE) {
+        DiskUtils diskUtils;
+        DWORD diskNumber = 0;
+        bool isDisk = diskUtils.GetDiskNumber(hDevice, diskNumber);
+        CloseHandle(hDevice);
+        if (isDisk) {
+            return L"disk" + std::to_wstring(diskNumber);
+        }
+    }
+    // Files (and devices that are not disks): jobs on the same volume share its slots
+    std::wstring key = path;
+    wchar_t volumePath[MAX_PATH] = {};
+    if (GetVolumePathNameW(path.c_str(), volumePath, MAX_PATH)) {
+        key = volumePath;
+    }
+    std::transform(key.begin(), key.end(), key.begin(), std::towlower);
+    return key;
+}
+
+bool JobScheduler::CanStart(const CopyJob& job) const
+{
+    if (m_running >= m_maxJobs) {
+        return false;
+    }
+    for (const std::wstring& device : job.devices) {
+        auto use = m_deviceUse.find(device);
+        if (use != m_deviceUse.end() && use->second >= m_deviceSlots) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int JobScheduler::GetWeight(const CopyJob& job)
+{
+    return (job.priority > 0) ? job.priority + 1 : 1;
+}
+
+void JobScheduler::Rebalance()
+{
+    LONGLONG totalWeight = 0;
+    for (const auto& running : m_copiers) {
+        totalWeight += GetWeight(m_jobs[running.first]);
+    }
+    for (const auto& running : m_copiers) {
+        LONGLONG share = (totalWeight > 0) ? static_cast<LONGLONG>(m_poolContexts) * GetWeight(m_jobs[running.first]) / totalWeight : m_poolContexts;
+        running.second->setShare(share > 0 ? static_cast<int>(share) : 1);
+        LOG_DEBUG(L"JobScheduler::Rebalance: Job %zu may keep %lld of %d contexts active.\n", running.first + 1, (share > 0 ? share : 1), m_poolContexts);
+    }
+}
+
+bool JobScheduler::Run(int nThreads, int blockSizeMB, int queueDepth, LONGLONG memoryBudgetMB, Configure configure)
+{
+    LOG_DEBUG(L"Inside JobScheduler::Run\n");
+    if (m_jobs.empty()) {
+        LOG_ERROR(L"JobScheduler::Run: No jobs to run.\n");
+        LOG_DEBUG(L"End of JobScheduler::Run\n");
+        return false;
+    }
+
+    if (blockSizeMB <= 0 || blockSizeMB > MAX_BLOCK_SIZE_MB) {
+        LOG_ERROR(L"JobScheduler::Run: Invalid block size %d MB. Must be between 1 and %d.\n", blockSizeMB, MAX_BLOCK_SIZE_MB);
+        LOG_DEBUG(L"End of JobScheduler::Run\n");
+        return false;
+    }
+
+    for (CopyJob& job : m_jobs) {
+        job.devices = { GetDeviceKey(job.srcPath) };
+        std::wstring destDevice = GetDeviceKey(job.destPath);
+        if (destDevice != job.devices[0]) {
+            job.devices.push_back(destDevice);
+        }
+    }
+
+    // Each job that may run gets an equal share of the budget, and the arena holds every share. A job's
+    // FitMemoryBudget keeps its buffers within its share, so the running jobs never ask for more slices than exist.
+    int maxRunning = (m_maxJobs < static_cast<int>(m_jobs.size())) ? m_maxJobs : static_cast<int>(m_jobs.size());
+    LONGLONG budget = (memoryBudgetMB > 0) ? memoryBudgetMB * 1024 * 1024 : BlockCopier::GetDefaultMemoryBudget();
+    LONGLONG jobBudget = budget / maxRunning;
+    DWORD blockSize = static_cast<DWORD>(blockSizeMB) * 1024 * 1024;
+    LONGLONG jobSlices = jobBudget / blockSize;
+    LONGLONG maxJobSlices = static_cast<LONGLONG>(nThreads) * queueDepth * 2; // Compressed images take two per context
+    jobSlices = (jobSlices < maxJobSlices) ? jobSlices : maxJobSlices;
+    if (jobSlices < 1 || !m_arena.Create(blockSize, static_cast<DWORD>(jobSlices * maxRunning))) {
+        LOG_ERROR(L"JobScheduler::Run: Failed to allocate a buffer arena for %d jobs within %lld MB.\n", maxRunning, budget / (1024 * 1024));
+        LOG_DEBUG(L"End of JobScheduler::Run\n");
+        return false;
+    }
+    LOG_INFO(L"JobScheduler::Run: %zu jobs, up to %d at a time and %d per disk, %lld MB of buffers each.\n",
+        m_jobs.size(), maxRunning, m_deviceSlots, (jobSlices * blockSize) / (1024 * 1024));
+
+    // One port and one set of threads for every job. The running jobs split as many active contexts as a
+    // single copy with these parameters would have, by weight, so a busy job cannot crowd the others out.
+    if (!m_pool.Start(nThreads)) {
+        LOG_ERROR(L"JobScheduler::Run: Failed to start the completion pool.\n");
+        m_arena.Destroy();
+        LOG_DEBUG(L"End of JobScheduler::Run\n");
+        return false;
+    }
+    m_poolContexts = m_pool.getThreadCount() * ((queueDepth > 0) ? queueDepth : 1);
+
+    // Start order: priority first, list order among equals
+    std::vector<size_t> order(m_jobs.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return m_jobs[a].priority > m_jobs[b].priority; });
+
+    std::vector<std::thread> jobThreads;
+    size_t remaining = m_jobs.size();
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (remaining > 0) {
+        // The first job in order whose disks are free starts, a job waiting for a busy disk does not hold up the others
+        for (size_t index : order) {
+            CopyJob& job = m_jobs[index];
+            if (job.started || !CanStart(job)) {
+                continue;
+            }
+            job.started = true;
+            --remaining;
+            ++m_running;
+            for (const std::wstring& device : job.devices) {
+                ++m_deviceUse[device];
+            }
+            LOG_INFO(L"JobScheduler::Run: Starting job %zu (priority %d): %s -> %s\n", index + 1, job.priority, job.srcPath.c_str(), job.destPath.c_str());
+
+            jobThreads.emplace_back([this, &job, index, nThreads, blockSizeMB, queueDepth, jobSlices, blockSize, configure]() {
+                auto start = std::chrono::steady_clock::now();
+                bool succeeded = false;
+                {
+                    BlockCopier copier;
+                    if (configure) {
+                        configure(copier);
+                    }
+                    copier.setSharedArena(&m_arena);
+                    copier.setMemoryBudget((jobSlices * blockSize) / (1024 * 1024));
+                    copier.setCompletionPool(&m_pool);
+                    {
+                        std::lock_guard<std::mutex> shareLock(m_lock);
+                        m_copiers[index] = &copier;
+                        Rebalance();
+                    }
+                    succeeded = copier.Initialize(job.srcPath.c_str(), job.destPath.c_str(), nThreads, blockSizeMB, queueDepth) && copier.StartCopy();
+
+                    // The others take over this job's share while it is torn down
+                    std::lock_guard<std::mutex> shareLock(m_lock);
+                    m_copiers.erase(index);
+                    Rebalance();
+                } // The copier hands its slices back before the next job may start
+
+                std::lock_guard<std::mutex> doneLock(m_lock);
+                job.succeeded = succeeded;
+                job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                for (const std::wstring& device : job.devices) {
+                    --m_deviceUse[device];
+                }
+                --m_running;
+                LOG_INFO(L"JobScheduler::Run: Job %zu %s after %.1f s.\n", index + 1, (succeeded ? L"completed" : L"failed"), job.seconds);
+                m_jobDone.notify_all();
+            });
+            if (m_running >= m_maxJobs) {
+                break;
+            }
+        }
+        if (remaining > 0) {
+            m_jobDone.wait(lock);
+        }
+    }
+    lock.unlock();
+    for (std::thread& jobThread : jobThreads) {
+        jobThread.join();
+    }
+    m_pool.Stop();
+
+    bool allSucceeded = true;
+    for (size_t i = 0; i < m_jobs.size(); ++i) {
+        const CopyJob& job = m_jobs[i];
+        LOG_INFO(L"Job %zu: %s, %.1f s, priority %d, %s -> %s\n", i + 1, (job.succeeded ? L"ok" : L"FAILED"), job.seconds, job.priority,
+            job.srcPath.c_str(), job.destPath.c_str());
+        allSucceeded = allSucceeded && job.succeeded;
+    }
+    m_arena.Destroy();
+    LOG_DEBUG(L"End of JobScheduler::Run\n");
+    return allSucceeded;
+}
@@ -5,6 +5,41 @@
 #include <codecvt>   
 #include <locale>   
 #include <sstream>
+#include <algorithm>
+
+// One logged line, formatted by the calling thread
+struct LogRecord {
+    ULONGLONG timestamp;    // FILETIME (UTC) of the call, also used to order records of different threads
+    DWORD threadId;
+    LogUtils::LogLevel level;
+    wchar_t text[LOG_RECORD_TEXT_CHARS];
+};
+
+// Single producer (the owning thread), single consumer (whoever holds LogUtils::m_mutex) ring of records
+class LogRing {
+public:
+    LogRecord m_records[LOG_RING_RECORDS];
+    alignas(64) std::atomic<ULONG> m_head;  // Next record to fill, written by the producer
+    alignas(64) std::atomic<ULONG> m_tail;  // Next record to drain, written by the consumer
+    std::atomic<bool> m_inUse;              // Owned by a live thread, released when that thread exits
+
+    LogRing() : m_head(0), m_tail(0), m_inUse(true) {}
+};
+
+namespace {
+    // Hands the ring back when its thread exits, so threads of later runs reuse it
+    struct ThreadRingHolder {
+        LogRing* ring = nullptr;
+        ~ThreadRingHolder() {
+            if (ring != nullptr) {
+                ring->m_inUse.store(false, std::memory_order_release);
+            }
+        }
+    };
+    thread_local ThreadRingHolder t_ringHolder;
+}
+
+std::atomic<LogUtils::LogLevel> LogUtils::s_currentLogLevel(LogUtils::LogLevel::INFO);
 
 //Singleton Instance
 LogUtils& LogUtils::GetInstance() {
@@ -15,12 +50,17 @@ LogUtils& LogUtils::GetInstance() {
 
 //Private Constructor
 LogUtils::LogUtils()
-    : m_currentLogLevel(LogLevel::INFO),
+    : m_wakeEvent(nullptr),
+    m_stopWriter(false),
+    m_droppedRecords(0),
     m_consoleLoggingEnabled(true), 
     m_fileLoggingEnabled(false)    
 {
     // Set console output code page to UTF-8 for better Unicode display
     SetConsoleOutputCP(CP_UTF8);
+
+    m_wakeEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    m_writerThread = std::thread(&LogUtils::WriterThreadLoop, this);
 }
 
 void LogUtils::Initialize()
@@ -30,50 +70,47 @@ void LogUtils::Initialize()
     std::wcout << L"1. Console alone\n2. File\n3. Both\n";
     std::wcin >> logType;
 
-    // Option 1: Log only to console
-    if (logType == 1)
-    {
-        EnableConsoleLogging(true);
-        EnableFileLogging(false); 
-    }
-    else if (logType == 2)// Option 2: Log only to a file
-    {
-        EnableConsoleLogging(false);
-        EnableFileLogging(true, DEFAULT_LOG_FILE_PATH, true);
-    }
-    else if (logType == 3)// Option 3: Log to both console AND a file
-    {
-        EnableConsoleLogging(true);
-        EnableFileLogging(true, DEFAULT_LOG_FILE_PATH, true);
-    }
-
     DWORD logLevel = 1;
     std::wcout << L"\n\nEnter the button as per the log level needed\n\n";
     std::wcout << L"0. DEBUG\n1. INFO\n2. WARNING\n3. ERROR\n4. CRITICAL\n5. NONE\n";
     std::wcin >> logLevel;
-
-    // Set desired logging level
-    switch (logLevel) {
-    case 0: SetLogLevel(LogLevel::DEBUG); break;
-    case 1: SetLogLevel(LogLevel::INFO); break;
-    case 2: SetLogLevel(LogLevel::WARNING); break;
-    case 3: SetLogLevel(LogLevel::ERROR_LEVEL); break;
-    case 4: SetLogLevel(LogLevel::CRITICAL); break;
-    case 5: SetLogLevel(LogLevel::NONE); break;
-    default: SetLogLevel(LogLevel::INFO); break;
+    if (logLevel < FILEBACKUP_LOG_MIN_LEVEL) {
+        std::wcout << L"Messages below level " << FILEBACKUP_LOG_MIN_LEVEL << L" are not compiled into this build.\n";
     }
 
+    // Option 1: Log only to console, option 2: only to a file, option 3: to both
+    bool console = (logType != 2);
+    bool file = (logType == 2 || logType == 3);
+    Initialize(console, (file ? DEFAULT_LOG_FILE_PATH : nullptr), (logLevel <= 5 ? static_cast<LogLevel>(logLevel) : LogLevel::INFO));
+}
+
+void LogUtils::Initialize(bool console, const wchar_t* filePath, LogLevel level)
+{
+    EnableConsoleLogging(console);
+    if (filePath != nullptr) {
+        EnableFileLogging(true, filePath, true);
+    }
+    else {
+        EnableFileLogging(false);
+    }
+    SetLogLevel(level);
     LOG_INFO(L"Log Open\n");
 }
 
 void LogUtils::DeInitialize()
 {
     LOG_INFO(L"Log Close\n");
+    StopWriter();
     CloseFileLog();
 }
 
 //Private Destructor
 LogUtils::~LogUtils() {
+    StopWriter();
+    if (m_wakeEvent != nullptr) {
+        CloseHandle(m_wakeEvent);
+        m_wakeEvent = nullptr;
+    }
     try {
         if (m_fileLoggingEnabled.load(std::memory_order_relaxed) && m_logFileStream.is_open()) {
             m_logFileStream.flush();
@@ -88,7 +125,7 @@ LogUtils::~LogUtils() {
 
 //Configuration Methods
 void LogUtils::SetLogLevel(LogLevel level) {
-    m_currentLogLevel.store(level, std::memory_order_relaxed);
+    s_currentLogLevel.store(level, std::memory_order_relaxed);
 }
 
 void LogUtils::EnableConsoleLogging(bool enable) {
@@ -129,9 +166,13 @@ void LogUtils::CloseFileLog() {
 }
 
 //Helper Functions
-std::wstring LogUtils::GetTimestamp() {
-    SYSTEMTIME st;
-    GetLocalTime(&st);
+std::wstring LogUtils::GetTimestamp(ULONGLONG fileTime) {
+    FILETIME utcTime, localTime;
+    utcTime.dwLowDateTime = static_cast<DWORD>(fileTime & 0xFFFFFFFF);
+    utcTime.dwHighDateTime = static_cast<DWORD>(fileTime >> 32);
+    SYSTEMTIME st = {};
+    FileTimeToLocalFileTime(&utcTime, &localTime);
+    FileTimeToSystemTime(&localTime, &st);
     wchar_t timestampBuffer[64];
     // Format: YYYY-MM-DD HH:MM:SS.ms
     swprintf_s(timestampBuffer, 64, L"%04d-%02d-%02d %02d:%02d:%02d.%03d",
@@ -160,41 +201,151 @@ std::string LogUtils::WideToUtf8(const std::wstring& wstr) {
 }
 
 //Core Logging Function
+// Formats into the calling thread's ring, no lock is taken once the thread has its ring
 void LogUtils::Log(LogLevel level, const wchar_t* format, va_list args) {
-    if (level < m_currentLogLevel.load(std::memory_order_relaxed)) { // Check log level before processing
+    if (!IsEnabled(level)) { // Check log level before processing
+        return;
+    }
+
+    LogRing* ring = GetThreadRing();
+    if (ring == nullptr) {
         return;
     }
 
-    const size_t BUFFER_SIZE = 2048; // Max log message length
-    wchar_t messageBuffer[BUFFER_SIZE];
+    ULONG head = ring->m_head.load(std::memory_order_relaxed);
+    while (head - ring->m_tail.load(std::memory_order_acquire) >= LOG_RING_RECORDS) {
+        // Full: drop chatty levels rather than stall the I/O path, wait for the writer for anything important
+        if (level < LogLevel::WARNING) {
+            m_droppedRecords.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (m_stopWriter.load(std::memory_order_acquire)) {
+            Flush(); // No writer after DeInitialize, drain on this thread
+        }
+        else {
+            SetEvent(m_wakeEvent);
+            std::this_thread::yield();
+        }
+    }
+
+    LogRecord& record = ring->m_records[head % LOG_RING_RECORDS];
+    FILETIME now;
+    GetSystemTimePreciseAsFileTime(&now);
+    record.timestamp = (static_cast<ULONGLONG>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+    record.threadId = GetCurrentThreadId();
+    record.level = level;
+
+    // Truncate instead of failing on long messages
+    if (_vsnwprintf_s(record.text, LOG_RECORD_TEXT_CHARS, _TRUNCATE, format, args) < 0 && record.text[0] == L'\0') {
+        wcscpy_s(record.text, LOG_RECORD_TEXT_CHARS, L"!!! Log Message Formatting Error !!!");
+    }
+    ring->m_head.store(head + 1, std::memory_order_release);
+
+    if (m_stopWriter.load(std::memory_order_acquire)) {
+        Flush();
+    }
+    else if (level >= LogLevel::ERROR_LEVEL) {
+        SetEvent(m_wakeEvent); // Errors are written out right away
+    }
+}
+
+LogRing* LogUtils::GetThreadRing() {
+    if (t_ringHolder.ring != nullptr) {
+        return t_ringHolder.ring;
+    }
 
-    // Format the message using vswprintf_s
-    int result = vswprintf_s(messageBuffer, BUFFER_SIZE, format, args);
+    std::unique_lock<std::mutex> lock(m_ringsLock);
+    // Reuse the ring of a thread that has exited, its records are still drained in order
+    for (auto& ring : m_rings) {
+        bool inUse = false;
+        if (ring->m_inUse.compare_exchange_strong(inUse, true, std::memory_order_acq_rel)) {
+            t_ringHolder.ring = ring.get();
+            return t_ringHolder.ring;
+        }
+    }
+    try {
+        m_rings.push_back(std::make_unique<LogRing>());
+    }
+    catch (const std::exception& e) {
+        std::wcerr << L"ERROR: Exception while allocating a log ring: " << e.what() << std::endl;
+        return nullptr;
+    }
+    t_ringHolder.ring = m_rings.back().get();
+    return t_ringHolder.ring;
+}
 
-    if (result < 0) {
-        wcscpy_s(messageBuffer, BUFFER_SIZE, L"!!! Log Message Formatting Error !!!");
+void LogUtils::DrainRings() {
+    std::vector<const LogRecord*> batch;
+    std::vector<std::pair<LogRing*, ULONG>> drained;
+    {
+        std::unique_lock<std::mutex> lock(m_ringsLock);
+        for (auto& ring : m_rings) {
+            ULONG tail = ring->m_tail.load(std::memory_order_relaxed);
+            ULONG head = ring->m_head.load(std::memory_order_acquire);
+            for (ULONG i = tail; i != head; ++i) {
+                batch.push_back(&ring->m_records[i % LOG_RING_RECORDS]);
+            }
+            if (head != tail) {
+                drained.push_back({ ring.get(), head });
+            }
+        }
     }
 
-    std::wstring timestamp = GetTimestamp();
-    std::wstring levelStr = LogLevelToString(level);
-    DWORD threadId = GetCurrentThreadId();
+    ULONGLONG dropped = m_droppedRecords.exchange(0, std::memory_order_relaxed);
+    if (batch.empty() && dropped == 0) {
+        return;
+    }
+
+    // Interleave the threads' records in call order
+    std::stable_sort(batch.begin(), batch.end(), [](const LogRecord* a, const LogRecord* b) { return a->timestamp < b->timestamp; });
+
     DWORD pId = GetCurrentProcessId();
+    bool toConsole = m_consoleLoggingEnabled.load(std::memory_order_relaxed);
+    bool toFile = m_fileLoggingEnabled.load(std::memory_order_relaxed) && m_logFileStream.is_open();
+    std::wstringstream lines;
+    for (const LogRecord* record : batch) {
+        lines << L"[" << GetTimestamp(record->timestamp) << L"] [PID: " << pId << "] [ThreadId: " << record->threadId << L"] [" << LogLevelToString(record->level) << L"] " << record->text << L"\n";
+    }
+    if (dropped > 0) {
+        lines << L"[WARNING] " << dropped << L" log messages were dropped because the logger could not keep up.\n";
+    }
 
+    // Records are written out, their slots can be refilled
+    for (auto& entry : drained) {
+        entry.first->m_tail.store(entry.second, std::memory_order_release);
+    }
 
-    // Acquire lock for thread safe output to streams
-    std::unique_lock<std::mutex> lock(m_mutex);
+    std::wstring text = lines.str();
+    if (toConsole) {
+        std::wcout << text;
+        std::wcout.flush();
+    }
+    if (toFile) {
+        m_logFileStream << WideToUtf8(text);
+        m_logFileStream.flush();
+    }
+}
 
-    if (m_consoleLoggingEnabled.load(std::memory_order_relaxed)) {
-        std::wcout << L"[" << timestamp << L"] [PID: " << pId << "] [ThreadId: " << threadId << L"] [" << levelStr << L"] " << messageBuffer << std::endl;
+void LogUtils::WriterThreadLoop() {
+    while (!m_stopWriter.load(std::memory_order_acquire)) {
+        WaitForSingleObject(m_wakeEvent, LOG_FLUSH_INTERVAL_MS);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        DrainRings();
     }
+}
 
-    if (m_fileLoggingEnabled.load(std::memory_order_relaxed) && m_logFileStream.is_open()) {
-        std::wstringstream fullLogLine;
-        fullLogLine << L"[" << timestamp << L"] [PID: " << pId << "] [ThreadId: " << threadId << L"] [" << levelStr << L"] " << messageBuffer;
-        std::wstring finalWideLog = fullLogLine.str();
-        m_logFileStream << WideToUtf8(finalWideLog).c_str()<< std::endl;
-        m_logFileStream.flush(); 
+void LogUtils::Flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    DrainRings();
+}
+
+void LogUtils::StopWriter() {
+    if (m_writerThread.joinable()) {
+        m_stopWriter.store(true, std::memory_order_release);
+        SetEvent(m_wakeEvent);
+        m_writerThread.join();
     }
+    Flush(); // Whatever was logged after the writer's last pass
 }
 
 //Logging Methods
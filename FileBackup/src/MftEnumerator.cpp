@@ -0,0 +1,371 @@
+#include "MftEnumerator.h"
+#include <algorithm>
+#include <cstdint>
+
+// On-disk layout of the parts of a file record that are read here
+#define MFT_RECORD_IN_USE 0x0001
+#define MFT_ATTRIBUTE_STANDARD_INFORMATION 0x10
+#define MFT_ATTRIBUTE_ATTRIBUTE_LIST 0x20
+#define MFT_ATTRIBUTE_DATA 0x80
+#define MFT_ATTRIBUTE_END 0xFFFFFFFF
+#define MFT_ATTRIBUTE_FLAG_COMPRESSED 0x00FF
+#define MFT_ATTRIBUTE_FLAG_ENCRYPTED 0x4000
+#define MFT_ATTRIBUTE_FLAG_SPARSE 0x8000
+
+namespace {
+    template <typename T>
+    T ReadField(const BYTE* base, size_t offset)
+    {
+        T value;
+        memcpy(&value, base + offset, sizeof(T));
+        return value;
+    }
+}
+
+//Getters
+DWORD MftEnumerator::getClusterSize() const
+{
+    return m_clusterSize;
+}
+
+LONGLONG MftEnumerator::getRecordCount() const
+{
+    return m_recordCount;
+}
+
+bool MftEnumerator::ApplyFixups(BYTE* record, DWORD recordSize)
+{
+    if (memcmp(record, "FILE", 4) != 0) {
+        return false;
+    }
+    WORD usaOffset = ReadField<WORD>(record, 4);
+    WORD usaCount = ReadField<WORD>(record, 6);
+    if (usaCount < 2 || usaOffset + usaCount * sizeof(WORD) > recordSize || (recordSize % (usaCount - 1)) != 0) {
+        return false;
+    }
+    // The last word of every stride was replaced by the update sequence number when the record was written,
+    // a stride that does not end in it was not written with the rest of the record
+    DWORD stride = recordSize / (usaCount - 1);
+    WORD usn = ReadField<WORD>(record, usaOffset);
+    for (WORD i = 1; i < usaCount; ++i) {
+        BYTE* end = record + i * stride - sizeof(WORD);
+        if (ReadField<WORD>(end, 0) != usn) {
+            return false;
+        }
+        memcpy(end, record + usaOffset + i * sizeof(WORD), sizeof(WORD));
+    }
+    return true;
+}
+
+bool MftEnumerator::DecodeRuns(const BYTE* mappingPairs, const BYTE* end, std::vector<DataRun>& runs)
+{
+    // Each pair is a header byte (low nibble: bytes of the length, high nibble: bytes of the LCN delta),
+    // the cluster count and the LCN relative to the previous run; a run without an LCN is sparse
+    LONGLONG vcn = 0;
+    LONGLONG lcn = 0;
+    const BYTE* pos = mappingPairs;
+    while (pos < end && *pos != 0) {
+        int lengthBytes = *pos & 0x0F;
+        int offsetBytes = (*pos >> 4) & 0x0F;
+        ++pos;
+        if (lengthBytes == 0 || lengthBytes > 8 || offsetBytes > 8 || pos + lengthBytes + offsetBytes > end) {
+            return false;
+        }
+        LONGLONG clusters = 0;
+        for (int i = 0; i < lengthBytes; ++i) {
+            clusters |= static_cast<LONGLONG>(pos[i]) << (8 * i);
+        }
+        pos += lengthBytes;
+        DataRun run = { vcn, -1, clusters };
+        if (offsetBytes > 0) {
+            LONGLONG delta = 0;
+            for (int i = 0; i < offsetBytes; ++i) {
+                delta |= static_cast<LONGLONG>(pos[i]) << (8 * i);
+            }
+            if (offsetBytes < 8 && (pos[offsetBytes - 1] & 0x80)) {
+                delta |= -1LL << (8 * offsetBytes); // Sign extend
+            }
+            pos += offsetBytes;
+            lcn += delta;
+            run.lcn = lcn;
+        }
+        runs.push_back(run);
+        vcn += clusters;
+    }
+    return true;
+}
+
+bool MftEnumerator::ParseRecord(BYTE* record, ULONGLONG fileRef, MftFileData& data)
+{
+    if (!ApplyFixups(record, m_recordSize)) {
+        return false;
+    }
+    WORD sequence = ReadField<WORD>(record, 16);
+    WORD firstAttribute = ReadField<WORD>(record, 20);
+    WORD flags = ReadField<WORD>(record, 22);
+    DWORD bytesInUse = std::min(ReadField<DWORD>(record, 24), m_recordSize);
+    ULONGLONG baseRecord = ReadField<ULONGLONG>(record, 32);
+    WORD wantedSequence = static_cast<WORD>(fileRef >> 48);
+    // A record reused since the enumeration, or an extension record of another file, is not this file's
+    if (!(flags & MFT_RECORD_IN_USE) || baseRecord != 0 || (wantedSequence != 0 && sequence != wantedSequence)) {
+        return false;
+    }
+
+    bool hasAttributeList = false;
+    bool hasData = false;
+    bool dataPlain = false;
+    LONGLONG initializedSize = 0;
+    DWORD offset = firstAttribute;
+    while (offset + 16 <= bytesInUse) {
+        const BYTE* attribute = record + offset;
+        DWORD type = ReadField<DWORD>(attribute, 0);
+        if (type == MFT_ATTRIBUTE_END) {
+            break;
+        }
+        DWORD length = ReadField<DWORD>(attribute, 4);
+        if (length < 16 || length > bytesInUse - offset) {
+            return false;
+        }
+        BYTE nonResident = attribute[8];
+        BYTE nameLength = attribute[9];
+        WORD attributeFlags = ReadField<WORD>(attribute, 12);
+
+        if (type == MFT_ATTRIBUTE_STANDARD_INFORMATION && !nonResident && length >= 24) {
+            DWORD valueLength = ReadField<DWORD>(attribute, 16);
+            WORD valueOffset = ReadField<WORD>(attribute, 20);
+            if (valueLength >= 36 && valueOffset <= length && valueLength <= length - valueOffset) {
+                const BYTE* value = attribute + valueOffset;
+                data.basicInfo.CreationTime.QuadPart = ReadField<LONGLONG>(value, 0);
+                data.basicInfo.LastWriteTime.QuadPart = ReadField<LONGLONG>(value, 8);
+                data.basicInfo.ChangeTime.QuadPart = ReadField<LONGLONG>(value, 16);
+                data.basicInfo.LastAccessTime.QuadPart = ReadField<LONGLONG>(value, 24);
+                data.basicInfo.FileAttributes = ReadField<DWORD>(value, 32);
+            }
+        }
+        else if (type == MFT_ATTRIBUTE_ATTRIBUTE_LIST) {
+            hasAttributeList = true;
+        }
+        else if (type == MFT_ATTRIBUTE_DATA && nameLength != 0) {
+            data.namedStreams = true;
+        }
+        else if (type == MFT_ATTRIBUTE_DATA && !hasData) {
+            dataPlain = (attributeFlags & (MFT_ATTRIBUTE_FLAG_COMPRESSED | MFT_ATTRIBUTE_FLAG_ENCRYPTED | MFT_ATTRIBUTE_FLAG_SPARSE)) == 0;
+            if (!nonResident && length >= 24) {
+                DWORD valueLength = ReadField<DWORD>(attribute, 16);
+                WORD valueOffset = ReadField<WORD>(attribute, 20);
+                if (valueOffset > length || valueLength > length - valueOffset) {
+                    return false;
+                }
+                hasData = true;
+                data.resident = true;
+                data.size = valueLength;
+                initializedSize = valueLength;
+                data.residentData.assign(attribute + valueOffset, attribute + valueOffset + valueLength);
+            }
+            else if (nonResident && length >= 64 && ReadField<LONGLONG>(attribute, 16) == 0) {
+                // Only the first extent of the stream is in the base record, the rest would be in extension records
+                WORD mappingPairsOffset = ReadField<WORD>(attribute, 32);
+                if (mappingPairsOffset >= length || !DecodeRuns(attribute + mappingPairsOffset, attribute + length, data.runs)) {
+                    return false;
+                }
+                hasData = true;
+                data.size = ReadField<LONGLONG>(attribute, 48);
+                initializedSize = ReadField<LONGLONG>(attribute, 56);
+            }
+        }
+        offset += length;
+    }
+
+    data.inRecord = true;
+    data.readable = hasData && dataPlain && !hasAttributeList && !data.namedStreams && initializedSize == data.size;
+    if (data.readable && !data.resident) {
+        LONGLONG clusters = 0;
+        for (const DataRun& run : data.runs) {
+            data.readable = data.readable && run.lcn >= 0;
+            clusters += run.clusters;
+        }
+        data.readable = data.readable && clusters * m_clusterSize >= data.size;
+    }
+    return true;
+}
+
+bool MftEnumerator::Open(HANDLE hVolume)
+{
+    LOG_DEBUG(L"Inside MftEnumerator::Open\n");
+    m_hVolume = hVolume;
+    NTFS_VOLUME_DATA_BUFFER volumeData = {};
+    DWORD bytesReturned = 0;
+    if (!m_diskUtils.DeviceIoControlSync(hVolume, FSCTL_GET_NTFS_VOLUME_DATA, nullptr, 0, &volumeData, sizeof(volumeData), &bytesReturned)) {
+        LOG_ERROR(L"MftEnumerator::Open: FSCTL_GET_NTFS_VOLUME_DATA failed with error: %d. The source is not on an NTFS volume.\n", GetLastError());
+        LOG_DEBUG(L"End of MftEnumerator::Open\n");
+        return false;
+    }
+    m_clusterSize = volumeData.BytesPerCluster;
+    m_recordSize = volumeData.BytesPerFileRecordSegment;
+    if (m_clusterSize == 0 || m_recordSize < 256) {
+        LOG_ERROR(L"MftEnumerator::Open: Unexpected geometry, cluster size %u, record size %u.\n", m_clusterSize, m_recordSize);
+        LOG_DEBUG(L"End of MftEnumerator::Open\n");
+        return false;
+    }
+
+    // Record 0 describes the MFT itself. It is at MftStartLcn, clusters are a multiple of the sector size.
+    DWORD readSize = ((m_recordSize + m_clusterSize - 1) / m_clusterSize) * m_clusterSize;
+    BYTE* buf = static_cast<BYTE*>(VirtualAlloc(nullptr, readSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (buf == nullptr) {
+        LOG_ERROR(L"MftEnumerator::Open: Failed to allocate %u bytes. Error: %d\n", readSize, GetLastError());
+        LOG_DEBUG(L"End of MftEnumerator::Open\n");
+        return false;
+    }
+    DWORD bytesRead = 0;
+    MftFileData mftData;
+    bool parsed = m_diskUtils.ReadSync(hVolume, volumeData.MftStartLcn.QuadPart * m_clusterSize, buf, readSize, &bytesRead) &&
+        bytesRead >= m_recordSize && ParseRecord(buf, 0, mftData);
+    VirtualFree(buf, 0, MEM_RELEASE);
+    if (!parsed || mftData.resident || mftData.runs.empty()) {
+        LOG_ERROR(L"MftEnumerator::Open: Failed to read the MFT's own record at LCN %lld. Error: %d\n", volumeData.MftStartLcn.QuadPart, GetLastError());
+        LOG_DEBUG(L"End of MftEnumerator::Open\n");
+        return false;
+    }
+    m_mftRuns = mftData.runs;
+
+    // A very fragmented MFT keeps the rest of its runs in extension records, records past the known runs are not read
+    LONGLONG mappedBytes = 0;
+    for (const DataRun& run : m_mftRuns) {
+        mappedBytes += run.clusters * m_clusterSize;
+    }
+    LONGLONG validBytes = std::min(volumeData.MftValidDataLength.QuadPart, mappedBytes);
+    m_recordCount = validBytes / m_recordSize;
+    if (mappedBytes < volumeData.MftValidDataLength.QuadPart) {
+        LOG_WARNING(L"MftEnumerator::Open: Only %lld of %lld MFT bytes are described by its base record, files past them are read through the file system.\n",
+            mappedBytes, volumeData.MftValidDataLength.QuadPart);
+    }
+    LOG_INFO(L"MftEnumerator::Open: Cluster size %u, record size %u, %lld records in %zu MFT runs.\n", m_clusterSize, m_recordSize, m_recordCount, m_mftRuns.size());
+    LOG_DEBUG(L"End of MftEnumerator::Open\n");
+    return true;
+}
+
+bool MftEnumerator::EnumerateNames(std::vector<MftName>& names)
+{
+    LOG_DEBUG(L"Inside MftEnumerator::EnumerateNames\n");
+    names.clear();
+    std::vector<BYTE> outBuf(MFT_ENUM_BUFFER_BYTES);
+    MFT_ENUM_DATA_V0 input = {};
+    input.StartFileReferenceNumber = 0;
+    input.LowUsn = 0;
+    input.HighUsn = MAXLONGLONG;
+    DWORD bytesReturned = 0;
+
+    // Each call returns the next file reference to start from, followed by USN records of the files it covered
+    while (true) {
+        if (!m_diskUtils.DeviceIoControlSync(m_hVolume, FSCTL_ENUM_USN_DATA, &input, sizeof(input), outBuf.data(), static_cast<DWORD>(outBuf.size()), &bytesReturned)) {
+            if (GetLastError() == ERROR_HANDLE_EOF) {
+                break;
+            }
+            LOG_ERROR(L"MftEnumerator::EnumerateNames: FSCTL_ENUM_USN_DATA failed with error: %d\n", GetLastError());
+            LOG_DEBUG(L"End of MftEnumerator::EnumerateNames\n");
+            return false;
+        }
+        if (bytesReturned <= sizeof(ULONGLONG)) {
+            break;
+        }
+        DWORD offset = sizeof(ULONGLONG);
+        while (offset + offsetof(USN_RECORD_V2, FileName) <= bytesReturned) {
+            const USN_RECORD_V2* record = reinterpret_cast<const USN_RECORD_V2*>(outBuf.data() + offset);
+            if (record->RecordLength == 0 || offset + record->RecordLength > bytesReturned) {
+                break;
+            }
+            if (record->MajorVersion == 2) {
+                MftName name;
+                name.fileRef = record->FileReferenceNumber;
+                name.parentRef = record->ParentFileReferenceNumber;
+                name.attributes = record->FileAttributes;
+                name.name.assign(reinterpret_cast<const wchar_t*>(reinterpret_cast<const BYTE*>(record) + record->FileNameOffset),
+                    record->FileNameLength / sizeof(wchar_t));
+                names.push_back(std::move(name));
+            }
+            offset += record->RecordLength;
+        }
+        input.StartFileReferenceNumber = ReadField<ULONGLONG>(outBuf.data(), 0);
+    }
+    LOG_INFO(L"MftEnumerator::EnumerateNames: %zu files and directories enumerated.\n", names.size());
+    LOG_DEBUG(L"End of MftEnumerator::EnumerateNames\n");
+    return true;
+}
+
+bool MftEnumerator::ReadFileRecords(const std::vector<ULONGLONG>& fileRefs, Handler handler)
+{
+    LOG_DEBUG(L"Inside MftEnumerator::ReadFileRecords\n");
+    // Record number to index into fileRefs, so one pass over the MFT finds every wanted record
+    std::vector<uint32_t> recordToIndex(static_cast<size_t>(m_recordCount), UINT32_MAX);
+    for (size_t i = 0; i < fileRefs.size(); ++i) {
+        ULONGLONG recordNumber = fileRefs[i] & MFT_RECORD_NUMBER_MASK;
+        if (static_cast<LONGLONG>(recordNumber) < m_recordCount) {
+            recordToIndex[static_cast<size_t>(recordNumber)] = static_cast<uint32_t>(i);
+        }
+        else {
+            MftFileData data;
+            handler(i, data);
+        }
+    }
+
+    DWORD chunkRecords = MFT_READ_BYTES / m_recordSize;
+    DWORD bufSize = MFT_READ_BYTES + m_clusterSize; // The last read of a chunk is rounded up to a cluster
+    BYTE* buf = static_cast<BYTE*>(VirtualAlloc(nullptr, bufSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (buf == nullptr) {
+        LOG_ERROR(L"MftEnumerator::ReadFileRecords: Failed to allocate %u bytes. Error: %d\n", bufSize, GetLastError());
+        LOG_DEBUG(L"End of MftEnumerator::ReadFileRecords\n");
+        return false;
+    }
+
+    LONGLONG chunksRead = 0;
+    bool succeeded = true;
+    for (LONGLONG first = 0; first < m_recordCount && succeeded; first += chunkRecords) {
+        LONGLONG last = std::min(first + static_cast<LONGLONG>(chunkRecords), m_recordCount);
+        bool wanted = false;
+        for (LONGLONG r = first; r < last && !wanted; ++r) {
+            wanted = recordToIndex[static_cast<size_t>(r)] != UINT32_MAX;
+        }
+        if (!wanted) {
+            continue;
+        }
+
+        // The chunk may span MFT runs, each piece is read from where its run lies on the volume
+        LONGLONG chunkStart = first * m_recordSize;
+        LONGLONG chunkEnd = last * m_recordSize;
+        for (const DataRun& run : m_mftRuns) {
+            LONGLONG runStart = run.vcn * m_clusterSize;
+            LONGLONG runEnd = runStart + run.clusters * m_clusterSize;
+            LONGLONG pieceStart = std::max(chunkStart, runStart);
+            LONGLONG pieceEnd = std::min(chunkEnd, runEnd);
+            if (pieceStart >= pieceEnd) {
+                continue;
+            }
+            DWORD length = static_cast<DWORD>(pieceEnd - pieceStart);
+            length = ((length + m_clusterSize - 1) / m_clusterSize) * m_clusterSize;
+            DWORD bytesRead = 0;
+            if (run.lcn < 0 || !m_diskUtils.ReadSync(m_hVolume, run.lcn * m_clusterSize + (pieceStart - runStart), buf + (pieceStart - chunkStart), length, &bytesRead) ||
+                bytesRead < pieceEnd - pieceStart) {
+                LOG_ERROR(L"MftEnumerator::ReadFileRecords: Failed to read MFT records %lld to %lld. Error: %d\n", first, last, GetLastError());
+                succeeded = false;
+                break;
+            }
+        }
+        ++chunksRead;
+
+        for (LONGLONG r = first; r < last && succeeded; ++r) {
+            uint32_t index = recordToIndex[static_cast<size_t>(r)];
+            if (index == UINT32_MAX) {
+                continue;
+            }
+            MftFileData data;
+            if (!ParseRecord(buf + (r - first) * m_recordSize, fileRefs[index], data)) {
+                data = MftFileData(); // Found at the file system level instead
+            }
+            handler(index, data);
+        }
+    }
+    VirtualFree(buf, 0, MEM_RELEASE);
+    LOG_INFO(L"MftEnumerator::ReadFileRecords: %zu records read in %lld chunks of %d MB.\n", fileRefs.size(), chunksRead, MFT_READ_BYTES / (1024 * 1024));
+    LOG_DEBUG(L"End of MftEnumerator::ReadFileRecords\n");
+    return succeeded;
+}
@@ -0,0 +1,189 @@
+#include "NetworkStream.h"
+#include <bcrypt.h>
+
+#pragma comment(lib, "Bcrypt.lib")
+
+bool NetworkStream::IsNetworkPath(LPCWSTR path)
+{
+    return path != nullptr && _wcsnicmp(path, STREAM_PATH_PREFIX, wcslen(STREAM_PATH_PREFIX)) == 0;
+}
+
+bool NetworkStream::ParseEndpoint(LPCWSTR path, std::wstring& host, std::wstring& port)
+{
+    if (!IsNetworkPath(path)) {
+        return false;
+    }
+    std::wstring endpoint = path + wcslen(STREAM_PATH_PREFIX);
+    size_t separator = std::wstring::npos;
+    if (!endpoint.empty() && endpoint[0] == L'[') {
+        size_t closing = endpoint.find(L']');
+        if (closing == std::wstring::npos || closing + 1 >= endpoint.size() || endpoint[closing + 1] != L':') {
+            return false;
+        }
+        host = endpoint.substr(1, closing - 1);
+        separator = closing + 1;
+    }
+    else {
+        separator = endpoint.rfind(L':');
+        if (separator == std::wstring::npos) {
+            return false;
+        }
+        host = endpoint.substr(0, separator);
+    }
+    port = endpoint.substr(separator + 1);
+    return !host.empty() && !port.empty() && port.find_first_not_of(L"0123456789") == std::wstring::npos;
+}
+
+bool NetworkStream::Startup()
+{
+    WSADATA wsaData = {};
+    int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (result != 0) {
+        LOG_ERROR(L"NetworkStream::Startup: WSAStartup failed with error: %d\n", result);
+        return false;
+    }
+    return true;
+}
+
+SOCKET NetworkStream::CreateSocket(int family)
+{
+    SOCKET socket = WSASocketW(family, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+    if (socket == INVALID_SOCKET) {
+        LOG_ERROR(L"NetworkStream::CreateSocket: WSASocket failed with error: %d\n", WSAGetLastError());
+        return INVALID_SOCKET;
+    }
+    // Frames are large and sent back to back, waiting to coalesce them only adds latency
+    BOOL noDelay = TRUE;
+    int bufferBytes = STREAM_SOCKET_BUFFER_BYTES;
+    if (setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay)) != 0 ||
+        setsockopt(socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&bufferBytes), sizeof(bufferBytes)) != 0 ||
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&bufferBytes), sizeof(bufferBytes)) != 0) {
+        LOG_WARNING(L"NetworkStream::CreateSocket: Failed to set socket options, error: %d\n", WSAGetLastError());
+    }
+    return socket;
+}
+
+bool NetworkStream::LoadRioTable(SOCKET socket, RIO_EXTENSION_FUNCTION_TABLE& rio)
+{
+    GUID rioId = WSAID_MULTIPLE_RIO;
+    DWORD bytesReturned = 0;
+    rio = {};
+    rio.cbSize = sizeof(rio);
+    if (WSAIoctl(socket, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &rioId, sizeof(rioId), &rio, sizeof(rio), &bytesReturned, nullptr, nullptr) != 0) {
+        LOG_ERROR(L"NetworkStream::LoadRioTable: Registered I/O is not available, error: %d\n", WSAGetLastError());
+        return false;
+    }
+    return true;
+}
+
+std::string NetworkStream::LoadSecret(LPCWSTR secretOption)
+{
+    std::wstring text;
+    if (secretOption != nullptr) {
+        text = secretOption;
+    }
+    else {
+        DWORD length = GetEnvironmentVariableW(STREAM_SECRET_ENV, nullptr, 0);
+        if (length > 1) {
+            text.resize(length);
+            length = GetEnvironmentVariableW(STREAM_SECRET_ENV, &text[0], length);
+            text.resize(length);
+        }
+    }
+    if (text.empty()) {
+        return std::string();
+    }
+    int bytes = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), nullptr, 0, nullptr, nullptr);
+    std::string secret(static_cast<size_t>(bytes), '\0');
+    WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), &secret[0], bytes, nullptr, nullptr);
+    SecureZeroMemory(&text[0], text.size() * sizeof(wchar_t));
+    return secret;
+}
+
+// HMAC-SHA256 over the nonce followed by every hello field before auth
+static bool ComputeAuth(const std::string& secret, const StreamChallenge& challenge, const StreamHello& hello, BYTE* auth)
+{
+    BYTE message[STREAM_NONCE_SIZE + offsetof(StreamHello, auth)];
+    memcpy(message, challenge.nonce, STREAM_NONCE_SIZE);
+    memcpy(message + STREAM_NONCE_SIZE, &hello, offsetof(StreamHello, auth));
+    NTSTATUS status = BCryptHash(BCRYPT_HMAC_SHA256_ALG_HANDLE, reinterpret_cast<PUCHAR>(const_cast<char*>(secret.data())), static_cast<ULONG>(secret.size()),
+        message, sizeof(message), auth, STREAM_AUTH_SIZE);
+    if (!BCRYPT_SUCCESS(status)) {
+        LOG_ERROR(L"NetworkStream::ComputeAuth: BCryptHash failed with status 0x%08X.\n", static_cast<unsigned int>(status));
+        return false;
+    }
+    return true;
+}
+
+bool NetworkStream::SignHello(const std::string& secret, const StreamChallenge& challenge, StreamHello& hello)
+{
+    memset(hello.auth, 0, STREAM_AUTH_SIZE);
+    if (secret.empty()) {
+        return true;
+    }
+    return ComputeAuth(secret, challenge, hello, hello.auth);
+}
+
+bool NetworkStream::CheckHello(const std::string& secret, const StreamChallenge& challenge, const StreamHello& hello)
+{
+    BYTE expected[STREAM_AUTH_SIZE];
+    if (!ComputeAuth(secret, challenge, hello, expected)) {
+        return false;
+    }
+    BYTE difference = 0;
+    for (int i = 0; i < STREAM_AUTH_SIZE; ++i) {
+        difference |= static_cast<BYTE>(expected[i] ^ hello.auth[i]);
+    }
+    return difference == 0;
+}
+
+bool NetworkStream::RandomNonce(StreamChallenge& challenge)
+{
+    NTSTATUS status = BCryptGenRandom(nullptr, challenge.nonce, STREAM_NONCE_SIZE, BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+    if (!BCRYPT_SUCCESS(status)) {
+        LOG_ERROR(L"NetworkStream::RandomNonce: BCryptGenRandom failed with status 0x%08X.\n", static_cast<unsigned int>(status));
+        return false;
+    }
+    return true;
+}
+
+void NetworkStream::SetReceiveTimeout(SOCKET socket, DWORD milliseconds)
+{
+    if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&milliseconds), sizeof(milliseconds)) != 0) {
+        LOG_WARNING(L"NetworkStream::SetReceiveTimeout: Failed to set the receive timeout, error: %d\n", WSAGetLastError());
+    }
+}
+
+bool NetworkStream::SendAll(SOCKET socket, const void* data, int length)
+{
+    const char* next = static_cast<const char*>(data);
+    while (length > 0) {
+        int sent = send(socket, next, length, 0);
+        if (sent == SOCKET_ERROR) {
+            LOG_ERROR(L"NetworkStream::SendAll: send failed with error: %d\n", WSAGetLastError());
+            return false;
+        }
+        next += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+bool NetworkStream::ReceiveAll(SOCKET socket, void* data, int length)
+{
+    char* next = static_cast<char*>(data);
+    while (length > 0) {
+        int received = recv(socket, next, length, 0);
+        if (received == 0) {
+            LOG_ERROR(L"NetworkStream::ReceiveAll: Connection closed by the peer.\n");
+            return false;
+        }
+        if (received == SOCKET_ERROR) {
+            LOG_ERROR(L"NetworkStream::ReceiveAll: recv failed with error: %d\n", WSAGetLastError());
+            return false;
+        }
+        next += received;
+        length -= received;
+    }
+    return true;
+}
@@ -0,0 +1,402 @@
+#include "NetworkStream.h" // Before any header that includes windows.h
+#include "NetworkTarget.h"
+#include "IOUtils.h"
+
+struct NetworkConnection {
+    SOCKET socket = INVALID_SOCKET;
+    RIO_RQ requestQueue = RIO_INVALID_RQ;
+    std::mutex sendLock;    // A request queue takes one caller at a time, and a frame's header and payload must stay together
+};
+
+struct NetworkRio {
+    RIO_EXTENSION_FUNCTION_TABLE table = {};
+    RIO_CQ completionQueue = RIO_INVALID_CQ;
+    StreamFrameHeader* headers = nullptr;   // One header slot per IOContext, a context has one frame in flight at most
+    RIO_BUFFERID headerBufferId = RIO_INVALID_BUFFERID;
+    std::vector<RIO_BUFFERID> payloadBufferIds; // Registered buffer of each IOContext, by IOContext::index
+};
+
+NetworkTarget::NetworkTarget() : m_rio(new NetworkRio()), m_notifyOverlapped(), m_wsaStarted(false), m_sectorSize(0), m_capacity(0), m_bytesSent(0)
+{
+}
+
+NetworkTarget::~NetworkTarget()
+{
+    Close();
+}
+
+//Getters
+bool NetworkTarget::isConnected() const
+{
+    return !m_connections.empty();
+}
+
+int NetworkTarget::getConnectionCount() const
+{
+    return static_cast<int>(m_connections.size());
+}
+
+DWORD NetworkTarget::getSectorSize() const
+{
+    return m_sectorSize;
+}
+
+LONGLONG NetworkTarget::getCapacity() const
+{
+    return m_capacity;
+}
+
+LONGLONG NetworkTarget::getBytesSent() const
+{
+    return m_bytesSent.load(std::memory_order_relaxed);
+}
+
+bool NetworkTarget::IsNetworkPath(LPCWSTR path)
+{
+    return NetworkStream::IsNetworkPath(path);
+}
+
+std::string NetworkTarget::LoadSecret(LPCWSTR secretOption)
+{
+    return NetworkStream::LoadSecret(secretOption);
+}
+
+bool NetworkTarget::Connect(LPCWSTR path, int nConnections, DWORD blockSize, LONGLONG sourceSize, const std::string& secret)
+{
+    LOG_DEBUG(L"Inside NetworkTarget::Connect\n");
+    Close();
+    std::wstring host;
+    std::wstring port;
+    if (!NetworkStream::ParseEndpoint(path, host, port)) {
+        LOG_ERROR(L"NetworkTarget::Connect: %s is not of the form tcp://host:port.\n", path);
+        LOG_DEBUG(L"End of NetworkTarget::Connect\n");
+        return false;
+    }
+    if (nConnections <= 0 || nConnections > STREAM_MAX_CONNECTIONS) {
+        LOG_ERROR(L"NetworkTarget::Connect: Between 1 and %d connections are supported, %d were requested.\n", STREAM_MAX_CONNECTIONS, nConnections);
+        LOG_DEBUG(L"End of NetworkTarget::Connect\n");
+        return false;
+    }
+    if (!NetworkStream::Startup()) {
+        LOG_DEBUG(L"End of NetworkTarget::Connect\n");
+        return false;
+    }
+    m_wsaStarted = true;
+    m_bytesSent = 0;
+
+    ADDRINFOW hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    PADDRINFOW addresses = nullptr;
+    int result = GetAddrInfoW(host.c_str(), port.c_str(), &hints, &addresses);
+    if (result != 0) {
+        LOG_ERROR(L"NetworkTarget::Connect: Failed to resolve %s, error: %d\n", host.c_str(), result);
+        Close();
+        LOG_DEBUG(L"End of NetworkTarget::Connect\n");
+        return false;
+    }
+
+    // Connections are opened one after the other, the receiver accepts the next one after answering a hello
+    bool connected = true;
+    for (int i = 0; i < nConnections && connected; ++i) {
+        std::unique_ptr<NetworkConnection> connection = std::make_unique<NetworkConnection>();
+        for (PADDRINFOW address = addresses; address != nullptr; address = address->ai_next) {
+            connection->socket = NetworkStream::CreateSocket(address->ai_family);
+            if (connection->socket == INVALID_SOCKET) {
+                continue;
+            }
+            if (connect(connection->socket, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0) {
+                break;
+            }
+            closesocket(connection->socket);
+            connection->socket = INVALID_SOCKET;
+        }
+        if (connection->socket == INVALID_SOCKET) {
+            LOG_ERROR(L"NetworkTarget::Connect: Failed to connect to %s port %s, error: %d\n", host.c_str(), port.c_str(), WSAGetLastError());
+            connected = false;
+            break;
+        }
+
+        // The receiver speaks first, a silent peer is not a receiver and must not hang the copy
+        NetworkStream::SetReceiveTimeout(connection->socket, STREAM_HANDSHAKE_TIMEOUT_MS);
+        StreamChallenge challenge = {};
+        StreamHello hello = { STREAM_MAGIC, STREAM_PROTOCOL_VERSION, blockSize, static_cast<DWORD>(nConnections), static_cast<DWORD>(i), 0, sourceSize };
+        StreamHelloReply reply = {};
+        if (!NetworkStream::ReceiveAll(connection->socket, &challenge, sizeof(challenge))) {
+            LOG_ERROR(L"NetworkTarget::Connect: Handshake on connection %d failed.\n", i);
+            connected = false;
+        }
+        else if (challenge.magic != STREAM_MAGIC || challenge.version != STREAM_PROTOCOL_VERSION) {
+            LOG_ERROR(L"NetworkTarget::Connect: %s port %s is not a FileBackupReceiver of protocol version %u.\n", host.c_str(), port.c_str(), STREAM_PROTOCOL_VERSION);
+            connected = false;
+        }
+        else if (!NetworkStream::SignHello(secret, challenge, hello) || !NetworkStream::SendAll(connection->socket, &hello, sizeof(hello)) ||
+            !NetworkStream::ReceiveAll(connection->socket, &reply, sizeof(reply))) {
+            LOG_ERROR(L"NetworkTarget::Connect: Handshake on connection %d failed.\n", i);
+            connected = false;
+        }
+        else if (reply.magic != STREAM_MAGIC) {
+            LOG_ERROR(L"NetworkTarget::Connect: %s port %s is not a FileBackupReceiver.\n", host.c_str(), port.c_str());
+            connected = false;
+        }
+        else if (reply.status == ERROR_ACCESS_DENIED) {
+            LOG_ERROR(L"NetworkTarget::Connect: Receiver refused the stream, the shared secret (--secret or %s) does not match its own.\n", STREAM_SECRET_ENV);
+            connected = false;
+        }
+        else if (reply.status != ERROR_SUCCESS) {
+            LOG_ERROR(L"NetworkTarget::Connect: Receiver refused the stream with error: %d\n", reply.status);
+            connected = false;
+        }
+        else {
+            m_sectorSize = reply.sectorSize;
+            m_capacity = reply.capacity;
+            NetworkStream::SetReceiveTimeout(connection->socket, 0);
+        }
+        m_connections.push_back(std::move(connection));
+    }
+    FreeAddrInfoW(addresses);
+
+    if (!connected || m_sectorSize == 0 || !NetworkStream::LoadRioTable(m_connections[0]->socket, m_rio->table)) {
+        Close();
+        LOG_DEBUG(L"End of NetworkTarget::Connect\n");
+        return false;
+    }
+    LOG_INFO(L"Network target: %s port %s over %d connections, receiver sector size %u bytes\n", host.c_str(), port.c_str(), nConnections, m_sectorSize);
+    LOG_DEBUG(L"End of NetworkTarget::Connect\n");
+    return true;
+}
+
+bool NetworkTarget::Start(const std::vector<std::unique_ptr<IOContext>>& cntxts, HANDLE hIocp, ULONG_PTR completionKey)
+{
+    LOG_DEBUG(L"Inside NetworkTarget::Start\n");
+    RIO_EXTENSION_FUNCTION_TABLE& rio = m_rio->table;
+    DWORD nConnections = static_cast<DWORD>(m_connections.size());
+    DWORD nContexts = static_cast<DWORD>(cntxts.size());
+    if (nConnections == 0 || nContexts == 0) {
+        LOG_ERROR(L"NetworkTarget::Start: Not connected, or no IOContexts to send from.\n");
+        LOG_DEBUG(L"End of NetworkTarget::Start\n");
+        return false;
+    }
+
+    // Frame headers get registered slots of their own, payloads are sent from the context buffers in place
+    SIZE_T headerBytes = static_cast<SIZE_T>(nContexts) * sizeof(StreamFrameHeader);
+    m_rio->headers = static_cast<StreamFrameHeader*>(VirtualAlloc(nullptr, headerBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (m_rio->headers == nullptr) {
+        LOG_ERROR(L"NetworkTarget::Start: Failed to allocate frame headers. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of NetworkTarget::Start\n");
+        return false;
+    }
+    m_rio->headerBufferId = rio.RIORegisterBuffer(reinterpret_cast<PCHAR>(m_rio->headers), static_cast<DWORD>(headerBytes));
+    if (m_rio->headerBufferId == RIO_INVALID_BUFFERID) {
+        LOG_ERROR(L"NetworkTarget::Start: Failed to register frame headers. Error: %d\n", WSAGetLastError());
+        LOG_DEBUG(L"End of NetworkTarget::Start\n");
+        return false;
+    }
+    m_rio->payloadBufferIds.assign(nContexts, RIO_INVALID_BUFFERID);
+    for (DWORD i = 0; i < nContexts; ++i) {
+        IOContext* cntxt = cntxts[i].get();
+        if (cntxt->index < 0 || static_cast<DWORD>(cntxt->index) >= nContexts) {
+            LOG_ERROR(L"NetworkTarget::Start: IOContext %u has the index %d, out of range.\n", i, cntxt->index);
+            LOG_DEBUG(L"End of NetworkTarget::Start\n");
+            return false;
+        }
+        RIO_BUFFERID bufferId = rio.RIORegisterBuffer(cntxt->buf, cntxt->bufSize);
+        if (bufferId == RIO_INVALID_BUFFERID) {
+            LOG_ERROR(L"NetworkTarget::Start: Failed to register the buffer of IOContext %u. Error: %d\n", i, WSAGetLastError());
+            LOG_DEBUG(L"End of NetworkTarget::Start\n");
+            return false;
+        }
+        m_rio->payloadBufferIds[cntxt->index] = bufferId;
+    }
+
+    // A context has one frame (a header and a payload send) in flight at most, always on the connection of its index
+    DWORD sendsPerConnection = 2 * ((nContexts + nConnections - 1) / nConnections);
+    RIO_NOTIFICATION_COMPLETION notification = {};
+    notification.Type = RIO_IOCP_COMPLETION;
+    notification.Iocp.IocpHandle = hIocp;
+    notification.Iocp.CompletionKey = reinterpret_cast<PVOID>(completionKey);
+    notification.Iocp.Overlapped = &m_notifyOverlapped;
+    m_rio->completionQueue = rio.RIOCreateCompletionQueue(nConnections * (sendsPerConnection + 1), &notification);
+    if (m_rio->completionQueue == RIO_INVALID_CQ) {
+        LOG_ERROR(L"NetworkTarget::Start: Failed to create the RIO completion queue. Error: %d\n", WSAGetLastError());
+        LOG_DEBUG(L"End of NetworkTarget::Start\n");
+        return false;
+    }
+    for (auto& connection : m_connections) {
+        // No receives are posted, the receiver's status is read with recv once every frame has been sent
+        connection->requestQueue = rio.RIOCreateRequestQueue(connection->socket, 1, 1, sendsPerConnection, 1,
+            m_rio->completionQueue, m_rio->completionQueue, connection.get());
+        if (connection->requestQueue == RIO_INVALID_RQ) {
+            LOG_ERROR(L"NetworkTarget::Start: Failed to create a RIO request queue. Error: %d\n", WSAGetLastError());
+            LOG_DEBUG(L"End of NetworkTarget::Start\n");
+            return false;
+        }
+    }
+    int notifyResult = rio.RIONotify(m_rio->completionQueue);
+    if (notifyResult != ERROR_SUCCESS) {
+        LOG_ERROR(L"NetworkTarget::Start: RIONotify failed with error: %d\n", notifyResult);
+        LOG_DEBUG(L"End of NetworkTarget::Start\n");
+        return false;
+    }
+    LOG_INFO(L"Network target: %u buffers registered, up to %u sends in flight per connection\n", nContexts, sendsPerConnection);
+    LOG_DEBUG(L"End of NetworkTarget::Start\n");
+    return true;
+}
+
+bool NetworkTarget::Send(IOContext* cntxt, DWORD length)
+{
+    RIO_EXTENSION_FUNCTION_TABLE& rio = m_rio->table;
+    NetworkConnection& connection = *m_connections[static_cast<size_t>(cntxt->index) % m_connections.size()];
+
+    StreamFrameHeader& header = m_rio->headers[cntxt->index];
+    header.magic = STREAM_MAGIC;
+    header.length = length;
+    header.offset = cntxt->readOffset;
+    RIO_BUF headerBuf = { m_rio->headerBufferId, static_cast<ULONG>(cntxt->index * sizeof(StreamFrameHeader)), sizeof(StreamFrameHeader) };
+    RIO_BUF payloadBuf = { m_rio->payloadBufferIds[cntxt->index], 0, length };
+
+    // The deferred header goes out together with the payload send. Its result carries no context, only errors matter.
+    std::lock_guard<std::mutex> guard(connection.sendLock);
+    if (!rio.RIOSend(connection.requestQueue, &headerBuf, 1, RIO_MSG_DEFER | RIO_MSG_DONT_NOTIFY, nullptr)) {
+        LOG_ERROR(L"NetworkTarget::Send: Failed to send the frame header for offset %lld. Error: %d\n", cntxt->readOffset, WSAGetLastError());
+        return false;
+    }
+    if (!rio.RIOSend(connection.requestQueue, &payloadBuf, 1, 0, cntxt)) {
+        LOG_ERROR(L"NetworkTarget::Send: Failed to send the block at offset %lld. Error: %d\n", cntxt->readOffset, WSAGetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool NetworkTarget::DrainCompletions(const SendHandler& handler)
+{
+    RIO_EXTENSION_FUNCTION_TABLE& rio = m_rio->table;
+    RIORESULT results[NETWORK_DEQUEUE_BATCH];
+    for (;;) {
+        ULONG count = 0;
+        {
+            std::lock_guard<std::mutex> guard(m_dequeueLock);
+            count = rio.RIODequeueCompletion(m_rio->completionQueue, results, NETWORK_DEQUEUE_BATCH);
+        }
+        if (count == RIO_CORRUPT_CQ) {
+            LOG_ERROR(L"NetworkTarget::DrainCompletions: The RIO completion queue is corrupt.\n");
+            return false;
+        }
+        if (count == 0) {
+            break;
+        }
+        for (ULONG i = 0; i < count; ++i) {
+            IOContext* cntxt = reinterpret_cast<IOContext*>(static_cast<ULONG_PTR>(results[i].RequestContext));
+            DWORD errCode = static_cast<DWORD>(results[i].Status);
+            if (cntxt == nullptr) {
+                // A frame header, a failure shows again on the payload behind it
+                if (errCode != ERROR_SUCCESS) {
+                    LOG_WARNING(L"NetworkTarget::DrainCompletions: Frame header send failed with error: %d\n", errCode);
+                }
+                continue;
+            }
+            if (errCode == ERROR_SUCCESS) {
+                m_bytesSent.fetch_add(results[i].BytesTransferred, std::memory_order_relaxed);
+            }
+            handler(cntxt, errCode, results[i].BytesTransferred);
+        }
+    }
+
+    // One notification per RIONotify, it is queued at once if results arrived after the last dequeue
+    int notifyResult = rio.RIONotify(m_rio->completionQueue);
+    if (notifyResult != ERROR_SUCCESS) {
+        LOG_ERROR(L"NetworkTarget::DrainCompletions: RIONotify failed with error: %d\n", notifyResult);
+        return false;
+    }
+    return true;
+}
+
+bool NetworkTarget::Finish(bool complete)
+{
+    LOG_DEBUG(L"Inside NetworkTarget::Finish\n");
+    if (!isConnected()) {
+        LOG_ERROR(L"NetworkTarget::Finish: Not connected.\n");
+        LOG_DEBUG(L"End of NetworkTarget::Finish\n");
+        return false;
+    }
+    if (!complete) {
+        LOG_WARNING(L"NetworkTarget::Finish: Dropping the connections, the receiver discards the stream.\n");
+        Close();
+        LOG_DEBUG(L"End of NetworkTarget::Finish\n");
+        return false;
+    }
+
+    // Every send has completed, so the end frame follows the last block on each connection
+    StreamFrameHeader endFrame = { STREAM_MAGIC, 0, STREAM_END_OFFSET };
+    bool confirmed = true;
+    for (auto& connection : m_connections) {
+        if (!NetworkStream::SendAll(connection->socket, &endFrame, sizeof(endFrame))) {
+            confirmed = false;
+            break;
+        }
+    }
+
+    // The receiver answers on every connection once all of them have ended and its target is flushed
+    LONGLONG bytesWritten = 0;
+    for (size_t i = 0; confirmed && i < m_connections.size(); ++i) {
+        StreamStatus status = {};
+        if (!NetworkStream::ReceiveAll(m_connections[i]->socket, &status, sizeof(status)) || status.magic != STREAM_MAGIC) {
+            LOG_ERROR(L"NetworkTarget::Finish: No status from the receiver on connection %zu.\n", i);
+            confirmed = false;
+        }
+        else if (status.status != ERROR_SUCCESS) {
+            LOG_ERROR(L"NetworkTarget::Finish: Receiver failed to write the stream with error: %d\n", status.status);
+            confirmed = false;
+        }
+        else {
+            bytesWritten = status.bytesWritten;
+        }
+    }
+    if (confirmed && bytesWritten != getBytesSent()) {
+        LOG_ERROR(L"NetworkTarget::Finish: Receiver wrote %lld bytes of the %lld bytes sent.\n", bytesWritten, getBytesSent());
+        confirmed = false;
+    }
+    if (confirmed) {
+        LOG_INFO(L"NetworkTarget::Finish: Receiver wrote and flushed %lld MB.\n", bytesWritten / (1024 * 1024));
+    }
+    Close();
+    LOG_DEBUG(L"End of NetworkTarget::Finish\n");
+    return confirmed;
+}
+
+void NetworkTarget::Close()
+{
+    // Closing a socket frees its request queue, the buffers and the completion queue go once no request can use them
+    for (auto& connection : m_connections) {
+        if (connection->socket != INVALID_SOCKET) {
+            closesocket(connection->socket);
+            connection->socket = INVALID_SOCKET;
+        }
+    }
+    m_connections.clear();
+
+    RIO_EXTENSION_FUNCTION_TABLE& rio = m_rio->table;
+    for (RIO_BUFFERID bufferId : m_rio->payloadBufferIds) {
+        if (bufferId != RIO_INVALID_BUFFERID) {
+            rio.RIODeregisterBuffer(bufferId);
+        }
+    }
+    m_rio->payloadBufferIds.clear();
+    if (m_rio->headerBufferId != RIO_INVALID_BUFFERID) {
+        rio.RIODeregisterBuffer(m_rio->headerBufferId);
+        m_rio->headerBufferId = RIO_INVALID_BUFFERID;
+    }
+    if (m_rio->headers != nullptr) {
+        VirtualFree(m_rio->headers, 0, MEM_RELEASE);
+        m_rio->headers = nullptr;
+    }
+    if (m_rio->completionQueue != RIO_INVALID_CQ) {
+        rio.RIOCloseCompletionQueue(m_rio->completionQueue);
+        m_rio->completionQueue = RIO_INVALID_CQ;
+    }
+    if (m_wsaStarted) {
+        WSACleanup();
+        m_wsaStarted = false;
+    }
+}
@@ -0,0 +1,77 @@
+#include "NumaPlacement.h"
+
+//Getters
+int NumaPlacement::getNode() const
+{
+    return m_node;
+}
+
+ULONG NumaPlacement::GetHighestNode()
+{
+    ULONG highestNode = 0;
+    if (!GetNumaHighestNodeNumber(&highestNode)) {
+        return 0;
+    }
+    return highestNode;
+}
+
+bool NumaPlacement::Configure(int node, int nThreads)
+{
+    LOG_DEBUG(L"Inside NumaPlacement::Configure\n");
+    m_node = NUMA_NODE_NONE;
+    m_affinities.clear();
+
+    if (node >= 0) {
+        GROUP_AFFINITY nodeAffinity = {};
+        if (static_cast<ULONG>(node) > GetHighestNode() || !GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &nodeAffinity) || nodeAffinity.Mask == 0) {
+            LOG_ERROR(L"NumaPlacement::Configure: NUMA node %d does not exist or has no processors. Error: %d\n", node, GetLastError());
+            LOG_DEBUG(L"End of NumaPlacement::Configure\n");
+            return false;
+        }
+        // The scheduler balances the workers within the node
+        m_node = node;
+        m_affinities.assign(nThreads, nodeAffinity);
+        LOG_INFO(L"NumaPlacement::Configure: %d workers on NUMA node %d (group %u, mask 0x%llx).\n", nThreads, node, nodeAffinity.Group,
+            static_cast<ULONGLONG>(nodeAffinity.Mask));
+        LOG_DEBUG(L"End of NumaPlacement::Configure\n");
+        return true;
+    }
+
+    // No node: a thread only ever runs in the group it starts in, so spread the workers over every group
+    WORD groupCount = GetActiveProcessorGroupCount();
+    if (groupCount <= 1) {
+        LOG_DEBUG(L"End of NumaPlacement::Configure\n");
+        return true;
+    }
+    DWORD totalProcessors = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    for (int i = 0; i < nThreads; ++i) {
+        // Worker i takes the group holding processor i * total / nThreads, so groups get workers in proportion to their size
+        DWORD processor = static_cast<DWORD>((static_cast<ULONGLONG>(i) * totalProcessors) / nThreads);
+        WORD group = 0;
+        DWORD groupProcessors = GetActiveProcessorCount(group);
+        while (processor >= groupProcessors && group + 1 < groupCount) {
+            processor -= groupProcessors;
+            ++group;
+            groupProcessors = GetActiveProcessorCount(group);
+        }
+        GROUP_AFFINITY affinity = {};
+        affinity.Group = group;
+        affinity.Mask = (groupProcessors >= sizeof(KAFFINITY) * 8) ? ~static_cast<KAFFINITY>(0) : ((static_cast<KAFFINITY>(1) << groupProcessors) - 1);
+        m_affinities.push_back(affinity);
+    }
+    LOG_INFO(L"NumaPlacement::Configure: %d workers spread over %u processor groups (%u logical processors).\n", nThreads, groupCount, totalProcessors);
+    LOG_DEBUG(L"End of NumaPlacement::Configure\n");
+    return true;
+}
+
+bool NumaPlacement::ApplyToCurrentThread(int workerIndex) const
+{
+    if (workerIndex < 0 || static_cast<size_t>(workerIndex) >= m_affinities.size()) {
+        return true;
+    }
+    if (!SetThreadGroupAffinity(GetCurrentThread(), &m_affinities[workerIndex], nullptr)) {
+        LOG_WARNING(L"NumaPlacement::ApplyToCurrentThread: SetThreadGroupAffinity failed for worker %d with error: %d\n", workerIndex, GetLastError());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,105 @@
+#include "RangeScheduler.h"
+
+//Getters
+int RangeScheduler::getWorkers() const
+{
+    return m_nWorkers;
+}
+
+LONGLONG RangeScheduler::getSteals() const
+{
+    return m_steals.load(std::memory_order_relaxed);
+}
+
+bool RangeScheduler::Build(const BlockSchedule& schedule, int nWorkers)
+{
+    LOG_DEBUG(L"Inside RangeScheduler::Build\n");
+    if (nWorkers <= 0) {
+        LOG_ERROR(L"RangeScheduler::Build: Worker count must be positive.\n");
+        LOG_DEBUG(L"End of RangeScheduler::Build\n");
+        return false;
+    }
+    m_schedule = &schedule;
+    m_nWorkers = nWorkers;
+    m_ranges.reset(new WorkerRange[nWorkers]);
+    m_steals.store(0, std::memory_order_relaxed);
+
+    LONGLONG totalBlocks = schedule.getTotalBlocks();
+    for (int i = 0; i < nWorkers; ++i) {
+        m_ranges[i].next = totalBlocks * i / nWorkers;
+        m_ranges[i].end = totalBlocks * (i + 1) / nWorkers;
+        m_ranges[i].remaining.store(m_ranges[i].end - m_ranges[i].next, std::memory_order_relaxed);
+    }
+    LOG_INFO(L"RangeScheduler::Build: %lld blocks in %d ranges of about %lld blocks.\n", totalBlocks, nWorkers, totalBlocks / nWorkers);
+    LOG_DEBUG(L"End of RangeScheduler::Build\n");
+    return true;
+}
+
+bool RangeScheduler::Claim(int worker, LONGLONG maxBlocks, LONGLONG& blockIndex, LONGLONG& blockCount)
+{
+    if (m_schedule == nullptr || worker < 0 || worker >= m_nWorkers) {
+        return false;
+    }
+    WorkerRange& range = m_ranges[worker];
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(range.lock);
+            if (range.next < range.end) {
+                LONGLONG remaining = range.end - range.next;
+                blockIndex = range.next;
+                blockCount = m_schedule->GetRunLength(blockIndex, (maxBlocks < remaining) ? maxBlocks : remaining);
+                if (blockCount < 1) {
+                    blockCount = 1;
+                }
+                range.next += blockCount;
+                range.remaining.store(range.end - range.next, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        if (!Steal(worker)) {
+            return false;
+        }
+    }
+}
+
+bool RangeScheduler::Steal(int worker)
+{
+    // Ranges only shrink, so remaining can only be stale high; once every one reads zero nothing is left
+    while (true) {
+        int victim = -1;
+        LONGLONG most = 0;
+        for (int i = 0; i < m_nWorkers; ++i) {
+            LONGLONG remaining = m_ranges[i].remaining.load(std::memory_order_relaxed);
+            if (i != worker && remaining > most) {
+                most = remaining;
+                victim = i;
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+
+        // Both locks, so the stolen blocks are never in neither range while another thief looks for work
+        WorkerRange& own = m_ranges[worker];
+        WorkerRange& other = m_ranges[victim];
+        std::unique_lock<std::mutex> ownLock(own.lock, std::defer_lock);
+        std::unique_lock<std::mutex> otherLock(other.lock, std::defer_lock);
+        std::lock(ownLock, otherLock);
+        if (own.next < own.end) { // Another context of this worker stole in the meantime
+            return true;
+        }
+        LONGLONG remaining = other.end - other.next;
+        if (remaining <= 0) {
+            continue; // Emptied since the scan, look again
+        }
+        LONGLONG stolen = (remaining / 2 > 0) ? remaining / 2 : remaining;
+        own.next = other.end - stolen;
+        own.end = other.end;
+        other.end = own.next;
+        own.remaining.store(stolen, std::memory_order_relaxed);
+        other.remaining.store(other.end - other.next, std::memory_order_relaxed);
+        m_steals.fetch_add(1, std::memory_order_relaxed);
+        LOG_DEBUG(L"RangeScheduler::Steal: Worker %d took blocks [%lld, %lld) from worker %d.\n", worker, own.next, own.end, victim);
+        return true;
+    }
+}
@@ -0,0 +1,95 @@
+#include "ReorderBuffer.h"
+
+//Getters
+LONGLONG ReorderBuffer::getNextBlock()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_nextBlock;
+}
+
+int ReorderBuffer::getMaxWaitingWrites()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_maxWaitingWrites;
+}
+
+void ReorderBuffer::Start(Handler handler)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_waiting.clear();
+    m_nextBlock = 0;
+    m_waitingWrites = 0;
+    m_maxWaitingWrites = 0;
+    m_ready.clear();
+    m_releasing = false;
+    m_handler = std::move(handler);
+}
+
+void ReorderBuffer::Submit(IOContext* cntxt)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (cntxt->blockIndex == m_nextBlock) { // In order, no need to go through the map
+        m_nextBlock += cntxt->blockCount;
+        m_ready.push_back(cntxt);
+        Drain();
+        Release(lock);
+        return;
+    }
+    m_waiting[cntxt->blockIndex] = Entry{ cntxt->blockCount, cntxt };
+    ++m_waitingWrites;
+    m_maxWaitingWrites = (m_waitingWrites > m_maxWaitingWrites) ? m_waitingWrites : m_maxWaitingWrites;
+    LOG_DEBUG(L"ReorderBuffer::Submit: Block %lld waits for block %lld, %d writes waiting.\n", cntxt->blockIndex, m_nextBlock, m_waitingWrites);
+}
+
+void ReorderBuffer::Skip(LONGLONG blockIndex, LONGLONG blockCount)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (blockIndex == m_nextBlock) {
+        m_nextBlock += blockCount;
+        Drain();
+        Release(lock);
+        return;
+    }
+    // Runs of skipped blocks become one entry, so a long zero region does not grow the map while a write is slow
+    auto next = m_waiting.lower_bound(blockIndex);
+    if (next != m_waiting.begin()) {
+        auto previous = std::prev(next);
+        if (previous->second.cntxt == nullptr && previous->first + previous->second.blockCount == blockIndex) {
+            previous->second.blockCount += blockCount;
+            return;
+        }
+    }
+    m_waiting[blockIndex] = Entry{ blockCount, nullptr };
+}
+
+void ReorderBuffer::Drain()
+{
+    auto head = m_waiting.begin();
+    while (head != m_waiting.end() && head->first == m_nextBlock) {
+        m_nextBlock += head->second.blockCount;
+        if (head->second.cntxt != nullptr) {
+            --m_waitingWrites;
+            m_ready.push_back(head->second.cntxt);
+        }
+        head = m_waiting.erase(head);
+    }
+}
+
+void ReorderBuffer::Release(std::unique_lock<std::mutex>& lock)
+{
+    if (m_releasing) {
+        return;
+    }
+    m_releasing = true;
+    std::vector<IOContext*> batch;
+    while (!m_ready.empty()) {
+        batch.swap(m_ready);
+        lock.unlock();
+        for (IOContext* cntxt : batch) {
+            m_handler(cntxt);
+        }
+        batch.clear();
+        lock.lock();
+    }
+    m_releasing = false;
+}
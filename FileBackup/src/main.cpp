@@ -1,42 +1,493 @@
 #include "BlockCopier.h"
+#include "JobScheduler.h"
+#include "FileTreeCopier.h"
+#include "CopyTrace.h"
+#include "ImageRestorer.h"
+
+static void PrintUsage(const wchar_t* exeName) {
+    std::wcout<<L"Usage: "<<exeName<<L" <sourcePath> <targetPartitionPath> [--usedefault | <threads> <blockSizeMB>] [options]\n";
+    std::wcout<<L"       "<<exeName<<L" --jobs <jobFile> [--usedefault | <threads> <blockSizeMB>] [options]\n";
+    std::wcout<<L"       "<<exeName<<L" <backupPath> <targetPartitionPath> [--usedefault | <threads> <blockSizeMB>] --restore [--chunkstore <dir>] [options]\n";
+    std::wcout<<L"Options:\n";
+    std::wcout<<L"  --jobs <jobFile>    Run the copies listed in <jobFile>, one \"source|destination[|priority]\" per line, in place of <sourcePath> <targetPartitionPath>\n";
+    std::wcout<<L"  --filelevel         <sourcePath> is a directory of an NTFS snapshot and <targetPartitionPath> a directory: the files are enumerated from the MFT and copied, small ones in coalesced volume reads, large ones by the block engine\n";
+    std::wcout<<L"  --maxjobs <n>       With --jobs or --filelevel: copies (large files) running at the same time, they share the memory budget (default: "<<DEFAULT_MAX_JOBS<<L")\n";
+    std::wcout<<L"  --deviceslots <n>   With --jobs or --filelevel: copies that may use one disk at the same time (default: "<<DEFAULT_DEVICE_SLOTS<<L")\n";
+    std::wcout<<L"  --queuedepth <n>    Buffers (in-flight I/Os) per worker thread (default: "<<DEFAULT_QUEUE_DEPTH<<L")\n";
+    std::wcout<<L"  --engine <apc|iocp> I/O engine: APC completions per thread or a shared I/O completion port pool (default: apc)\n";
+    std::wcout<<L"  <targetPartitionPath> may be tcp://host:port, the blocks are then streamed to a FileBackupReceiver on that host (uses iocp)\n";
+    std::wcout<<L"  --connections <n>   Parallel TCP connections to a tcp:// destination (default: "<<DEFAULT_NETWORK_CONNECTIONS<<L")\n";
+    std::wcout<<L"  --secret <text>     Shared secret of the receiver of a tcp:// destination (default: the FILEBACKUP_STREAM_SECRET environment variable)\n";
+    std::wcout<<L"  --mirror <path>     Also write every block to <path>, the source is read once (repeatable, up to "<<FANOUT_MAX_DESTINATIONS<<L" destinations, uses iocp)\n";
+    std::wcout<<L"  --ordered           Write blocks strictly in offset order (SMR, USB bridges, appliances), reads run ahead by up to --queuedepth (default: "<<MAX_QUEUE_DEPTH<<L") per thread, uses iocp\n";
+    std::wcout<<L"  --scheduler <ranges|shared> Claim blocks from a contiguous range per worker with work stealing, or from one shared index (default: ranges)\n";
+    std::wcout<<L"  --usedonly          Copy only blocks holding in-use clusters of an NTFS source (free space is skipped)\n";
+    std::wcout<<L"  --incremental <idx> Skip writing blocks unchanged since the run that saved the digest index <idx>\n";
+    std::wcout<<L"  --zeroblocks <write|skip|unmap> All-zero blocks: write them, skip them (destination already zeroed) or TRIM the destination range (default: write)\n";
+    std::wcout<<L"  --journal <file>    Record completed blocks in <file> so an interrupted copy can be resumed (deleted on success)\n";
+    std::wcout<<L"  --resume            Continue the copy recorded by --journal, copying only the blocks it does not list as complete\n";
+    std::wcout<<L"  --fileimage         <targetPartitionPath> is a raw image file, created and allocated to the source size before copying\n";
+    std::wcout<<L"  --baseimage <file>  With --fileimage and --incremental: clone unchanged blocks from the previous image <file> (ReFS block cloning)\n";
+    std::wcout<<L"  --compress <fast|ratio> Write a compressed image file to <targetPartitionPath> instead of a raw copy: fast (XPRESS) or ratio (LZMS)\n";
+    std::wcout<<L"  --compressthreads <n> Compression threads for --compress (default: one per logical processor)\n";
+    std::wcout<<L"  --chunkstore <dir>  Deduplicate into the chunk store in <dir>, shared by every backup (and job) written to it: only chunks it does not hold yet are written, <targetPartitionPath> receives the backup's chunk manifest\n";
+    std::wcout<<L"  --restore           Restore the compressed image (or, with --chunkstore, the chunk manifest) <sourcePath> to <targetPartitionPath>: chunks are read and decompressed on a thread pool, zero ranges follow --zeroblocks and the hot ranges are restored first\n";
+    std::wcout<<L"  --hotranges <auto|off|offsetMB:lengthMB[,...]> With --restore: ranges restored before the rest so a VM can boot early, found in the partition tables and boot sectors, none, or the given ranges besides the found ones (default: auto)\n";
+    std::wcout<<L"  --chunksize <KB>    Chunk size of a chunk store --chunkstore creates, a power of two the block size is a multiple of (default: "<<DEFAULT_CHUNK_SIZE_KB<<L")\n";
+    std::wcout<<L"  --manifest <file>   Hash every block while copying (xxHash64, on a thread pool alongside the writes) and save the hashes and an image digest to <file>, uses iocp\n";
+    std::wcout<<L"  --verify            After copying, read the destination back and compare every block with the hash of its source block, uses iocp\n";
+    std::wcout<<L"  --hashthreads <n>   Hash threads for --manifest and --verify (default: one per logical processor)\n";
+    std::wcout<<L"  --metrics <file>    Write latency histograms, per worker counters and a per second throughput timeline as JSON\n";
+    std::wcout<<L"  --retries <n>       Reissue a failed read or write up to n times with exponential backoff while the rest of the copy continues, 0 fails at once (default: "<<FAULT_DEFAULT_RETRIES<<L")\n";
+    std::wcout<<L"  --retrydelay <ms>   Delay before the first reissue, doubled for every further one (default: "<<FAULT_DEFAULT_RETRY_DELAY_MS<<L")\n";
+    std::wcout<<L"  --errorbudget <n>   Source sectors that may stay unreadable after the retries, they are copied as zeros (default: 0, the copy fails)\n";
+    std::wcout<<L"  --badsectors <file> List the unreadable source ranges in <file> as offset,length,error lines\n";
+    std::wcout<<L"  --membudget <MB>    Memory all buffers together may use, lowers queue depth and then threads to fit (default: "<<DEFAULT_MEMORY_BUDGET_PERCENT<<L"% of physical memory)\n";
+    std::wcout<<L"  --maxmbps <n>       Limit reads to n MB/s with a token bucket, contexts wait for tokens instead of reading (uses iocp)\n";
+    std::wcout<<L"  --maxiops <n>       Limit reads to n per second, combines with --maxmbps (uses iocp)\n";
+    std::wcout<<L"  --iopriority <normal|low|verylow> I/O priority hint of the source and destination handles, low priority I/O yields to other I/O (default: normal)\n";
+    std::wcout<<L"  --numanode <auto|off|n> Run workers and allocate buffers on a NUMA node: the one of the source (or destination) disk, none, or node n (default: auto)\n";
+    std::wcout<<L"  --autotune          Tune in-flight I/Os and I/O size (up to "<<AUTOTUNE_MAX_BLOCKS_PER_IO<<L" blocks) while copying, --queuedepth becomes the upper bound (default: "<<AUTOTUNE_DEFAULT_QUEUE_DEPTH<<L"), uses iocp\n";
+    std::wcout<<L"Example 1 (defaults): "<<exeName<<L" \"\\\\?\\GLOBALROOT\\Device\\HarddiskVolumeShadowCopyX\" \"\\\\.\\PhysicalDriveX\" --usedefault\n";
+    std::wcout<<L"Example 2 (custom): "<<exeName<<L" \"\\\\?\\GLOBALROOT\\Device\\HarddiskVolumeShadowCopyX\" \"\\\\.\\PhysicalDriveX\" 10 4 --queuedepth 4\n";
+    std::wcout<<L"Example 3 (network): "<<exeName<<L" \"\\\\?\\GLOBALROOT\\Device\\HarddiskVolumeShadowCopyX\" tcp://backuphost:7447 8 4 --connections 8\n";
+}
 
 //Application entry point
 int wmain(int argc, wchar_t* argv[]) {
     // Parse commandline arguments
-    if (argc < 3 || argc > 5) { // Minimum 3 args (src, dst), Max 5 args (src, dst, threads, block_size) or 4 (src, dst, --usedefault)
-        std::wcout<<L"Usage: "<<argv[0]  <<L"<sourcePath> <targetPartitionPath>[--usedefault | <threads> <blockSizeMB>]\n";
-        std::wcout<<L"Example 1 (defaults): "<< argv[0] << L"\"\\\\?\\GLOBALROOT\\Device\\HarddiskVolumeShadowCopyX\" \"\\\\.\\PhysicalDriveX\" --usedefault\n";
-        std::wcout<<L"Example 2 (custom): "<< argv[0]<<L"\"\\\\?\\GLOBALROOT\\Device\\HarddiskVolumeShadowCopyX\" \"\\\\.\\PhysicalDriveX\" 10 4\n";
+    if (argc < 4) { // Minimum 4 args (exe, src, dst, --usedefault | threads blockSize), followed by optional flags
+        PrintUsage(argv[0]);
         return 1;
     }
 
+    // Job mode: --jobs <file> takes the place of the source and destination
+    bool jobMode = (std::wstring(argv[1]) == L"--jobs");
+    LPCWSTR jobFilePath = jobMode ? argv[2] : nullptr;
     LPCWSTR srcPath = argv[1];
     LPCWSTR dstPath = argv[2];
+    int maxJobs = DEFAULT_MAX_JOBS;
+    int deviceSlots = DEFAULT_DEVICE_SLOTS;
     int numThreads;
     int blockSizeMB;
+    int queueDepth = DEFAULT_QUEUE_DEPTH;
+    IOEngineType engineType = IOEngineType::APC;
+    bool usedBlocksOnly = false;
+    LPCWSTR digestIndexPath = nullptr;
+    ZeroBlockPolicy zeroBlockPolicy = ZeroBlockPolicy::WRITE;
+    LPCWSTR journalPath = nullptr;
+    ImageCompression imageCompression = ImageCompression::NONE;
+    int compressionThreads = 0;
+    LPCWSTR metricsPath = nullptr;
+    LPCWSTR chunkStorePath = nullptr;
+    DWORD chunkSizeKB = 0;
+    int retries = FAULT_DEFAULT_RETRIES;
+    DWORD retryDelayMs = FAULT_DEFAULT_RETRY_DELAY_MS;
+    LONGLONG errorBudget = 0;
+    LPCWSTR badSectorPath = nullptr;
+    LPCWSTR manifestPath = nullptr;
+    bool verify = false;
+    int hashThreads = 0;
+    bool resume = false;
+    bool fileImage = false;
+    LPCWSTR baseImagePath = nullptr;
+    bool autoTune = false;
+    LONGLONG memoryBudgetMB = 0;
+    int numaNode = NUMA_NODE_AUTO;
+    int networkConnections = DEFAULT_NETWORK_CONNECTIONS;
+    LPCWSTR networkSecret = nullptr;
+    LONGLONG maxMBps = 0;
+    LONGLONG maxIops = 0;
+    PRIORITY_HINT ioPriority = IoPriorityHintNormal;
+    bool sharedCursor = false;
+    bool orderedWrites = false;
+    bool fileLevel = false;
+    bool restore = false;
+    std::vector<DiskExtent> hotRanges;
+    bool detectHotRanges = true;
+    bool hotRangesGiven = false;
+    std::vector<std::wstring> destPaths{ dstPath };
+    bool queueDepthGiven = false;
+    int argIndex = 3;
 
     // Check for --usedefault flag
-    if (argc == 4 && std::wstring(argv[3]) == L"--usedefault") {
+    if (std::wstring(argv[3]) == L"--usedefault") {
         numThreads = DEFAULT_MAX_OUTSTANDING_IO;
         blockSizeMB = DEFAULT_BLOCK_SIZE_MB;
+        argIndex = 4;
         std::wcout<<L"Using default parameters: Threads = "<<numThreads<<L", Block Size = "<<blockSizeMB<<L" MB.\n\n";
     }
     // Check if custom threads and block size are provided
-    else if (argc == 5) {
+    else if (argc >= 5 && argv[3][0] != L'-' && argv[4][0] != L'-') {
         numThreads = _wtoi(argv[3]);
         blockSizeMB = _wtoi(argv[4]);
+        argIndex = 5;
 
         // Basic validation for custom values
-        if (numThreads <= 0 || blockSizeMB <= 0) {
-            std::wcout<<L"Invalid threads ("<<numThreads<<L") or block size("<<blockSizeMB<<L" MB).Must be positive integers.\n\n";
+        if (numThreads <= 0 || blockSizeMB <= 0 || blockSizeMB > MAX_BLOCK_SIZE_MB) {
+            std::wcout<<L"Invalid threads ("<<numThreads<<L") or block size("<<blockSizeMB<<L" MB).Must be positive integers, with at most "<<MAX_BLOCK_SIZE_MB<<L" MB blocks.\n\n";
             return 1;
         }
         std::wcout<<L"Using custom parameters: Threads = "<<numThreads<<L", Block Size = "<<blockSizeMB<<L" MB.\n\n";
     }
     else {
-        std::wcout<<L"Invalid argument combination. Usage: "<< argv[0]<<L" <sourcePath> <targetPartitionPath>[--usedefault | <threads> <blockSizeMB>]\n\n";
+        std::wcout<<L"Invalid argument combination.\n";
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // Optional flags
+    for (; argIndex < argc; ++argIndex) {
+        std::wstring arg = argv[argIndex];
+        if (arg == L"--queuedepth" && argIndex + 1 < argc) {
+            queueDepth = _wtoi(argv[++argIndex]);
+            queueDepthGiven = true;
+            if (queueDepth <= 0) {
+                std::wcout<<L"Invalid queue depth ("<<queueDepth<<L"). Must be a positive integer.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Using queue depth per thread = "<<queueDepth<<L".\n\n";
+        }
+        else if (arg == L"--maxjobs" && argIndex + 1 < argc) {
+            maxJobs = _wtoi(argv[++argIndex]);
+            if (maxJobs <= 0) {
+                std::wcout<<L"Invalid job count ("<<maxJobs<<L"). Must be a positive integer.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Running up to "<<maxJobs<<L" jobs at a time.\n\n";
+        }
+        else if (arg == L"--deviceslots" && argIndex + 1 < argc) {
+            deviceSlots = _wtoi(argv[++argIndex]);
+            if (deviceSlots <= 0) {
+                std::wcout<<L"Invalid device slot count ("<<deviceSlots<<L"). Must be a positive integer.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Running up to "<<deviceSlots<<L" jobs per disk at a time.\n\n";
+        }
+        else if (arg == L"--connections" && argIndex + 1 < argc) {
+            networkConnections = _wtoi(argv[++argIndex]);
+            if (networkConnections <= 0) {
+                std::wcout<<L"Invalid connection count ("<<networkConnections<<L"). Must be a positive integer.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Using "<<networkConnections<<L" connections to a network destination.\n\n";
+        }
+        else if (arg == L"--secret" && argIndex + 1 < argc) {
+            networkSecret = argv[++argIndex];
+        }
+        else if (arg == L"--mirror" && argIndex + 1 < argc) {
+            destPaths.push_back(argv[++argIndex]);
+            std::wcout<<L"Also writing to destination: "<<destPaths.back()<<L"\n\n";
+        }
+        else if (arg == L"--filelevel") {
+            fileLevel = true;
+            std::wcout<<L"Copying the files of the source directory.\n\n";
+        }
+        else if (arg == L"--restore") {
+            restore = true;
+            std::wcout<<L"Restoring the backup at the source path to the target.\n\n";
+        }
+        else if (arg == L"--hotranges" && argIndex + 1 < argc) {
+            std::wstring ranges = argv[++argIndex];
+            hotRangesGiven = true;
+            if (ranges == L"off") {
+                detectHotRanges = false;
+            }
+            else if (ranges != L"auto") {
+                // offsetMB:lengthMB pairs separated by commas
+                size_t pos = 0;
+                while (pos <= ranges.size()) {
+                    size_t end = ranges.find(L',', pos);
+                    std::wstring range = ranges.substr(pos, (end == std::wstring::npos) ? std::wstring::npos : end - pos);
+                    size_t colon = range.find(L':');
+                    LONGLONG offsetMB = (colon == std::wstring::npos) ? -1 : _wtoi64(range.substr(0, colon).c_str());
+                    LONGLONG lengthMB = (colon == std::wstring::npos) ? 0 : _wtoi64(range.substr(colon + 1).c_str());
+                    if (offsetMB < 0 || lengthMB <= 0 || range.find_first_not_of(L"0123456789:") != std::wstring::npos) {
+                        std::wcout<<L"Invalid hot range ("<<range<<L"). Must be auto, off or offsetMB:lengthMB pairs separated by commas.\n\n";
+                        return 1;
+                    }
+                    hotRanges.push_back(DiskExtent{ offsetMB * 1024 * 1024, lengthMB * 1024 * 1024 });
+                    if (end == std::wstring::npos) {
+                        break;
+                    }
+                    pos = end + 1;
+                }
+            }
+            std::wcout<<L"Using hot ranges = "<<ranges<<L".\n\n";
+        }
+        else if (arg == L"--ordered") {
+            orderedWrites = true;
+            std::wcout<<L"Writing blocks in offset order.\n\n";
+        }
+        else if (arg == L"--scheduler" && argIndex + 1 < argc) {
+            std::wstring scheduler = argv[++argIndex];
+            if (scheduler == L"ranges") {
+                sharedCursor = false;
+            }
+            else if (scheduler == L"shared") {
+                sharedCursor = true;
+            }
+            else {
+                std::wcout<<L"Invalid scheduler ("<<scheduler<<L"). Must be ranges or shared.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Using block scheduler = "<<scheduler<<L".\n\n";
+        }
+        else if (arg == L"--usedonly") {
+            usedBlocksOnly = true;
+            std::wcout<<L"Copying only in-use clusters of the source volume.\n\n";
+        }
+        else if (arg == L"--incremental" && argIndex + 1 < argc) {
+            digestIndexPath = argv[++argIndex];
+            std::wcout<<L"Incremental copy using digest index: "<<digestIndexPath<<L"\n\n";
+        }
+        else if (arg == L"--journal" && argIndex + 1 < argc) {
+            journalPath = argv[++argIndex];
+            std::wcout<<L"Recording completed blocks in journal: "<<journalPath<<L"\n\n";
+        }
+        else if (arg == L"--compress" && argIndex + 1 < argc) {
+            std::wstring level = argv[++argIndex];
+            if (level == L"fast") {
+                imageCompression = ImageCompression::FAST;
+            }
+            else if (level == L"ratio") {
+                imageCompression = ImageCompression::RATIO;
+            }
+            else {
+                std::wcout<<L"Invalid compression ("<<level<<L"). Must be fast or ratio.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Writing a compressed image, compression = "<<level<<L".\n\n";
+        }
+        else if (arg == L"--compressthreads" && argIndex + 1 < argc) {
+            compressionThreads = _wtoi(argv[++argIndex]);
+            if (compressionThreads <= 0) {
+                std::wcout<<L"Invalid compression thread count ("<<compressionThreads<<L"). Must be a positive integer.\n\n";
+                return 1;
+            }
+        }
+        else if (arg == L"--chunkstore" && argIndex + 1 < argc) {
+            chunkStorePath = argv[++argIndex];
+            std::wcout<<L"Deduplicating into the chunk store: "<<chunkStorePath<<L"\n\n";
+        }
+        else if (arg == L"--chunksize" && argIndex + 1 < argc) {
+            int chunkSize = _wtoi(argv[++argIndex]);
+            if (chunkSize < MIN_CHUNK_SIZE_KB || chunkSize > MAX_CHUNK_SIZE_KB || (chunkSize & (chunkSize - 1)) != 0) {
+                std::wcout<<L"Invalid chunk size ("<<chunkSize<<L" KB). Must be a power of two between "<<MIN_CHUNK_SIZE_KB<<L" and "<<MAX_CHUNK_SIZE_KB<<L".\n\n";
+                return 1;
+            }
+            chunkSizeKB = static_cast<DWORD>(chunkSize);
+            std::wcout<<L"Using chunk size = "<<chunkSizeKB<<L" KB for a new chunk store.\n\n";
+        }
+        else if (arg == L"--metrics" && argIndex + 1 < argc) {
+            metricsPath = argv[++argIndex];
+            std::wcout<<L"Writing copy metrics to: "<<metricsPath<<L"\n\n";
+        }
+        else if (arg == L"--retries" && argIndex + 1 < argc) {
+            retries = _wtoi(argv[++argIndex]);
+            if (retries < 0) {
+                std::wcout<<L"Invalid retry count ("<<retries<<L"). Must be 0 or a positive integer.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Reissuing failed reads and writes up to "<<retries<<L" times.\n\n";
+        }
+        else if (arg == L"--retrydelay" && argIndex + 1 < argc) {
+            int delay = _wtoi(argv[++argIndex]);
+            if (delay <= 0 || delay > FAULT_MAX_RETRY_DELAY_MS) {
+                std::wcout<<L"Invalid retry delay ("<<delay<<L"). Must be between 1 and "<<FAULT_MAX_RETRY_DELAY_MS<<L" ms.\n\n";
+                return 1;
+            }
+            retryDelayMs = static_cast<DWORD>(delay);
+            std::wcout<<L"Waiting "<<retryDelayMs<<L" ms before the first reissue.\n\n";
+        }
+        else if (arg == L"--errorbudget" && argIndex + 1 < argc) {
+            errorBudget = _wtoi64(argv[++argIndex]);
+            if (errorBudget < 0) {
+                std::wcout<<L"Invalid error budget ("<<errorBudget<<L"). Must be 0 or a positive integer.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Tolerating up to "<<errorBudget<<L" unreadable source sectors.\n\n";
+        }
+        else if (arg == L"--badsectors" && argIndex + 1 < argc) {
+            badSectorPath = argv[++argIndex];
+            std::wcout<<L"Listing unreadable source ranges in: "<<badSectorPath<<L"\n\n";
+        }
+        else if (arg == L"--manifest" && argIndex + 1 < argc) {
+            manifestPath = argv[++argIndex];
+            std::wcout<<L"Writing block hashes to manifest: "<<manifestPath<<L"\n\n";
+        }
+        else if (arg == L"--verify") {
+            verify = true;
+            std::wcout<<L"Verifying the destination after copying.\n\n";
+        }
+        else if (arg == L"--hashthreads" && argIndex + 1 < argc) {
+            hashThreads = _wtoi(argv[++argIndex]);
+            if (hashThreads <= 0) {
+                std::wcout<<L"Invalid hash thread count ("<<hashThreads<<L"). Must be a positive integer.\n\n";
+                return 1;
+            }
+        }
+        else if (arg == L"--resume") {
+            resume = true;
+        }
+        else if (arg == L"--fileimage") {
+            fileImage = true;
+            std::wcout<<L"Writing a raw image file.\n\n";
+        }
+        else if (arg == L"--baseimage" && argIndex + 1 < argc) {
+            baseImagePath = argv[++argIndex];
+            std::wcout<<L"Cloning unchanged blocks from the previous image: "<<baseImagePath<<L"\n\n";
+        }
+        else if (arg == L"--membudget" && argIndex + 1 < argc) {
+            memoryBudgetMB = _wtoi64(argv[++argIndex]);
+            if (memoryBudgetMB <= 0) {
+                std::wcout<<L"Invalid memory budget ("<<memoryBudgetMB<<L" MB). Must be a positive integer.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Using memory budget = "<<memoryBudgetMB<<L" MB.\n\n";
+        }
+        else if ((arg == L"--maxmbps" || arg == L"--maxiops") && argIndex + 1 < argc) {
+            LONGLONG limit = _wtoi64(argv[++argIndex]);
+            LONGLONG maxLimit = (arg == L"--maxmbps") ? THROTTLE_MAX_MBPS : THROTTLE_MAX_IOPS;
+            if (limit <= 0 || limit > maxLimit) {
+                std::wcout<<L"Invalid limit ("<<limit<<L") for "<<arg<<L". Must be a positive integer up to "<<maxLimit<<L".\n\n";
+                return 1;
+            }
+            if (arg == L"--maxmbps") {
+                maxMBps = limit;
+                std::wcout<<L"Limiting reads to "<<maxMBps<<L" MB/s.\n\n";
+            }
+            else {
+                maxIops = limit;
+                std::wcout<<L"Limiting reads to "<<maxIops<<L" IOPS.\n\n";
+            }
+        }
+        else if (arg == L"--iopriority" && argIndex + 1 < argc) {
+            std::wstring priority = argv[++argIndex];
+            if (priority == L"normal") {
+                ioPriority = IoPriorityHintNormal;
+            }
+            else if (priority == L"low") {
+                ioPriority = IoPriorityHintLow;
+            }
+            else if (priority == L"verylow") {
+                ioPriority = IoPriorityHintVeryLow;
+            }
+            else {
+                std::wcout<<L"Invalid I/O priority ("<<priority<<L"). Must be normal, low or verylow.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Using I/O priority = "<<priority<<L".\n\n";
+        }
+        else if (arg == L"--numanode" && argIndex + 1 < argc) {
+            std::wstring node = argv[++argIndex];
+            if (node == L"auto") {
+                numaNode = NUMA_NODE_AUTO;
+            }
+            else if (node == L"off") {
+                numaNode = NUMA_NODE_NONE;
+            }
+            else {
+                numaNode = _wtoi(node.c_str());
+                if (numaNode < 0 || node.find_first_not_of(L"0123456789") != std::wstring::npos) {
+                    std::wcout<<L"Invalid NUMA node ("<<node<<L"). Must be auto, off or a node number.\n\n";
+                    return 1;
+                }
+            }
+            std::wcout<<L"Using NUMA node = "<<node<<L".\n\n";
+        }
+        else if (arg == L"--autotune") {
+            autoTune = true;
+            std::wcout<<L"Auto tuning queue depth and I/O size while copying.\n\n";
+        }
+        else if (arg == L"--zeroblocks" && argIndex + 1 < argc) {
+            std::wstring policy = argv[++argIndex];
+            if (policy == L"write") {
+                zeroBlockPolicy = ZeroBlockPolicy::WRITE;
+            }
+            else if (policy == L"skip") {
+                zeroBlockPolicy = ZeroBlockPolicy::SKIP;
+            }
+            else if (policy == L"unmap") {
+                zeroBlockPolicy = ZeroBlockPolicy::UNMAP;
+            }
+            else {
+                std::wcout<<L"Invalid zero block policy ("<<policy<<L"). Must be write, skip or unmap.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Using zero block policy = "<<policy<<L".\n\n";
+        }
+        else if (arg == L"--engine" && argIndex + 1 < argc) {
+            std::wstring engine = argv[++argIndex];
+            if (engine == L"apc") {
+                engineType = IOEngineType::APC;
+            }
+            else if (engine == L"iocp") {
+                engineType = IOEngineType::IOCP;
+            }
+            else {
+                std::wcout<<L"Invalid engine ("<<engine<<L"). Must be apc or iocp.\n\n";
+                return 1;
+            }
+            std::wcout<<L"Using I/O engine = "<<engine<<L".\n\n";
+        }
+        else {
+            std::wcout<<L"Unknown or incomplete option: "<<arg<<L"\n";
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (resume && journalPath == nullptr) {
+        std::wcout<<L"--resume requires --journal <file>.\n\n";
+        return 1;
+    }
+    if (baseImagePath != nullptr && !fileImage) {
+        std::wcout<<L"--baseimage requires --fileimage.\n\n";
+        return 1;
+    }
+    if (retries == 0 && (errorBudget > 0 || badSectorPath != nullptr)) {
+        std::wcout<<L"--errorbudget and --badsectors require --retries above 0.\n\n";
         return 1;
     }
+    if (chunkSizeKB != 0 && chunkStorePath == nullptr) {
+        std::wcout<<L"--chunksize requires --chunkstore.\n\n";
+        return 1;
+    }
+    // Per copy files would be shared by every job
+    if (jobMode && (destPaths.size() > 1 || journalPath != nullptr || digestIndexPath != nullptr || metricsPath != nullptr || manifestPath != nullptr || baseImagePath != nullptr ||
+        badSectorPath != nullptr)) {
+        std::wcout<<L"--mirror, --journal, --incremental, --metrics, --manifest, --baseimage and --badsectors cannot be used with --jobs.\n\n";
+        return 1;
+    }
+
+    // A file-level copy writes a directory tree, block level destinations and per copy files do not apply to it
+    if (fileLevel && (jobMode || destPaths.size() > 1 || journalPath != nullptr || digestIndexPath != nullptr || metricsPath != nullptr || manifestPath != nullptr ||
+        verify || baseImagePath != nullptr || fileImage || usedBlocksOnly || imageCompression != ImageCompression::NONE || badSectorPath != nullptr || chunkStorePath != nullptr || std::wstring(dstPath).compare(0, 6, L"tcp://") == 0)) {
+        std::wcout<<L"--filelevel cannot be used with --jobs, --mirror, --journal, --incremental, --metrics, --manifest, --verify, --fileimage, --baseimage, --usedonly, --compress, --badsectors, --chunkstore or a tcp:// destination.\n\n";
+        return 1;
+    }
+
+    if (hotRangesGiven && !restore) {
+        std::wcout<<L"--hotranges requires --restore.\n\n";
+        return 1;
+    }
+    // A restore reads a backup through its own engine, copy options and other modes do not apply to it
+    if (restore && (jobMode || fileLevel || destPaths.size() > 1 || journalPath != nullptr || digestIndexPath != nullptr || manifestPath != nullptr || verify ||
+        fileImage || baseImagePath != nullptr || usedBlocksOnly || imageCompression != ImageCompression::NONE || orderedWrites || chunkSizeKB != 0 ||
+        std::wstring(dstPath).compare(0, 6, L"tcp://") == 0)) {
+        std::wcout<<L"--restore cannot be used with --jobs, --filelevel, --mirror, --journal, --incremental, --manifest, --verify, --fileimage, --baseimage, --usedonly, --compress, --ordered, --chunksize or a tcp:// destination.\n\n";
+        return 1;
+    }
+
+    // The tuner searches up to the queue depth, give it room unless one was asked for
+    if (autoTune && !queueDepthGiven) {
+        queueDepth = AUTOTUNE_DEFAULT_QUEUE_DEPTH;
+    }
+    // Ordered writes read ahead by every context, the memory budget then decides how many there are
+    if (orderedWrites && !queueDepthGiven) {
+        queueDepth = MAX_QUEUE_DEPTH;
+    }
 
     std::wcout << "Make Sure if the provided Source Path has a valid snapshot!\n\n";
     std::wcout << "[Critical] Make sure if the provided target drive is an empty drive or else it might corrupt the provided drive.\n\n";
@@ -52,13 +503,103 @@ int wmain(int argc, wchar_t* argv[]) {
     //Configure Logger
     LogUtils& logger = LogUtils::GetInstance();
     logger.Initialize();
+    CopyTrace::Register(); // Events cost nothing until an ETW session enables the provider
 
     LOG_DEBUG(L"Inside Main\n");
+    // Opened once, so every copy of a job list deduplicates against the others as well
+    ChunkStore chunkStore;
+    if (chunkStorePath != nullptr && !chunkStore.Open(chunkStorePath, chunkSizeKB * 1024)) {
+        LOG_ERROR(L"Main: Failed to open the chunk store %s.\n", chunkStorePath);
+        CopyTrace::Unregister();
+        logger.DeInitialize();
+        return 1;
+    }
+    if (restore) {
+        ImageRestorer restorer;
+        restorer.setZeroBlockPolicy(zeroBlockPolicy);
+        if (chunkStorePath != nullptr) {
+            restorer.setChunkStore(&chunkStore);
+        }
+        restorer.setHotRanges(hotRanges, detectHotRanges);
+        bool succeeded = restorer.Initialize(srcPath, dstPath, numThreads, blockSizeMB, queueDepth) && restorer.Restore();
+        if (!succeeded) {
+            LOG_ERROR(L"Main: Restore of %s failed.\n", srcPath);
+        }
+        LOG_DEBUG(L"End of Main\n");
+        CopyTrace::Unregister();
+        logger.DeInitialize();
+        return succeeded ? 0 : 1;
+    }
+
+    // Options of every copy, single or one of a job list
+    auto configure = [&](BlockCopier& copier) {
+        copier.setEngineType(engineType);
+        copier.setUsedBlocksOnly(usedBlocksOnly);
+        copier.setDigestIndexPath(digestIndexPath);
+        copier.setZeroBlockPolicy(zeroBlockPolicy);
+        copier.setJournalPath(journalPath, resume);
+        copier.setImageCompression(imageCompression, compressionThreads);
+        copier.setMetricsPath(metricsPath);
+        copier.setBlockHashing(manifestPath, verify, hashThreads);
+        copier.setAutoTune(autoTune);
+        copier.setMemoryBudget(memoryBudgetMB);
+        copier.setNumaNode(numaNode);
+        copier.setIoPriority(ioPriority);
+        copier.setNetworkConnections(networkConnections);
+        copier.setNetworkSecret(NetworkTarget::LoadSecret(networkSecret));
+        copier.setFileImage(fileImage, baseImagePath);
+        if (maxMBps > 0 || maxIops > 0) {
+            copier.setThrottle(maxMBps, maxIops);
+        }
+        copier.setSharedCursor(sharedCursor);
+        copier.setOrderedWrites(orderedWrites);
+        copier.setFaultHandling(retries, retryDelayMs, errorBudget, badSectorPath);
+        if (chunkStorePath != nullptr) {
+            copier.setChunkStore(&chunkStore);
+        }
+    };
+
+    if (jobMode) {
+        JobScheduler scheduler;
+        scheduler.setMaxJobs(maxJobs);
+        scheduler.setDeviceSlots(deviceSlots);
+        if (!scheduler.LoadJobs(jobFilePath)) {
+            LOG_ERROR(L"Main: Failed to load job list %s.\n", jobFilePath);
+            CopyTrace::Unregister();
+            logger.DeInitialize();
+            return 1;
+        }
+        bool allSucceeded = scheduler.Run(numThreads, blockSizeMB, queueDepth, memoryBudgetMB, configure);
+        if (!allSucceeded) {
+            LOG_ERROR(L"Main: One or more jobs failed.\n");
+        }
+        LOG_DEBUG(L"End of Main\n");
+        CopyTrace::Unregister();
+        logger.DeInitialize();
+        return allSucceeded ? 0 : 1;
+    }
+
+    if (fileLevel) {
+        FileTreeCopier treeCopier;
+        treeCopier.setMaxJobs(maxJobs);
+        treeCopier.setDeviceSlots(deviceSlots);
+        bool succeeded = treeCopier.Run(srcPath, dstPath, numThreads, blockSizeMB, queueDepth, memoryBudgetMB, configure);
+        if (!succeeded) {
+            LOG_ERROR(L"Main: File-level copy of %s failed.\n", srcPath);
+        }
+        LOG_DEBUG(L"End of Main\n");
+        CopyTrace::Unregister();
+        logger.DeInitialize();
+        return succeeded ? 0 : 1;
+    }
+
     BlockCopier copier;
+    configure(copier);
 
     // Initialize the copier with paths and parameters
-    if (!copier.Initialize(srcPath, dstPath, numThreads, blockSizeMB)) {
+    if (!copier.Initialize(srcPath, destPaths, numThreads, blockSizeMB, queueDepth)) {
         LOG_ERROR(L"Failed to initialize BlockCopier.\n");
+        CopyTrace::Unregister();
         logger.DeInitialize();
         return 1; // Initialization failed
     }
@@ -70,6 +611,7 @@ int wmain(int argc, wchar_t* argv[]) {
     // Start the copying process
     if (!copier.StartCopy()) {
         LOG_ERROR(L"Main : StartCopy method failed with error code: %d\n",GetLastError());
+        CopyTrace::Unregister();
         logger.DeInitialize();
         return 1; 
     }
@@ -78,6 +620,7 @@ int wmain(int argc, wchar_t* argv[]) {
         LOG_DEBUG(L"Main: StartCopyMethod Succeeded.\n");
     }
     LOG_DEBUG(L"End of Main\n");
+    CopyTrace::Unregister();
     logger.DeInitialize();
     return 0; 
 }
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+#include <windows.h>
+#include <winioctl.h>
+#include <string>
+#include <LogUtils.h>
+
+#define BENCH_FILL_CHUNK_BYTES (4 * 1024 * 1024) // Write size used while filling synthetic files
+
+// Kind of source a benchmark case copies from
+enum class BenchSourceType {
+    SPARSE = 0, // Sparse file of the requested size, reads return zeros without touching the media
+    DATA,       // File filled with pseudo random content, put --workdir on a ramdisk for a RAM backed source
+    PATH        // Existing file, volume or device
+};
+
+struct BenchSourceSpec {
+    BenchSourceType type;
+    LONGLONG sizeMB;        // SPARSE and DATA only
+    std::wstring path;      // PATH only, otherwise filled in by Prepare
+    std::wstring name;      // Label used in reports
+};
+
+// Creates and removes the synthetic files the benchmark copies from and to
+class BenchFiles {
+public:
+    // Parses sparse:<MB>, data:<MB> or path:<file>
+    static bool ParseSourceSpec(const std::wstring& spec, BenchSourceSpec& source);
+
+    // Creates the synthetic source in workDir (no-op for PATH) and fills in source.path
+    static bool PrepareSource(BenchSourceSpec& source, const std::wstring& workDir);
+
+    // Size of a file, volume or device, 0 if it cannot be queried
+    static LONGLONG QuerySize(LPCWSTR path);
+
+    static bool CreateSparseFile(LPCWSTR path, LONGLONG size);
+    static bool CreateDataFile(LPCWSTR path, LONGLONG size);
+
+    // Destination file of at least size bytes. It is written once front to back so that the copies measured
+    // later do not pay for NTFS zero filling beyond the valid data length.
+    static bool CreateDestinationFile(LPCWSTR path, LONGLONG size);
+
+    static void Remove(LPCWSTR path);
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <BlockCopier.h>
+#include <MicroBench.h>
+#include <LogUtils.h>
+
+// One point of the parameter matrix
+struct BenchCase {
+    std::wstring sourceName;
+    std::wstring sourcePath;
+    std::wstring destPath;
+    IOEngineType engineType;
+    int threads;
+    int blockSizeMB;
+    int queueDepth;
+};
+
+// Measured result of one run of a case
+struct BenchResult {
+    BenchCase benchCase;
+    int repetition;             // 0 based, warm-up runs are not reported
+    bool succeeded;
+    double seconds;             // StartCopy wall time
+    LONGLONG bytes;             // Source bytes copied
+    double mbPerSec;
+    double iops;                // Reads and writes completed per second
+    ULONGLONG readP50Us;
+    ULONGLONG readP99Us;
+    ULONGLONG writeP50Us;
+    ULONGLONG writeP99Us;
+    double cpuSecondsPerGB;     // User + kernel time of the process per GiB copied
+    std::wstring bottleneck;
+};
+
+// Runs the BlockCopier engine over a matrix of cases and reports per run results
+class BenchRunner {
+private:
+    std::vector<BenchResult> m_results;
+
+    static double GetProcessCpuSeconds();
+
+public:
+    BenchRunner() {}
+
+    //Getters
+    const std::vector<BenchResult>& getResults() const;
+
+    // Runs warmup unreported and then repeat reported copies of the case
+    bool RunCase(const BenchCase& benchCase, int warmup, int repeat);
+
+    // One copy through a fresh BlockCopier
+    static bool RunOnce(const BenchCase& benchCase, BenchResult& result);
+
+    bool WriteCsv(LPCWSTR path) const;
+    bool WriteJson(LPCWSTR path, const std::vector<MicroResult>& microResults) const; // Matrix runs and micro benchmarks
+    void PrintTable() const;
+
+    static const wchar_t* GetEngineName(IOEngineType engineType);
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <BlockCopier.h>
+#include <LogUtils.h>
+
+#define MICRO_CLAIM_BLOCK_SIZE 4096             // Small reads so the issue path, not the transfer, dominates
+#define MICRO_CLAIM_FILE_MB 64                  // Cached file the claim benchmark reads from
+#define MICRO_CLAIM_EXTENT_REPEAT 256           // Schedule lists the file this many times, so it never runs out
+
+// Cost of one operation of a micro benchmark
+struct MicroResult {
+    std::wstring name;
+    int threads;
+    LONGLONG operations;
+    double nsPerOp;
+};
+
+// Micro benchmarks of the engine's hot paths, run through IOUtils on a default constructed BlockCopier
+class MicroBench {
+private:
+    std::vector<MicroResult> m_results;
+
+    void AddResult(const std::wstring& name, int threads, LONGLONG operations, LONGLONG ticks);
+
+public:
+    MicroBench() {}
+
+    //Getters
+    const std::vector<MicroResult>& getResults() const;
+
+    // IOUtils::IssueRead claim and issue path, each thread reading 4 KB blocks of a cached file through its
+    // own completion port while all of them claim from one schedule, through per thread ranges or one shared index
+    bool RunIssueRead(const std::wstring& workDir, int threads, LONGLONG iterationsPerThread, bool useRanges);
+
+    // IOUtils::OnReadCompletion for an all-zero block with the skip policy (the zero scan and bookkeeping, no write)
+    bool RunZeroReadCompletion(DWORD blockSize, LONGLONG iterations);
+
+    // IOUtils::OnWriteCompletion bookkeeping, each thread completing its own context
+    bool RunWriteCompletion(int threads, LONGLONG iterationsPerThread);
+
+    void Print() const;
+};
@@ -0,0 +1,158 @@
+#include "BenchFiles.h"
+#include <vector>
+
+bool BenchFiles::ParseSourceSpec(const std::wstring& spec, BenchSourceSpec& source)
+{
+    size_t colon = spec.find(L':');
+    if (colon == std::wstring::npos || colon + 1 >= spec.size()) {
+        return false;
+    }
+    std::wstring kind = spec.substr(0, colon);
+    std::wstring value = spec.substr(colon + 1);
+    source.sizeMB = 0;
+    source.path.clear();
+    source.name = spec;
+    if (kind == L"path") {
+        source.type = BenchSourceType::PATH;
+        source.path = value;
+        return true;
+    }
+    if (kind == L"sparse") {
+        source.type = BenchSourceType::SPARSE;
+    }
+    else if (kind == L"data") {
+        source.type = BenchSourceType::DATA;
+    }
+    else {
+        return false;
+    }
+    source.sizeMB = _wtoi64(value.c_str());
+    return source.sizeMB > 0;
+}
+
+bool BenchFiles::PrepareSource(BenchSourceSpec& source, const std::wstring& workDir)
+{
+    LOG_DEBUG(L"Inside BenchFiles::PrepareSource\n");
+    if (source.type == BenchSourceType::PATH) {
+        LOG_DEBUG(L"End of BenchFiles::PrepareSource\n");
+        return true;
+    }
+    LONGLONG size = source.sizeMB * 1024 * 1024;
+    if (source.type == BenchSourceType::SPARSE) {
+        source.path = workDir + L"\\bench_sparse_" + std::to_wstring(source.sizeMB) + L"MB.bin";
+        LOG_DEBUG(L"End of BenchFiles::PrepareSource\n");
+        return CreateSparseFile(source.path.c_str(), size);
+    }
+    source.path = workDir + L"\\bench_data_" + std::to_wstring(source.sizeMB) + L"MB.bin";
+    LOG_DEBUG(L"End of BenchFiles::PrepareSource\n");
+    return CreateDataFile(source.path.c_str(), size);
+}
+
+LONGLONG BenchFiles::QuerySize(LPCWSTR path)
+{
+    HANDLE handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"BenchFiles::QuerySize: Failed to open %s with error: %d\n", path, GetLastError());
+        return 0;
+    }
+    LONGLONG size = 0;
+    GET_LENGTH_INFORMATION lengthInfo;
+    DWORD bytesReturned = 0;
+    LARGE_INTEGER fileSize;
+    if (DeviceIoControl(handle, IOCTL_DISK_GET_LENGTH_INFO, nullptr, 0, &lengthInfo, sizeof(lengthInfo), &bytesReturned, nullptr)) {
+        size = lengthInfo.Length.QuadPart;
+    }
+    else if (GetFileSizeEx(handle, &fileSize)) {
+        size = fileSize.QuadPart;
+    }
+    CloseHandle(handle);
+    return size;
+}
+
+bool BenchFiles::CreateSparseFile(LPCWSTR path, LONGLONG size)
+{
+    LOG_DEBUG(L"Inside BenchFiles::CreateSparseFile\n");
+    HANDLE handle = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"BenchFiles::CreateSparseFile: Failed to create %s with error: %d\n", path, GetLastError());
+        return false;
+    }
+    DWORD bytesReturned = 0;
+    LARGE_INTEGER end;
+    end.QuadPart = size;
+    bool ok = DeviceIoControl(handle, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytesReturned, nullptr) &&
+        SetFilePointerEx(handle, end, nullptr, FILE_BEGIN) && SetEndOfFile(handle);
+    if (!ok) {
+        LOG_ERROR(L"BenchFiles::CreateSparseFile: Failed to size sparse file %s with error: %d\n", path, GetLastError());
+    }
+    CloseHandle(handle);
+    LOG_DEBUG(L"End of BenchFiles::CreateSparseFile\n");
+    return ok;
+}
+
+bool BenchFiles::CreateDataFile(LPCWSTR path, LONGLONG size)
+{
+    LOG_DEBUG(L"Inside BenchFiles::CreateDataFile\n");
+    HANDLE handle = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"BenchFiles::CreateDataFile: Failed to create %s with error: %d\n", path, GetLastError());
+        return false;
+    }
+
+    // xorshift64, incompressible and never all zero, so no block takes a shortcut through the engine
+    std::vector<ULONGLONG> chunk(BENCH_FILL_CHUNK_BYTES / sizeof(ULONGLONG));
+    ULONGLONG state = 0x9E3779B97F4A7C15ULL;
+    bool ok = true;
+    for (LONGLONG written = 0; ok && written < size; ) {
+        for (ULONGLONG& word : chunk) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            word = state;
+        }
+        DWORD toWrite = static_cast<DWORD>((size - written) < BENCH_FILL_CHUNK_BYTES ? (size - written) : BENCH_FILL_CHUNK_BYTES);
+        DWORD bytesWritten = 0;
+        ok = WriteFile(handle, chunk.data(), toWrite, &bytesWritten, nullptr) && bytesWritten == toWrite;
+        written += toWrite;
+    }
+    if (!ok) {
+        LOG_ERROR(L"BenchFiles::CreateDataFile: Failed to fill %s with error: %d\n", path, GetLastError());
+    }
+    CloseHandle(handle);
+    LOG_DEBUG(L"End of BenchFiles::CreateDataFile\n");
+    return ok;
+}
+
+bool BenchFiles::CreateDestinationFile(LPCWSTR path, LONGLONG size)
+{
+    LOG_DEBUG(L"Inside BenchFiles::CreateDestinationFile\n");
+    if (QuerySize(path) >= size) { // Reuse the one a previous case already filled
+        LOG_DEBUG(L"End of BenchFiles::CreateDestinationFile\n");
+        return true;
+    }
+    HANDLE handle = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"BenchFiles::CreateDestinationFile: Failed to create %s with error: %d\n", path, GetLastError());
+        return false;
+    }
+    std::vector<char> chunk(BENCH_FILL_CHUNK_BYTES, 0);
+    bool ok = true;
+    for (LONGLONG written = 0; ok && written < size; written += BENCH_FILL_CHUNK_BYTES) {
+        DWORD bytesWritten = 0;
+        ok = WriteFile(handle, chunk.data(), BENCH_FILL_CHUNK_BYTES, &bytesWritten, nullptr) && bytesWritten == BENCH_FILL_CHUNK_BYTES;
+    }
+    if (!ok || !FlushFileBuffers(handle)) {
+        LOG_ERROR(L"BenchFiles::CreateDestinationFile: Failed to fill %s with error: %d\n", path, GetLastError());
+        ok = false;
+    }
+    CloseHandle(handle);
+    LOG_DEBUG(L"End of BenchFiles::CreateDestinationFile\n");
+    return ok;
+}
+
+void BenchFiles::Remove(LPCWSTR path)
+{
+    if (!DeleteFileW(path) && GetLastError() != ERROR_FILE_NOT_FOUND) {
+        LOG_WARNING(L"BenchFiles::Remove: Failed to delete %s with error: %d\n", path, GetLastError());
+    }
+}
@@ -0,0 +1,188 @@
+#include "BenchRunner.h"
+#include <sstream>
+#include <iomanip>
+
+// Narrow copy of a report label, escaped for JSON if asked (labels of path: sources hold backslashes)
+static std::string ToReportString(const std::wstring& text, bool forJson)
+{
+    std::string escaped;
+    for (wchar_t c : text) {
+        if (forJson && (c == L'\\' || c == L'"')) {
+            escaped += '\\';
+        }
+        escaped += (c < 0x80) ? static_cast<char>(c) : '?';
+    }
+    return escaped;
+}
+
+static bool WriteTextFile(LPCWSTR path, const std::string& text)
+{
+    HANDLE hFile = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"BenchRunner: Failed to create %s. Error: %d\n", path, GetLastError());
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    bool success = WriteFile(hFile, text.data(), static_cast<DWORD>(text.size()), &bytesWritten, nullptr) && bytesWritten == text.size();
+    if (!success) {
+        LOG_ERROR(L"BenchRunner: Failed to write %s. Error: %d\n", path, GetLastError());
+    }
+    CloseHandle(hFile);
+    return success;
+}
+
+//Getters
+const std::vector<BenchResult>& BenchRunner::getResults() const
+{
+    return m_results;
+}
+
+const wchar_t* BenchRunner::GetEngineName(IOEngineType engineType)
+{
+    return (engineType == IOEngineType::IOCP) ? L"iocp" : L"apc";
+}
+
+double BenchRunner::GetProcessCpuSeconds()
+{
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0.0;
+    }
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+    return static_cast<double>(kernel.QuadPart + user.QuadPart) / 1e7; // 100 ns units
+}
+
+bool BenchRunner::RunOnce(const BenchCase& benchCase, BenchResult& result)
+{
+    LOG_DEBUG(L"Inside BenchRunner::RunOnce\n");
+    result = BenchResult();
+    result.benchCase = benchCase;
+    result.succeeded = false;
+
+    BlockCopier copier;
+    copier.setEngineType(benchCase.engineType);
+    if (!copier.Initialize(benchCase.sourcePath.c_str(), benchCase.destPath.c_str(), benchCase.threads, benchCase.blockSizeMB, benchCase.queueDepth)) {
+        LOG_ERROR(L"BenchRunner::RunOnce: Failed to initialize the copier for %s.\n", benchCase.sourceName.c_str());
+        LOG_DEBUG(L"End of BenchRunner::RunOnce\n");
+        return false;
+    }
+
+    double cpuStart = GetProcessCpuSeconds();
+    LONGLONG startTicks = CopyMetrics::Now();
+    bool copied = copier.StartCopy();
+    LONGLONG endTicks = CopyMetrics::Now();
+    double cpuSeconds = GetProcessCpuSeconds() - cpuStart;
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    CopyMetricsSummary summary = copier.getMetrics().GetSummary();
+    result.succeeded = copied;
+    result.seconds = static_cast<double>(endTicks - startTicks) / frequency.QuadPart;
+    result.bytes = copier.m_bytesReadTotal.load();
+    double gigabytes = static_cast<double>(result.bytes) / (1024.0 * 1024.0 * 1024.0);
+    if (result.seconds > 0) {
+        result.mbPerSec = static_cast<double>(result.bytes) / (1024.0 * 1024.0) / result.seconds;
+        result.iops = static_cast<double>(summary.readLatency.count + summary.writeLatency.count) / result.seconds;
+    }
+    result.readP50Us = summary.readLatency.p50;
+    result.readP99Us = summary.readLatency.p99;
+    result.writeP50Us = summary.writeLatency.p50;
+    result.writeP99Us = summary.writeLatency.p99;
+    result.cpuSecondsPerGB = (gigabytes > 0) ? cpuSeconds / gigabytes : 0.0;
+    result.bottleneck = summary.likelyBottleneck;
+    LOG_DEBUG(L"End of BenchRunner::RunOnce\n");
+    return copied;
+}
+
+bool BenchRunner::RunCase(const BenchCase& benchCase, int warmup, int repeat)
+{
+    LOG_DEBUG(L"Inside BenchRunner::RunCase\n");
+    std::wcout << L"Case: " << benchCase.sourceName << L", " << GetEngineName(benchCase.engineType) << L", " << benchCase.threads << L" threads, "
+        << benchCase.blockSizeMB << L" MB blocks, queue depth " << benchCase.queueDepth << L"\n";
+
+    bool allSucceeded = true;
+    for (int run = 0; run < warmup + repeat; ++run) {
+        BenchResult result;
+        bool succeeded = RunOnce(benchCase, result);
+        allSucceeded = allSucceeded && succeeded;
+        if (run < warmup) {
+            continue;
+        }
+        result.repetition = run - warmup;
+        m_results.push_back(result);
+        if (!succeeded) {
+            LOG_ERROR(L"BenchRunner::RunCase: Run %d of %s failed.\n", result.repetition, benchCase.sourceName.c_str());
+        }
+    }
+    LOG_DEBUG(L"End of BenchRunner::RunCase\n");
+    return allSucceeded;
+}
+
+bool BenchRunner::WriteCsv(LPCWSTR path) const
+{
+    std::ostringstream csv;
+    csv << "source,engine,threads,block_mb,queue_depth,repetition,succeeded,seconds,bytes,mb_per_sec,iops,"
+        "read_p50_us,read_p99_us,write_p50_us,write_p99_us,cpu_sec_per_gb,bottleneck\n";
+    for (const BenchResult& result : m_results) {
+        const BenchCase& benchCase = result.benchCase;
+        csv << ToReportString(benchCase.sourceName, false) << ','
+            << (benchCase.engineType == IOEngineType::IOCP ? "iocp" : "apc") << ','
+            << benchCase.threads << ',' << benchCase.blockSizeMB << ',' << benchCase.queueDepth << ','
+            << result.repetition << ',' << (result.succeeded ? 1 : 0) << ','
+            << std::fixed << std::setprecision(4) << result.seconds << ',' << result.bytes << ','
+            << std::setprecision(2) << result.mbPerSec << ',' << result.iops << ','
+            << result.readP50Us << ',' << result.readP99Us << ',' << result.writeP50Us << ',' << result.writeP99Us << ','
+            << std::setprecision(4) << result.cpuSecondsPerGB << ','
+            << ToReportString(result.bottleneck, false) << '\n';
+    }
+    return WriteTextFile(path, csv.str());
+}
+
+bool BenchRunner::WriteJson(LPCWSTR path, const std::vector<MicroResult>& microResults) const
+{
+    std::ostringstream json;
+    json << std::fixed << "{\n  \"runs\": [";
+    for (size_t i = 0; i < m_results.size(); ++i) {
+        const BenchResult& result = m_results[i];
+        const BenchCase& benchCase = result.benchCase;
+        json << (i == 0 ? "\n" : ",\n")
+            << "    { \"source\": \"" << ToReportString(benchCase.sourceName, true) << "\""
+            << ", \"engine\": \"" << (benchCase.engineType == IOEngineType::IOCP ? "iocp" : "apc") << "\""
+            << ", \"threads\": " << benchCase.threads << ", \"blockSizeMB\": " << benchCase.blockSizeMB << ", \"queueDepth\": " << benchCase.queueDepth
+            << ", \"repetition\": " << result.repetition << ", \"succeeded\": " << (result.succeeded ? "true" : "false")
+            << ", \"seconds\": " << std::setprecision(4) << result.seconds << ", \"bytes\": " << result.bytes
+            << ", \"mbPerSec\": " << std::setprecision(2) << result.mbPerSec << ", \"iops\": " << result.iops
+            << ", \"readP50Us\": " << result.readP50Us << ", \"readP99Us\": " << result.readP99Us
+            << ", \"writeP50Us\": " << result.writeP50Us << ", \"writeP99Us\": " << result.writeP99Us
+            << ", \"cpuSecondsPerGB\": " << std::setprecision(4) << result.cpuSecondsPerGB
+            << ", \"bottleneck\": \"" << ToReportString(result.bottleneck, true) << "\" }";
+    }
+    json << "\n  ],\n  \"micro\": [";
+    for (size_t i = 0; i < microResults.size(); ++i) {
+        const MicroResult& result = microResults[i];
+        json << (i == 0 ? "\n" : ",\n")
+            << "    { \"name\": \"" << ToReportString(result.name, true) << "\", \"threads\": " << result.threads
+            << ", \"operations\": " << result.operations << ", \"nsPerOp\": " << std::setprecision(1) << result.nsPerOp << " }";
+    }
+    json << "\n  ]\n}\n";
+    return WriteTextFile(path, json.str());
+}
+
+void BenchRunner::PrintTable() const
+{
+    std::wcout << L"\nsource                 engine thr blkMB qd  rep       MB/s       IOPS  rd p50/p99 us  wr p50/p99 us  cpu s/GB\n";
+    for (const BenchResult& result : m_results) {
+        const BenchCase& benchCase = result.benchCase;
+        std::wcout << std::left << std::setw(22) << benchCase.sourceName << L" " << std::setw(6) << GetEngineName(benchCase.engineType)
+            << std::right << std::setw(4) << benchCase.threads << std::setw(6) << benchCase.blockSizeMB << std::setw(4) << benchCase.queueDepth
+            << std::setw(5) << result.repetition << std::fixed << std::setprecision(1) << std::setw(11) << result.mbPerSec
+            << std::setw(11) << result.iops << std::setw(7) << result.readP50Us << L"/" << std::left << std::setw(7) << result.readP99Us
+            << std::right << std::setw(7) << result.writeP50Us << L"/" << std::left << std::setw(7) << result.writeP99Us
+            << std::right << std::setprecision(3) << std::setw(9) << result.cpuSecondsPerGB
+            << (result.succeeded ? L"" : L"  FAILED") << L"\n";
+    }
+}
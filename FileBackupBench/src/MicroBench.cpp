@@ -0,0 +1,188 @@
+#include "MicroBench.h"
+#include "BenchFiles.h"
+#include <thread>
+#include <memory>
+#include <iomanip>
+
+//Getters
+const std::vector<MicroResult>& MicroBench::getResults() const
+{
+    return m_results;
+}
+
+void MicroBench::AddResult(const std::wstring& name, int threads, LONGLONG operations, LONGLONG ticks)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    MicroResult result;
+    result.name = name;
+    result.threads = threads;
+    result.operations = operations;
+    result.nsPerOp = (operations > 0) ? static_cast<double>(ticks) * 1e9 / frequency.QuadPart / operations : 0.0;
+    m_results.push_back(result);
+}
+
+bool MicroBench::RunIssueRead(const std::wstring& workDir, int threads, LONGLONG iterationsPerThread, bool useRanges)
+{
+    LOG_DEBUG(L"Inside MicroBench::RunIssueRead\n");
+    std::wstring path = workDir + L"\\bench_micro_claim.bin";
+    LONGLONG fileSize = static_cast<LONGLONG>(MICRO_CLAIM_FILE_MB) * 1024 * 1024;
+    if (BenchFiles::QuerySize(path.c_str()) != fileSize && !BenchFiles::CreateDataFile(path.c_str(), fileSize)) {
+        return false;
+    }
+
+    // The same range listed many times gives a long schedule of cached blocks with many extents to search
+    std::vector<DiskExtent> extents(MICRO_CLAIM_EXTENT_REPEAT, DiskExtent{ 0, fileSize });
+    BlockSchedule schedule;
+    if (!schedule.Build(extents, MICRO_CLAIM_BLOCK_SIZE) || schedule.getTotalBlocks() < threads * iterationsPerThread) {
+        LOG_ERROR(L"MicroBench::RunIssueRead: Schedule too short for %lld iterations.\n", threads * iterationsPerThread);
+        return false;
+    }
+
+    BlockCopier copier; // Only provides the metrics the I/O paths record into
+    copier.getMetrics().Start(threads, threads);
+    IOUtils ioUtils;
+    ioUtils.setEngineType(IOEngineType::IOCP);
+    ioUtils.setSchedule(&schedule);
+    RangeScheduler ranges;
+    if (useRanges) {
+        ranges.Build(schedule, threads);
+        ioUtils.setRanges(&ranges);
+    }
+
+    std::atomic<bool> failed(false);
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<LONGLONG> ticks(threads, 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+            HANDLE hPort = (hFile != INVALID_HANDLE_VALUE) ? CreateIoCompletionPort(hFile, nullptr, 0, 1) : nullptr;
+            IOContext context(MICRO_CLAIM_BLOCK_SIZE);
+            context.curInst = &copier;
+            context.workerIndex = t;
+            ready.fetch_add(1);
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            if (hPort == nullptr || !context.buf) {
+                failed.store(true);
+            }
+            LONGLONG start = CopyMetrics::Now();
+            for (LONGLONG i = 0; i < iterationsPerThread && !failed.load(); ++i) {
+                DWORD bytes = 0;
+                ULONG_PTR key = 0;
+                LPOVERLAPPED overlapped = nullptr;
+                if (!ioUtils.IssueRead(hFile, &context) || !GetQueuedCompletionStatus(hPort, &bytes, &key, &overlapped, INFINITE)) {
+                    failed.store(true);
+                }
+            }
+            ticks[t] = CopyMetrics::Now() - start;
+            if (hPort != nullptr) {
+                CloseHandle(hPort);
+            }
+            if (hFile != INVALID_HANDLE_VALUE) {
+                CloseHandle(hFile);
+            }
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    go.store(true);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (failed.load()) {
+        LOG_ERROR(L"MicroBench::RunIssueRead: A read failed to issue or complete.\n");
+        return false;
+    }
+
+    LONGLONG slowest = 0;
+    for (LONGLONG t : ticks) {
+        slowest = (t > slowest) ? t : slowest;
+    }
+    // Per thread cost of one claim + ReadFile + dequeue round trip
+    AddResult(useRanges ? L"issue_read_roundtrip_4k_ranges" : L"issue_read_roundtrip_4k_shared", threads, iterationsPerThread, slowest);
+    LOG_DEBUG(L"End of MicroBench::RunIssueRead\n");
+    return true;
+}
+
+bool MicroBench::RunZeroReadCompletion(DWORD blockSize, LONGLONG iterations)
+{
+    LOG_DEBUG(L"Inside MicroBench::RunZeroReadCompletion\n");
+    BlockCopier copier;
+    copier.getMetrics().Start(1, 1);
+    BlockPipelineConfig pipeline; // No Initialize, so pick the zero skipping pipeline it would have
+    pipeline.zeroBlocks = ZeroBlockPolicy::SKIP;
+    copier.setZeroBlockPolicy(ZeroBlockPolicy::SKIP);
+    copier.ioUtilsObj.setBlockHandler(BlockStages::Select(pipeline));
+    copier.ioUtilsObj.setBufferRelease(BlockStages::SelectRelease(pipeline));
+    IOContext context(blockSize); // VirtualAlloc hands out zeroed pages
+    if (!context.buf) {
+        return false;
+    }
+    context.curInst = &copier;
+
+    LONGLONG start = CopyMetrics::Now();
+    for (LONGLONG i = 0; i < iterations; ++i) {
+        copier.ioUtilsObj.OnReadCompletion(ERROR_SUCCESS, blockSize, &context.overlapped);
+    }
+    LONGLONG ticks = CopyMetrics::Now() - start;
+    if (copier.m_bytesZeroTotal.load() != static_cast<LONGLONG>(blockSize) * iterations) {
+        LOG_ERROR(L"MicroBench::RunZeroReadCompletion: Blocks did not take the zero block path.\n");
+        return false;
+    }
+    AddResult(L"read_completion_zero_" + std::to_wstring(blockSize / 1024) + L"k", 1, iterations, ticks);
+    LOG_DEBUG(L"End of MicroBench::RunZeroReadCompletion\n");
+    return true;
+}
+
+bool MicroBench::RunWriteCompletion(int threads, LONGLONG iterationsPerThread)
+{
+    LOG_DEBUG(L"Inside MicroBench::RunWriteCompletion\n");
+    BlockCopier copier;
+    copier.getMetrics().Start(threads, threads);
+    copier.ioUtilsObj.setBufferRelease(BlockStages::SelectRelease(BlockPipelineConfig()));
+    std::vector<std::unique_ptr<IOContext>> contexts;
+    for (int t = 0; t < threads; ++t) {
+        contexts.push_back(std::unique_ptr<IOContext>(new IOContext(MICRO_CLAIM_BLOCK_SIZE)));
+        contexts.back()->curInst = &copier;
+        contexts.back()->workerIndex = t;
+    }
+
+    std::vector<LONGLONG> ticks(threads, 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            IOContext* context = contexts[t].get();
+            LONGLONG start = CopyMetrics::Now();
+            for (LONGLONG i = 0; i < iterationsPerThread; ++i) {
+                context->issueTicks = start;
+                copier.ioUtilsObj.OnWriteCompletion(ERROR_SUCCESS, MICRO_CLAIM_BLOCK_SIZE, &context->overlapped);
+            }
+            ticks[t] = CopyMetrics::Now() - start;
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    LONGLONG slowest = 0;
+    for (LONGLONG t : ticks) {
+        slowest = (t > slowest) ? t : slowest;
+    }
+    AddResult(L"write_completion", threads, iterationsPerThread, slowest);
+    LOG_DEBUG(L"End of MicroBench::RunWriteCompletion\n");
+    return true;
+}
+
+void MicroBench::Print() const
+{
+    std::wcout << L"\nmicro benchmark            threads        ops      ns/op\n";
+    for (const MicroResult& result : m_results) {
+        std::wcout << std::left << std::setw(26) << result.name << std::right << std::setw(8) << result.threads
+            << std::setw(11) << result.operations << std::fixed << std::setprecision(1) << std::setw(11) << result.nsPerOp << L"\n";
+    }
+}
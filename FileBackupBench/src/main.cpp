@@ -0,0 +1,222 @@
+#include "BenchRunner.h"
+#include "BenchFiles.h"
+#include "MicroBench.h"
+#include <CopyTrace.h>
+#include <sstream>
+
+#define BENCH_DEFAULT_SOURCE L"sparse:1024"
+#define BENCH_DEFAULT_REPEAT 3
+#define BENCH_DEFAULT_WARMUP 1
+#define BENCH_MICRO_ITERATIONS 200000
+
+static void PrintUsage(const wchar_t* exeName) {
+    std::wcout<<L"Usage: "<<exeName<<L" --workdir <dir> [options]\n";
+    std::wcout<<L"Options:\n";
+    std::wcout<<L"  --source <spec>       sparse:<MB>, data:<MB> (pseudo random, in --workdir) or path:<file|volume|device>, may repeat (default: "<<BENCH_DEFAULT_SOURCE<<L")\n";
+    std::wcout<<L"  --dest <path>         Existing destination file or device, OVERWRITTEN by every run (default: a file in --workdir)\n";
+    std::wcout<<L"  --threads <list>      Comma separated thread counts (default: 1,4)\n";
+    std::wcout<<L"  --blocksizes <list>   Comma separated block sizes in MB (default: 1,4)\n";
+    std::wcout<<L"  --engines <list>      Comma separated engines, apc and/or iocp (default: apc,iocp)\n";
+    std::wcout<<L"  --queuedepths <list>  Comma separated queue depths per thread (default: "<<DEFAULT_QUEUE_DEPTH<<L")\n";
+    std::wcout<<L"  --repeat <n>          Reported runs per case (default: "<<BENCH_DEFAULT_REPEAT<<L")\n";
+    std::wcout<<L"  --warmup <n>          Unreported runs before them (default: "<<BENCH_DEFAULT_WARMUP<<L")\n";
+    std::wcout<<L"  --csv <file>          Write one row per run\n";
+    std::wcout<<L"  --json <file>         Write runs and micro benchmarks as JSON\n";
+    std::wcout<<L"  --micro               Also run the IssueRead and completion micro benchmarks\n";
+    std::wcout<<L"  --microonly           Run only the micro benchmarks\n";
+    std::wcout<<L"  --keep                Keep the synthetic files in --workdir\n";
+    std::wcout<<L"Example: "<<exeName<<L" --workdir R:\\bench --source data:2048 --threads 1,2,4,8 --blocksizes 1,4,16 --csv bench.csv --micro\n";
+}
+
+// Parses a comma separated list of positive integers
+static bool ParseIntList(const std::wstring& text, std::vector<int>& values) {
+    values.clear();
+    std::wstringstream stream(text);
+    std::wstring item;
+    while (std::getline(stream, item, L',')) {
+        int value = _wtoi(item.c_str());
+        if (value <= 0) {
+            return false;
+        }
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+//Benchmark entry point
+int wmain(int argc, wchar_t* argv[]) {
+    std::wstring workDir;
+    std::wstring destPath;
+    std::vector<std::wstring> sourceSpecs;
+    std::vector<int> threadCounts = { 1, 4 };
+    std::vector<int> blockSizes = { 1, 4 };
+    std::vector<int> queueDepths = { DEFAULT_QUEUE_DEPTH };
+    std::vector<IOEngineType> engines = { IOEngineType::APC, IOEngineType::IOCP };
+    int repeat = BENCH_DEFAULT_REPEAT;
+    int warmup = BENCH_DEFAULT_WARMUP;
+    LPCWSTR csvPath = nullptr;
+    LPCWSTR jsonPath = nullptr;
+    bool runMicro = false;
+    bool runMatrix = true;
+    bool keepFiles = false;
+
+    for (int argIndex = 1; argIndex < argc; ++argIndex) {
+        std::wstring arg = argv[argIndex];
+        bool hasValue = argIndex + 1 < argc;
+        if (arg == L"--workdir" && hasValue) {
+            workDir = argv[++argIndex];
+        }
+        else if (arg == L"--source" && hasValue) {
+            sourceSpecs.push_back(argv[++argIndex]);
+        }
+        else if (arg == L"--dest" && hasValue) {
+            destPath = argv[++argIndex];
+        }
+        else if ((arg == L"--threads" || arg == L"--blocksizes" || arg == L"--queuedepths") && hasValue) {
+            std::vector<int>& values = (arg == L"--threads") ? threadCounts : (arg == L"--blocksizes") ? blockSizes : queueDepths;
+            if (!ParseIntList(argv[++argIndex], values)) {
+                std::wcout<<L"Invalid list for "<<arg<<L". Must be comma separated positive integers.\n\n";
+                return 1;
+            }
+        }
+        else if (arg == L"--engines" && hasValue) {
+            engines.clear();
+            std::wstringstream stream(argv[++argIndex]);
+            std::wstring engine;
+            while (std::getline(stream, engine, L',')) {
+                if (engine == L"apc") {
+                    engines.push_back(IOEngineType::APC);
+                }
+                else if (engine == L"iocp") {
+                    engines.push_back(IOEngineType::IOCP);
+                }
+                else {
+                    std::wcout<<L"Invalid engine ("<<engine<<L"). Must be apc or iocp.\n\n";
+                    return 1;
+                }
+            }
+        }
+        else if ((arg == L"--repeat" || arg == L"--warmup") && hasValue) {
+            int value = _wtoi(argv[++argIndex]);
+            if (value < 0 || (arg == L"--repeat" && value == 0)) {
+                std::wcout<<L"Invalid value for "<<arg<<L".\n\n";
+                return 1;
+            }
+            (arg == L"--repeat" ? repeat : warmup) = value;
+        }
+        else if (arg == L"--csv" && hasValue) {
+            csvPath = argv[++argIndex];
+        }
+        else if (arg == L"--json" && hasValue) {
+            jsonPath = argv[++argIndex];
+        }
+        else if (arg == L"--micro") {
+            runMicro = true;
+        }
+        else if (arg == L"--microonly") {
+            runMicro = true;
+            runMatrix = false;
+        }
+        else if (arg == L"--keep") {
+            keepFiles = true;
+        }
+        else {
+            std::wcout<<L"Unknown or incomplete option: "<<arg<<L"\n";
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (workDir.empty()) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    if (sourceSpecs.empty()) {
+        sourceSpecs.push_back(BENCH_DEFAULT_SOURCE);
+    }
+
+    // Only failures reach the console, per block logging would distort the numbers. Initialize is not
+    // called, it asks for the log targets on the console and a benchmark must run unattended.
+    LogUtils& logger = LogUtils::GetInstance();
+    logger.EnableConsoleLogging(true);
+    logger.SetLogLevel(LogUtils::LogLevel::ERROR_LEVEL);
+    CopyTrace::Register(); // Bench runs can be traced like real copies
+
+    LOG_DEBUG(L"Inside Main\n");
+    BenchRunner runner;
+    MicroBench micro;
+    bool succeeded = true;
+    std::vector<std::wstring> createdFiles;
+
+    if (runMatrix) {
+        for (const std::wstring& spec : sourceSpecs) {
+            BenchSourceSpec source;
+            if (!BenchFiles::ParseSourceSpec(spec, source)) {
+                std::wcout<<L"Invalid source ("<<spec<<L"). Must be sparse:<MB>, data:<MB> or path:<path>.\n\n";
+                CopyTrace::Unregister();
+                logger.DeInitialize();
+                return 1;
+            }
+            std::wcout<<L"Preparing source "<<source.name<<L"...\n";
+            if (!BenchFiles::PrepareSource(source, workDir)) {
+                LOG_ERROR(L"Main: Failed to prepare source %s.\n", source.name.c_str());
+                succeeded = false;
+                continue;
+            }
+            if (source.type != BenchSourceType::PATH) {
+                createdFiles.push_back(source.path);
+            }
+
+            LONGLONG sourceSize = BenchFiles::QuerySize(source.path.c_str());
+            std::wstring caseDest = destPath;
+            if (caseDest.empty()) {
+                caseDest = workDir + L"\\bench_dest.bin";
+                if (!BenchFiles::CreateDestinationFile(caseDest.c_str(), sourceSize)) {
+                    succeeded = false;
+                    continue;
+                }
+                createdFiles.push_back(caseDest);
+            }
+
+            for (IOEngineType engine : engines) {
+                for (int threads : threadCounts) {
+                    for (int blockSizeMB : blockSizes) {
+                        for (int queueDepth : queueDepths) {
+                            BenchCase benchCase = { source.name, source.path, caseDest, engine, threads, blockSizeMB, queueDepth };
+                            succeeded = runner.RunCase(benchCase, warmup, repeat) && succeeded;
+                        }
+                    }
+                }
+            }
+        }
+        runner.PrintTable();
+    }
+
+    if (runMicro) {
+        std::wcout<<L"\nRunning micro benchmarks...\n";
+        succeeded = micro.RunIssueRead(workDir, 1, BENCH_MICRO_ITERATIONS, false) && succeeded;
+        succeeded = micro.RunIssueRead(workDir, 4, BENCH_MICRO_ITERATIONS, false) && succeeded;
+        succeeded = micro.RunIssueRead(workDir, 4, BENCH_MICRO_ITERATIONS, true) && succeeded;
+        succeeded = micro.RunZeroReadCompletion(64 * 1024, BENCH_MICRO_ITERATIONS) && succeeded;
+        succeeded = micro.RunZeroReadCompletion(1024 * 1024, BENCH_MICRO_ITERATIONS / 100) && succeeded;
+        succeeded = micro.RunWriteCompletion(1, BENCH_MICRO_ITERATIONS) && succeeded;
+        succeeded = micro.RunWriteCompletion(4, BENCH_MICRO_ITERATIONS) && succeeded;
+        createdFiles.push_back(workDir + L"\\bench_micro_claim.bin");
+        micro.Print();
+    }
+
+    if (csvPath != nullptr && !runner.WriteCsv(csvPath)) {
+        succeeded = false;
+    }
+    if (jsonPath != nullptr && !runner.WriteJson(jsonPath, micro.getResults())) {
+        succeeded = false;
+    }
+    if (!keepFiles) {
+        for (const std::wstring& path : createdFiles) {
+            BenchFiles::Remove(path.c_str());
+        }
+    }
+    LOG_DEBUG(L"End of Main\n");
+    CopyTrace::Unregister();
+    logger.DeInitialize();
+    return succeeded ? 0 : 1;
+}
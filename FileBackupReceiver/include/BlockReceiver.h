@@ -0,0 +1,119 @@
+#pragma once
+#include <NetworkStream.h> // Winsock 2 must come before windows.h
+#include <BufferArena.h>
+#include <DiskUtils.h>
+#include <LogUtils.h>
+#include <vector>
+#include <string>
+
+#define RECEIVER_SLICES_PER_CONNECTION 8    // Receive buffers per connection, how far writes may lag behind the sockets
+#define RECEIVER_DEQUEUE_BATCH 64           // Completions dequeued per call, from the port and from the RIO queue
+#define RECEIVER_WRITE_KEY 0                // Completion key of the target's writes
+#define RECEIVER_NETWORK_KEY 1              // Completion key of the RIO completion queue's notifications
+
+// Buffer one frame's payload is received into and written from
+struct ReceiveSlice {
+    OVERLAPPED overlapped = {}; // Of the slice's write, must stay the first member
+    char* buf = nullptr;
+    RIO_BUFFERID bufferId = RIO_INVALID_BUFFERID;
+    DWORD length = 0;           // Payload bytes of the frame being written
+};
+
+// What a connection is receiving
+enum class ReceiveState {
+    HEADER = 0,     // The next frame header
+    PAYLOAD,        // The payload of the current frame
+    WAITING,        // The payload of the current frame, once a slice is free
+    ENDED           // The end frame arrived
+};
+
+struct ReceiveConnection {
+    SOCKET socket = INVALID_SOCKET;
+    RIO_RQ requestQueue = RIO_INVALID_RQ;
+    ReceiveState state = ReceiveState::HEADER;
+    StreamFrameHeader header = {};  // Current frame header, copied from the connection's registered header slot
+    DWORD received = 0;             // Bytes of the header or payload received so far
+    ReceiveSlice* slice = nullptr;  // Slice the current payload is received into
+};
+
+// Receiving end of a tcp:// destination. It listens on one address only and accepts a connection only from an
+// allowed address and, when a secret is set, with a hello that proves it. It accepts the connections of one stream,
+// receives every frame with Registered I/O into pre-registered slices and writes each at its offset with overlapped
+// unbuffered writes. One thread services the completion port both the target and the RIO completion queue report
+// to, so the request queues, which take one caller at a time, need no locks. It does not use the IOUtils engine:
+// that one drives read-then-write IOContexts over a block schedule, here data comes from receives at the offsets
+// the frames carry.
+class BlockReceiver {
+private:
+    SOCKET m_listenSocket;
+    bool m_wsaStarted;
+    HANDLE m_hTarget;
+    HANDLE m_hIocp;
+    DiskUtils m_diskUtils;
+    DWORD m_sectorSize;
+    LONGLONG m_capacity;
+    DWORD m_blockSize;                  // Largest frame payload of the current stream
+    RIO_EXTENSION_FUNCTION_TABLE m_rio;
+    RIO_CQ m_completionQueue;
+    OVERLAPPED m_notifyOverlapped;      // Queued to the completion port when the completion queue holds results
+    StreamFrameHeader* m_headers;       // Registered header slot of each connection
+    RIO_BUFFERID m_headerBufferId;
+    BufferArena m_arena;
+    std::vector<ReceiveSlice> m_slices;
+    std::vector<ReceiveSlice*> m_freeSlices;
+    std::vector<ReceiveConnection> m_connections;
+    int m_connectionsEnded;
+    int m_writesInFlight;
+    LONGLONG m_bytesWritten;
+    DWORD m_status;                     // First error of the stream, ERROR_SUCCESS while it goes well
+    std::string m_secret;               // Shared secret hellos must prove, empty to rely on the allow-list alone
+    std::vector<sockaddr_storage> m_allowed; // Addresses connections are accepted from, empty to accept any
+
+    // Opens the target and reads its capacity and sector size
+    bool OpenTarget(LPCWSTR targetPath);
+    // Accepts the connections of one stream and answers their hellos, refusing a stream the target cannot take.
+    // Connections from an address not on the allow-list or with a hello that fails the secret are dropped.
+    bool AcceptStream(LPCWSTR targetPath);
+    bool IsAllowed(const sockaddr_storage& peer) const;
+    bool PrepareBuffers();
+
+    // Posts the receive of the rest of the connection's header or payload
+    bool PostReceive(int connIndex);
+    void OnReceiveCompletion(int connIndex, LONG status, DWORD bytesReceived);
+    // Hands the connection a free slice for its payload, false if none is free yet
+    bool StartPayload(int connIndex);
+    void IssueWrite(int connIndex);
+    void OnWriteCompletion(ReceiveSlice* slice, DWORD errCode, DWORD bytesWritten);
+
+    void Fail(DWORD errCode);
+    void CloseStream();
+
+public:
+    BlockReceiver() : m_listenSocket(INVALID_SOCKET), m_wsaStarted(false), m_hTarget(INVALID_HANDLE_VALUE), m_hIocp(nullptr), m_sectorSize(0), m_capacity(0),
+        m_blockSize(0), m_rio(), m_completionQueue(RIO_INVALID_CQ), m_notifyOverlapped(), m_headers(nullptr), m_headerBufferId(RIO_INVALID_BUFFERID),
+        m_connectionsEnded(0), m_writesInFlight(0), m_bytesWritten(0), m_status(ERROR_SUCCESS) {}
+
+    // Getters
+    LONGLONG getBytesWritten() const;
+    bool hasAllowList() const;
+
+    // Setters
+    void setSecret(const std::string& secret);
+    // Adds a numeric IPv4 or IPv6 address to the allow-list, false if it is not one
+    bool AllowAddress(LPCWSTR address);
+
+    // Listens on the port of bindAddress, a numeric address of this machine
+    bool Listen(LPCWSTR bindAddress, LPCWSTR port);
+
+    // Serves one stream: writes every frame to targetPath, flushes it and reports the result to the sender
+    bool ReceiveStream(LPCWSTR targetPath);
+
+    void Close();
+
+    ~BlockReceiver() {
+        Close();
+    }
+
+    BlockReceiver(const BlockReceiver&) = delete;
+    BlockReceiver& operator=(const BlockReceiver&) = delete;
+};
@@ -0,0 +1,580 @@
+#include "BlockReceiver.h"
+
+//Getters
+LONGLONG BlockReceiver::getBytesWritten() const
+{
+    return m_bytesWritten;
+}
+
+bool BlockReceiver::hasAllowList() const
+{
+    return !m_allowed.empty();
+}
+
+//Setters
+void BlockReceiver::setSecret(const std::string& secret)
+{
+    m_secret = secret;
+}
+
+bool BlockReceiver::AllowAddress(LPCWSTR address)
+{
+    sockaddr_storage allowed = {};
+    if (InetPtonW(AF_INET, address, &reinterpret_cast<sockaddr_in*>(&allowed)->sin_addr) == 1) {
+        allowed.ss_family = AF_INET;
+    }
+    else if (InetPtonW(AF_INET6, address, &reinterpret_cast<sockaddr_in6*>(&allowed)->sin6_addr) == 1) {
+        allowed.ss_family = AF_INET6;
+    }
+    else {
+        return false;
+    }
+    m_allowed.push_back(allowed);
+    return true;
+}
+
+bool BlockReceiver::Listen(LPCWSTR bindAddress, LPCWSTR port)
+{
+    LOG_DEBUG(L"Inside BlockReceiver::Listen\n");
+    Close();
+    if (!NetworkStream::Startup()) {
+        LOG_DEBUG(L"End of BlockReceiver::Listen\n");
+        return false;
+    }
+    m_wsaStarted = true;
+
+    ADDRINFOW hints = {};
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    PADDRINFOW address = nullptr;
+    int result = GetAddrInfoW(bindAddress, port, &hints, &address);
+    if (result != 0) {
+        LOG_ERROR(L"BlockReceiver::Listen: %s is not a numeric IPv4 or IPv6 address, error: %d\n", bindAddress, result);
+        LOG_DEBUG(L"End of BlockReceiver::Listen\n");
+        return false;
+    }
+
+    // Accepted sockets inherit the listening socket's Registered I/O flag
+    m_listenSocket = NetworkStream::CreateSocket(address->ai_family);
+    bool listening = m_listenSocket != INVALID_SOCKET;
+    if (listening && (bind(m_listenSocket, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0 || listen(m_listenSocket, SOMAXCONN) != 0)) {
+        LOG_ERROR(L"BlockReceiver::Listen: Failed to listen on %s port %s, error: %d\n", bindAddress, port, WSAGetLastError());
+        listening = false;
+    }
+    FreeAddrInfoW(address);
+    if (!listening) {
+        LOG_DEBUG(L"End of BlockReceiver::Listen\n");
+        return false;
+    }
+    LOG_INFO(L"BlockReceiver::Listen: Listening on %s port %s\n", bindAddress, port);
+    LOG_DEBUG(L"End of BlockReceiver::Listen\n");
+    return true;
+}
+
+bool BlockReceiver::ReceiveStream(LPCWSTR targetPath)
+{
+    LOG_DEBUG(L"Inside BlockReceiver::ReceiveStream\n");
+    m_connectionsEnded = 0;
+    m_writesInFlight = 0;
+    m_bytesWritten = 0;
+    m_status = ERROR_SUCCESS;
+
+    if (!AcceptStream(targetPath) || !PrepareBuffers()) {
+        CloseStream();
+        LOG_DEBUG(L"End of BlockReceiver::ReceiveStream\n");
+        return false;
+    }
+    int nConnections = static_cast<int>(m_connections.size());
+    for (int i = 0; i < nConnections && m_status == ERROR_SUCCESS; ++i) {
+        PostReceive(i);
+    }
+
+    // Until every connection has ended (or the stream failed) and no write is left in flight
+    OVERLAPPED_ENTRY entries[RECEIVER_DEQUEUE_BATCH];
+    RIORESULT results[RECEIVER_DEQUEUE_BATCH];
+    while (m_writesInFlight > 0 || (m_status == ERROR_SUCCESS && m_connectionsEnded < nConnections)) {
+        ULONG numEntries = 0;
+        if (!GetQueuedCompletionStatusEx(m_hIocp, entries, RECEIVER_DEQUEUE_BATCH, &numEntries, INFINITE, FALSE)) {
+            LOG_ERROR(L"BlockReceiver::ReceiveStream: GetQueuedCompletionStatusEx failed with error: %d\n", GetLastError());
+            Fail(GetLastError());
+            break;
+        }
+        for (ULONG i = 0; i < numEntries; ++i) {
+            if (entries[i].lpCompletionKey == RECEIVER_NETWORK_KEY) {
+                ULONG count = 0;
+                while ((count = m_rio.RIODequeueCompletion(m_completionQueue, results, RECEIVER_DEQUEUE_BATCH)) != 0) {
+                    if (count == RIO_CORRUPT_CQ) {
+                        LOG_ERROR(L"BlockReceiver::ReceiveStream: The RIO completion queue is corrupt.\n");
+                        Fail(ERROR_INVALID_DATA);
+                        break;
+                    }
+                    for (ULONG j = 0; j < count; ++j) {
+                        OnReceiveCompletion(static_cast<int>(results[j].RequestContext), results[j].Status, results[j].BytesTransferred);
+                    }
+                }
+                int notifyResult = m_rio.RIONotify(m_completionQueue);
+                if (notifyResult != ERROR_SUCCESS && m_status == ERROR_SUCCESS) {
+                    LOG_ERROR(L"BlockReceiver::ReceiveStream: RIONotify failed with error: %d\n", notifyResult);
+                    Fail(static_cast<DWORD>(notifyResult));
+                }
+                continue;
+            }
+
+            ReceiveSlice* slice = reinterpret_cast<ReceiveSlice*>(entries[i].lpOverlapped);
+            DWORD bytesWritten = entries[i].dwNumberOfBytesTransferred;
+            DWORD errCode = ERROR_SUCCESS;
+            if (!GetOverlappedResult(m_hTarget, &slice->overlapped, &bytesWritten, FALSE)) {
+                errCode = GetLastError();
+            }
+            OnWriteCompletion(slice, errCode, bytesWritten);
+        }
+    }
+
+    if (m_status == ERROR_SUCCESS && !FlushFileBuffers(m_hTarget)) {
+        LOG_ERROR(L"BlockReceiver::ReceiveStream: Failed to flush the target. Error: %d\n", GetLastError());
+        Fail(GetLastError());
+    }
+
+    // The sender waits for the status on every connection, one that dropped its connections does not read it
+    StreamStatus status = { STREAM_MAGIC, m_status, m_bytesWritten };
+    for (ReceiveConnection& connection : m_connections) {
+        NetworkStream::SendAll(connection.socket, &status, sizeof(status));
+    }
+    bool succeeded = (m_status == ERROR_SUCCESS);
+    if (succeeded) {
+        LOG_INFO(L"BlockReceiver::ReceiveStream: Stream complete, %lld MB written to %s.\n", m_bytesWritten / (1024 * 1024), targetPath);
+    }
+    else {
+        LOG_ERROR(L"BlockReceiver::ReceiveStream: Stream failed with error %d after %lld MB written to %s.\n", m_status, m_bytesWritten / (1024 * 1024), targetPath);
+    }
+    CloseStream();
+    LOG_DEBUG(L"End of BlockReceiver::ReceiveStream\n");
+    return succeeded;
+}
+
+bool BlockReceiver::OpenTarget(LPCWSTR targetPath)
+{
+    LOG_DEBUG(L"Inside BlockReceiver::OpenTarget\n");
+    // The target is opened like a local destination, and held exclusively for the whole stream
+    m_hTarget = CreateFileW(targetPath, GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+        FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_hTarget == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(L"BlockReceiver::OpenTarget: Failed to open the target %s with the error: %d\n", targetPath, GetLastError());
+        LOG_DEBUG(L"End of BlockReceiver::OpenTarget\n");
+        return false;
+    }
+    m_capacity = m_diskUtils.GetDiskOrDriveSize(m_hTarget, targetPath, FALSE);
+    m_sectorSize = m_diskUtils.GetVolumeSectorSize(m_hTarget, targetPath, false);
+    if (m_capacity == 0 || m_sectorSize == 0) {
+        LOG_ERROR(L"BlockReceiver::OpenTarget: Failed to determine the capacity and sector size of %s.\n", targetPath);
+        LOG_DEBUG(L"End of BlockReceiver::OpenTarget\n");
+        return false;
+    }
+    LOG_DEBUG(L"End of BlockReceiver::OpenTarget\n");
+    return true;
+}
+
+bool BlockReceiver::IsAllowed(const sockaddr_storage& peer) const
+{
+    if (m_allowed.empty()) {
+        return true;
+    }
+    // An IPv4 sender reaching an IPv6 socket shows up as a v4-mapped address
+    IN_ADDR peerV4 = {};
+    bool isV4 = false;
+    if (peer.ss_family == AF_INET) {
+        peerV4 = reinterpret_cast<const sockaddr_in*>(&peer)->sin_addr;
+        isV4 = true;
+    }
+    else if (IN6_IS_ADDR_V4MAPPED(&reinterpret_cast<const sockaddr_in6*>(&peer)->sin6_addr)) {
+        memcpy(&peerV4, &reinterpret_cast<const sockaddr_in6*>(&peer)->sin6_addr.s6_addr[12], sizeof(peerV4));
+        isV4 = true;
+    }
+    for (const sockaddr_storage& allowed : m_allowed) {
+        if (isV4 && allowed.ss_family == AF_INET &&
+            reinterpret_cast<const sockaddr_in*>(&allowed)->sin_addr.s_addr == peerV4.s_addr) {
+            return true;
+        }
+        if (!isV4 && allowed.ss_family == AF_INET6 &&
+            IN6_ADDR_EQUAL(&reinterpret_cast<const sockaddr_in6*>(&allowed)->sin6_addr, &reinterpret_cast<const sockaddr_in6*>(&peer)->sin6_addr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BlockReceiver::AcceptStream(LPCWSTR targetPath)
+{
+    LOG_DEBUG(L"Inside BlockReceiver::AcceptStream\n");
+    m_connections.clear();
+    StreamHello first = {};
+    DWORD expected = 1; // The first hello tells how many connections follow
+    while (m_connections.size() < expected) {
+        DWORD i = static_cast<DWORD>(m_connections.size());
+        sockaddr_storage peer = {};
+        int peerLength = sizeof(peer);
+        SOCKET socket = accept(m_listenSocket, reinterpret_cast<sockaddr*>(&peer), &peerLength);
+        if (socket == INVALID_SOCKET) {
+            LOG_ERROR(L"BlockReceiver::AcceptStream: accept failed with error: %d\n", WSAGetLastError());
+            LOG_DEBUG(L"End of BlockReceiver::AcceptStream\n");
+            return false;
+        }
+        wchar_t peerName[INET6_ADDRSTRLEN + 8] = L"?";
+        DWORD peerNameLength = ARRAYSIZE(peerName);
+        WSAAddressToStringW(reinterpret_cast<LPSOCKADDR>(&peer), peerLength, nullptr, peerName, &peerNameLength);
+
+        // Strangers are dropped without a word and do not cost the stream being accepted anything
+        if (!IsAllowed(peer)) {
+            LOG_WARNING(L"BlockReceiver::AcceptStream: Dropped a connection from %s, it is not on the allow-list.\n", peerName);
+            closesocket(socket);
+            continue;
+        }
+        NetworkStream::SetReceiveTimeout(socket, STREAM_HANDSHAKE_TIMEOUT_MS);
+        StreamChallenge challenge = { STREAM_MAGIC, STREAM_PROTOCOL_VERSION };
+        if (!NetworkStream::RandomNonce(challenge)) {
+            closesocket(socket);
+            LOG_DEBUG(L"End of BlockReceiver::AcceptStream\n");
+            return false;
+        }
+        StreamHello hello = {};
+        if (!NetworkStream::SendAll(socket, &challenge, sizeof(challenge)) || !NetworkStream::ReceiveAll(socket, &hello, sizeof(hello)) ||
+            hello.magic != STREAM_MAGIC) {
+            LOG_WARNING(L"BlockReceiver::AcceptStream: Dropped a connection from %s, it is not a FileBackup sender.\n", peerName);
+            closesocket(socket);
+            continue;
+        }
+        if (!m_secret.empty() && !NetworkStream::CheckHello(m_secret, challenge, hello)) {
+            LOG_WARNING(L"BlockReceiver::AcceptStream: Dropped a connection from %s, its hello does not prove the shared secret.\n", peerName);
+            StreamHelloReply denied = { STREAM_MAGIC, ERROR_ACCESS_DENIED, 0, 0, 0 };
+            NetworkStream::SendAll(socket, &denied, sizeof(denied));
+            closesocket(socket);
+            continue;
+        }
+        NetworkStream::SetReceiveTimeout(socket, 0);
+        ReceiveConnection connection;
+        connection.socket = socket;
+        m_connections.push_back(connection);
+
+        DWORD status = ERROR_SUCCESS;
+        if (hello.version != STREAM_PROTOCOL_VERSION) {
+            LOG_ERROR(L"BlockReceiver::AcceptStream: Sender speaks protocol version %u, this receiver version %u.\n", hello.version, STREAM_PROTOCOL_VERSION);
+            status = ERROR_REVISION_MISMATCH;
+        }
+        else if (i == 0) {
+            LOG_INFO(L"BlockReceiver::AcceptStream: Stream from %s.\n", peerName);
+            first = hello;
+            // Opened once a sender is there, so a target that is missing or in use refuses streams instead of spinning
+            if (!OpenTarget(targetPath)) {
+                status = ERROR_NOT_READY;
+            }
+            else if (hello.connections == 0 || hello.connections > STREAM_MAX_CONNECTIONS || hello.blockSize == 0 || hello.blockSize > STREAM_MAX_BLOCK_SIZE ||
+                hello.blockSize % m_sectorSize != 0) {
+                LOG_ERROR(L"BlockReceiver::AcceptStream: Unsupported stream of %u connections and %u byte blocks (target sector size %u bytes).\n",
+                    hello.connections, hello.blockSize, m_sectorSize);
+                status = ERROR_INVALID_PARAMETER;
+            }
+            else if (hello.sourceSize > m_capacity) {
+                LOG_ERROR(L"BlockReceiver::AcceptStream: Source size (%lld MB) is larger than the target (%lld MB).\n", hello.sourceSize / (1024 * 1024), m_capacity / (1024 * 1024));
+                status = ERROR_DISK_FULL;
+            }
+            else {
+                expected = hello.connections;
+            }
+        }
+        else if (hello.connectionIndex != i || hello.connections != first.connections || hello.blockSize != first.blockSize || hello.sourceSize != first.sourceSize) {
+            LOG_ERROR(L"BlockReceiver::AcceptStream: Connection %u does not belong to the stream being accepted.\n", i);
+            status = ERROR_INVALID_PARAMETER;
+        }
+
+        StreamHelloReply reply = { STREAM_MAGIC, status, m_sectorSize, 0, m_capacity };
+        if (!NetworkStream::SendAll(connection.socket, &reply, sizeof(reply)) || status != ERROR_SUCCESS) {
+            LOG_DEBUG(L"End of BlockReceiver::AcceptStream\n");
+            return false;
+        }
+    }
+    m_blockSize = first.blockSize;
+    LOG_INFO(L"BlockReceiver::AcceptStream: Receiving %lld MB in blocks of %u KB over %u connections.\n", first.sourceSize / (1024 * 1024), m_blockSize / 1024, expected);
+    LOG_DEBUG(L"End of BlockReceiver::AcceptStream\n");
+    return true;
+}
+
+bool BlockReceiver::PrepareBuffers()
+{
+    LOG_DEBUG(L"Inside BlockReceiver::PrepareBuffers\n");
+    DWORD nConnections = static_cast<DWORD>(m_connections.size());
+    if (!NetworkStream::LoadRioTable(m_connections[0].socket, m_rio)) {
+        LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+        return false;
+    }
+    m_hIocp = CreateIoCompletionPort(m_hTarget, nullptr, RECEIVER_WRITE_KEY, 1);
+    if (m_hIocp == nullptr) {
+        LOG_ERROR(L"BlockReceiver::PrepareBuffers: Failed to bind the target to an I/O completion port. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+        return false;
+    }
+
+    // Headers are received into a registered slot per connection, payloads straight into their slice
+    SIZE_T headerBytes = static_cast<SIZE_T>(nConnections) * sizeof(StreamFrameHeader);
+    m_headers = static_cast<StreamFrameHeader*>(VirtualAlloc(nullptr, headerBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (m_headers == nullptr) {
+        LOG_ERROR(L"BlockReceiver::PrepareBuffers: Failed to allocate frame headers. Error: %d\n", GetLastError());
+        LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+        return false;
+    }
+    m_headerBufferId = m_rio.RIORegisterBuffer(reinterpret_cast<PCHAR>(m_headers), static_cast<DWORD>(headerBytes));
+    if (m_headerBufferId == RIO_INVALID_BUFFERID) {
+        LOG_ERROR(L"BlockReceiver::PrepareBuffers: Failed to register frame headers. Error: %d\n", WSAGetLastError());
+        LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+        return false;
+    }
+
+    DWORD sliceCount = nConnections * RECEIVER_SLICES_PER_CONNECTION;
+    if (!m_arena.Create(m_blockSize, sliceCount)) {
+        LOG_ERROR(L"BlockReceiver::PrepareBuffers: Failed to allocate %u receive buffers of %u KB.\n", sliceCount, m_blockSize / 1024);
+        LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+        return false;
+    }
+    m_slices.assign(sliceCount, ReceiveSlice()); // Not resized again, connections and writes point into it
+    for (ReceiveSlice& slice : m_slices) {
+        slice.buf = m_arena.Acquire();
+        slice.bufferId = m_rio.RIORegisterBuffer(slice.buf, m_blockSize);
+        if (slice.bufferId == RIO_INVALID_BUFFERID) {
+            LOG_ERROR(L"BlockReceiver::PrepareBuffers: Failed to register a receive buffer. Error: %d\n", WSAGetLastError());
+            LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+            return false;
+        }
+        m_freeSlices.push_back(&slice);
+    }
+
+    // Every connection has one receive in flight, the status goes out with send once the stream is over
+    RIO_NOTIFICATION_COMPLETION notification = {};
+    notification.Type = RIO_IOCP_COMPLETION;
+    notification.Iocp.IocpHandle = m_hIocp;
+    notification.Iocp.CompletionKey = reinterpret_cast<PVOID>(static_cast<ULONG_PTR>(RECEIVER_NETWORK_KEY));
+    notification.Iocp.Overlapped = &m_notifyOverlapped;
+    m_completionQueue = m_rio.RIOCreateCompletionQueue(nConnections * 2, &notification);
+    if (m_completionQueue == RIO_INVALID_CQ) {
+        LOG_ERROR(L"BlockReceiver::PrepareBuffers: Failed to create the RIO completion queue. Error: %d\n", WSAGetLastError());
+        LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+        return false;
+    }
+    for (ReceiveConnection& connection : m_connections) {
+        connection.requestQueue = m_rio.RIOCreateRequestQueue(connection.socket, 1, 1, 1, 1, m_completionQueue, m_completionQueue, nullptr);
+        if (connection.requestQueue == RIO_INVALID_RQ) {
+            LOG_ERROR(L"BlockReceiver::PrepareBuffers: Failed to create a RIO request queue. Error: %d\n", WSAGetLastError());
+            LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+            return false;
+        }
+    }
+    int notifyResult = m_rio.RIONotify(m_completionQueue);
+    if (notifyResult != ERROR_SUCCESS) {
+        LOG_ERROR(L"BlockReceiver::PrepareBuffers: RIONotify failed with error: %d\n", notifyResult);
+        LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+        return false;
+    }
+    LOG_INFO(L"BlockReceiver::PrepareBuffers: %u receive buffers of %u KB registered (%s).\n", sliceCount, m_blockSize / 1024,
+        (m_arena.isLargePages() ? L"large pages" : (m_arena.isLocked() ? L"locked" : L"pageable")));
+    LOG_DEBUG(L"End of BlockReceiver::PrepareBuffers\n");
+    return true;
+}
+
+bool BlockReceiver::PostReceive(int connIndex)
+{
+    ReceiveConnection& connection = m_connections[connIndex];
+    RIO_BUF buffer = {};
+    if (connection.state == ReceiveState::HEADER) {
+        buffer.BufferId = m_headerBufferId;
+        buffer.Offset = static_cast<ULONG>(connIndex * sizeof(StreamFrameHeader) + connection.received);
+        buffer.Length = static_cast<ULONG>(sizeof(StreamFrameHeader) - connection.received);
+    }
+    else {
+        buffer.BufferId = connection.slice->bufferId;
+        buffer.Offset = connection.received;
+        buffer.Length = connection.header.length - connection.received;
+    }
+    if (!m_rio.RIOReceive(connection.requestQueue, &buffer, 1, 0, reinterpret_cast<PVOID>(static_cast<ULONG_PTR>(connIndex)))) {
+        LOG_ERROR(L"BlockReceiver::PostReceive: Receive on connection %d failed with error: %d\n", connIndex, WSAGetLastError());
+        Fail(WSAGetLastError());
+        return false;
+    }
+    return true;
+}
+
+// TCP may deliver a header or payload in several pieces, the rest is received into the same place
+void BlockReceiver::OnReceiveCompletion(int connIndex, LONG status, DWORD bytesReceived)
+{
+    if (m_status != ERROR_SUCCESS) {
+        return; // The stream has failed, nothing more is received
+    }
+    ReceiveConnection& connection = m_connections[connIndex];
+    if (status != 0) {
+        LOG_ERROR(L"BlockReceiver::OnReceiveCompletion: Connection %d failed with error: %d\n", connIndex, status);
+        Fail(static_cast<DWORD>(status));
+        return;
+    }
+    if (bytesReceived == 0) {
+        LOG_ERROR(L"BlockReceiver::OnReceiveCompletion: Connection %d was closed before the end of the stream.\n", connIndex);
+        Fail(WSAECONNRESET);
+        return;
+    }
+    connection.received += bytesReceived;
+
+    if (connection.state == ReceiveState::HEADER) {
+        if (connection.received < sizeof(StreamFrameHeader)) {
+            PostReceive(connIndex);
+            return;
+        }
+        connection.header = m_headers[connIndex];
+        connection.received = 0;
+        if (connection.header.magic == STREAM_MAGIC && connection.header.length == 0 && connection.header.offset == STREAM_END_OFFSET) {
+            connection.state = ReceiveState::ENDED;
+            ++m_connectionsEnded;
+            return;
+        }
+        LONGLONG paddedLength = ((static_cast<LONGLONG>(connection.header.length) + m_sectorSize - 1) / m_sectorSize) * m_sectorSize;
+        if (connection.header.magic != STREAM_MAGIC || connection.header.length == 0 || connection.header.length > m_blockSize ||
+            connection.header.offset < 0 || connection.header.offset % m_sectorSize != 0 || connection.header.offset + paddedLength > m_capacity) {
+            LOG_ERROR(L"BlockReceiver::OnReceiveCompletion: Invalid frame of %u bytes at offset %lld on connection %d.\n", connection.header.length, connection.header.offset, connIndex);
+            Fail(ERROR_INVALID_DATA);
+            return;
+        }
+        // Without a free slice the connection waits, which leaves the rest of the stream in the socket buffers
+        if (!StartPayload(connIndex)) {
+            connection.state = ReceiveState::WAITING;
+        }
+        return;
+    }
+
+    if (connection.received < connection.header.length) {
+        PostReceive(connIndex);
+        return;
+    }
+    IssueWrite(connIndex);
+    connection.state = ReceiveState::HEADER;
+    connection.received = 0;
+    connection.slice = nullptr;
+    if (m_status == ERROR_SUCCESS) {
+        PostReceive(connIndex);
+    }
+}
+
+bool BlockReceiver::StartPayload(int connIndex)
+{
+    if (m_freeSlices.empty()) {
+        return false;
+    }
+    ReceiveConnection& connection = m_connections[connIndex];
+    connection.slice = m_freeSlices.back();
+    m_freeSlices.pop_back();
+    connection.state = ReceiveState::PAYLOAD;
+    connection.received = 0;
+    PostReceive(connIndex);
+    return true;
+}
+
+void BlockReceiver::IssueWrite(int connIndex)
+{
+    ReceiveConnection& connection = m_connections[connIndex];
+    ReceiveSlice* slice = connection.slice;
+
+    // FILE_FLAG_NO_BUFFERING: the last block of the source may be short of a sector
+    slice->length = connection.header.length;
+    DWORD bytesToWrite = ((slice->length + m_sectorSize - 1) / m_sectorSize) * m_sectorSize;
+    memset(slice->buf + slice->length, 0, bytesToWrite - slice->length);
+
+    slice->overlapped = {};
+    slice->overlapped.Offset = static_cast<DWORD>(connection.header.offset & 0xFFFFFFFF);
+    slice->overlapped.OffsetHigh = static_cast<DWORD>((connection.header.offset >> 32) & 0xFFFFFFFF);
+    if (!WriteFile(m_hTarget, slice->buf, bytesToWrite, nullptr, &slice->overlapped) && GetLastError() != ERROR_IO_PENDING) {
+        DWORD err = GetLastError();
+        LOG_ERROR(L"BlockReceiver::IssueWrite: Write failed for offset %lld with error: %d\n", connection.header.offset, err);
+        m_freeSlices.push_back(slice);
+        Fail(err);
+        return;
+    }
+    ++m_writesInFlight;
+}
+
+void BlockReceiver::OnWriteCompletion(ReceiveSlice* slice, DWORD errCode, DWORD bytesWritten)
+{
+    --m_writesInFlight;
+    if (errCode != ERROR_SUCCESS) {
+        LOG_ERROR(L"BlockReceiver::OnWriteCompletion: Write failed for offset %lld after %u bytes with error: %d\n",
+            (static_cast<LONGLONG>(slice->overlapped.OffsetHigh) << 32) | slice->overlapped.Offset, bytesWritten, errCode);
+        Fail(errCode);
+    }
+    else {
+        m_bytesWritten += slice->length;
+    }
+    m_freeSlices.push_back(slice);
+
+    // The slice goes to a connection that has been waiting for one
+    for (int i = 0; m_status == ERROR_SUCCESS && i < static_cast<int>(m_connections.size()); ++i) {
+        if (m_connections[i].state == ReceiveState::WAITING) {
+            StartPayload(i);
+            break;
+        }
+    }
+}
+
+void BlockReceiver::Fail(DWORD errCode)
+{
+    if (m_status == ERROR_SUCCESS) {
+        m_status = (errCode != ERROR_SUCCESS) ? errCode : ERROR_GEN_FAILURE;
+    }
+}
+
+void BlockReceiver::CloseStream()
+{
+    // Closing a socket frees its request queue, the buffers and the completion queue go once no request can use them
+    for (ReceiveConnection& connection : m_connections) {
+        if (connection.socket != INVALID_SOCKET) {
+            closesocket(connection.socket);
+        }
+    }
+    m_connections.clear();
+    for (ReceiveSlice& slice : m_slices) {
+        if (slice.bufferId != RIO_INVALID_BUFFERID) {
+            m_rio.RIODeregisterBuffer(slice.bufferId);
+        }
+        m_arena.Release(slice.buf);
+    }
+    m_slices.clear();
+    m_freeSlices.clear();
+    m_arena.Destroy();
+    if (m_headerBufferId != RIO_INVALID_BUFFERID) {
+        m_rio.RIODeregisterBuffer(m_headerBufferId);
+        m_headerBufferId = RIO_INVALID_BUFFERID;
+    }
+    if (m_headers != nullptr) {
+        VirtualFree(m_headers, 0, MEM_RELEASE);
+        m_headers = nullptr;
+    }
+    if (m_completionQueue != RIO_INVALID_CQ) {
+        m_rio.RIOCloseCompletionQueue(m_completionQueue);
+        m_completionQueue = RIO_INVALID_CQ;
+    }
+    if (m_hIocp != nullptr) {
+        CloseHandle(m_hIocp);
+        m_hIocp = nullptr;
+    }
+    if (m_hTarget != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hTarget);
+        m_hTarget = INVALID_HANDLE_VALUE;
+    }
+}
+
+void BlockReceiver::Close()
+{
+    CloseStream();
+    if (m_listenSocket != INVALID_SOCKET) {
+        closesocket(m_listenSocket);
+        m_listenSocket = INVALID_SOCKET;
+    }
+    if (m_wsaStarted) {
+        WSACleanup();
+        m_wsaStarted = false;
+    }
+}
@@ -0,0 +1,99 @@
+#include "BlockReceiver.h"
+#include <iostream>
+
+static void PrintUsage(const wchar_t* exeName) {
+    std::wcout<<L"Usage: "<<exeName<<L" <targetPartitionPath> --bind <address> [--secret <text>] [--allow <address>]... [options]\n";
+    std::wcout<<L"Options:\n";
+    std::wcout<<L"  --bind <address>    Local IPv4 or IPv6 address to listen on, e.g. that of the backup network (required)\n";
+    std::wcout<<L"  --secret <text>     Shared secret senders must prove in their hello (default: the "<<STREAM_SECRET_ENV<<L" environment variable)\n";
+    std::wcout<<L"  --allow <address>   Accept connections from this sender address only (repeatable)\n";
+    std::wcout<<L"                      A secret, an allow-list or both are required\n";
+    std::wcout<<L"  --port <port>       TCP port FileBackup senders connect to (default: "<<STREAM_DEFAULT_PORT<<L")\n";
+    std::wcout<<L"  --serve             Keep waiting for the next stream instead of exiting after the first one\n";
+    std::wcout<<L"Example: "<<exeName<<L" \"\\\\.\\PhysicalDriveX\" --bind 10.0.0.2 --allow 10.0.0.1 --port 7447\n";
+}
+
+//Application entry point
+int wmain(int argc, wchar_t* argv[]) {
+    // Parse commandline arguments
+    if (argc < 2) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    LPCWSTR targetPath = argv[1];
+    LPCWSTR bindAddress = nullptr;
+    LPCWSTR secretOption = nullptr;
+    LPCWSTR port = STREAM_DEFAULT_PORT;
+    bool serve = false;
+    BlockReceiver receiver;
+    for (int i = 2; i < argc; ++i) {
+        std::wstring arg = argv[i];
+        if (arg == L"--bind" && i + 1 < argc) {
+            bindAddress = argv[++i];
+        }
+        else if (arg == L"--secret" && i + 1 < argc) {
+            secretOption = argv[++i];
+        }
+        else if (arg == L"--allow" && i + 1 < argc) {
+            if (!receiver.AllowAddress(argv[++i])) {
+                std::wcout<<L"Invalid sender address: "<<argv[i]<<L"\n";
+                return 1;
+            }
+        }
+        else if (arg == L"--port" && i + 1 < argc) {
+            port = argv[++i];
+            if (_wtoi(port) <= 0 || _wtoi(port) > 65535) {
+                std::wcout<<L"Invalid port: "<<port<<L"\n";
+                return 1;
+            }
+        }
+        else if (arg == L"--serve") {
+            serve = true;
+        }
+        else {
+            std::wcout<<L"Unknown option: "<<arg<<L"\n";
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (bindAddress == nullptr) {
+        std::wcout<<L"--bind is required, the receiver does not listen on every address.\n";
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    std::string secret = NetworkStream::LoadSecret(secretOption);
+    if (secret.empty() && !receiver.hasAllowList()) {
+        std::wcout<<L"A shared secret (--secret or "<<STREAM_SECRET_ENV<<L") or an allow-list (--allow) is required, the receiver does not take streams from anyone.\n";
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    receiver.setSecret(secret);
+
+    std::wcout << "[Critical] Every stream received OVERWRITES the provided target drive, make sure it is an empty drive or else it might corrupt the provided drive.\n\n";
+
+    //Configure Logger
+    LogUtils& logger = LogUtils::GetInstance();
+    logger.Initialize();
+
+    LOG_DEBUG(L"Inside Main\n");
+    if (!receiver.Listen(bindAddress, port)) {
+        LOG_ERROR(L"Main: Failed to listen on %s port %s.\n", bindAddress, port);
+        logger.DeInitialize();
+        return 1;
+    }
+    std::wcout << L"Waiting for " << (serve ? L"streams" : L"a stream") << L" to " << targetPath << L" on " << bindAddress << L" port " << port << L"\n";
+
+    // A failed stream leaves the target to be overwritten by the next one, the sender reports the failure
+    bool succeeded = false;
+    do {
+        succeeded = receiver.ReceiveStream(targetPath);
+        if (!succeeded) {
+            LOG_ERROR(L"Main: Stream to %s failed.\n", targetPath);
+        }
+    } while (serve);
+
+    receiver.Close();
+    LOG_DEBUG(L"End of Main\n");
+    logger.DeInitialize();
+    return succeeded ? 0 : 1;
+}